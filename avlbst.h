@@ -6,61 +6,149 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <future>
+#include <thread>
 #include "bst.h"
 
 struct KeyError { };
 
+/**
+* Says whose value a set operation keeps for a key that is in both trees.
+*/
+enum MergeWinner { KEEP_THIS, KEEP_OTHER };
+
 /**
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* other additional helper functions. Like NodeBase, it takes the most derived node
+* type as NodeType so that AVLTree can work with several kinds of AVL nodes.
+*
+* Nodes may also keep the size of their subtree for order statistic queries. The
+* hooks for that are no-ops here; AVLTree only calls them when the node type sets
+* hasSubtreeSize, so plain AVL nodes pay nothing for them.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, typename NodeType>
+class AVLNodeBase : public NodeBase<Key, Value, NodeType>
 {
 public:
-    // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    // Constructor.
+    AVLNodeBase(const Key& key, const Value& value, NodeType* parent);
+    template<typename... Args>
+    AVLNodeBase(NodeType* parent, Args&&... args);
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // Subtree size hooks, see above.
+    static const bool hasSubtreeSize = false;
+    void updateSubtreeSize();
+    void swapSubtreeSize(NodeType* other);
+
+    // The getters for parent, left, and right come from NodeBase and
+    // already return the node type, so nothing is redefined here.
+    // See the NodeBase class in bst.h for more information.
 
 protected:
     int8_t balance_;    // effectively a signed char
 };
 
+/**
+* The node used by a plain AVLTree.
+*/
+template <typename Key, typename Value>
+class AVLNode : public AVLNodeBase<Key, Value, AVLNode<Key, Value> >
+{
+public:
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    template<typename... Args>
+    AVLNode(AVLNode<Key, Value>* parent, Args&&... args);
+};
+
+/**
+* An AVL node that also stores the number of nodes in its subtree,
+* which lets the tree answer select() and rank() queries in O(log n).
+*/
+template <typename Key, typename Value>
+class RankedAVLNode : public AVLNodeBase<Key, Value, RankedAVLNode<Key, Value> >
+{
+public:
+    RankedAVLNode(const Key& key, const Value& value, RankedAVLNode<Key, Value>* parent);
+    template<typename... Args>
+    RankedAVLNode(RankedAVLNode<Key, Value>* parent, Args&&... args);
+
+    static const bool hasSubtreeSize = true;
+    size_t getSubtreeSize() const;
+    void updateSubtreeSize();
+    void swapSubtreeSize(RankedAVLNode<Key, Value>* other);
+
+protected:
+    size_t size_;
+};
+
+/**
+* An AVL node without a separate balance field. Node addresses are
+* multiples of eight, so the low three bits of the parent pointer are
+* always zero; the balance is kept there instead, which for int keys and
+* values saves the eight bytes the padded balance_ costs. Three bits
+* rather than two, since the fix-ups briefly store balances of -2 and 2.
+* The parent pointer is only masked when it is read, and lookups never
+* read it.
+*/
+template <typename Key, typename Value>
+class CompactAVLNode : public NodeBase<Key, Value, CompactAVLNode<Key, Value> >
+{
+public:
+    CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value>* parent);
+    template<typename... Args>
+    CompactAVLNode(CompactAVLNode<Key, Value>* parent, Args&&... args);
+
+    // These replace the parent getter and setter of NodeBase, which would
+    // see the balance bits.
+    CompactAVLNode<Key, Value>* getParent() const;
+    void setParent(CompactAVLNode<Key, Value>* parent);
+
+    int8_t getBalance() const;
+    void setBalance(int8_t balance);
+    void updateBalance(int8_t diff);
+
+    static const bool hasSubtreeSize = false;
+    void updateSubtreeSize();
+    void swapSubtreeSize(CompactAVLNode<Key, Value>* other);
+
+private:
+    static const uintptr_t BALANCE_BITS = 7;
+    uintptr_t parentBits() const;
+};
+
 /*
   -------------------------------------------------
-  Begin implementations for the AVLNode class.
+  Begin implementations for the AVLNode classes.
   -------------------------------------------------
 */
 
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor and setting
-* the color to red since every new node will be red when it is first inserted.
+* the balance to 0 since every new node is a leaf when it is first inserted.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, class NodeType>
+AVLNodeBase<Key, Value, NodeType>::AVLNodeBase(const Key& key, const Value& value, NodeType *parent) :
+    NodeBase<Key, Value, NodeType>(key, value, parent), balance_(0)
 {
 
 }
 
 /**
-* A destructor which does nothing.
+* A constructor that builds the item in place from args.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class NodeType>
+template<typename... Args>
+AVLNodeBase<Key, Value, NodeType>::AVLNodeBase(NodeType* parent, Args&&... args) :
+    NodeBase<Key, Value, NodeType>(parent, std::forward<Args>(args)...), balance_(0)
 {
 
 }
@@ -68,8 +156,8 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class NodeType>
+int8_t AVLNodeBase<Key, Value, NodeType>::getBalance() const
 {
     return balance_;
 }
@@ -77,8 +165,8 @@ int8_t AVLNode<Key, Value>::getBalance() const
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class NodeType>
+void AVLNodeBase<Key, Value, NodeType>::setBalance(int8_t balance)
 {
     balance_ = balance;
 }
@@ -86,120 +174,234 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class NodeType>
+void AVLNodeBase<Key, Value, NodeType>::updateBalance(int8_t diff)
 {
     balance_ += diff;
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* No subtree size is kept, so there is nothing to update.
+*/
+template<class Key, class Value, class NodeType>
+void AVLNodeBase<Key, Value, NodeType>::updateSubtreeSize()
+{
+
+}
+
+/**
+* No subtree size is kept, so there is nothing to swap.
+*/
+template<class Key, class Value, class NodeType>
+void AVLNodeBase<Key, Value, NodeType>::swapSubtreeSize(NodeType* other)
+{
+
+}
+
+/**
+* Constructors for a plain AVL node.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
+    AVLNodeBase<Key, Value, AVLNode<Key, Value> >(key, value, parent)
+{
+
+}
+
+template<class Key, class Value>
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(AVLNode<Key, Value>* parent, Args&&... args) :
+    AVLNodeBase<Key, Value, AVLNode<Key, Value> >(parent, std::forward<Args>(args)...)
+{
+
+}
+
+/**
+* Constructors for a ranked AVL node. A new node is a leaf, so its
+* subtree holds just itself.
+*/
+template<class Key, class Value>
+RankedAVLNode<Key, Value>::RankedAVLNode(const Key& key, const Value& value, RankedAVLNode<Key, Value> *parent) :
+    AVLNodeBase<Key, Value, RankedAVLNode<Key, Value> >(key, value, parent), size_(1)
+{
+
+}
+
+template<class Key, class Value>
+template<typename... Args>
+RankedAVLNode<Key, Value>::RankedAVLNode(RankedAVLNode<Key, Value>* parent, Args&&... args) :
+    AVLNodeBase<Key, Value, RankedAVLNode<Key, Value> >(parent, std::forward<Args>(args)...), size_(1)
+{
+
+}
+
+/**
+* A getter for the number of nodes in the subtree rooted here.
+*/
+template<class Key, class Value>
+size_t RankedAVLNode<Key, Value>::getSubtreeSize() const
+{
+    return size_;
+}
+
+/**
+* Recomputes the subtree size from the children, which must
+* already be up to date.
+*/
+template<class Key, class Value>
+void RankedAVLNode<Key, Value>::updateSubtreeSize()
+{
+    size_ = 1;
+    if(this->left_ != NULL) {
+        size_ += this->left_->size_;
+    }
+    if(this->right_ != NULL) {
+        size_ += this->right_->size_;
+    }
+}
+
+/**
+* Exchanges subtree sizes with other. Used when two nodes trade
+* places in the tree, since the size belongs to the position.
+*/
+template<class Key, class Value>
+void RankedAVLNode<Key, Value>::swapSubtreeSize(RankedAVLNode<Key, Value>* other)
+{
+    std::swap(size_, other->size_);
+}
+
+
+/**
+* Constructors for a compact node. NodeBase stores parent as it is,
+* which is right since a new node's balance is 0.
+*/
+template<class Key, class Value>
+CompactAVLNode<Key, Value>::CompactAVLNode(const Key& key, const Value& value, CompactAVLNode<Key, Value> *parent) :
+    NodeBase<Key, Value, CompactAVLNode<Key, Value> >(key, value, parent)
+{
+    static_assert(alignof(CompactAVLNode<Key, Value>) > BALANCE_BITS, "no spare pointer bits for the balance");
+}
+
+template<class Key, class Value>
+template<typename... Args>
+CompactAVLNode<Key, Value>::CompactAVLNode(CompactAVLNode<Key, Value>* parent, Args&&... args) :
+    NodeBase<Key, Value, CompactAVLNode<Key, Value> >(parent, std::forward<Args>(args)...)
+{
+    static_assert(alignof(CompactAVLNode<Key, Value>) > BALANCE_BITS, "no spare pointer bits for the balance");
+}
+
+template<class Key, class Value>
+uintptr_t CompactAVLNode<Key, Value>::parentBits() const
+{
+    return reinterpret_cast<uintptr_t>(this->parent_);
+}
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getParent() const
+{
+    return reinterpret_cast<CompactAVLNode<Key, Value>*>(parentBits() & ~BALANCE_BITS);
+}
+
+/**
+* Sets the parent and keeps the balance.
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+void CompactAVLNode<Key, Value>::setParent(CompactAVLNode<Key, Value>* parent)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    this->parent_ = reinterpret_cast<CompactAVLNode<Key, Value>*>(
+        reinterpret_cast<uintptr_t>(parent) | (parentBits() & BALANCE_BITS));
 }
 
 /**
-* Overridden for the same reasons as above.
+* The balance is stored as a three bit two's complement number.
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+int8_t CompactAVLNode<Key, Value>::getBalance() const
+{
+    return static_cast<int8_t>(static_cast<int>((parentBits() & BALANCE_BITS) ^ 4) - 4);
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setBalance(int8_t balance)
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    this->parent_ = reinterpret_cast<CompactAVLNode<Key, Value>*>(
+        (parentBits() & ~BALANCE_BITS) | (static_cast<uintptr_t>(balance) & BALANCE_BITS));
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::updateBalance(int8_t diff)
+{
+    setBalance(getBalance() + diff);
 }
 
 /**
-* Overridden for the same reasons as above.
+* No subtree size is kept, so there is nothing to update or swap.
 */
 template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+void CompactAVLNode<Key, Value>::updateSubtreeSize()
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+
 }
 
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::swapSubtreeSize(CompactAVLNode<Key, Value>* other)
+{
+
+}
 
 /*
   -----------------------------------------------
-  End implementations for the AVLNode class.
+  End implementations for the AVLNode classes.
   -----------------------------------------------
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* The AVL balancing steps on their own: the fix-ups after a node has been
+* linked in or before one is taken out, and the rotations they use. They
+* only touch the links, balances and subtree sizes of the nodes and the
+* root pointer they are given, so AVLTree, which allocates its nodes, and
+* IntrusiveAVLTree, whose nodes are hooks in the caller's objects, share
+* them. The fix-ups report their rotations, swaps and remove depth to
+* a Counters policy (see TreeCounters).
+*/
+template <typename NodeType, typename Counters = NoTreeCounters>
+struct AVLAlgorithms
 {
-public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
-protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
-
-    // Add helper functions here
-		void insert_fix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node);
-		void remove_fix(AVLNode<Key, Value>* node, int8_t diff);
-		void rotateLeft(AVLNode<Key, Value>* node);
-		void rotateRight(AVLNode<Key, Value>* node);
-		AVLNode<Key, Value>* AVLcast(Node<Key, Value>* node);
-
+    static void rebalanceAfterInsert(NodeType*& root, Counters& counters, NodeType* curr);
+    static void unlink(NodeType*& root, Counters& counters, NodeType* removal_item);
+    static void insert_fix(NodeType*& root, Counters& counters, NodeType* parent, NodeType* node);
+    static void remove_fix(NodeType*& root, Counters& counters, NodeType* node, int8_t diff);
+    static void rotateLeft(NodeType*& root, NodeType* node);
+    static void rotateRight(NodeType*& root, NodeType* node);
+    static void swapNodes(NodeType*& root, Counters& counters, NodeType* n1, NodeType* n2);
 };
 
 /*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
+ * Called once a new leaf, curr, has been linked into the tree rooted at
+ * root. Fixes the balances on the way up and rotates where needed.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::rebalanceAfterInsert(NodeType*& root, Counters& counters, NodeType* curr)
 {
-    // TODO
-		Key key = new_item.first;
-		Value value = new_item.second;
-
-		//If the AVL Tree is empty, create a root node
-		if(AVLcast(this->root_) == NULL){
-			AVLNode<Key, Value>* newValue = new AVLNode<Key, Value>(key, value, NULL);
-			this->root_ = newValue;
-			return;
+		//Every subtree on the path to the root grew by one node.
+		//This has to happen before any rotation, since rotations
+		//recompute sizes from the children.
+		if(NodeType::hasSubtreeSize){
+			for(NodeType* n = curr->getParent(); n != NULL; n = n->getParent()){
+				n->updateSubtreeSize();
+			}
 		}
 
-		//If the key is already in the AVL Tree, change it
-		AVLNode<Key, Value>* curr = AVLcast(this->internalFind(key));
-		if(curr != NULL){
-			curr->setValue(value);
+		//A new root needs no balancing.
+		NodeType* parentNode = curr->getParent();
+		if(parentNode == NULL){
 			return;
 		}
 
-		//Otherwise, start at the root and traverse until you get 
-		//to the right spot (a leaf node). Then, insert.
-		curr = AVLcast(this->root_);
-		AVLNode<Key, Value>* next = NULL;
-		while(curr != NULL){
-			if(key < curr->getKey()){
-				next = curr->getLeft();
-				if(next == NULL){
-					AVLNode<Key, Value>* newValue = new AVLNode<Key, Value>(key, value, curr);
-					curr->setLeft(newValue);
-					curr = newValue;
-					break;
-				}
-			} else {
-				next = curr->getRight();
-				if(next == NULL){
-					AVLNode<Key, Value>* newValue = new AVLNode<Key, Value>(key, value, curr);
-					curr->setRight(newValue);
-					curr = newValue;
-					break;
-				}
-			}
-			curr = next;
-		}	
-
 		//Balance the subtree (parent and child)
 		//and decide whether or not insert_fix()
 		//needs to be called
-		AVLNode<Key, Value>* parentNode = curr->getParent();
 		int8_t parentBalance = parentNode->getBalance();
 		
 		if(parentBalance != 0){
@@ -212,9 +414,8 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 			}
 
 			//call insert_fix to rotate the tree if necessary.
-			insert_fix(parentNode, curr);
+			insert_fix(root, counters, parentNode, curr);
 		}
-
 }
 
 /* 
@@ -222,15 +423,16 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
 * balance of the tree and perfrom necessary rotations
 * after an insert
 */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* node){
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::insert_fix(NodeType*& root, Counters& counters, NodeType* parent, NodeType* node)
+{
 	
 		//do nothing if either parent or granparent are NULL
 		if(parent == NULL){
 			return;
 		}
 
-		AVLNode<Key, Value>* grandparent = parent->getParent(); 
+		NodeType* grandparent = parent->getParent(); 
 		if(grandparent == NULL){
 			return;
 		}
@@ -243,15 +445,17 @@ void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* parent, AVLNode<Key, V
 			if(gpBal == 0){ //do nothing if grandparent is balanced
 				return;
 			} else if (gpBal == -1){ //recursively call insert_fix one level up
-				insert_fix(grandparent, parent);
+				insert_fix(root, counters, grandparent, parent);
 			} else if (gpBal == -2){ //need to perform rotations; unbalanced.
 				if(parent->getLeft() == node){
-					rotateRight(grandparent);
+					rotateRight(root, grandparent);
+					counters.rotation(false);
 					parent->setBalance(0);
 					grandparent->setBalance(0);
 				} else {
-					rotateLeft(parent);
-					rotateRight(grandparent);
+					rotateLeft(root, parent);
+					rotateRight(root, grandparent);
+					counters.rotation(true);
 					int8_t nodeBal = node->getBalance();
 					if(nodeBal == -1){
 						parent->setBalance(0);
@@ -272,15 +476,17 @@ void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* parent, AVLNode<Key, V
 			if(gpBal == 0){
 				return;
 			} else if (gpBal == 1){
-				insert_fix(grandparent, parent);
+				insert_fix(root, counters, grandparent, parent);
 			} else if (gpBal == 2){
 				if(parent->getRight() == node){
-					rotateLeft(grandparent);
+					rotateLeft(root, grandparent);
+					counters.rotation(false);
 					parent->setBalance(0);
 					grandparent->setBalance(0);
 				} else {
-					rotateRight(parent);
-					rotateLeft(grandparent);
+					rotateRight(root, parent);
+					rotateLeft(root, grandparent);
+					counters.rotation(true);
 					int8_t nodeBal = node->getBalance();
 					if(nodeBal == 1){
 						parent->setBalance(0);
@@ -296,38 +502,33 @@ void AVLTree<Key, Value>::insert_fix(AVLNode<Key, Value>* parent, AVLNode<Key, V
 				}
 			}
 		}
-
 }
 
 /*
+ * Takes removal_item out of the tree rooted at root and rebalances.
+ * The node is not freed, and its own links are left as they were.
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::unlink(NodeType*& root, Counters& counters, NodeType* removal_item)
 {
-    // TODO
-
-		//If an item with the key is not in the AVLtree, do nothing.
-		AVLNode<Key, Value>* removal_item = AVLcast(this->internalFind(key));
-		if(removal_item == NULL){
-			return;
-		}
+		NodeType* replacement = NULL;
 
 		//store the pointers to other nodes.
-		AVLNode<Key, Value>* left_child = removal_item->getLeft();
-		AVLNode<Key, Value>* right_child = removal_item->getRight();
-		AVLNode<Key, Value>* parent = removal_item->getParent();
+		NodeType* left_child = removal_item->getLeft();
+		NodeType* right_child = removal_item->getRight();
+		NodeType* parent = removal_item->getParent();
 
 		//Handle the case when there are two children. Swap with
 		//the predecessor and then update the temporary pointers 
 		//made.
 		if(left_child != NULL && right_child != NULL){
-			AVLNode<Key, Value>* pred = AVLcast(this->predecessor(removal_item));
+			NodeType* pred = NodeLinks<NodeType>::prev(removal_item);
 			if(pred == NULL){
 				return;
 			}
-			nodeSwap(removal_item, pred);
+			swapNodes(root, counters, removal_item, pred);
 			left_child = removal_item->getLeft();
 			right_child = removal_item->getRight();
 			parent = removal_item->getParent();
@@ -349,9 +550,9 @@ void AVLTree<Key, Value>::remove(const Key& key)
 
 		//If one child, then swap with the item to be removed and
 		//update all pointers as necessary so that the bst completely
-		//excludes the removed item. Then, delete that node.
+		//excludes the removed item. The caller frees it.
 		if(left_child != NULL){
-			nodeSwap(removal_item, left_child);
+			swapNodes(root, counters, removal_item, left_child);
 			left_child->setLeft(removal_item->getLeft());
 			left_child->setRight(removal_item->getRight());
 			if(left_child->getLeft() != NULL){
@@ -360,9 +561,12 @@ void AVLTree<Key, Value>::remove(const Key& key)
 			if(left_child->getRight() != NULL){
 				left_child->getRight()->setParent(left_child);
 			}
-			delete removal_item;
+			//swapNodes() handed the removed node's balance to the
+			//child, but the child is a leaf now.
+			left_child->setBalance(0);
+			replacement = left_child;
 		} else if (right_child != NULL){
-			nodeSwap(removal_item, right_child);
+			swapNodes(root, counters, removal_item, right_child);
 			right_child->setLeft(removal_item->getLeft());
 			right_child->setRight(removal_item->getRight());
 			if(right_child->getLeft() != NULL){
@@ -371,14 +575,16 @@ void AVLTree<Key, Value>::remove(const Key& key)
 			if(right_child->getRight() != NULL){
 				right_child->getRight()->setParent(right_child);
 			}
-			delete removal_item;
+			//swapNodes() handed the removed node's balance to the
+			//child, but the child is a leaf now.
+			right_child->setBalance(0);
+			replacement = right_child;
 		} else {
 
 			//If a leaf node has NULL as a parent, it is the root. 
 			//Update the tree such that it becomes empty.
 			if(parent == NULL){
-				delete removal_item;
-				this->root_ = NULL;
+				root = NULL;
 				return;
 			}
 
@@ -390,24 +596,38 @@ void AVLTree<Key, Value>::remove(const Key& key)
 			} else {
 				parent->setRight(NULL);
 			}
-			delete removal_item;
 		}
 
-		//call remove_fix to fix balances and rotate if necessary.
-		remove_fix(parent, diff);
+		//Subtrees from the removed spot up to the root lost a node.
+		if(NodeType::hasSubtreeSize){
+			NodeType* n = (replacement != NULL) ? replacement : parent;
+			for(; n != NULL; n = n->getParent()){
+				n->updateSubtreeSize();
+			}
+		}
 
+		//call remove_fix to fix balances and rotate if necessary.
+		remove_fix(root, counters, parent, diff);
+		counters.removeFixDone();
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* node, int8_t diff){
+/*
+ * Called after the subtree on the diff side of node lost a level
+ * (diff is 1 for the left side, -1 for the right). Fixes balances
+ * and rotates on the way up.
+ */
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::remove_fix(NodeType*& root, Counters& counters, NodeType* node, int8_t diff)
+{
 	
 	//do nothing if the node is NULL
 	if(node == NULL){
 		return;
 	}
+	counters.removeFixLevel();
 
 	//calculate ndiff (next difference) if the parent is not NULL
-	AVLNode<Key, Value>* p = node->getParent();
+	NodeType* p = node->getParent();
 	int8_t ndiff = 0;
 	if(p != NULL){
 		if(p->getLeft() == node){	
@@ -422,7 +642,7 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* node, int8_t diff){
 	//and left child cases are handled at once.
 	int8_t nodeBalance = node->getBalance();
 	if(nodeBalance + diff == diff * 2){ //imbalance. Eiher zig-zig or zig-zag
-		AVLNode<Key, Value>* child = NULL;
+		NodeType* child = NULL;
 		if(diff < 0){
 			child = node->getLeft();
 		} else {
@@ -432,34 +652,37 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* node, int8_t diff){
 		int8_t childBal = child->getBalance();
 		if(childBal == diff * 1){ //zig-zig
 			if(diff < 0){
-				rotateRight(node);
+				rotateRight(root, node);
 			} else {
-				rotateLeft(node);
+				rotateLeft(root, node);
 			}
+			counters.rotation(false);
 			node->setBalance(0);
 			child->setBalance(0);
-			remove_fix(p, ndiff);
+			remove_fix(root, counters, p, ndiff);
 			//Recurses.
 		} else if (childBal == 0){ //zig-zig
 			if(diff < 0){
-				rotateRight(node);
+				rotateRight(root, node);
 			} else {
-				rotateLeft(node);
+				rotateLeft(root, node);
 			}
+			counters.rotation(false);
 			node->setBalance(diff * 1);
 			child->setBalance(diff* -1);
 			//Done.
 		} else { //zig-zag
-			AVLNode<Key, Value>* g = NULL;
+			NodeType* g = NULL;
 			if(diff < 0){
 				g = child->getRight();
-				rotateLeft(child);
-				rotateRight(node);
+				rotateLeft(root, child);
+				rotateRight(root, node);
 			} else {
 				g = child->getLeft();
-				rotateRight(child);
-				rotateLeft(node);
+				rotateRight(root, child);
+				rotateLeft(root, node);
 			}
+			counters.rotation(true);
 			int8_t gnBalance = g->getBalance();
 			if(gnBalance == diff * -1){
 				node->setBalance(0);
@@ -472,32 +695,38 @@ void AVLTree<Key, Value>::remove_fix(AVLNode<Key, Value>* node, int8_t diff){
 				child->setBalance(0);
 			}
 			g->setBalance(0);
-			remove_fix(p, ndiff);
+			remove_fix(root, counters, p, ndiff);
 			//Recurses.
 		}	
 	} else if(nodeBalance + diff == diff * 1){ //just update balance.
 		node->setBalance(diff * 1);
 	} else { //if nodeBalance + diff = 0
 		node->setBalance(0);
-		remove_fix(p, ndiff);
+		remove_fix(root, counters, p, ndiff);
 		//Recurses.
 	}
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node){
+/*
+ * Rotates node down to the left, so that its right child takes its
+ * place. Subtrees that have been taken out of a tree (see split())
+ * have no parent, but must leave root alone.
+ */
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::rotateLeft(NodeType*& root, NodeType* node)
+{
 	
 	//do nothing if node or rightChild is NULL.
 	if(node == NULL){
 		return;
 	}
-	AVLNode<Key, Value>* rightChild = node->getRight();
+	NodeType* rightChild = node->getRight();
 	if(rightChild == NULL){
 		return;
 	}
 
-	AVLNode<Key, Value>* b = rightChild->getLeft();
-	AVLNode<Key, Value>* newParent = node->getParent();
+	NodeType* b = rightChild->getLeft();
+	NodeType* newParent = node->getParent();
 
 	//Change all of the necessary pointers between b, newParent,
 	//rightChild, and node.
@@ -508,8 +737,12 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node){
 	rightChild->setLeft(node);
 
 	rightChild->setParent(newParent);
+	//Subtrees that have been taken out of a tree (see split())
+	//have no parent either, but must leave root_ alone.
 	if(newParent == NULL){
-		this->root_ = rightChild;
+		if(root == node){
+			root = rightChild;
+		}
 	} else {
 		if(newParent->getRight() == node){
 			newParent->setRight(rightChild);
@@ -519,22 +752,30 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* node){
 	}
 	node->setParent(rightChild);
 
+	//node is now below rightChild, so its size is fixed first.
+	node->updateSubtreeSize();
+	rightChild->updateSubtreeSize();
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node){
+/*
+ * Rotates node down to the right, so that its left child takes its
+ * place.
+ */
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::rotateRight(NodeType*& root, NodeType* node)
+{
 	
 	//do nothing if node or leftChild is NULL.
 	if(node == NULL){
 		return;
 	}
-	AVLNode<Key, Value>* leftChild = node->getLeft();
+	NodeType* leftChild = node->getLeft();
 	if(leftChild == NULL){
 		return;
 	}
 
-	AVLNode<Key, Value>* c = leftChild->getRight();
-	AVLNode<Key, Value>* newParent = node->getParent();
+	NodeType* c = leftChild->getRight();
+	NodeType* newParent = node->getParent();
 
 	//Change all of the necessary pointers between c, newParent,
 	//leftChild, and node.
@@ -546,7 +787,9 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node){
 
 	leftChild->setParent(newParent);
 	if(newParent == NULL){
-		this->root_ = leftChild;
+		if(root == node){
+			root = leftChild;
+		}
 	} else {
 		if(newParent->getRight() == node){
 			newParent->setRight(leftChild);
@@ -555,21 +798,1189 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* node){
 		}
 	}
 	node->setParent(leftChild);
-	
-}
 
-template <class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::AVLcast(Node<Key, Value>* node){
-	return static_cast<AVLNode<Key, Value>*>(node);
+	//node is now below leftChild, so its size is fixed first.
+	node->updateSubtreeSize();
+	leftChild->updateSubtreeSize();
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/*
+ * Swaps the positions of two nodes along with their balances and
+ * subtree sizes, so that each keeps describing its position.
+ */
+template<typename NodeType, typename Counters>
+void AVLAlgorithms<NodeType, Counters>::swapNodes(NodeType*& root, Counters& counters, NodeType* n1, NodeType* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    NodeLinks<NodeType>::swap(root, n1, n2);
+    counters.nodeSwap();
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    n1->swapSubtreeSize(n2);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for AVLAlgorithms.
+  -----------------------------------------------
+*/
+
+
+template <class Key, class Value, class NodeType = AVLNode<Key, Value>, class Compare = std::less<Key>,
+          class Counters = NoTreeCounters>
+class AVLTree : public BinarySearchTree<Key, Value, NodeType, Compare, Counters>
+{
+public:
+    explicit AVLTree(const Compare& comp = Compare());
+    virtual size_t erase(const Key& lo, const Key& hi);
+    template<typename ForwardIt>
+    void buildFromSorted(ForwardIt first, ForwardIt last);
+
+    // Moving items between trees in O(log n). Nodes change owner but
+    // are never copied or reallocated.
+    void split(const Key& key, AVLTree& left, AVLTree& right);
+    void join(AVLTree& left, std::pair<const Key, Value> pivot, AVLTree& right);
+    void concat(AVLTree& left, AVLTree& right);
+
+    // Set operations in O(m log(n/m + 1)) work for trees of sizes
+    // m <= n. They fork onto up to threads threads, 0 meaning one per
+    // core.
+    void unite(AVLTree& other, MergeWinner winner = KEEP_THIS, unsigned threads = 0);
+    void intersect(const AVLTree& other, MergeWinner winner = KEEP_THIS, unsigned threads = 0);
+    void subtract(const AVLTree& other, unsigned threads = 0);
+
+    // Order statistics. These need a node type that keeps subtree
+    // sizes, such as RankedAVLNode (see RankedAVLTree below).
+    typename AVLTree<Key, Value, NodeType, Compare, Counters>::iterator select(size_t k);
+    typename AVLTree<Key, Value, NodeType, Compare, Counters>::const_iterator select(size_t k) const;
+    size_t rank(const Key& key) const;
+    size_t countInRange(const Key& lo, const Key& hi) const;
+protected:
+    virtual void nodeSwap( NodeType* n1, NodeType* n2);
+    virtual void rebalanceAfterInsert(NodeType* node);
+    virtual void removeNode(NodeType* node);
+
+    // Add helper functions here
+		void insert_fix(NodeType* parent, NodeType* node);
+		void remove_fix(NodeType* node, int8_t diff);
+		void rotateLeft(NodeType* node);
+		void rotateRight(NodeType* node);
+		template<typename ForwardIt>
+		NodeType* buildSortedHelper(ForwardIt& it, size_t n, NodeType*& prev, int& height);
+		NodeType* selectHelper(size_t k) const;
+		size_t countBelow(const Key& key, bool inclusive) const;
+		static size_t subtreeSize(NodeType* node);
+		static int treeHeight(NodeType* node);
+		static void childHeights(NodeType* node, int height, int& leftHeight, int& rightHeight);
+		NodeType* splitTree(NodeType* tree, int height, const Key& key, NodeType*& left, int& leftHeight,
+				NodeType*& right, int& rightHeight);
+		NodeType* splitLast(NodeType* tree, int height, NodeType*& last, int& newHeight);
+		NodeType* joinTrees(NodeType* left, int leftHeight, NodeType* pivot, NodeType* right, int rightHeight, int& height);
+		NodeType* joinRight(NodeType* left, int leftHeight, NodeType* pivot, NodeType* right, int rightHeight, int& height);
+		NodeType* joinLeft(NodeType* left, int leftHeight, NodeType* pivot, NodeType* right, int rightHeight, int& height);
+		NodeType* concatTrees(NodeType* left, int leftHeight, NodeType* right, int rightHeight, int& height);
+		NodeType* detachTree(int& height, size_t& size, bool& sizeKnown);
+		void installTree(NodeType* root, size_t size, bool sizeKnown);
+		static size_t sizeFromNodes(NodeType* root, std::true_type);
+		static size_t sizeFromNodes(NodeType* root, std::false_type);
+
+		// State shared by every task of one set operation.
+		struct SetOp
+		{
+			MergeWinner winner;
+			int forkDepth;
+		};
+		// Subtrees below this height are never handed to another thread.
+		static const int PARALLEL_MIN_HEIGHT = 12;
+		static int forkDepthFor(unsigned threads);
+		NodeType* uniteHelper(NodeType* t1, int h1, NodeType* t2, int h2, const SetOp& op, int depth,
+				std::vector<NodeType*>& garbage, int& height);
+		NodeType* intersectHelper(NodeType* t1, int h1, NodeType* t2, const SetOp& op, int depth,
+				std::vector<NodeType*>& garbage, int& height);
+		NodeType* subtractHelper(NodeType* t1, int h1, NodeType* t2, const SetOp& op, int depth,
+				std::vector<NodeType*>& garbage, int& height);
+		size_t freeGarbage(const std::vector<NodeType*>& garbage);
+
+};
+
+/**
+* An AVLTree whose nodes keep subtree sizes, so that select(), rank()
+* and countInRange() run in O(log n).
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Counters = NoTreeCounters>
+using RankedAVLTree = AVLTree<Key, Value, RankedAVLNode<Key, Value>, Compare, Counters>;
+
+/**
+* An AVLTree whose nodes keep their balance in the parent pointer (see
+* CompactAVLNode), for maps with small keys and values.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, class Counters = NoTreeCounters>
+using CompactAVLTree = AVLTree<Key, Value, CompactAVLNode<Key, Value>, Compare, Counters>;
+
+/*
+ * Creates an empty tree whose keys are ordered by comp.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+AVLTree<Key, Value, NodeType, Compare, Counters>::AVLTree(const Compare& comp) :
+		BinarySearchTree<Key, Value, NodeType, Compare, Counters>(comp)
+{
+}
+
+/*
+ * Called by BinarySearchTree once a new node has been linked in
+ * by insert(), insert_or_assign() or try_emplace(), each of which
+ * finds the spot for the node in a single descent. Recall: if the
+ * key was already in the tree, the value is overwritten and no
+ * node is added, so this is not called.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::rebalanceAfterInsert(NodeType* curr)
+{
+		AVLAlgorithms<NodeType, Counters>::rebalanceAfterInsert(this->root_, this->counters_, curr);
+}
+
+/* 
+* Helper function for insert() function, used to fix the 
+* balance of the tree and perfrom necessary rotations
+* after an insert
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::insert_fix(NodeType* parent, NodeType* node){
+		AVLAlgorithms<NodeType, Counters>::insert_fix(this->root_, this->counters_, parent, node);
+}
+
+/*
+ * Called by BinarySearchTree::remove() with the node holding the key.
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::removeNode(NodeType* removal_item)
+{
+    // TODO
+		--this->size_;
+		AVLAlgorithms<NodeType, Counters>::unlink(this->root_, this->counters_, removal_item);
+		this->destroyNode(removal_item);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::remove_fix(NodeType* node, int8_t diff){
+		AVLAlgorithms<NodeType, Counters>::remove_fix(this->root_, this->counters_, node, diff);
+}
+
+/*
+ * Removes every item whose key k satisfies lo <= k <= hi and returns
+ * how many were removed, in O(k + log n). The tree is split at lo and
+ * at hi with join-based splits, which rebalance only along the two
+ * search paths; the part in between is freed without any rebalancing
+ * and the outer parts are joined back together once at the end.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::erase(const Key& lo, const Key& hi)
+{
+		if(this->comp_(hi, lo) || this->root_ == NULL){
+			return 0;
+		}
+
+		//The tree is taken out of root_ while it is in pieces.
+		NodeType* tree = this->root_;
+		this->root_ = NULL;
+
+		NodeType* left = NULL;
+		NodeType* rest = NULL;
+		NodeType* middle = NULL;
+		NodeType* right = NULL;
+		int leftHeight = 0;
+		int restHeight = 0;
+		int middleHeight = 0;
+		int rightHeight = 0;
+		NodeType* loNode = splitTree(tree, treeHeight(tree), lo, left, leftHeight, rest, restHeight);
+		NodeType* hiNode = splitTree(rest, restHeight, hi, middle, middleHeight, right, rightHeight);
+
+		size_t removed = 0;
+		if(middle != NULL){
+			removed += this->clearHelper(middle);
+		}
+		if(loNode != NULL){
+			this->destroyNode(loNode);
+			++removed;
+		}
+		if(hiNode != NULL && hiNode != loNode){
+			this->destroyNode(hiNode);
+			++removed;
+		}
+
+		int height = 0;
+		this->root_ = concatTrees(left, leftHeight, right, rightHeight, height);
+		this->size_ -= removed;
+		return removed;
+}
+
+/*
+ * Height of a subtree, found by following the taller child down
+ * from node using the balances.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+int AVLTree<Key, Value, NodeType, Compare, Counters>::treeHeight(NodeType* node)
+{
+		int height = 0;
+		while(node != NULL){
+			++height;
+			node = (node->getBalance() < 0) ? node->getLeft() : node->getRight();
+		}
+		return height;
+}
+
+/*
+ * Heights of the two children of a node whose own height is known.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::childHeights(NodeType* node, int height,
+		int& leftHeight, int& rightHeight)
+{
+		int balance = node->getBalance();
+		if(balance >= 0){
+			rightHeight = height - 1;
+			leftHeight = height - 1 - balance;
+		} else {
+			leftHeight = height - 1;
+			rightHeight = height - 1 + balance;
+		}
+}
+
+/*
+ * Splits the AVL tree rooted at tree, of the given height, into the
+ * keys less than key (left) and the keys greater than key (right).
+ * Both results are valid AVL trees whose roots have no parent. The
+ * node holding key is detached and returned, or NULL if there is none.
+ * Every node on the search path is used as the pivot of one join, and
+ * the heights of those joins telescope, so the split is O(log n).
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::splitTree(NodeType* tree, int height, const Key& key,
+		NodeType*& left, int& leftHeight, NodeType*& right, int& rightHeight)
+{
+		if(tree == NULL){
+			left = NULL;
+			right = NULL;
+			leftHeight = 0;
+			rightHeight = 0;
+			return NULL;
+		}
+
+		int hl = 0;
+		int hr = 0;
+		childHeights(tree, height, hl, hr);
+		NodeType* l = tree->getLeft();
+		NodeType* r = tree->getRight();
+		if(l != NULL){
+			l->setParent(NULL);
+		}
+		if(r != NULL){
+			r->setParent(NULL);
+		}
+		tree->setLeft(NULL);
+		tree->setRight(NULL);
+		tree->setParent(NULL);
+
+		NodeType* found = NULL;
+		if(this->comp_(key, tree->getKey())){
+			NodeType* inner = NULL;
+			int innerHeight = 0;
+			found = splitTree(l, hl, key, left, leftHeight, inner, innerHeight);
+			right = joinTrees(inner, innerHeight, tree, r, hr, rightHeight);
+		} else if(this->comp_(tree->getKey(), key)){
+			NodeType* inner = NULL;
+			int innerHeight = 0;
+			found = splitTree(r, hr, key, inner, innerHeight, right, rightHeight);
+			left = joinTrees(l, hl, tree, inner, innerHeight, leftHeight);
+		} else {
+			found = tree;
+			left = l;
+			leftHeight = hl;
+			right = r;
+			rightHeight = hr;
+		}
+		return found;
+}
+
+/*
+ * Detaches the largest node of a non-empty tree into last and returns
+ * the rest of the tree, rebalanced, with its height in newHeight.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::splitLast(NodeType* tree, int height,
+		NodeType*& last, int& newHeight)
+{
+		int hl = 0;
+		int hr = 0;
+		childHeights(tree, height, hl, hr);
+		NodeType* l = tree->getLeft();
+		NodeType* r = tree->getRight();
+		if(l != NULL){
+			l->setParent(NULL);
+		}
+
+		if(r == NULL){
+			last = tree;
+			tree->setLeft(NULL);
+			tree->setParent(NULL);
+			newHeight = hl;
+			return l;
+		}
+
+		r->setParent(NULL);
+		tree->setLeft(NULL);
+		tree->setRight(NULL);
+		tree->setParent(NULL);
+		int restHeight = 0;
+		NodeType* rest = splitLast(r, hr, last, restHeight);
+		return joinTrees(l, hl, tree, rest, restHeight, newHeight);
+}
+
+/*
+ * Joins two trees where every key in left is less than every key in
+ * right, using the largest node of left as the pivot.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::concatTrees(NodeType* left, int leftHeight,
+		NodeType* right, int rightHeight, int& height)
+{
+		if(left == NULL){
+			height = rightHeight;
+			if(right != NULL){
+				right->setParent(NULL);
+			}
+			return right;
+		}
+		if(right == NULL){
+			height = leftHeight;
+			left->setParent(NULL);
+			return left;
+		}
+		NodeType* last = NULL;
+		int restHeight = 0;
+		NodeType* rest = splitLast(left, leftHeight, last, restHeight);
+		return joinTrees(rest, restHeight, last, right, rightHeight, height);
+}
+
+/*
+ * Joins left, the detached node pivot and right into one AVL tree,
+ * where every key in left is less than the pivot and every key in
+ * right greater. Runs in O(|leftHeight - rightHeight| + 1): the pivot
+ * is hung on the spine of the taller tree at the height of the other
+ * one, and only that spine is retraced. The root of the result has
+ * no parent and its height is returned in height.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::joinTrees(NodeType* left, int leftHeight, NodeType* pivot,
+		NodeType* right, int rightHeight, int& height)
+{
+		if(left != NULL){
+			left->setParent(NULL);
+		}
+		if(right != NULL){
+			right->setParent(NULL);
+		}
+		pivot->setParent(NULL);
+
+		//joinRight() also handles trees of about the same height.
+		NodeType* root = NULL;
+		if(rightHeight > leftHeight + 1){
+			root = joinLeft(left, leftHeight, pivot, right, rightHeight, height);
+		} else {
+			root = joinRight(left, leftHeight, pivot, right, rightHeight, height);
+		}
+		root->setParent(NULL);
+		return root;
+}
+
+/*
+ * Helper for joinTrees() when left is the taller tree. Walks down the
+ * right spine of left until the subtree there is no more than one
+ * level taller than right, puts the pivot there, and fixes balances
+ * on the way back up with at most one single or double rotation.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::joinRight(NodeType* left, int leftHeight, NodeType* pivot,
+		NodeType* right, int rightHeight, int& height)
+{
+		if(leftHeight <= rightHeight + 1){
+			pivot->setLeft(left);
+			pivot->setRight(right);
+			if(left != NULL){
+				left->setParent(pivot);
+			}
+			if(right != NULL){
+				right->setParent(pivot);
+			}
+			pivot->setBalance(rightHeight - leftHeight);
+			pivot->updateSubtreeSize();
+			height = std::max(leftHeight, rightHeight) + 1;
+			return pivot;
+		}
+
+		int hl = 0;
+		int hr = 0;
+		childHeights(left, leftHeight, hl, hr);
+		int th = 0;
+		NodeType* t = joinRight(left->getRight(), hr, pivot, right, rightHeight, th);
+		left->setRight(t);
+		t->setParent(left);
+
+		if(th <= hl + 1){
+			left->setBalance(th - hl);
+			left->updateSubtreeSize();
+			height = std::max(hl, th) + 1;
+			return left;
+		}
+
+		//t is two levels taller than its sibling.
+		if(t->getBalance() >= 0){ //zig-zig
+			int tBal = t->getBalance();
+			rotateLeft(left);
+			if(tBal == 1){
+				left->setBalance(0);
+				t->setBalance(0);
+				height = th;
+			} else {
+				left->setBalance(1);
+				t->setBalance(-1);
+				height = th + 1;
+			}
+			return t;
+		}
+
+		//zig-zag
+		NodeType* g = t->getLeft();
+		int hgl = 0;
+		int hgr = 0;
+		childHeights(g, th - 1, hgl, hgr);
+		rotateRight(t);
+		rotateLeft(left);
+		left->setBalance(hgl - (th - 2));
+		t->setBalance((th - 2) - hgr);
+		g->setBalance(0);
+		height = th;
+		return g;
+}
+
+/*
+ * Mirror image of joinRight(), used when right is the taller tree.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::joinLeft(NodeType* left, int leftHeight, NodeType* pivot,
+		NodeType* right, int rightHeight, int& height)
+{
+		if(rightHeight <= leftHeight + 1){
+			return joinRight(left, leftHeight, pivot, right, rightHeight, height);
+		}
+
+		int hl = 0;
+		int hr = 0;
+		childHeights(right, rightHeight, hl, hr);
+		int th = 0;
+		NodeType* t = joinLeft(left, leftHeight, pivot, right->getLeft(), hl, th);
+		right->setLeft(t);
+		t->setParent(right);
+
+		if(th <= hr + 1){
+			right->setBalance(hr - th);
+			right->updateSubtreeSize();
+			height = std::max(hr, th) + 1;
+			return right;
+		}
+
+		if(t->getBalance() <= 0){ //zig-zig
+			int tBal = t->getBalance();
+			rotateRight(right);
+			if(tBal == -1){
+				right->setBalance(0);
+				t->setBalance(0);
+				height = th;
+			} else {
+				right->setBalance(-1);
+				t->setBalance(1);
+				height = th + 1;
+			}
+			return t;
+		}
+
+		//zig-zag
+		NodeType* g = t->getRight();
+		int hgl = 0;
+		int hgr = 0;
+		childHeights(g, th - 1, hgl, hgr);
+		rotateLeft(t);
+		rotateRight(right);
+		right->setBalance((th - 2) - hgr);
+		t->setBalance(hgl - (th - 2));
+		g->setBalance(0);
+		height = th;
+		return g;
+}
+
+/*
+ * Moves the items with keys less than key into left and the rest into
+ * right, in O(log n). Whatever left and right held before is cleared,
+ * and this tree ends up empty unless it is one of the two. Throws
+ * std::invalid_argument if left and right are the same tree.
+ *
+ * A plain AVLTree cannot tell how many items went to each side, so the
+ * first size() on either result counts them; a RankedAVLTree knows.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::split(const Key& key, AVLTree& left, AVLTree& right)
+{
+		if(&left == &right){
+			throw std::invalid_argument("split: left and right must be different trees");
+		}
+
+		//Make room in the targets and let them take over the memory
+		//of this tree's nodes before anything is moved.
+		if(&left != this){
+			left.clear();
+			left.pool_.adopt(this->pool_);
+		}
+		if(&right != this){
+			right.clear();
+			right.pool_.adopt(this->pool_);
+		}
+
+		int height = 0;
+		size_t total = 0;
+		bool known = false;
+		NodeType* tree = detachTree(height, total, known);
+		if(&left != this && &right != this){
+			this->pool_.release();
+		}
+
+		NodeType* l = NULL;
+		NodeType* r = NULL;
+		int hl = 0;
+		int hr = 0;
+		NodeType* found = splitTree(tree, height, key, l, hl, r, hr);
+		if(found != NULL){
+			r = joinTrees(NULL, 0, found, r, hr, hr);
+		}
+
+		//If one side is empty, the other one has every item.
+		left.installTree(l, total, known && r == NULL);
+		right.installTree(r, total, known && l == NULL);
+}
+
+/*
+ * Replaces the contents of this tree with the items of left, then
+ * pivot, then the items of right, in O(log n); left and right end up
+ * empty unless one of them is this tree. Every key in left must be
+ * less than the key of pivot, and every key in right greater, or
+ * std::invalid_argument is thrown and nothing changes.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::join(AVLTree& left, std::pair<const Key, Value> pivot, AVLTree& right)
+{
+		NodeType* leftLast = left.getLargestNode();
+		NodeType* rightFirst = right.getSmallestNode();
+		if((leftLast != NULL && !this->comp_(leftLast->getKey(), pivot.first)) ||
+				(rightFirst != NULL && !this->comp_(pivot.first, rightFirst->getKey()))){
+			throw std::invalid_argument("join: keys are not in order around the pivot");
+		}
+
+		if(this != &left && this != &right){
+			this->clear();
+		}
+		if(this != &left){
+			this->pool_.adopt(left.pool_);
+		}
+		if(this != &right){
+			this->pool_.adopt(right.pool_);
+		}
+		NodeType* node = this->createNode(NULL, std::move(pivot));
+
+		int hl = 0;
+		int hr = 0;
+		size_t sl = 0;
+		size_t sr = 0;
+		bool kl = false;
+		bool kr = false;
+		NodeType* l = left.detachTree(hl, sl, kl);
+		NodeType* r = right.detachTree(hr, sr, kr);
+		if(this != &left){
+			left.pool_.release();
+		}
+		if(this != &right){
+			right.pool_.release();
+		}
+
+		int height = 0;
+		installTree(joinTrees(l, hl, node, r, hr, height), sl + sr + 1, kl && kr);
+}
+
+/*
+ * Like join(), but without a pivot: replaces the contents of this
+ * tree with the items of left followed by the items of right. Every
+ * key in left must be less than every key in right, or
+ * std::invalid_argument is thrown and nothing changes. O(log n).
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::concat(AVLTree& left, AVLTree& right)
+{
+		NodeType* leftLast = left.getLargestNode();
+		NodeType* rightFirst = right.getSmallestNode();
+		if(&left == &right && leftLast != NULL){
+			throw std::invalid_argument("concat: a tree cannot be joined with itself");
+		}
+		if(leftLast != NULL && rightFirst != NULL && !this->comp_(leftLast->getKey(), rightFirst->getKey())){
+			throw std::invalid_argument("concat: keys of left are not all less than keys of right");
+		}
+
+		if(this != &left && this != &right){
+			this->clear();
+		}
+		if(this != &left){
+			this->pool_.adopt(left.pool_);
+		}
+		if(this != &right){
+			this->pool_.adopt(right.pool_);
+		}
+
+		int hl = 0;
+		int hr = 0;
+		size_t sl = 0;
+		size_t sr = 0;
+		bool kl = false;
+		bool kr = false;
+		NodeType* l = left.detachTree(hl, sl, kl);
+		NodeType* r = right.detachTree(hr, sr, kr);
+		if(this != &left){
+			left.pool_.release();
+		}
+		if(this != &right){
+			right.pool_.release();
+		}
+
+		int height = 0;
+		installTree(concatTrees(l, hl, r, hr, height), sl + sr, kl && kr);
+}
+
+/*
+ * Adds every item of other to this tree, leaving other empty. For
+ * keys in both trees, winner picks the value that is kept. Nodes move
+ * over without being copied. The two trees are merged by splitting
+ * other at the root key of this tree and uniting the two halves
+ * recursively; the halves are independent, so the left one is handed
+ * to another thread while the tree is big enough.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::unite(AVLTree& other, MergeWinner winner, unsigned threads)
+{
+		if(&other == this){
+			return;
+		}
+		this->pool_.adopt(other.pool_);
+
+		int h1 = 0;
+		int h2 = 0;
+		size_t s1 = 0;
+		size_t s2 = 0;
+		bool k1 = false;
+		bool k2 = false;
+		NodeType* t1 = detachTree(h1, s1, k1);
+		NodeType* t2 = other.detachTree(h2, s2, k2);
+		other.pool_.release();
+
+		SetOp op = { winner, forkDepthFor(threads) };
+		std::vector<NodeType*> garbage;
+		int height = 0;
+		NodeType* root = uniteHelper(t1, h1, t2, h2, op, 0, garbage, height);
+
+		//Duplicates are freed here rather than in the tasks, since
+		//the pool is not meant to be used from several threads.
+		size_t freed = freeGarbage(garbage);
+		installTree(root, s1 + s2 - freed, k1 && k2);
+}
+
+/*
+ * Removes every item whose key is not in other. For the keys that
+ * remain, winner picks the value that is kept; KEEP_OTHER copies the
+ * value over from other, which is not changed.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::intersect(const AVLTree& other, MergeWinner winner, unsigned threads)
+{
+		if(&other == this){
+			return;
+		}
+
+		int h1 = 0;
+		size_t s1 = 0;
+		bool k1 = false;
+		NodeType* t1 = detachTree(h1, s1, k1);
+
+		SetOp op = { winner, forkDepthFor(threads) };
+		std::vector<NodeType*> garbage;
+		int height = 0;
+		NodeType* root = intersectHelper(t1, h1, other.root_, op, 0, garbage, height);
+		size_t freed = freeGarbage(garbage);
+		installTree(root, s1 - freed, k1);
+}
+
+/*
+ * Removes every item whose key is in other. other is not changed.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::subtract(const AVLTree& other, unsigned threads)
+{
+		if(&other == this){
+			this->clear();
+			return;
+		}
+
+		int h1 = 0;
+		size_t s1 = 0;
+		bool k1 = false;
+		NodeType* t1 = detachTree(h1, s1, k1);
+
+		SetOp op = { KEEP_THIS, forkDepthFor(threads) };
+		std::vector<NodeType*> garbage;
+		int height = 0;
+		NodeType* root = subtractHelper(t1, h1, other.root_, op, 0, garbage, height);
+		size_t freed = freeGarbage(garbage);
+		installTree(root, s1 - freed, k1);
+}
+
+/*
+ * Every fork doubles the number of running tasks, so this is how many
+ * levels of recursion may fork before threads tasks are running.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+int AVLTree<Key, Value, NodeType, Compare, Counters>::forkDepthFor(unsigned threads)
+{
+		if(threads == 0){
+			threads = std::thread::hardware_concurrency();
+		}
+		int depth = 0;
+		while((1u << depth) < threads){
+			++depth;
+		}
+		return depth;
+}
+
+/*
+ * Helper for unite(). Returns the union of the detached trees t1 and
+ * t2 and its height. Nodes that lose to a duplicate key are added to
+ * garbage instead of being freed.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::uniteHelper(NodeType* t1, int h1, NodeType* t2, int h2,
+		const SetOp& op, int depth, std::vector<NodeType*>& garbage, int& height)
+{
+		if(t1 == NULL){
+			height = h2;
+			return t2;
+		}
+		if(t2 == NULL){
+			height = h1;
+			return t1;
+		}
+
+		//Take the root of t1 off its subtrees, and split t2 around it.
+		int hl1 = 0;
+		int hr1 = 0;
+		childHeights(t1, h1, hl1, hr1);
+		NodeType* l1 = t1->getLeft();
+		NodeType* r1 = t1->getRight();
+		if(l1 != NULL){
+			l1->setParent(NULL);
+		}
+		if(r1 != NULL){
+			r1->setParent(NULL);
+		}
+		t1->setLeft(NULL);
+		t1->setRight(NULL);
+
+		NodeType* l2 = NULL;
+		NodeType* r2 = NULL;
+		int hl2 = 0;
+		int hr2 = 0;
+		NodeType* found = splitTree(t2, h2, t1->getKey(), l2, hl2, r2, hr2);
+		NodeType* pivot = t1;
+		if(found != NULL){
+			if(op.winner == KEEP_OTHER){
+				garbage.push_back(t1);
+				pivot = found;
+			} else {
+				garbage.push_back(found);
+			}
+		}
+
+		NodeType* left = NULL;
+		NodeType* right = NULL;
+		int hl = 0;
+		int hr = 0;
+		if(depth < op.forkDepth && std::max(h1, h2) >= PARALLEL_MIN_HEIGHT){
+			std::vector<NodeType*> leftGarbage;
+			std::future<NodeType*> leftTask = std::async(std::launch::async, [&]() {
+				return uniteHelper(l1, hl1, l2, hl2, op, depth + 1, leftGarbage, hl);
+			});
+			right = uniteHelper(r1, hr1, r2, hr2, op, depth + 1, garbage, hr);
+			left = leftTask.get();
+			garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+		} else {
+			left = uniteHelper(l1, hl1, l2, hl2, op, depth + 1, garbage, hl);
+			right = uniteHelper(r1, hr1, r2, hr2, op, depth + 1, garbage, hr);
+		}
+		return joinTrees(left, hl, pivot, right, hr, height);
+}
+
+/*
+ * Helper for intersect(). Splits the detached tree t1 around every
+ * key of the subtree t2, which is only read, and keeps the nodes of
+ * t1 whose keys it meets. Subtrees of t1 that cannot meet any key of
+ * t2 are added to garbage whole.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::intersectHelper(NodeType* t1, int h1, NodeType* t2,
+		const SetOp& op, int depth, std::vector<NodeType*>& garbage, int& height)
+{
+		height = 0;
+		if(t1 == NULL){
+			return NULL;
+		}
+		if(t2 == NULL){
+			garbage.push_back(t1);
+			return NULL;
+		}
+
+		NodeType* l1 = NULL;
+		NodeType* r1 = NULL;
+		int hl1 = 0;
+		int hr1 = 0;
+		NodeType* found = splitTree(t1, h1, t2->getKey(), l1, hl1, r1, hr1);
+
+		NodeType* left = NULL;
+		NodeType* right = NULL;
+		int hl = 0;
+		int hr = 0;
+		if(depth < op.forkDepth && h1 >= PARALLEL_MIN_HEIGHT){
+			std::vector<NodeType*> leftGarbage;
+			std::future<NodeType*> leftTask = std::async(std::launch::async, [&]() {
+				return intersectHelper(l1, hl1, t2->getLeft(), op, depth + 1, leftGarbage, hl);
+			});
+			right = intersectHelper(r1, hr1, t2->getRight(), op, depth + 1, garbage, hr);
+			left = leftTask.get();
+			garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+		} else {
+			left = intersectHelper(l1, hl1, t2->getLeft(), op, depth + 1, garbage, hl);
+			right = intersectHelper(r1, hr1, t2->getRight(), op, depth + 1, garbage, hr);
+		}
+
+		if(found == NULL){
+			return concatTrees(left, hl, right, hr, height);
+		}
+		if(op.winner == KEEP_OTHER){
+			found->setValue(t2->getValue());
+		}
+		return joinTrees(left, hl, found, right, hr, height);
+}
+
+/*
+ * Helper for subtract(). Like intersectHelper(), but keeps the nodes
+ * of t1 whose keys are not in t2 instead.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::subtractHelper(NodeType* t1, int h1, NodeType* t2,
+		const SetOp& op, int depth, std::vector<NodeType*>& garbage, int& height)
+{
+		if(t1 == NULL || t2 == NULL){
+			height = h1;
+			return t1;
+		}
+
+		NodeType* l1 = NULL;
+		NodeType* r1 = NULL;
+		int hl1 = 0;
+		int hr1 = 0;
+		NodeType* found = splitTree(t1, h1, t2->getKey(), l1, hl1, r1, hr1);
+		if(found != NULL){
+			garbage.push_back(found);
+		}
+
+		NodeType* left = NULL;
+		NodeType* right = NULL;
+		int hl = 0;
+		int hr = 0;
+		if(depth < op.forkDepth && h1 >= PARALLEL_MIN_HEIGHT){
+			std::vector<NodeType*> leftGarbage;
+			std::future<NodeType*> leftTask = std::async(std::launch::async, [&]() {
+				return subtractHelper(l1, hl1, t2->getLeft(), op, depth + 1, leftGarbage, hl);
+			});
+			right = subtractHelper(r1, hr1, t2->getRight(), op, depth + 1, garbage, hr);
+			left = leftTask.get();
+			garbage.insert(garbage.end(), leftGarbage.begin(), leftGarbage.end());
+		} else {
+			left = subtractHelper(l1, hl1, t2->getLeft(), op, depth + 1, garbage, hl);
+			right = subtractHelper(r1, hr1, t2->getRight(), op, depth + 1, garbage, hr);
+		}
+		return concatTrees(left, hl, right, hr, height);
+}
+
+/*
+ * Frees the detached subtrees collected by a set operation and
+ * returns how many nodes that was.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::freeGarbage(const std::vector<NodeType*>& garbage)
+{
+		size_t freed = 0;
+		for(size_t i = 0; i < garbage.size(); ++i){
+			freed += this->clearHelper(garbage[i]);
+		}
+		return freed;
+}
+
+/*
+ * Takes the whole tree out of this object, leaving it empty, and
+ * returns its root along with its height and size. The nodes stay in
+ * this tree's pool.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::detachTree(int& height, size_t& size, bool& sizeKnown)
+{
+		NodeType* root = this->root_;
+		height = treeHeight(root);
+		size = this->size_;
+		sizeKnown = this->sizeKnown_;
+		this->root_ = NULL;
+		this->size_ = 0;
+		this->sizeKnown_ = true;
+		return root;
+}
+
+/*
+ * Makes root the root of this tree, which must be empty. size is
+ * only trusted if sizeKnown is set; nodes that keep subtree sizes
+ * always know it, and otherwise it is left for size() to count.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::installTree(NodeType* root, size_t size, bool sizeKnown)
+{
+		if(root != NULL){
+			root->setParent(NULL);
+		}
+		this->root_ = root;
+		if(root == NULL){
+			this->size_ = 0;
+			this->sizeKnown_ = true;
+		} else if(NodeType::hasSubtreeSize){
+			this->size_ = sizeFromNodes(root, std::integral_constant<bool, NodeType::hasSubtreeSize>());
+			this->sizeKnown_ = true;
+		} else {
+			this->size_ = size;
+			this->sizeKnown_ = sizeKnown;
+		}
+}
+
+/*
+ * Size of the subtree at root, for node types that keep it.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::sizeFromNodes(NodeType* root, std::true_type)
+{
+		return subtreeSize(root);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::sizeFromNodes(NodeType* root, std::false_type)
+{
+		return 0;
+}
+
+/*
+ * Replaces the contents of the tree with the items in [first, last),
+ * which must be sorted by strictly increasing key. The result is a
+ * perfectly balanced tree built in linear time: every node is
+ * created once, linked to its parent directly and given its final
+ * balance, so no rotations or retracing happen. Throws
+ * std::invalid_argument (leaving the tree empty) if the input is
+ * unsorted or contains a duplicate key.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename ForwardIt>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::buildFromSorted(ForwardIt first, ForwardIt last)
+{
+		this->clear();
+
+		size_t n = std::distance(first, last);
+		NodeType* prev = NULL;
+		int height = 0;
+		this->root_ = buildSortedHelper(first, n, prev, height);
+		this->size_ = n;
+}
+
+/*
+ * Helper for buildFromSorted(). Builds a balanced subtree out of the
+ * next n items, consuming them in order, and returns its root. The
+ * left half is built first so that every node is created in key order;
+ * prev is the last node created and is used to check the ordering.
+ * A subtree that was built is freed again if anything after it throws.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename ForwardIt>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::buildSortedHelper(ForwardIt& it, size_t n,
+		NodeType*& prev, int& height)
+{
+		if(n == 0){
+			height = 0;
+			return NULL;
+		}
+
+		//The right half gets the extra item if there is one, so the
+		//two heights differ by at most one and the balance is 0 or 1.
+		size_t leftCount = (n - 1) / 2;
+		int leftHeight = 0;
+		int rightHeight = 0;
+		NodeType* left = buildSortedHelper(it, leftCount, prev, leftHeight);
+		NodeType* node = NULL;
+		try {
+			node = this->createNode(NULL, *it);
+			++it;
+			if(prev != NULL && !this->comp_(prev->getKey(), node->getKey())){
+				throw std::invalid_argument("buildFromSorted: keys are not strictly increasing");
+			}
+			prev = node;
+			node->setLeft(left);
+			if(left != NULL){
+				left->setParent(node);
+			}
+			left = NULL;
+
+			NodeType* right = buildSortedHelper(it, n - 1 - leftCount, prev, rightHeight);
+			node->setRight(right);
+			if(right != NULL){
+				right->setParent(node);
+			}
+		} catch(...) {
+			if(left != NULL){
+				this->clearHelper(left);
+			}
+			if(node != NULL){
+				this->clearHelper(node);
+			}
+			throw;
+		}
+
+		node->setBalance(rightHeight - leftHeight);
+		node->updateSubtreeSize();
+		height = rightHeight + 1;
+		return node;
+}
+
+/*
+ * Returns an iterator to the k-th smallest item (counting from 0),
+ * or end() if k is not less than size(). O(log n).
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename AVLTree<Key, Value, NodeType, Compare, Counters>::iterator AVLTree<Key, Value, NodeType, Compare, Counters>::select(size_t k)
+{
+		return this->makeIterator(selectHelper(k));
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename AVLTree<Key, Value, NodeType, Compare, Counters>::const_iterator AVLTree<Key, Value, NodeType, Compare, Counters>::select(size_t k) const
+{
+		return this->makeIterator(selectHelper(k));
+}
+
+/*
+ * Returns the number of keys smaller than key, which is also the
+ * index select() would need to reach key. O(log n).
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::rank(const Key& key) const
+{
+		return countBelow(key, false);
+}
+
+/*
+ * Returns the number of keys k with lo <= k <= hi. O(log n).
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::countInRange(const Key& lo, const Key& hi) const
+{
+		if(this->comp_(hi, lo)){
+			return 0;
+		}
+		return countBelow(hi, true) - countBelow(lo, false);
+}
+
+/*
+ * Helper for select(). Uses the subtree sizes to decide at every
+ * node whether the k-th item is on the left, here or on the right.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType* AVLTree<Key, Value, NodeType, Compare, Counters>::selectHelper(size_t k) const
+{
+		NodeType* curr = this->root_;
+		while(curr != NULL){
+			size_t leftSize = subtreeSize(curr->getLeft());
+			if(k < leftSize){
+				curr = curr->getLeft();
+			} else if(k == leftSize){
+				return curr;
+			} else {
+				k -= leftSize + 1;
+				curr = curr->getRight();
+			}
+		}
+		return NULL;
+}
+
+/*
+ * Helper for rank() and countInRange(). Counts the keys below key,
+ * or at most key if inclusive is set, adding up whole left subtrees
+ * on every step to the right.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::countBelow(const Key& key, bool inclusive) const
+{
+		size_t count = 0;
+		NodeType* curr = this->root_;
+		while(curr != NULL){
+			bool goRight = inclusive ? !this->comp_(key, curr->getKey()) : this->comp_(curr->getKey(), key);
+			if(goRight){
+				count += subtreeSize(curr->getLeft()) + 1;
+				curr = curr->getRight();
+			} else {
+				curr = curr->getLeft();
+			}
+		}
+		return count;
+}
+
+/*
+ * Subtree size of a possibly empty subtree.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t AVLTree<Key, Value, NodeType, Compare, Counters>::subtreeSize(NodeType* node)
+{
+		return node == NULL ? 0 : node->getSubtreeSize();
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::rotateLeft(NodeType* node){
+		AVLAlgorithms<NodeType, Counters>::rotateLeft(this->root_, node);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::rotateRight(NodeType* node){
+		AVLAlgorithms<NodeType, Counters>::rotateRight(this->root_, node);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void AVLTree<Key, Value, NodeType, Compare, Counters>::nodeSwap( NodeType* n1, NodeType* n2)
+{
+    AVLAlgorithms<NodeType, Counters>::swapNodes(this->root_, this->counters_, n1, n2);
 }
 
 
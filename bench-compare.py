@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Compares two JSON files written by `bench-suite --json`.
+
+Prints every phase that got slower or faster than the threshold (in
+percent) between the baseline and the current run, and the entries whose
+memory use changed. Exits with status 1 if anything got slower, so it can
+fail a build:
+
+    ./bench-compare.py baseline.json current.json --threshold 10
+
+Timings of small sizes move by more than 10% between runs on a busy
+machine; run bench-suite with a higher --repeat, or raise the threshold,
+before trusting a single flagged row.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    if data.get("format") != "bench-suite":
+        sys.exit("%s: not a bench-suite result file" % path)
+    if data.get("version") != 1:
+        sys.exit("%s: unsupported version %r" % (path, data.get("version")))
+    results = {}
+    for r in data["results"]:
+        results[(r["tree"], r["workload"], r["size"])] = r
+    return data, results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent change to report (default 10)")
+    parser.add_argument("--min-ns", type=float, default=1.0,
+                        help="ignore changes smaller than this many ns/op "
+                             "(default 1), e.g. clear() of a pooled tree")
+    args = parser.parse_args()
+
+    base_data, base = load(args.baseline)
+    cur_data, cur = load(args.current)
+    if base_data.get("node_allocation") != cur_data.get("node_allocation"):
+        print("warning: comparing %s node allocation against %s" %
+              (base_data.get("node_allocation"), cur_data.get("node_allocation")))
+
+    slower = []
+    faster = []
+    memory = []
+    for key in sorted(set(base) & set(cur)):
+        b = base[key]
+        c = cur[key]
+        for phase, before in sorted(b["ns_per_op"].items()):
+            after = c["ns_per_op"].get(phase)
+            if after is None or before <= 0:
+                continue
+            change = (after - before) / before * 100.0
+            if abs(after - before) < args.min_ns:
+                continue
+            row = key + (phase, before, after, change)
+            if change > args.threshold:
+                slower.append(row)
+            elif change < -args.threshold:
+                faster.append(row)
+        before = b["bytes_per_entry"]
+        after = c["bytes_per_entry"]
+        if before > 0 and abs(after - before) / before * 100.0 > args.threshold:
+            memory.append(key + (before, after))
+
+    def show(title, rows):
+        if not rows:
+            return
+        print("%s (threshold %.0f%%):" % (title, args.threshold))
+        for tree, workload, size, phase, before, after, change in rows:
+            print("  %-5s %-11s %10d %-8s %10.1f -> %10.1f ns/op  %+6.1f%%" %
+                  (tree, workload, size, phase, before, after, change))
+
+    show("slower", slower)
+    show("faster", faster)
+    if memory:
+        print("bytes per entry changed:")
+        for tree, workload, size, before, after in memory:
+            print("  %-5s %-11s %10d %8.1f -> %8.1f" % (tree, workload, size, before, after))
+
+    missing = sorted(set(base) ^ set(cur))
+    if missing:
+        print("%d entries are only in one of the files" % len(missing))
+    if not slower:
+        print("no slowdowns beyond %.0f%%" % args.threshold)
+    return 1 if slower else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,426 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+// Runs every tree through the same workloads at several sizes and prints
+// nanoseconds per operation for each phase, optionally as JSON (--json) so
+// that bench-compare.py can hold two runs against each other.
+//
+//   bench-suite [--sizes 1000,10000,...] [--repeat N] [--json FILE]
+//
+// Workloads decide the order keys are inserted and removed in and which
+// keys find() and the mixed phase ask for:
+//   sequential  ascending keys throughout
+//   random      shuffled inserts and removes, uniform lookups
+//   zipfian     shuffled inserts and removes, lookups skewed towards a few
+//               hot keys (Zipf exponent 0.99, as in YCSB)
+//   adversarial keys alternate between the two ends (0, n-1, 1, n-2, ...),
+//               which makes an unbalanced tree a zig-zag path and makes the
+//               AVL tree rotate on most inserts; removes go in ascending
+//               order, which keeps the AVL tree rebalancing its left edge
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Keeps the optimizer from discarding lookups whose results are unused.
+static volatile long sink;
+
+// BinarySearchTree does not rebalance, so sorted and zig-zag inserts cost
+// O(n^2). Bigger runs of those workloads are skipped for it.
+static const size_t UNBALANCED_MAX_KEYS = 20000;
+
+// Every entry is run at least --repeat times and then again until this
+// much time has gone by (or MAX_RUNS), since a single run of a small size
+// is over in microseconds and would be mostly noise.
+static const double MIN_SECONDS_PER_ENTRY = 0.25;
+static const int MAX_RUNS = 1000;
+
+// find() and the mixed phase run at most this many operations, so that
+// the largest sizes do not need a second key array of their own.
+static const size_t MAX_PROBES = 10000000;
+
+enum Workload { SEQUENTIAL, RANDOM, ZIPFIAN, ADVERSARIAL, WORKLOAD_COUNT };
+
+static const char* const WORKLOAD_NAMES[WORKLOAD_COUNT] =
+    { "sequential", "random", "zipfian", "adversarial" };
+
+static const char* const PHASE_NAMES[] =
+    { "insert", "find", "mixed", "iterate", "remove", "clear" };
+static const int PHASE_COUNT = sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]);
+
+/**
+* Bytes std::map has asked for through CountingAllocator. Only one map is
+* alive at a time, so a single total is enough.
+*/
+static size_t mapBytes = 0;
+
+template<typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    CountingAllocator() { }
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U>&) { }
+
+    T* allocate(size_t n)
+    {
+        mapBytes += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n)
+    {
+        mapBytes -= n * sizeof(T);
+        ::operator delete(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) { return true; }
+template<typename T, typename U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) { return false; }
+
+typedef map<int, int, less<int>, CountingAllocator<pair<const int, int> > > CountedMap;
+
+// The few calls that differ between the trees and std::map.
+template<typename Tree>
+void removeKey(Tree& tree, int key)
+{
+    tree.remove(key);
+}
+
+void removeKey(CountedMap& tree, int key)
+{
+    tree.erase(key);
+}
+
+template<typename Tree>
+size_t bytesUsed(const Tree& tree)
+{
+    return tree.stats().bytes;
+}
+
+size_t bytesUsed(const CountedMap& tree)
+{
+    return sizeof(tree) + mapBytes;
+}
+
+/**
+* Draws ranks 0 .. n-1 with probability proportional to 1 / (rank+1)^theta,
+* using the constant time method of Gray et al., "Quickly Generating
+* Billion-Record Synthetic Databases" (as YCSB does). Setting up sums n
+* powers once.
+*/
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta, unsigned seed);
+    size_t next();
+
+private:
+    size_t n_;
+    double theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+    mt19937_64 rng_;
+    uniform_real_distribution<double> uniform_;
+};
+
+ZipfGenerator::ZipfGenerator(size_t n, double theta, unsigned seed) :
+    n_(n),
+    theta_(theta),
+    alpha_(1.0 / (1.0 - theta)),
+    zetan_(0.0),
+    rng_(seed),
+    uniform_(0.0, 1.0)
+{
+    for(size_t i = 1; i <= n; ++i) {
+        zetan_ += 1.0 / pow((double)i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+}
+
+size_t ZipfGenerator::next()
+{
+    double u = uniform_(rng_);
+    double uz = u * zetan_;
+    if(uz < 1.0) {
+        return 0;
+    }
+    if(uz < 1.0 + pow(0.5, theta_)) {
+        return 1;
+    }
+    size_t rank = (size_t)(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+    return rank < n_ ? rank : n_ - 1;
+}
+
+/**
+* The keys 0 .. n-1 in the order a workload inserts them, and the keys its
+* lookups ask for.
+*/
+struct WorkloadKeys
+{
+    vector<int> order;
+    vector<int> probes;
+};
+
+void makeWorkload(Workload workload, size_t n, WorkloadKeys& keys)
+{
+    keys.order.resize(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys.order[i] = (int)i;
+    }
+    if(workload == RANDOM || workload == ZIPFIAN) {
+        shuffle(keys.order.begin(), keys.order.end(), mt19937(42));
+    } else if(workload == ADVERSARIAL) {
+        for(size_t i = 0; i < n; ++i) {
+            keys.order[i] = (int)(i % 2 == 0 ? i / 2 : n - 1 - i / 2);
+        }
+    }
+
+    size_t probes = min(n, MAX_PROBES);
+    keys.probes.resize(probes);
+    mt19937_64 rng(7);
+    if(workload == RANDOM) {
+        uniform_int_distribution<size_t> uniform(0, n - 1);
+        for(size_t i = 0; i < probes; ++i) {
+            keys.probes[i] = (int)uniform(rng);
+        }
+    } else if(workload == ZIPFIAN) {
+        // Ranks go through the shuffled order, so the hot keys are spread
+        // over the tree instead of sitting together at one end.
+        ZipfGenerator zipf(n, 0.99, 7);
+        for(size_t i = 0; i < probes; ++i) {
+            keys.probes[i] = keys.order[zipf.next()];
+        }
+    } else {
+        copy(keys.order.begin(), keys.order.begin() + probes, keys.probes.begin());
+    }
+}
+
+/**
+* The fastest time seen for each phase of one tree, workload and size.
+*/
+struct Result
+{
+    string tree;
+    Workload workload;
+    size_t size;
+    int runs;
+    double nanosPerOp[PHASE_COUNT];
+    double bytesPerEntry;
+};
+
+/**
+* One pass over every phase with a fresh tree. Each phase keeps its time
+* in nanos if it beat what is already there.
+*/
+template<typename Tree>
+void runOnce(Workload workload, const WorkloadKeys& keys, double* nanos, double& bytesPerEntry)
+{
+    size_t n = keys.order.size();
+    size_t probes = keys.probes.size();
+    double secs[PHASE_COUNT];
+    long total = 0;
+    Tree* tree = new Tree;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->insert(make_pair(keys.order[i], (int)i));
+    }
+    secs[0] = secondsSince(start);
+
+    start = Clock::now();
+    for(size_t i = 0; i < probes; ++i) {
+        total += tree->find(keys.probes[i]) != tree->end();
+    }
+    secs[1] = secondsSince(start);
+
+    // 80% lookups; the rest take a key out and put it straight back, so
+    // the size stays the same.
+    start = Clock::now();
+    for(size_t i = 0; i < probes; ++i) {
+        int key = keys.probes[i];
+        size_t slot = i % 10;
+        if(slot < 8) {
+            total += tree->find(key) != tree->end();
+        } else if(slot == 8) {
+            removeKey(*tree, key);
+        } else {
+            tree->insert(make_pair(keys.probes[i - 1], (int)i));
+        }
+    }
+    secs[2] = secondsSince(start);
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree->begin(); it != tree->end(); ++it) {
+        total += it->second;
+    }
+    secs[3] = secondsSince(start);
+
+    bytesPerEntry = (double)bytesUsed(*tree) / n;
+
+    // Half of the keys are removed one by one and clear() frees the rest.
+    start = Clock::now();
+    for(size_t i = 0; i < n; i += 2) {
+        removeKey(*tree, workload == ADVERSARIAL ? (int)i : keys.order[i]);
+    }
+    secs[4] = secondsSince(start);
+
+    start = Clock::now();
+    tree->clear();
+    secs[5] = secondsSince(start);
+    delete tree;
+    sink = total;
+
+    size_t ops[PHASE_COUNT] = { n, probes, probes, n, (n + 1) / 2, n / 2 };
+    for(int p = 0; p < PHASE_COUNT; ++p) {
+        double perOp = ops[p] == 0 ? 0.0 : secs[p] * 1e9 / ops[p];
+        if(nanos[p] < 0 || perOp < nanos[p]) {
+            nanos[p] = perOp;
+        }
+    }
+}
+
+template<typename Tree>
+void runTree(const string& name, Workload workload, const WorkloadKeys& keys,
+             int repeat, vector<Result>& results)
+{
+    Result result;
+    result.tree = name;
+    result.workload = workload;
+    result.size = keys.order.size();
+    for(int p = 0; p < PHASE_COUNT; ++p) {
+        result.nanosPerOp[p] = -1.0;
+    }
+    result.runs = 0;
+    Clock::time_point start = Clock::now();
+    while(result.runs < repeat ||
+          (result.runs < MAX_RUNS && secondsSince(start) < MIN_SECONDS_PER_ENTRY)) {
+        runOnce<Tree>(workload, keys, result.nanosPerOp, result.bytesPerEntry);
+        ++result.runs;
+    }
+
+    cout << left << setw(6) << name << setw(12) << WORKLOAD_NAMES[workload]
+         << right << setw(10) << result.size << fixed << setprecision(1);
+    for(int p = 0; p < PHASE_COUNT; ++p) {
+        cout << setw(10) << result.nanosPerOp[p];
+    }
+    cout << setw(8) << result.bytesPerEntry << endl;
+    results.push_back(result);
+}
+
+void writeJson(ostream& out, const vector<Result>& results, int repeat)
+{
+    out << "{\n  \"format\": \"bench-suite\",\n  \"version\": 1,\n";
+#ifdef BST_HEAP_NODES
+    out << "  \"node_allocation\": \"heap\",\n";
+#else
+    out << "  \"node_allocation\": \"pool\",\n";
+#endif
+    out << "  \"repeat\": " << repeat << ",\n  \"results\": [";
+    out << fixed << setprecision(2);
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"tree\": \"" << r.tree << "\", \"workload\": \""
+            << WORKLOAD_NAMES[r.workload] << "\", \"size\": " << r.size << ", \"runs\": " << r.runs
+            << ", \"bytes_per_entry\": " << r.bytesPerEntry << ", \"ns_per_op\": {";
+        for(int p = 0; p < PHASE_COUNT; ++p) {
+            out << (p == 0 ? "" : ", ") << "\"" << PHASE_NAMES[p] << "\": " << r.nanosPerOp[p];
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+vector<size_t> parseSizes(const char* list)
+{
+    vector<size_t> sizes;
+    stringstream in(list);
+    string item;
+    while(getline(in, item, ',')) {
+        size_t size = strtoul(item.c_str(), NULL, 10);
+        if(size > 0) {
+            sizes.push_back(size);
+        }
+    }
+    return sizes;
+}
+
+int main(int argc, char* argv[])
+{
+    vector<size_t> sizes;
+    sizes.push_back(1000);
+    sizes.push_back(10000);
+    sizes.push_back(100000);
+    sizes.push_back(1000000);
+    int repeat = 3;
+    const char* jsonPath = NULL;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizes = parseSizes(argv[++i]);
+        } else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = max(1, atoi(argv[++i]));
+        } else if(strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0]
+                 << " [--sizes 1000,10000,...] [--repeat N] [--json FILE]" << endl;
+            return 2;
+        }
+    }
+
+    cout << "ns/op, best of " << repeat << " runs or more for small sizes; bytes per entry after the mixed phase" << endl;
+    cout << left << setw(6) << "tree" << setw(12) << "workload" << right << setw(10) << "keys";
+    for(int p = 0; p < PHASE_COUNT; ++p) {
+        cout << setw(10) << PHASE_NAMES[p];
+    }
+    cout << setw(8) << "bytes" << endl;
+
+    vector<Result> results;
+    for(size_t s = 0; s < sizes.size(); ++s) {
+        for(int w = 0; w < WORKLOAD_COUNT; ++w) {
+            Workload workload = (Workload)w;
+            WorkloadKeys keys;
+            makeWorkload(workload, sizes[s], keys);
+            runTree<CountedMap>("map", workload, keys, repeat, results);
+            runTree<AVLTree<int, int> >("avl", workload, keys, repeat, results);
+            bool unbalancedIsQuadratic = workload == SEQUENTIAL || workload == ADVERSARIAL;
+            if(!unbalancedIsQuadratic || sizes[s] <= UNBALANCED_MAX_KEYS) {
+                runTree<BinarySearchTree<int, int> >("bst", workload, keys, repeat, results);
+            }
+        }
+    }
+
+    if(jsonPath != NULL) {
+        ofstream out(jsonPath);
+        writeJson(out, results, repeat);
+        if(!out) {
+            cerr << "could not write " << jsonPath << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
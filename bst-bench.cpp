@@ -0,0 +1,875 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include "bst.h"
+#include "avlbst.h"
+#include "btree.h"
+#include "persistent_avl.h"
+#include "concurrent_avl.h"
+#include "sharded_tree.h"
+#include "intrusive_avl.h"
+#include "parentless_avl.h"
+#include "frozen_tree.h"
+#include "tree_counters.h"
+#include "tree_snapshot.h"
+
+using namespace std;
+
+// Build this file twice: once as is (slab node pool) and once with
+// -DBST_HEAP_NODES (one heap allocation per node) and compare the output.
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const string& tree, const string& op, size_t ops, double secs)
+{
+    cout << left << setw(8) << tree << setw(12) << op
+         << right << setw(10) << fixed << setprecision(2) << (ops / secs / 1e6) << " Mops/s"
+         << setw(10) << setprecision(1) << (secs * 1e9 / ops) << " ns/op" << endl;
+}
+
+// Keeps the optimizer from discarding lookups whose results are unused.
+static volatile long sink;
+
+template<typename Tree>
+void runAllocationBench(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree* tree = new Tree;
+
+    // Allocation throughput: every insert allocates one node.
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree->insert(make_pair(keys[i], (int)i));
+    }
+    report(name, "insert", n, secondsSince(start));
+
+    // Lookup locality: random probes and an in-order walk over every node.
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree->find(probes[i])->second;
+    }
+    report(name, "find", n, secondsSince(start));
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree->begin(); it != tree->end(); ++it) {
+        total += it->second;
+    }
+    report(name, "iterate", n, secondsSince(start));
+
+    // Churn: free half of the nodes and allocate them again.
+    start = Clock::now();
+    for(size_t i = 0; i < n; i += 2) {
+        tree->remove(keys[i]);
+    }
+    for(size_t i = 0; i < n; i += 2) {
+        tree->insert(make_pair(keys[i], (int)i));
+    }
+    report(name, "churn", n, secondsSince(start));
+
+    start = Clock::now();
+    delete tree;
+    report(name, "destroy", n, secondsSince(start));
+
+    sink = total;
+}
+
+// Gives the teardown benchmark direct control over the shape of the tree.
+// A degenerate tree cannot be built through insert() in reasonable time,
+// since every insert would walk the whole chain.
+class ShapedTree : public BinarySearchTree<int, string>
+{
+public:
+    void buildChain(size_t n)
+    {
+        Node<int, string>* last = NULL;
+        for(size_t i = 0; i < n; ++i) {
+            Node<int, string>* node = createNode(last, make_pair((int)i, string("v")));
+            attachNode(node, last, false);
+            last = node;
+        }
+    }
+
+    void buildBalanced(int lo, int hi)
+    {
+        if(lo >= hi) {
+            return;
+        }
+        int mid = lo + (hi - lo) / 2;
+        try_emplace(mid, "v");
+        buildBalanced(lo, mid);
+        buildBalanced(mid + 1, hi);
+    }
+};
+
+// clear() on both shapes. The string values force the per-node walk.
+void runTeardownBench(size_t n)
+{
+    ShapedTree chain;
+    chain.buildChain(n);
+    Clock::time_point start = Clock::now();
+    chain.clear();
+    report("bst", "clear-chain", n, secondsSince(start));
+
+    ShapedTree balanced;
+    balanced.buildBalanced(0, (int)n);
+    start = Clock::now();
+    balanced.clear();
+    report("bst", "clear-bal", n, secondsSince(start));
+}
+
+// Startup cost of building an AVLTree out of already sorted data.
+void runBulkLoadBench(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+
+    Clock::time_point start = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        report("avl", "load-insert", n, secondsSince(start));
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<int, int> tree;
+        tree.buildFromSorted(items.begin(), items.end());
+        report("avl", "load-sorted", n, secondsSince(start));
+    }
+}
+
+// Cost of keeping subtree sizes up to date, and the queries they enable.
+template<typename Tree>
+void runOrderStatInsertRemove(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    report(name, "insert", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report(name, "remove", n, secondsSince(start));
+}
+
+void runOrderStatBench(const vector<int>& keys)
+{
+    size_t n = keys.size();
+    runOrderStatInsertRemove<AVLTree<int, int> >("avl", keys);
+    runOrderStatInsertRemove<RankedAVLTree<int, int> >("ranked", keys);
+
+    RankedAVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.select((size_t)keys[i])->first;
+    }
+    report("ranked", "select", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.rank(keys[i]);
+    }
+    report("ranked", "rank", n, secondsSince(start));
+    sink = total;
+}
+
+// Removing a block of keys with erase(lo, hi) versus one remove() per key.
+void runRangeEraseBench(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    int lo = (int)(n / 4);
+    int hi = (int)(n / 4 * 3) - 1;
+    size_t count = hi - lo + 1;
+
+    AVLTree<int, int> tree;
+    tree.buildFromSorted(items.begin(), items.end());
+    Clock::time_point start = Clock::now();
+    for(int k = lo; k <= hi; ++k) {
+        tree.remove(k);
+    }
+    report("avl", "remove-loop", count, secondsSince(start));
+
+    tree.buildFromSorted(items.begin(), items.end());
+    start = Clock::now();
+    tree.erase(lo, hi);
+    report("avl", "erase-range", count, secondsSince(start));
+
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.lower_bound((int)i)->first;
+    }
+    report("avl", "lower_bound", n, secondsSince(start));
+    sink = total;
+}
+
+// Repartitioning a tree into two shards and back: split() and concat()
+// against moving every item with remove() and insert().
+void runSplitJoinBench(size_t n)
+{
+    vector<pair<int, int> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair((int)i, (int)i);
+    }
+    int middle = (int)(n / 2);
+    const int rounds = 1000;
+
+    AVLTree<int, int> tree, left, right;
+    tree.buildFromSorted(items.begin(), items.end());
+    Clock::time_point start = Clock::now();
+    for(int r = 0; r < rounds; ++r) {
+        tree.split(middle + r % 100, left, right);
+        tree.concat(left, right);
+    }
+    report("avl", "split+concat", rounds, secondsSince(start));
+
+    // One round, reported per item moved, is enough to show the
+    // linear cost of moving items one by one.
+    start = Clock::now();
+    for(int k = middle; k < (int)n; ++k) {
+        tree.remove(k);
+        right.insert(make_pair(k, k));
+    }
+    for(int k = middle; k < (int)n; ++k) {
+        right.remove(k);
+        tree.insert(make_pair(k, k));
+    }
+    report("avl", "move-items", n - middle, secondsSince(start));
+}
+
+// Builds a tree holding the multiples of step below limit.
+static void buildMultiples(AVLTree<int, int>& tree, int step, size_t limit)
+{
+    vector<pair<int, int> > items;
+    for(size_t k = 0; k < limit; k += step) {
+        items.push_back(make_pair((int)k, (int)k));
+    }
+    tree.buildFromSorted(items.begin(), items.end());
+}
+
+// unite/intersect/subtract on two trees of about n keys each, from one
+// thread up to one per core, against merging with find() and insert().
+// 1, 2, 4, ... threads up to the number of cores.
+static vector<unsigned> threadCounts()
+{
+    unsigned cores = thread::hardware_concurrency();
+    if(cores == 0) {
+        cores = 1;
+    }
+    vector<unsigned> counts;
+    for(unsigned t = 1; t < cores; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(cores);
+    return counts;
+}
+
+void runSetOpBench(size_t n)
+{
+    vector<unsigned> counts = threadCounts();
+
+    AVLTree<int, int> a, b;
+    buildMultiples(a, 2, 2 * n);
+    buildMultiples(b, 3, 3 * n);
+    Clock::time_point start = Clock::now();
+    for(AVLTree<int, int>::iterator it = b.begin(); it != b.end(); ++it) {
+        if(a.find(it->first) == a.end()) {
+            a.insert(*it);
+        }
+    }
+    report("avl", "unite-loop", n, secondsSince(start));
+
+    for(size_t i = 0; i < counts.size(); ++i) {
+        string suffix = " x" + to_string(counts[i]);
+        buildMultiples(a, 2, 2 * n);
+        buildMultiples(b, 3, 3 * n);
+        start = Clock::now();
+        a.unite(b, KEEP_THIS, counts[i]);
+        report("avl", "unite" + suffix, n, secondsSince(start));
+
+        buildMultiples(a, 2, 2 * n);
+        buildMultiples(b, 3, 3 * n);
+        start = Clock::now();
+        a.intersect(b, KEEP_THIS, counts[i]);
+        report("avl", "intersect" + suffix, n, secondsSince(start));
+
+        buildMultiples(a, 2, 2 * n);
+        start = Clock::now();
+        a.subtract(b, counts[i]);
+        report("avl", "subtract" + suffix, n, secondsSince(start));
+    }
+}
+
+// Lookups in the pointer tree against its frozen Eytzinger snapshot.
+// Run with 10000000 and 100000000 keys for the larger sizes.
+void runFreezeBench(const vector<int>& keys)
+{
+    size_t n = keys.size();
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    Clock::time_point start = Clock::now();
+    FrozenTree<int, int> frozen = freeze(tree);
+    report("frozen", "freeze", n, secondsSince(start));
+    cout << "frozen: " << fixed << setprecision(1) << (double)frozen.bytes() / n
+         << " bytes/entry, avl " << sizeof(AVLNode<int, int>) << " bytes/entry" << endl;
+
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(11));
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.find(probes[i])->second;
+    }
+    report("avl", "find", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += frozen.find(probes[i])->second;
+    }
+    report("frozen", "find", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.lower_bound(probes[i])->first;
+    }
+    report("avl", "lower_bound", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += frozen.lower_bound(probes[i])->first;
+    }
+    report("frozen", "lower_bound", n, secondsSince(start));
+
+    start = Clock::now();
+    for(FrozenTree<int, int>::const_iterator it = frozen.begin(); it != frozen.end(); ++it) {
+        total += it->second;
+    }
+    report("frozen", "iterate", n, secondsSince(start));
+    sink = total;
+}
+
+// Saving to a snapshot file and mapping it back in, against rebuilding
+// the tree by insertion. Loads are reported per entry so they line up
+// with the rest; loading with SKIP_CHECKSUM does not depend on the size.
+void runSnapshotFileBench(const vector<int>& keys)
+{
+    const char* path = "bst-bench.snapshot";
+    size_t n = keys.size();
+    AVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    Clock::time_point start = Clock::now();
+    writeSnapshot(tree, path);
+    report("mapped", "save", n, secondsSince(start));
+
+    MappedTree<int, int> mapped;
+    start = Clock::now();
+    mapped.load(path);
+    report("mapped", "load", n, secondsSince(start));
+    start = Clock::now();
+    mapped.load(path, SKIP_CHECKSUM);
+    report("mapped", "load-nocheck", n, secondsSince(start));
+    std::FILE* file = std::fopen(path, "rb");
+    std::fseek(file, 0, SEEK_END);
+    cout << "mapped: " << fixed << setprecision(1) << (double)std::ftell(file) / n
+         << " bytes/entry on disk" << endl;
+    std::fclose(file);
+
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(13));
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += mapped.find(probes[i])->second;
+    }
+    report("mapped", "find", n, secondsSince(start));
+
+    start = Clock::now();
+    for(MappedTree<int, int>::const_iterator it = mapped.begin(); it != mapped.end(); ++it) {
+        total += it->second;
+    }
+    report("mapped", "iterate", n, secondsSince(start));
+
+    AVLTree<int, int> rebuilt;
+    start = Clock::now();
+    mapped.materialize(rebuilt);
+    report("mapped", "materialize", n, secondsSince(start));
+
+    AVLTree<int, int> inserted;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        inserted.insert(make_pair(keys[i], (int)i));
+    }
+    report("avl", "insert", n, secondsSince(start));
+    sink = total + rebuilt.size() + inserted.size();
+    std::remove(path);
+}
+
+// Batched lookups against a loop of find() over the same probes, for a
+// few batch sizes. Only pays off once the tree is well out of cache.
+template<typename Tree>
+void runFindBatchBench(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(13));
+
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.find(probes[i])->second;
+    }
+    report(name, "find-loop", n, secondsSince(start));
+
+    const size_t batches[] = { 64, 256, 1024 };
+    for(size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); ++b) {
+        size_t batch = batches[b];
+        vector<typename Tree::iterator> found(batch);
+        start = Clock::now();
+        for(size_t i = 0; i < n; i += batch) {
+            size_t count = min(batch, n - i);
+            tree.findBatch(&probes[i], count, &found[0]);
+            for(size_t j = 0; j < count; ++j) {
+                total += found[j]->second;
+            }
+        }
+        report(name, "batch-" + to_string(batch), n, secondsSince(start));
+    }
+    sink = total;
+}
+
+// What a reader's consistent view costs: a deep copy of the AVLTree
+// (reported per item copied) against an O(1) snapshot of the persistent
+// tree, and the path copying a writer pays while a snapshot is held.
+void runSnapshotBench(const vector<int>& keys)
+{
+    size_t n = keys.size();
+    AVLTree<int, int> tree;
+    PersistentAVLTree<int, int> persistent;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        persistent.insert(make_pair(keys[i], (int)i));
+    }
+    report("persist", "insert", n, secondsSince(start));
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+
+    start = Clock::now();
+    {
+        AVLTree<int, int> copy;
+        for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            copy.insert(*it);
+        }
+        sink = copy.size();
+    }
+    report("avl", "deep-copy", n, secondsSince(start));
+
+    const size_t snapshots = 1000;
+    start = Clock::now();
+    for(size_t i = 0; i < snapshots; ++i) {
+        PersistentAVLTree<int, int>::Snapshot view = persistent.snapshot();
+        sink = view.size();
+    }
+    report("persist", "snapshot", snapshots, secondsSince(start));
+
+    // Every write after a fresh snapshot copies its root path.
+    size_t writes = min(n, (size_t)100000);
+    start = Clock::now();
+    for(size_t i = 0; i < writes; ++i) {
+        PersistentAVLTree<int, int>::Snapshot view = persistent.snapshot();
+        persistent.insert(make_pair(keys[i], (int)i + 1));
+    }
+    report("persist", "cow-write", writes, secondsSince(start));
+
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(17));
+    PersistentAVLTree<int, int>::Snapshot view = persistent.snapshot();
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += view[probes[i]];
+    }
+    report("persist", "find", n, secondsSince(start));
+    sink = total;
+}
+
+// An AVLTree behind one mutex, which is what the concurrent tree replaces.
+class LockedAVLTree
+{
+public:
+    bool insert(const pair<const int, int>& item)
+    {
+        lock_guard<mutex> lock(mutex_);
+        return tree_.insert(item).second;
+    }
+    bool remove(const int& key)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tree_.remove(key);
+        return true;
+    }
+    bool find(const int& key, int& value)
+    {
+        lock_guard<mutex> lock(mutex_);
+        AVLTree<int, int>::iterator it = tree_.find(key);
+        if(it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+private:
+    mutex mutex_;
+    AVLTree<int, int> tree_;
+};
+
+// Every thread runs the same mix of lookups and writes (half inserts, half
+// removes) on random keys out of [0, range).
+template<typename Tree>
+void runMixedOps(const string& name, size_t range, unsigned readPercent, size_t opsPerThread)
+{
+    vector<unsigned> counts = threadCounts();
+    for(size_t c = 0; c < counts.size(); ++c) {
+        Tree tree;
+        for(size_t i = 0; i < range; i += 2) {
+            tree.insert(make_pair((int)i, (int)i));
+        }
+        vector<thread> workers;
+        Clock::time_point start = Clock::now();
+        for(unsigned t = 0; t < counts[c]; ++t) {
+            workers.push_back(thread([&tree, range, readPercent, opsPerThread, t]() {
+                mt19937 rng(100 + t);
+                long total = 0;
+                for(size_t i = 0; i < opsPerThread; ++i) {
+                    int key = (int)(rng() % range);
+                    unsigned dice = rng() % 100;
+                    int value = 0;
+                    if(dice < readPercent) {
+                        total += tree.find(key, value) ? value : 0;
+                    } else if(dice % 2 == 0) {
+                        tree.insert(make_pair(key, (int)i));
+                    } else {
+                        tree.remove(key);
+                    }
+                }
+                sink = total;
+            }));
+        }
+        for(size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+        }
+        report(name, "r" + to_string(readPercent) + " x" + to_string(counts[c]),
+               opsPerThread * counts[c], secondsSince(start));
+    }
+}
+
+void runConcurrentBench(size_t n)
+{
+    size_t ops = max(n, (size_t)100000);
+    const unsigned mixes[] = { 100, 90, 50 };
+    for(size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m) {
+        runMixedOps<LockedAVLTree>("locked", n, mixes[m], ops);
+        runMixedOps<ConcurrentAVLTree<int, int> >("cavl", n, mixes[m], ops);
+    }
+}
+
+// Writes only, so the single lock is the bottleneck the shards remove.
+void runShardedBench(size_t n)
+{
+    size_t ops = max(n, (size_t)100000);
+    runMixedOps<LockedAVLTree>("locked", n, 0, ops);
+    runMixedOps<ShardedTree<int, int> >("sharded", n, 0, ops);
+}
+
+// A piece of a larger buffer, such as a field parsed out of a request,
+// that compares with std::string without being copied into one.
+struct StringRef
+{
+    const char* data;
+    size_t size;
+};
+bool operator<(const StringRef& a, const string& b) { return b.compare(0, b.size(), a.data, a.size) > 0; }
+bool operator<(const string& a, const StringRef& b) { return a.compare(0, a.size(), b.data, b.size) < 0; }
+
+// Lookups in a string keyed tree with keys that arrive as StringRefs.
+// With std::less every find() has to build a std::string first (the keys
+// are too long for the small string buffer, so that allocates); with
+// TransparentLess the reference is compared as it is.
+void runStringLookupBench(size_t n)
+{
+    size_t count = min(n, (size_t)200000);
+    vector<string> keys(count);
+    for(size_t i = 0; i < count; ++i) {
+        keys[i] = "customer/" + to_string(i * 7919 % count) + "/profile";
+    }
+    AVLTree<string, int> less;
+    AVLTree<string, int, AVLNode<string, int>, TransparentLess> transparent;
+    for(size_t i = 0; i < count; ++i) {
+        less.insert(make_pair(keys[i], (int)i));
+        transparent.insert(make_pair(keys[i], (int)i));
+    }
+    vector<StringRef> probes(count);
+    for(size_t i = 0; i < count; ++i) {
+        StringRef ref = { keys[i].data(), keys[i].size() };
+        probes[i] = ref;
+    }
+    shuffle(probes.begin(), probes.end(), mt19937(23));
+
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < count; ++i) {
+        total += less.find(string(probes[i].data, probes[i].size))->second;
+    }
+    report("less", "find-ref", count, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < count; ++i) {
+        total += transparent.find(probes[i])->second;
+    }
+    report("transp", "find-ref", count, secondsSince(start));
+    sink = total;
+}
+
+// An object that carries its own hook for IntrusiveAVLTree.
+struct Entry : AVLHook<Entry>
+{
+    int key;
+    int value;
+};
+
+// Linking caller owned objects into an IntrusiveAVLTree versus copying
+// them into the nodes of an AVLTree, and removing them again by reference
+// (no lookup) or by key.
+void runIntrusiveBench(const vector<int>& keys)
+{
+    size_t n = keys.size();
+    typedef IntrusiveAVLTree<Entry, int, &Entry::key> Tree;
+    vector<Entry> entries(n);
+    for(size_t i = 0; i < n; ++i) {
+        entries[i].key = keys[i];
+        entries[i].value = (int)i;
+    }
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(entries[i]);
+    }
+    report("intr", "insert", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(entries[i]);
+    }
+    report("intr", "remove-ref", n, secondsSince(start));
+
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(entries[i]);
+    }
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report("intr", "remove-key", n, secondsSince(start));
+}
+
+// The same steps against the three AVL node layouts: AVLNode, the balance
+// packed into the parent pointer (CompactAVLTree), and no parent pointer
+// at all (ParentlessAVLTree).
+template<typename Tree>
+void runNodeLayoutBench(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    report(name, "insert", n, secondsSince(start));
+
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.find((int)i)->second;
+    }
+    report(name, "find", n, secondsSince(start));
+
+    start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        total += it->second;
+    }
+    report(name, "iterate", n, secondsSince(start));
+
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report(name, "remove", n, secondsSince(start));
+    sink = total;
+}
+
+void runCompactNodeBench(const vector<int>& keys)
+{
+    cout << "bytes per entry: avl " << sizeof(AVLNode<int, int>)
+         << ", compact " << sizeof(CompactAVLNode<int, int>)
+         << ", nopar " << ParentlessAVLTree<int, int>::nodeSize() << endl;
+    runNodeLayoutBench<AVLTree<int, int> >("avl", keys);
+    runNodeLayoutBench<CompactAVLTree<int, int> >("compact", keys);
+    runNodeLayoutBench<ParentlessAVLTree<int, int> >("nopar", keys);
+
+    size_t n = keys.size();
+    ParentlessAVLTree<int, int> tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        total += tree.contains((int)i);
+    }
+    report("nopar", "contains", n, secondsSince(start));
+    sink = total;
+}
+
+// What one stats() walk costs, and the shapes it reports for the same
+// random keys.
+template<typename Tree>
+void runStatsBench(const string& name, const vector<int>& keys)
+{
+    size_t n = keys.size();
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    Clock::time_point start = Clock::now();
+    TreeStats stats = tree.stats();
+    report(name, "stats", n, secondsSince(start));
+    cout << name << " shape: height " << stats.height
+         << ", average leaf depth " << fixed << setprecision(1) << stats.averageLeafDepth()
+         << ", off balance " << setprecision(2) << stats.offBalanceFraction()
+         << ", " << stats.bytes / n << " bytes per entry" << endl;
+}
+
+// What counting costs: the same steps for an AVLTree without counters,
+// with TreeCounters<> and with every 64th operation timed as well, then
+// what the sampled tree counted.
+void runCountersBench(const vector<int>& keys)
+{
+    typedef AVLTree<int, int, AVLNode<int, int>, std::less<int>, TreeCounters<64> > SampledTree;
+    runNodeLayoutBench<AVLTree<int, int> >("avl", keys);
+    runNodeLayoutBench<AVLTree<int, int, AVLNode<int, int>, std::less<int>, TreeCounters<> > >("counted", keys);
+    runNodeLayoutBench<SampledTree>("sampled", keys);
+
+    size_t n = keys.size();
+    SampledTree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    for(size_t i = 0; i < n; ++i) {
+        tree.find(keys[i]);
+    }
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    TreeCounterSnapshot counts = tree.counters().snapshot();
+    cout << "counts per key: " << fixed << setprecision(2)
+         << (double)counts.comparisons / (2 * n) << " find comparisons, "
+         << (double)counts.singleRotations / n << " single and "
+         << (double)counts.doubleRotations / n << " double rotations, "
+         << (double)counts.nodeSwaps / n << " swaps, "
+         << (double)counts.removeFixLevels / n << " remove fix levels (max "
+         << counts.maxRemoveFixDepth << ")" << endl;
+    const char* names[TREE_OPERATION_COUNT] = { "find", "insert", "remove" };
+    for(int op = 0; op < TREE_OPERATION_COUNT; ++op) {
+        const LatencyHistogram& latency = counts.latency[op];
+        cout << "sampled " << names[op] << " ns: p50 < " << latency.percentile(50)
+             << ", p99 < " << latency.percentile(99)
+             << ", p99.9 < " << latency.percentile(99.9) << endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (int)i;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+#ifdef BST_HEAP_NODES
+    cout << "node allocation: heap, " << n << " keys" << endl;
+#else
+    cout << "node allocation: slab pool, " << n << " keys" << endl;
+#endif
+    cout << "node size: bst " << sizeof(Node<int, int>)
+         << " bytes, avl " << sizeof(AVLNode<int, int>) << " bytes" << endl;
+    runAllocationBench<BinarySearchTree<int, int> >("bst", keys);
+    runAllocationBench<AVLTree<int, int> >("avl", keys);
+    cout << "btree: " << BTree<int, int>::MAX_KEYS << " keys per node" << endl;
+    runAllocationBench<BTree<int, int> >("btree", keys);
+    runBulkLoadBench(n);
+    runTeardownBench(n);
+    runOrderStatBench(keys);
+    runIntrusiveBench(keys);
+    runCompactNodeBench(keys);
+    runStatsBench<BinarySearchTree<int, int> >("bst", keys);
+    runStatsBench<AVLTree<int, int> >("avl", keys);
+    runCountersBench(keys);
+    runRangeEraseBench(n);
+    runSplitJoinBench(n);
+    runSetOpBench(n);
+    runFreezeBench(keys);
+    runSnapshotFileBench(keys);
+    runFindBatchBench<BinarySearchTree<int, int> >("bst", keys);
+    runFindBatchBench<AVLTree<int, int> >("avl", keys);
+    runStringLookupBench(n);
+    runSnapshotBench(keys);
+    runConcurrentBench(n);
+    runShardedBench(n);
+
+    return 0;
+}
@@ -1,10 +1,1252 @@
 #include <iostream>
 #include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
 #include "bst.h"
 #include "avlbst.h"
+#include "btree.h"
+#include "persistent_avl.h"
+#include "concurrent_avl.h"
+#include "sharded_tree.h"
+#include "intrusive_avl.h"
+#include "parentless_avl.h"
+#include "tree_trace.h"
+#include "frozen_tree.h"
+#include "tree_counters.h"
+#include "tree_snapshot.h"
+#include <thread>
+#include <pthread.h>
+#include <atomic>
+#include <functional>
 
 using namespace std;
 
+// A value type that counts how often it is copied or moved.
+struct CopyCounter
+{
+    static int copies;
+    static int moves;
+    static int destroyed;
+
+    CopyCounter() {}
+    ~CopyCounter() { ++destroyed; }
+    CopyCounter(const CopyCounter&) { ++copies; }
+    CopyCounter(CopyCounter&&) { ++moves; }
+    CopyCounter& operator=(const CopyCounter&) { ++copies; return *this; }
+    CopyCounter& operator=(CopyCounter&&) { ++moves; return *this; }
+};
+int CopyCounter::copies = 0;
+int CopyCounter::moves = 0;
+int CopyCounter::destroyed = 0;
+
+// A value whose copies throw std::bad_alloc once copiesLeft runs down to
+// 0, standing in for running out of memory halfway through a change. A
+// negative copiesLeft never throws.
+struct Fragile
+{
+    static int copiesLeft;
+
+    Fragile(int v = 0) : n(v) {}
+    Fragile(const Fragile& other) : n(other.n)
+    {
+        if(copiesLeft == 0) {
+            throw std::bad_alloc();
+        }
+        --copiesLeft;
+    }
+    Fragile& operator=(const Fragile& other) { n = other.n; return *this; }
+    int n;
+};
+int Fragile::copiesLeft = -1;
+
+// The trees can print their values, so the counter has to support that.
+ostream& operator<<(ostream& os, const CopyCounter&) { return os << "counter"; }
+
+// A view of part of a string that compares with std::string but cannot
+// be turned into one, so lookups with it can never build a key.
+struct Slice
+{
+    Slice(const char* text, size_t length) : data(text), size(length) {}
+    const char* data;
+    size_t size;
+};
+bool operator<(const Slice& a, const string& b) { return b.compare(0, b.size(), a.data, a.size) > 0; }
+bool operator<(const string& a, const Slice& b) { return a.compare(0, a.size(), b.data, b.size) < 0; }
+
+// An object kept in two intrusive trees at once, one per hook.
+struct ById {};
+struct ByDeadline {};
+struct Job : AVLHook<Job, ById>, AVLHook<Job, ByDeadline>
+{
+    Job() : id(0), deadline(0) {}
+    int id;
+    int deadline;
+};
+
+int failures = 0;
+
+void check(bool ok, const char* msg)
+{
+    cout << (ok ? "PASS: " : "FAIL: ") << msg << endl;
+    if(!ok) {
+        ++failures;
+    }
+}
+
+// Rvalue inserts, emplace, try_emplace and overwrites must not copy the value.
+template<typename Tree>
+void testNoCopies(const char* name)
+{
+    cout << "\n" << name << " copy counts:" << endl;
+    Tree t;
+    CopyCounter::copies = 0;
+    t.insert(std::make_pair(string("a"), CopyCounter()));
+    t.emplace(string("b"), CopyCounter());
+    t.try_emplace(string("c"));
+    t.insert_or_assign(string("a"), CopyCounter());
+    t.insert(std::make_pair(string("b"), CopyCounter()));
+    t.emplace(string("c"), CopyCounter());
+    t[string("d")] = CopyCounter();
+    check(CopyCounter::copies == 0, "no value copies on insert/emplace/overwrite");
+
+    CopyCounter lvalue;
+    t.insert(std::pair<const string, CopyCounter>(string("e"), lvalue));
+    const std::pair<const string, CopyCounter> item(string("f"), lvalue);
+    CopyCounter::copies = 0;
+    t.insert(item);
+    check(CopyCounter::copies == 1, "one copy when inserting a const item");
+}
+
+
+// Bulk loading sorted items must give a balanced tree and reject bad input.
+void testBuildFromSorted()
+{
+    cout << "\nAVLTree::buildFromSorted:" << endl;
+    std::map<int, int> items;
+    for(int i = 0; i < 100; ++i) {
+        items[i * 3] = i;
+    }
+    AVLTree<int, int> t;
+    t.buildFromSorted(items.begin(), items.end());
+    bool same = true;
+    std::map<int, int>::iterator expected = items.begin();
+    for(AVLTree<int, int>::iterator it = t.begin(); it != t.end(); ++it, ++expected) {
+        same = same && it->first == expected->first && it->second == expected->second;
+    }
+    check(same && expected == items.end(), "holds every item in order");
+    check(t.isBalanced(), "is balanced");
+
+    std::pair<int, int> unsorted[] = { std::make_pair(1, 1), std::make_pair(3, 3), std::make_pair(2, 2) };
+    bool threw = false;
+    try {
+        t.buildFromSorted(unsorted, unsorted + 3);
+    } catch(std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && t.empty(), "rejects unsorted input");
+
+    t.buildFromSorted(items.begin(), items.end());
+    std::pair<int, int> repeated[] = { std::make_pair(1, 1), std::make_pair(2, 2), std::make_pair(2, 3),
+                                       std::make_pair(4, 4) };
+    threw = false;
+    try {
+        t.buildFromSorted(repeated, repeated + 4);
+    } catch(std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && t.empty(), "rejects repeated keys");
+}
+
+// Tears down two degenerate trees, one with clear() and one by deleting
+// it. Runs on a thread with a small stack, where a recursive walk down a
+// chain this long would overflow it.
+void* tearDownChains(void* arg)
+{
+    BinarySearchTree<int, string>** chains = static_cast<BinarySearchTree<int, string>**>(arg);
+    chains[0]->clear();
+    delete chains[1];
+    chains[1] = NULL;
+    return NULL;
+}
+
+void testChainTeardown()
+{
+    cout << "\nDegenerate teardown:" << endl;
+    // String values keep clear() from skipping the walk; a recursive walk
+    // overflows a 256 KB stack well before 10000 nodes.
+    BinarySearchTree<int, string>* chains[2];
+    for(int c = 0; c < 2; ++c) {
+        chains[c] = new BinarySearchTree<int, string>();
+        for(int i = 0; i < 10000; ++i) {
+            chains[c]->insert(std::make_pair(i, string("v")));
+        }
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    pthread_t thread;
+    bool ok = pthread_create(&thread, &attr, tearDownChains, chains) == 0 && pthread_join(thread, NULL) == 0;
+    pthread_attr_destroy(&attr);
+    check(ok && chains[0]->empty() && chains[1] == NULL, "clear() and the destructor on a 10000 node chain");
+    delete chains[0];
+}
+
+// Freed slots must be reused before the pool grows, release() must drop
+// every chunk, and trees must still destroy values the pool cannot skip.
+void testNodePool()
+{
+    cout << "\nNode pool:" << endl;
+    NodePool pool(sizeof(double), alignof(double));
+    void* first = pool.allocate();
+    void* second = pool.allocate();
+    size_t reserved = pool.bytesReserved();
+    pool.deallocate(first);
+    void* again = pool.allocate();
+    check(NodePool::releasesInBulk ? again == first : true, "deallocated slot handed out again");
+    check(pool.bytesReserved() == reserved, "reuse reserves no more bytes");
+    pool.deallocate(again);
+    pool.deallocate(second);
+    pool.release();
+    check(pool.chunkCount() == 0 && pool.bytesReserved() == 0, "release() drops every chunk");
+    pool.deallocate(pool.allocate());
+    check(pool.chunkCount() == (NodePool::releasesInBulk ? 1u : 0u), "pool usable after release()");
+
+    NodePool taker(sizeof(double), alignof(double));
+    NodePool giver(sizeof(double), alignof(double));
+    void* given = giver.allocate();
+    giver.deallocate(given);
+    taker.adopt(giver);
+    reserved = taker.bytesReserved();
+    check(NodePool::releasesInBulk ? taker.allocate() == given : true, "adopt() takes over the free slots");
+    check(taker.bytesReserved() == reserved, "adopted free slot used before growing");
+
+    AVLTree<int, int> t;
+    for(int i = 0; i < 1000; ++i) {
+        t.insert(std::make_pair(i, i));
+    }
+    size_t bytes = t.stats().bytes;
+    for(int round = 0; round < 10; ++round) {
+        t.remove(round * 7);
+        t.insert(std::make_pair(round * 7, round));
+    }
+    check(t.stats().bytes == bytes, "remove then insert reuses the freed node");
+
+    {
+        AVLTree<int, CopyCounter> values;
+        for(int i = 0; i < 100; ++i) {
+            values.emplace(i, CopyCounter());
+        }
+        CopyCounter::destroyed = 0;
+        values.clear();
+        check(CopyCounter::destroyed == 100 && values.empty(), "clear() destroys non-trivial values");
+        values.emplace(1, CopyCounter());
+        CopyCounter::destroyed = 0;
+    }
+    check(CopyCounter::destroyed == 1, "destructor destroys non-trivial values");
+}
+
+// Iterators must work both ways and with std algorithms and range-for.
+template<typename Tree>
+void testIterators(const char* name)
+{
+    cout << "\n" << name << " iterators:" << endl;
+    Tree t;
+    for(int i = 0; i < 20; ++i) {
+        t.insert(std::make_pair((i * 7) % 20, i));
+    }
+    const Tree& ct = t;
+
+    vector<int> forward;
+    for(const std::pair<const int, int>& item : ct) {
+        forward.push_back(item.first);
+    }
+    vector<int> backward;
+    for(typename Tree::const_reverse_iterator it = ct.rbegin(); it != ct.rend(); ++it) {
+        backward.push_back(it->first);
+    }
+    std::reverse(backward.begin(), backward.end());
+    check(forward.size() == 20 && std::is_sorted(forward.begin(), forward.end()), "range-for visits keys in order");
+    check(forward == backward, "reverse iteration mirrors forward iteration");
+
+    typename Tree::iterator last = t.end();
+    --last;
+    check(last->first == 19 && (last--)->first == 19 && last->first == 18, "decrement from end()");
+    typename Tree::const_iterator found = ct.find(5);
+    check(found == t.find(5) && found != ct.end(), "iterator and const_iterator compare");
+
+    t.insert(std::make_pair(100, 0));
+    t.insert(std::make_pair(101, 0));
+    check(t.find(100) != t.find(101), "distinct nodes with equal values differ");
+    check(std::distance(t.begin(), t.end()) == 22, "std::distance counts items");
+}
+
+// select/rank/countInRange against a simple count over the same keys.
+void testOrderStatistics()
+{
+    cout << "\nRankedAVLTree order statistics:" << endl;
+    RankedAVLTree<int, int> t;
+    for(int i = 0; i < 50; ++i) {
+        t.insert(std::make_pair((i * 17) % 50 * 2, i));
+    }
+    for(int i = 0; i < 50; i += 5) {
+        t.remove(i * 2);
+    }
+    check(t.size() == 40, "size() counts items");
+    bool ok = true;
+    size_t index = 0;
+    for(RankedAVLTree<int, int>::iterator it = t.begin(); it != t.end(); ++it, ++index) {
+        ok = ok && t.select(index) == it && t.rank(it->first) == index;
+    }
+    check(ok && t.select(index) == t.end(), "select() and rank() agree with iteration");
+    check(t.countInRange(10, 30) == 8 && t.countInRange(30, 10) == 0, "countInRange() is inclusive");
+}
+
+template<typename Tree>
+void testRangeQueries(const char* name)
+{
+    cout << "\n" << name << " range queries:" << endl;
+    Tree t;
+    for(int i = 0; i < 100; ++i) {
+        t.insert(std::make_pair((i * 37) % 100 * 2, i));
+    }
+    const Tree& ct = t;
+    check(t.lower_bound(10)->first == 10 && t.lower_bound(11)->first == 12, "lower_bound()");
+    check(t.upper_bound(10)->first == 12 && ct.upper_bound(198) == ct.end(), "upper_bound()");
+    check(t.floor(11)->first == 10 && t.floor(-1) == t.end(), "floor()");
+    check(t.ceiling(197)->first == 198 && t.ceiling(199) == t.end(), "ceiling()");
+    check(t.equal_range(10).first->first == 10 && t.equal_range(10).second->first == 12
+          && t.equal_range(11).first == t.equal_range(11).second, "equal_range()");
+
+    bool ok = t.erase(21, 60) == 20 && t.size() == 80 && t.erase(60, 21) == 0;
+    ok = ok && t.lower_bound(21)->first == 62 && t.floor(61)->first == 20;
+    ok = ok && t.erase(-5, 0) == 1 && t.erase(190, 500) == 5 && t.size() == 74;
+    ok = ok && t.erase(-1000, 1000) == 74 && t.empty() && t.begin() == t.end();
+    check(ok, "erase(lo, hi) removes an inclusive range");
+}
+
+template<typename Tree>
+void testSplitJoin(const char* name)
+{
+    cout << "\n" << name << " split/join:" << endl;
+    Tree t;
+    for(int i = 0; i < 100; ++i) {
+        t.insert(std::make_pair((i * 37) % 100, string(1, 'a' + i % 26)));
+    }
+    Tree left, right;
+    t.split(40, left, right);
+    check(t.empty() && left.size() == 40 && right.size() == 60, "split() divides the items");
+    check(left.isBalanced() && right.isBalanced(), "split() keeps both sides balanced");
+    check(left.begin()->first == 0 && right.begin()->first == 40 && (--right.end())->first == 99,
+          "keys below the split key go left");
+
+    right.split(70, right, t);
+    t.join(left, std::make_pair(40, string("x")), t);
+    check(left.empty() && t.size() == 71 && t.isBalanced(), "join() with the result as a source");
+    check(t.find(40)->second == "x" && right.find(40)->second != "x", "join() inserts the pivot");
+
+    right.remove(40);
+    Tree lower, upper, all;
+    t.split(70, lower, upper);
+    all.concat(lower, right);
+    all.concat(all, upper);
+    bool ok = all.size() == 100 && all.isBalanced() && lower.empty() && right.empty() && upper.empty();
+    int expected = 0;
+    for(typename Tree::iterator it = all.begin(); it != all.end(); ++it, ++expected) {
+        ok = ok && it->first == expected;
+    }
+    check(ok && expected == 100, "concat() joins trees in key order");
+
+    bool threw = false;
+    try {
+        all.join(left, std::make_pair(5, string("y")), all);
+    } catch(std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw && all.size() == 100, "join() rejects keys out of order");
+}
+
+// A window of keys that slides on: the oldest ones are split off and
+// cleared, the rest concatenated back and new keys inserted. The memory
+// of the cleared half has to be reused by the new keys.
+void testSlidingWindow()
+{
+    cout << "\nAVLTree sliding window:" << endl;
+    AVLTree<int, int> tree;
+    int oldest = 0;
+    int next = 0;
+    for(; next < 20000; ++next) {
+        tree.insert(std::make_pair(next, next));
+    }
+    size_t settled = 0;
+    for(int round = 0; round < 50; ++round) {
+        AVLTree<int, int> old, rest;
+        oldest += 2000;
+        tree.split(oldest, old, rest);
+        old.clear();
+        tree.concat(rest, tree);
+        for(int i = 0; i < 2000; ++i, ++next) {
+            tree.insert(std::make_pair(next, next));
+        }
+        if(round == 4) {
+            settled = tree.stats().bytes;
+        }
+    }
+    check(tree.size() == 20000 && tree.isBalanced() && tree.begin()->first == oldest &&
+          tree.stats().bytes <= settled, "split() and clear() give their memory back");
+}
+
+void testSetOperations()
+{
+    cout << "\nAVLTree set operations:" << endl;
+    // a holds the multiples of 2 below 6000, b the multiples of 3.
+    AVLTree<int, char> a, b;
+    for(int i = 0; i < 6000; i += 2) {
+        a.insert(std::make_pair(i, 'a'));
+    }
+    for(int i = 0; i < 6000; i += 3) {
+        b.insert(std::make_pair(i, 'b'));
+    }
+
+    AVLTree<int, char> both, left;
+    both.unite(a, KEEP_THIS, 4);
+    both.intersect(b, KEEP_OTHER, 4);
+    check(both.size() == 1000 && both.isBalanced() && a.empty(), "intersect() keeps shared keys");
+    check(both.find(6)->second == 'b' && both.find(4) == both.end(), "intersect() takes the winner's value");
+
+    left.unite(both);
+    left.unite(b, KEEP_THIS, 4);
+    check(left.size() == 2000 && b.empty() && left.isBalanced(), "unite() merges and empties the other tree");
+    check(left.find(6)->second == 'b' && left.find(3)->second == 'b', "unite() keeps this tree's value");
+
+    for(int i = 0; i < 6000; i += 2) {
+        a.insert(std::make_pair(i, 'a'));
+    }
+    a.subtract(left, 4);
+    bool ok = a.size() == 2000 && a.isBalanced();
+    for(AVLTree<int, char>::iterator it = a.begin(); it != a.end(); ++it) {
+        ok = ok && it->first % 2 == 0 && it->first % 3 != 0;
+    }
+    check(ok, "subtract() removes keys of the other tree");
+}
+
+void testFreeze()
+{
+    cout << "\nFrozenTree:" << endl;
+    AVLTree<int, string> t;
+    for(int i = 0; i < 200; ++i) {
+        t.insert(std::make_pair((i * 37) % 200 * 2, string(1, 'a' + i % 26)));
+    }
+    FrozenTree<int, string> f = freeze(t);
+    t.clear();
+    check(f.size() == 200 && !f.empty(), "freeze() copies every item");
+
+    bool ok = true;
+    int expected = 0;
+    for(FrozenTree<int, string>::const_iterator it = f.begin(); it != f.end(); ++it, expected += 2) {
+        ok = ok && it->first == expected && (*it).second.size() == 1;
+    }
+    check(ok && expected == 400, "iteration visits keys in order");
+    check((--f.end())->first == 398 && --(++f.begin()) == f.begin(), "iterators step backwards");
+    check(f.find(74)->first == 74 && f.find(75) == f.end() && f.find(-1) == f.end(), "find()");
+    check(f.lower_bound(75)->first == 76 && f.upper_bound(76)->first == 78
+          && f.lower_bound(399) == f.end(), "lower_bound() and upper_bound()");
+}
+
+template<typename Tree>
+void testFindBatch(const char* name)
+{
+    cout << "\n" << name << " findBatch:" << endl;
+    Tree t;
+    for(int i = 0; i < 100; ++i) {
+        t.insert(std::make_pair((i * 37) % 100 * 2, i));
+    }
+    vector<int> keys;
+    for(int k = 250; k >= -10; --k) {
+        keys.push_back(k);
+    }
+    vector<typename Tree::iterator> found(keys.size());
+    t.findBatch(&keys[0], keys.size(), &found[0]);
+    bool ok = true;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        ok = ok && found[i] == t.find(keys[i]);
+    }
+    check(ok, "results match find() in input order");
+
+    const Tree& ct = t;
+    vector<typename Tree::const_iterator> cfound(2);
+    ct.findBatch(&keys[52], 2, &cfound[0]);
+    check(cfound[0] != ct.end() && cfound[0]->first == 198 && cfound[1] == ct.end(), "const findBatch()");
+}
+
+void testBTree()
+{
+    cout << "\nBTree:" << endl;
+    BTree<int, string> t;
+    std::map<int, string> expected;
+    for(int i = 0; i < 2000; ++i) {
+        int key = (i * 7919) % 2000;
+        t.insert(std::make_pair(key, string(1, 'a' + i % 26)));
+        expected[key] = string(1, 'a' + i % 26);
+    }
+    check(t.size() == 2000 && t.height() > 1 && t.isBalanced(), "inserts split nodes and stay balanced");
+    check(!t.insert(std::make_pair(5, string("x"))).second && t.find(5)->second == "x"
+          && t.size() == 2000, "insert() overwrites an existing key");
+    expected[5] = "x";
+
+    for(int key = 0; key < 2000; key += 3) {
+        t.remove(key);
+        expected.erase(key);
+    }
+    t.remove(5000);
+    check(t.size() == expected.size() && t.isBalanced(), "remove() keeps the tree balanced");
+
+    bool ok = true;
+    std::map<int, string>::const_iterator mit = expected.begin();
+    for(BTree<int, string>::iterator it = t.begin(); it != t.end(); ++it, ++mit) {
+        ok = ok && mit != expected.end() && it->first == mit->first && (*it).second == mit->second;
+    }
+    check(ok && mit == expected.end(), "iteration visits keys in order");
+    check((--t.end())->first == 1999 && --(++t.begin()) == t.begin(), "iterators step backwards");
+
+    t[3] = "new";
+    const BTree<int, string>& ct = t;
+    bool threw = false;
+    try {
+        ct[6];
+    } catch(const std::out_of_range&) {
+        threw = true;
+    }
+    check(ct[3] == "new" && threw && ct.find(6) == ct.end(), "operator[] and find()");
+
+    // operator[] alone grows a tree, splitting full leaves and the full
+    // nodes above them on the way back up.
+    BTree<int, int> counts;
+    std::map<int, int> expectedCounts;
+    for(int i = 0; i < 20000; ++i) {
+        int key = (i * 7919) % 5000;
+        ++counts[key];
+        ++expectedCounts[key];
+    }
+    ok = counts.size() == expectedCounts.size() && counts.height() > 2 && counts.isBalanced();
+    std::map<int, int>::const_iterator cit = expectedCounts.begin();
+    for(BTree<int, int>::iterator it = counts.begin(); ok && it != counts.end(); ++it, ++cit) {
+        ok = it->first == cit->first && it->second == cit->second;
+    }
+    check(ok, "operator[] inserts missing keys and finds present ones");
+
+    // Removing nearly everything merges the root away level by level.
+    size_t tallest = t.height();
+    ok = true;
+    for(int key = 0; key < 1990; ++key) {
+        t.remove(key);
+        ok = ok && t.isBalanced();
+    }
+    check(ok && t.height() < tallest && t.size() == 7 && t.begin()->first == 1990,
+          "remove() shrinks the root");
+
+    t.clear();
+    check(t.empty() && t.begin() == t.end() && t.isBalanced(), "clear()");
+}
+
+void testPersistentTree()
+{
+    cout << "\nPersistentAVLTree:" << endl;
+    typedef PersistentAVLTree<int, string> Tree;
+    Tree t;
+    for(int i = 0; i < 100; ++i) {
+        t.insert(std::make_pair((i * 37) % 100, string("old")));
+    }
+    Tree::Snapshot before = t.snapshot();
+    for(int i = 0; i < 100; i += 2) {
+        t.remove(i);
+    }
+    check(!t.insert(std::make_pair(1, string("new"))) && t.insert(std::make_pair(500, string("new"))),
+          "insert() reports whether the key was new");
+    check(t.size() == 51 && t.isBalanced() && t[1] == "new", "writer sees its changes");
+
+    bool ok = before.size() == 100 && before.isBalanced();
+    int expected = 0;
+    for(Tree::const_iterator it = before.begin(); it != before.end(); ++it, ++expected) {
+        ok = ok && it->first == expected && it->second == "old";
+    }
+    check(ok && expected == 100, "snapshot keeps the old version");
+
+    Tree copy(t);
+    copy.remove(1);
+    check(t.find(1) != t.end() && copy.find(1) == copy.end(), "copies change independently");
+
+    t.clear();
+    bool threw = false;
+    try {
+        t[1];
+    } catch(const std::out_of_range&) {
+        threw = true;
+    }
+    check(t.empty() && threw && before[0] == "old" && before.find(101) == before.end(),
+          "snapshot outlives clear()");
+
+    // Changes that fail part way leave the tree as it was, whether they
+    // copy shared nodes or work in place.
+    typedef PersistentAVLTree<int, Fragile> FragileTree;
+    FragileTree f;
+    std::map<int, int> mirror;
+    for(int i = 0; i < 200; ++i) {
+        f.insert(std::make_pair(i * 2, Fragile(i)));
+        mirror[i * 2] = i;
+    }
+    FragileTree::Snapshot held = f.snapshot();
+    ok = true;
+    int failures = 0;
+    for(int round = 0; round < 120; ++round) {
+        int key = (round * 37) % 420;
+        Fragile::copiesLeft = round % 12;
+        try {
+            if(round % 3 == 2) {
+                f.remove(key);
+                mirror.erase(key);
+            } else {
+                f.insert(std::make_pair(key, Fragile(-key)));
+                mirror[key] = -key;
+            }
+        } catch(const std::bad_alloc&) {
+            ++failures;
+        }
+        Fragile::copiesLeft = -1;
+        if(round == 60) {
+            held = FragileTree::Snapshot();
+        }
+        ok = ok && f.size() == mirror.size() && f.isBalanced();
+        std::map<int, int>::const_iterator m = mirror.begin();
+        for(FragileTree::const_iterator it = f.begin(); ok && it != f.end(); ++it, ++m) {
+            ok = it->first == m->first && it->second.n == m->second;
+        }
+    }
+    check(ok && failures > 0, "a change that throws leaves the tree unchanged");
+}
+
+void testConcurrentTree()
+{
+    cout << "\nConcurrentAVLTree:" << endl;
+    typedef ConcurrentAVLTree<int, int> Tree;
+    Tree t;
+    for(int i = 0; i < 200; ++i) {
+        t.insert(std::make_pair((i * 37) % 200, i));
+    }
+    check(!t.insert(std::make_pair(5, -5)) && t.size() == 200 && t.isBalanced(),
+          "insert() overwrites and reports existing keys");
+    for(int i = 0; i < 200; i += 2) {
+        t.remove(i);
+    }
+    int value = 0;
+    check(t.size() == 100 && t.isBalanced() && !t.contains(4) && !t.remove(4)
+          && t.find(5, value) && value == -5, "remove() and find()");
+
+    // Each thread owns a disjoint range, so the final contents are known.
+    const int threads = 4;
+    std::vector<std::thread> workers;
+    for(int w = 0; w < threads; ++w) {
+        workers.push_back(std::thread([&t, w]() {
+            for(int i = 0; i < 500; ++i) {
+                t.insert(std::make_pair(1000 + w * 1000 + i, i));
+            }
+            for(int i = 0; i < 500; i += 2) {
+                t.remove(1000 + w * 1000 + i);
+            }
+        }));
+    }
+    for(size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+    bool ok = t.size() == 100 + threads * 250 && t.isBalanced();
+    for(int w = 0; w < threads; ++w) {
+        for(int i = 0; i < 500; ++i) {
+            ok = ok && t.contains(1000 + w * 1000 + i) == (i % 2 == 1);
+        }
+    }
+    check(ok, "concurrent writers on disjoint ranges");
+
+    // Readers run while writers insert and remove the same keys, so their
+    // optimistic descents race with rotations and unlinks. Keys that are
+    // multiples of 4 stay put and keys 1 mod 4 never appear; the writers
+    // churn the keys 3 mod 4 between them.
+    Tree mixed;
+    const int range = 4000;
+    for(int k = 0; k < range; k += 4) {
+        mixed.insert(std::make_pair(k, k * 10));
+    }
+    std::atomic<bool> done(false);
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> threadsMixed;
+    for(int w = 0; w < 2; ++w) {
+        threadsMixed.push_back(std::thread([&mixed, w, range]() {
+            for(int round = 0; round < 20; ++round) {
+                for(int k = 3 + 4 * w; k < range; k += 4) {
+                    mixed.insert(std::make_pair(k, k));
+                }
+                for(int k = range - 1; k > 0; k -= 4) {
+                    mixed.remove(k);
+                }
+            }
+        }));
+    }
+    for(int r = 0; r < 2; ++r) {
+        threadsMixed.push_back(std::thread([&mixed, &done, &wrong, range]() {
+            while(!done.load()) {
+                for(int k = 0; k < range; k += 4) {
+                    int found = -1;
+                    if(!mixed.find(k, found) || found != k * 10 || !mixed.contains(k) || mixed.contains(k + 1)) {
+                        ++wrong;
+                    }
+                }
+            }
+        }));
+    }
+    for(int w = 0; w < 2; ++w) {
+        threadsMixed[w].join();
+    }
+    done = true;
+    for(size_t i = 2; i < threadsMixed.size(); ++i) {
+        threadsMixed[i].join();
+    }
+    check(wrong == 0 && mixed.size() == range / 4 && mixed.isBalanced(),
+          "readers racing writers on the same keys");
+}
+
+void testShardedTree()
+{
+    cout << "\nShardedTree:" << endl;
+    typedef ShardedTree<int, int> Tree;
+    bool ok;
+    Tree t(4);
+    for(int i = 0; i < 8000; ++i) {
+        t.insert(std::make_pair(i, i));
+    }
+    bool even = true;
+    for(size_t s = 0; s < t.shardCount(); ++s) {
+        even = even && t.shardSize(s) * t.shardCount() <= 2 * t.size();
+    }
+    check(t.size() == 8000 && t.isBalanced() && even, "skewed inserts move the boundaries");
+
+    // With two shards the skew has to be measured against the other shard,
+    // since one shard can never hold more than twice half of the items.
+    Tree pair(2);
+    for(int i = 0; i < 100000; ++i) {
+        pair.insert(std::make_pair(i, i));
+    }
+    ok = pair.size() == 100000 && pair.isBalanced() &&
+         pair.shardSize(0) <= 2 * pair.shardSize(1) + 64 && pair.shardSize(1) <= 2 * pair.shardSize(0) + 64;
+    check(ok, "skewed inserts move the boundaries of two shards");
+
+    for(int i = 0; i < 8000; i += 2) {
+        t.remove(i);
+    }
+    int value = 0;
+    ok = t.size() == 4000 && !t.remove(2) && !t.contains(2) && t.find(3, value) && value == 3;
+    int expected = 1;
+    for(Tree::const_iterator it = t.begin(); it != t.end(); ++it, expected += 2) {
+        ok = ok && it->first == expected;
+    }
+    check(ok && expected == 8001, "remove(), find() and ordered iteration");
+
+    std::vector<int> sample;
+    for(int i = 0; i < 100; ++i) {
+        sample.push_back(100000 + i * 1000);
+    }
+    Tree sampled(4);
+    sampled.partition(sample.begin(), sample.end());
+    sampled.insert(std::make_pair(0, 0));
+    sampled.insert(std::make_pair(199000, 0));
+    check(sampled.shardSize(0) == 1 && sampled.shardSize(3) == 1 && sampled.isBalanced(),
+          "partition() places boundaries at sample quantiles");
+
+    const int threads = 4;
+    std::vector<std::thread> workers;
+    for(int w = 0; w < threads; ++w) {
+        workers.push_back(std::thread([&sampled, w]() {
+            for(int i = 0; i < 2000; ++i) {
+                sampled.insert(std::make_pair(100000 + w * 25000 + i, i));
+            }
+            for(int i = 0; i < 2000; i += 2) {
+                sampled.remove(100000 + w * 25000 + i);
+            }
+        }));
+    }
+    for(size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+    ok = sampled.size() == 2 + threads * 1000 && sampled.isBalanced();
+    for(int w = 0; w < threads; ++w) {
+        for(int i = 0; i < 2000; ++i) {
+            ok = ok && sampled.contains(100000 + w * 25000 + i) == (i % 2 == 1);
+        }
+    }
+    check(ok, "concurrent writers on disjoint ranges");
+}
+
+void testComparators()
+{
+    cout << "\nComparators:" << endl;
+    typedef AVLTree<int, int, AVLNode<int, int>, std::greater<int> > Descending;
+    Descending d;
+    for(int i = 0; i < 100; ++i) {
+        d.insert(std::make_pair((i * 37) % 100, i));
+    }
+    for(int i = 0; i < 100; i += 2) {
+        d.remove(i);
+    }
+    bool ok = d.size() == 50 && d.isBalanced() && d.lower_bound(50)->first == 49;
+    int expected = 99;
+    for(Descending::iterator it = d.begin(); it != d.end(); ++it, expected -= 2) {
+        ok = ok && it->first == expected;
+    }
+    FrozenTree<int, int, std::greater<int> > frozen = freeze(d);
+    ok = ok && frozen.lower_bound(50)->first == 49 && frozen.find(97) != frozen.end();
+    Descending low, high;
+    d.split(50, high, low);
+    check(ok && expected == -1 && high.size() == 25 && low.begin()->first == 49,
+          "std::greater orders the tree in reverse");
+
+    typedef AVLTree<string, int, AVLNode<string, int>, TransparentLess> Names;
+    Names names;
+    names.insert(std::make_pair(string("apple"), 1));
+    names.insert(std::make_pair(string("banana"), 2));
+    names.insert(std::make_pair(string("cherry"), 3));
+    const char* buffer = "banana,cherry";
+    Slice banana(buffer, 6);
+    Slice cherry(buffer + 7, 6);
+    check(names.find(banana)->second == 2 && names.find(Slice(buffer, 3)) == names.end() &&
+          names.lower_bound(Slice(buffer, 3))->first == "banana" && names.upper_bound(banana)->first == "cherry",
+          "lookups take a type that compares with the key");
+
+    const Names& view = names;
+    names.remove(cherry);
+    bool threw = false;
+    try {
+        view[cherry];
+    } catch(const std::out_of_range&) {
+        threw = true;
+    }
+    names["date"] = 4;
+    names["apple"] = 10;
+    check(threw && view[banana] == 2 && names.find("apple")->second == 10 && names.size() == 3 && names.find("date")->second == 4,
+          "remove() and operator[] take it too");
+}
+
+void testIntrusiveTree()
+{
+    cout << "\nIntrusiveAVLTree:" << endl;
+    typedef IntrusiveAVLTree<Job, int, &Job::id, std::less<int>, ById> JobsById;
+    typedef IntrusiveAVLTree<Job, int, &Job::deadline, std::greater<int>, ByDeadline> JobsByDeadline;
+    vector<Job> jobs(1000);
+    JobsById byId;
+    JobsByDeadline byDeadline;
+    for(int i = 0; i < 1000; ++i) {
+        jobs[i].id = (i * 389) % 1000;
+        jobs[i].deadline = i;
+        byId.insert(jobs[i]);
+        byDeadline.insert(jobs[i]);
+    }
+    Job duplicate;
+    duplicate.id = 5;
+    std::pair<JobsById::iterator, bool> result = byId.insert(duplicate);
+    bool ok = !result.second && &*result.first != &duplicate && result.first->id == 5;
+    int expected = 0;
+    for(JobsById::iterator it = byId.begin(); it != byId.end(); ++it, ++expected) {
+        ok = ok && it->id == expected;
+    }
+    check(ok && expected == 1000 && byId.isBalanced() && byDeadline.begin()->deadline == 999,
+          "one object sits in two trees in different orders");
+
+    for(int i = 0; i < 1000; i += 2) {
+        byId.remove(jobs[i]);
+    }
+    ok = byId.size() == 500 && byId.isBalanced() && byDeadline.size() == 1000;
+    for(int i = 0; i < 1000; ++i) {
+        ok = ok && (byId.find(jobs[i].id) != byId.end()) == (i % 2 == 1);
+    }
+    check(ok, "remove() by reference leaves the other tree alone");
+
+    Job* removed = byId.remove(jobs[1].id);
+    const JobsById& view = byId;
+    JobsById::const_iterator last = view.end();
+    --last;
+    ok = removed == &jobs[1] && byId.remove(jobs[1].id) == NULL && byId.size() == 499;
+    ok = ok && &*byId.iterator_to(jobs[3]) == &jobs[3] && last->id == 999;
+    ok = ok && byId.lower_bound(jobs[3].id)->id == jobs[3].id && byId.upper_bound(jobs[3].id)->id > jobs[3].id;
+    ok = ok && byId.lower_bound(1000) == byId.end();
+    check(ok, "lookups, bounds and iterator_to()");
+
+    byId.clear();
+    Job copy = jobs[3];
+    ok = byId.empty() && byId.insert(copy).second && byId.insert(jobs[3]).second == false;
+    for(int i = 0; i < 1000; ++i) {
+        byId.insert(jobs[i]);
+    }
+    check(ok && byId.size() == 1000 && byId.isBalanced(), "clear() lets the objects be linked again");
+}
+
+void testCompactNodes()
+{
+    cout << "\nCompact nodes:" << endl;
+    check(sizeof(CompactAVLNode<int, int>) < sizeof(AVLNode<int, int>) &&
+          ParentlessAVLTree<int, int>::nodeSize() < sizeof(CompactAVLNode<int, int>),
+          "compact nodes are smaller");
+
+    CompactAVLTree<int, string> compact;
+    ParentlessAVLTree<int, string> parentless;
+    map<int, string> reference;
+    bool ok = true;
+    for(int i = 0; i < 20000; ++i) {
+        int key = (i * 7919) % 1500;
+        if(i % 3 == 2) {
+            compact.remove(key);
+            parentless.remove(key);
+            reference.erase(key);
+        } else {
+            pair<const int, string> item(key, to_string(i));
+            compact.insert(item);
+            ok = ok && parentless.insert(item) == reference.insert(item).second;
+        }
+    }
+    ok = ok && compact.isBalanced() && parentless.isBalanced();
+    ok = ok && compact.size() == reference.size() && parentless.size() == reference.size();
+    map<int, string>::iterator expected = reference.begin();
+    ParentlessAVLTree<int, string>::iterator it = parentless.begin();
+    for(CompactAVLTree<int, string>::iterator c = compact.begin(); c != compact.end(); ++c, ++it, ++expected) {
+        ok = ok && c->first == expected->first && *it == *expected;
+    }
+    check(ok && it == parentless.end(), "inserts and removes match std::map");
+
+    const ParentlessAVLTree<int, string>& view = parentless;
+    ParentlessAVLTree<int, string>::const_iterator low = view.lower_bound(700);
+    ok = low->first == reference.lower_bound(700)->first;
+    ++low;
+    ok = ok && low->first == (++reference.lower_bound(700))->first;
+    ok = ok && view.find(reference.begin()->first) == view.begin();
+    ok = ok && parentless.contains(reference.rbegin()->first) && parentless.lower_bound(1500) == parentless.end();
+    parentless.clear();
+    check(ok && parentless.empty() && parentless.begin() == parentless.end(), "parentless lookups and iteration");
+}
+
+void testTreeStats()
+{
+    cout << "\nstats():" << endl;
+    BinarySearchTree<int, int> chain;
+    for(int i = 0; i < 3000; ++i) {
+        chain.insert(std::make_pair(i, i));
+    }
+    TreeStats c = chain.stats();
+    bool ok = c.nodes == 3000 && c.height == 3000 && c.leaves == 1 && c.maxLeafDepth == 2999;
+    ok = ok && c.offBalanceNodes == 2999 && c.depthHistogram.size() == 3000 && c.depthHistogram[2999] == 1;
+    check(ok && c.bytes >= 3000 * sizeof(Node<int, int>), "a degenerate BinarySearchTree");
+
+    std::map<int, int> items;
+    for(int i = 0; i < 1023; ++i) {
+        items[i] = i;
+    }
+    AVLTree<int, int> perfect;
+    perfect.buildFromSorted(items.begin(), items.end());
+    TreeStats p = perfect.stats();
+    ok = p.height == 10 && p.leaves == 512 && p.maxLeafDepth == 9 && p.averageLeafDepth() == 9.0;
+    check(ok && p.offBalanceNodes == 0 && p.depthHistogram[9] == 512, "a perfect AVLTree");
+
+    ShardedTree<int, int> sharded(4);
+    AVLTree<int, int> random;
+    for(int i = 0; i < 5000; ++i) {
+        sharded.insert(std::make_pair((i * 7919) % 5000, i));
+        random.insert(std::make_pair((i * 7919) % 5000, i));
+    }
+    TreeStats s = sharded.stats();
+    TreeStats r = random.stats();
+    size_t counted = 0;
+    for(size_t i = 0; i < s.depthHistogram.size(); ++i) {
+        counted += s.depthHistogram[i];
+    }
+    ok = s.nodes == 5000 && counted == 5000 && s.height < r.height && r.height <= 17;
+    check(ok && r.offBalanceFraction() > 0.0 && r.offBalanceFraction() < 0.5, "ShardedTree adds up its shards");
+
+    // split() leaves the sizes to be counted, so stats() counts the nodes.
+    AVLTree<int, int> whole, left, right;
+    for(int i = 0; i < 1000; ++i) {
+        whole.insert(std::make_pair(i, i));
+    }
+    whole.split(100, left, right);
+    TreeStats l = left.stats();
+    TreeStats rs = right.stats();
+    check(l.nodes == 100 && rs.nodes == 900 && l.depthHistogram[0] == 1, "stats() after split()");
+}
+
+void testTreeCounters()
+{
+    cout << "\nCounters:" << endl;
+    typedef AVLTree<int, int, AVLNode<int, int>, std::less<int>, TreeCounters<> > CountedAVL;
+    CountedAVL straight;
+    straight.insert(std::make_pair(1, 1));
+    straight.insert(std::make_pair(2, 2));
+    straight.insert(std::make_pair(3, 3));
+    CountedAVL bent;
+    bent.insert(std::make_pair(3, 3));
+    bent.insert(std::make_pair(1, 1));
+    bent.insert(std::make_pair(2, 2));
+    TreeCounterSnapshot a = straight.counters().snapshot();
+    TreeCounterSnapshot b = bent.counters().snapshot();
+    bool ok = a.singleRotations == 1 && a.doubleRotations == 0 && a.allocations == 3;
+    check(ok && b.singleRotations == 0 && b.doubleRotations == 1, "single and double rotations");
+
+    //2 is the root now, so finding it takes one level, 3 takes two and
+    //4 falls off below 3.
+    straight.find(2);
+    straight.find(3);
+    straight.find(4);
+    check(straight.counters().snapshot().comparisons == 2 + 4 + 4, "comparisons per level");
+
+    straight.remove(2);
+    TreeCounterSnapshot r = straight.counters().snapshot();
+    ok = r.nodeSwaps >= 1 && r.removeFixes == 1 && r.removeFixLevels >= 1 && r.deallocations == 1;
+    check(ok && r.maxRemoveFixDepth == r.removeFixLevels, "remove swaps and fix-up depth");
+
+    CountedAVL big;
+    for(int i = 0; i < 4096; ++i) {
+        big.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 4096; i += 2) {
+        big.remove(i);
+    }
+    TreeCounterSnapshot g = big.counters().snapshot();
+    ok = g.allocations == 4096 && g.deallocations == 2048 && g.removeFixes == 2048;
+    check(ok && g.maxRemoveFixDepth <= 13 && g.latency[TREE_INSERT].samples() == 0, "counting without sampling");
+
+    BinarySearchTree<int, int, Node<int, int>, std::less<int>, TreeCounters<> > plain;
+    plain.insert(std::make_pair(2, 2));
+    plain.insert(std::make_pair(1, 1));
+    plain.insert(std::make_pair(3, 3));
+    plain.remove(2);
+    TreeCounterSnapshot p = plain.counters().snapshot();
+    check(p.nodeSwaps == 1 && p.singleRotations == 0 && p.removeFixes == 0, "BinarySearchTree counts too");
+
+    AVLTree<int, int, AVLNode<int, int>, std::less<int>, TreeCounters<4> > sampled;
+    for(int i = 0; i < 100; ++i) {
+        sampled.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 100; ++i) {
+        sampled.find(i);
+    }
+    for(int i = 0; i < 40; ++i) {
+        sampled.remove(i);
+    }
+    TreeCounterSnapshot s = sampled.counters().snapshot();
+    const LatencyHistogram& finds = s.latency[TREE_FIND];
+    ok = s.latency[TREE_INSERT].samples() == 25 && finds.samples() == 25 && s.latency[TREE_REMOVE].samples() == 10;
+    check(ok && finds.percentile(50) > 0 && finds.percentile(50) <= finds.percentile(99), "every 4th operation is timed");
+
+    // Pairs are looked up before a node is built; emplace() builds first.
+    big.counters().reset();
+    big.insert(std::make_pair(1, 10));
+    big.insert(std::make_pair(3L, 30));
+    TreeCounterSnapshot e = big.counters().snapshot();
+    big.emplace(5, 50);
+    TreeCounterSnapshot f = big.counters().snapshot();
+    ok = e.allocations == 0 && e.deallocations == 0 && f.allocations == 1 && f.deallocations == 1;
+    check(ok && big.find(3)->second == 30 && big.find(5)->second == 50, "insert() of an existing key builds no node");
+
+    // clear() hands the nodes back in bulk but still counts every one.
+    CountedAVL emptied;
+    for(int i = 0; i < 1000; ++i) {
+        emptied.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        emptied.remove(i);
+    }
+    emptied.clear();
+    TreeCounterSnapshot c = emptied.counters().snapshot();
+    CountedAVL whole, left, right;
+    for(int i = 0; i < 100; ++i) {
+        whole.insert(std::make_pair(i, i));
+    }
+    whole.split(40, left, right);
+    left.clear();
+    right.clear();
+    TreeCounterSnapshot w = whole.counters().snapshot();
+    TreeCounterSnapshot l = left.counters().snapshot();
+    TreeCounterSnapshot rr = right.counters().snapshot();
+    ok = c.allocations == 1000 && c.deallocations == 1000 && emptied.empty();
+    ok = ok && w.allocations == l.deallocations + rr.deallocations && w.deallocations == 0;
+    check(ok, "clear() counts the nodes it releases");
+
+    CountedAVL cleared;
+    cleared.insert(std::make_pair(1, 1));
+    cleared.counters().reset();
+    check(cleared.counters().snapshot().allocations == 0, "reset()");
+}
+
+void testTraceRecorder()
+{
+    cout << "\nTrace recorder:" << endl;
+    const char* path = "bst-test.trace";
+    {
+        TracedTree<int, int> tree(path);
+        tree.insert(std::make_pair(20, 2));
+        tree.insert(std::make_pair(10, 1));
+        bool added = tree.insert(std::make_pair(30, 3)).second;
+        bool found = tree.find(10) != tree.end();
+        int sum = 0;
+        for(TracedTree<int, int>::iterator it = tree.lower_bound(15); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+        tree.remove(20);
+        check(added && found && sum == 5 && tree.size() == 2 && tree.tree().size() == 2, "TracedTree passes operations on");
+        tree.clear();
+    }
+
+    std::vector<TraceRecord<int, int> > records;
+    TraceReader<int, int> reader(path);
+    TraceRecord<int, int> record;
+    while(reader.next(record)) {
+        records.push_back(record);
+    }
+    TraceOp expected[] = { TRACE_INSERT, TRACE_INSERT, TRACE_INSERT, TRACE_FIND, TRACE_SEEK,
+                           TRACE_STEPS, TRACE_REMOVE, TRACE_CLEAR };
+    bool ok = records.size() == 8 && reader.header().keySize == sizeof(int);
+    for(size_t i = 0; ok && i < records.size(); ++i) {
+        ok = records[i].op == expected[i] && (i == 0 || records[i].atNanos >= records[i - 1].atNanos);
+    }
+    ok = ok && records[1].key == 10 && records[1].value == 1 && records[4].key == 15;
+    check(ok && records[5].steps == 2 && records[6].key == 20, "records read back in order");
+
+    bool threw = false;
+    try {
+        TraceReader<long long, int> wrongKeys(path);
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "a trace is only read with the key and value sizes it was written with");
+    std::remove(path);
+
+    // Every write to /dev/full fails as if the disk were full.
+    std::FILE* full = std::fopen("/dev/full", "wb");
+    if(full != NULL) {
+        std::fclose(full);
+        TracedTree<int, int> lost("/dev/full");
+        ok = lost.insert(std::make_pair(1, 1)).second && !lost.insert(std::make_pair(1, 2)).second;
+        threw = false;
+        try {
+            lost.flush();
+        } catch(const std::runtime_error&) {
+            threw = true;
+        }
+        check(ok && threw && lost.find(1)->second == 2, "insert() results pass through and write errors throw");
+    }
+}
+
+void testSnapshotFile()
+{
+    cout << "\nSnapshot files:" << endl;
+    const char* path = "bst-test.snapshot";
+    AVLTree<int, int> tree;
+    for(int i = -500; i < 500; ++i) {
+        tree.insert(std::make_pair(i * 7, i));
+    }
+    writeSnapshot(tree, path);
+
+    MappedTree<int, int> mapped(path);
+    bool ok = mapped.size() == tree.size();
+    AVLTree<int, int>::iterator expected = tree.begin();
+    for(MappedTree<int, int>::const_iterator it = mapped.begin(); ok && it != mapped.end(); ++it, ++expected) {
+        ok = it->first == expected->first && it->second == expected->second;
+    }
+    check(ok && expected == tree.end(), "iteration matches the saved tree");
+    ok = mapped.find(-3500) != mapped.end() && mapped.find(-3500)->second == -500 &&
+         mapped.find(3493)->second == 499 && mapped.find(5) == mapped.end() &&
+         mapped.find(-3501) == mapped.end() && mapped.find(3494) == mapped.end();
+    check(ok, "find()");
+    ok = mapped.lower_bound(-10000)->first == -3500 && mapped.lower_bound(1)->first == 7 &&
+         mapped.lower_bound(224)->first == 224 && mapped.lower_bound(225)->first == 231 &&
+         mapped.lower_bound(3494) == mapped.end();
+    check(ok, "lower_bound() across delta blocks");
+
+    AVLTree<int, int> rebuilt;
+    rebuilt.insert(std::make_pair(1, 1));
+    mapped.materialize(rebuilt);
+    ok = rebuilt.size() == tree.size() && rebuilt.isBalanced();
+    for(AVLTree<int, int>::iterator a = tree.begin(), b = rebuilt.begin(); ok && a != tree.end(); ++a, ++b) {
+        ok = a->first == b->first && a->second == b->second;
+    }
+    check(ok, "materialize() rebuilds the tree");
+
+    bool threw = false;
+    try {
+        MappedTree<long long, int> wrongKeys(path);
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "a snapshot is only loaded with the types it was saved with");
+
+    // Flips one byte of the last value.
+    mapped.unload();
+    std::FILE* file = std::fopen(path, "r+b");
+    std::fseek(file, -1, SEEK_END);
+    int last = std::fgetc(file);
+    std::fseek(file, -1, SEEK_END);
+    std::fputc(last ^ 1, file);
+    std::fclose(file);
+    threw = false;
+    try {
+        mapped.load(path);
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw && mapped.empty(), "a damaged snapshot fails its checksum");
+    mapped.load(path, SKIP_CHECKSUM);
+    check(mapped.size() == tree.size(), "SKIP_CHECKSUM loads without reading the values");
+
+    BinarySearchTree<double, char> reals;
+    reals.insert(std::make_pair(2.5, 'b'));
+    reals.insert(std::make_pair(-1.0, 'a'));
+    reals.insert(std::make_pair(10.0, 'c'));
+    writeSnapshot(reals, path);
+    MappedTree<double, char> mappedReals(path);
+    ok = mappedReals.size() == 3 && mappedReals.begin()->second == 'a' &&
+         mappedReals.find(2.5)->second == 'b' && mappedReals.lower_bound(3.0)->second == 'c';
+    check(ok, "keys that are not integers are stored raw");
+
+    AVLTree<int, int> none;
+    writeSnapshot(none, path);
+    mapped.load(path);
+    check(mapped.empty() && mapped.begin() == mapped.end() && mapped.find(0) == mapped.end(),
+          "an empty tree round trips");
+
+    // Pieces that stop short of filling a word must not drop its bytes.
+    unsigned char bytes[100];
+    for(int i = 0; i < 100; ++i) {
+        bytes[i] = (unsigned char)(i * 37 + 11);
+    }
+    SnapshotChecksum whole, pieces;
+    whole.update(bytes, 100);
+    const size_t cuts[] = { 3, 2, 0, 1, 13, 5, 0, 7, 30, 1, 38 };
+    size_t at = 0;
+    for(size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); ++i) {
+        pieces.update(bytes + at, cuts[i]);
+        at += cuts[i];
+    }
+    check(at == 100 && whole.value() == pieces.value(), "a checksum fed in uneven pieces matches one fed at once");
+
+    AVLTree<int, char> chars;
+    for(int i = 0; i < 1048545; ++i) {
+        chars.insert(std::make_pair(i, (char)i));
+    }
+    writeSnapshot(chars, path);
+    threw = false;
+    try {
+        MappedTree<int, char> mappedChars(path);
+        ok = mappedChars.size() == chars.size();
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    check(!threw && ok, "a snapshot whose last flush is short still passes its checksum");
+    std::remove(path);
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,5 +1286,37 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
-    return 0;
+    testNoCopies<BinarySearchTree<string, CopyCounter> >("BinarySearchTree");
+    testNoCopies<AVLTree<string, CopyCounter> >("AVLTree");
+    testBuildFromSorted();
+    testChainTeardown();
+    testNodePool();
+    testIterators<BinarySearchTree<int, int> >("BinarySearchTree");
+    testIterators<AVLTree<int, int> >("AVLTree");
+    testIterators<CompactAVLTree<int, int> >("CompactAVLTree");
+    testOrderStatistics();
+    testRangeQueries<BinarySearchTree<int, int> >("BinarySearchTree");
+    testRangeQueries<AVLTree<int, int> >("AVLTree");
+    testRangeQueries<RankedAVLTree<int, int> >("RankedAVLTree");
+    testSplitJoin<AVLTree<int, string> >("AVLTree");
+    testSplitJoin<RankedAVLTree<int, string> >("RankedAVLTree");
+    testSplitJoin<CompactAVLTree<int, string> >("CompactAVLTree");
+    testSlidingWindow();
+    testSetOperations();
+    testFreeze();
+    testBTree();
+    testFindBatch<BinarySearchTree<int, int> >("BinarySearchTree");
+    testFindBatch<AVLTree<int, int> >("AVLTree");
+    testPersistentTree();
+    testConcurrentTree();
+    testShardedTree();
+    testComparators();
+    testIntrusiveTree();
+    testCompactNodes();
+    testTreeStats();
+    testTreeCounters();
+    testTraceRecorder();
+    testSnapshotFile();
+
+    return failures == 0 ? 0 : 1;
 }
@@ -5,20 +5,31 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <tuple>
+#include <iterator>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <functional>
+#include <vector>
+#include "node_pool.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * A templated base class for a Node in a search tree.
+ * NodeType is the most derived node class (CRTP), so the
+ * getters for parent/left/right return the concrete node
+ * type directly. This lets future kinds of search trees,
+ * such as Red Black trees, Splay trees, and AVL trees,
+ * add their own data members without virtual dispatch or
+ * a vtable pointer in every node.
  */
-template <typename Key, typename Value>
-class Node
+template <typename Key, typename Value, typename NodeType>
+class NodeBase
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    NodeBase(const Key& key, const Value& value, NodeType* parent);
+    template<typename... Args>
+    NodeBase(NodeType* parent, Args&&... args);
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,33 +37,46 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    NodeType* getParent() const;
+    NodeType* getLeft() const;
+    NodeType* getRight() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(NodeType* parent);
+    void setLeft(NodeType* left);
+    void setRight(NodeType* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    NodeType* parent_;
+    NodeType* left_;
+    NodeType* right_;
+};
+
+/**
+ * The node used by a plain BinarySearchTree.
+ */
+template <typename Key, typename Value>
+class Node : public NodeBase<Key, Value, Node<Key, Value> >
+{
+public:
+    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    template<typename... Args>
+    Node(Node<Key, Value>* parent, Args&&... args);
 };
 
 /*
-  -----------------------------------------
-  Begin implementations for the Node class.
-  -----------------------------------------
+  ---------------------------------------------
+  Begin implementations for the NodeBase class.
+  ---------------------------------------------
 */
 
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename NodeType>
+NodeBase<Key, Value, NodeType>::NodeBase(const Key& key, const Value& value, NodeType* parent) :
     item_(key, value),
     parent_(parent),
     left_(NULL),
@@ -62,12 +86,16 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
-* are only used as references to existing nodes. The nodes pointed to by parent/left/right
-* are freed by the BinarySearchTree.
+* Constructor that builds the item in place from args, which are
+* forwarded to the constructor of std::pair<const Key, Value>.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename NodeType>
+template<typename... Args>
+NodeBase<Key, Value, NodeType>::NodeBase(NodeType* parent, Args&&... args) :
+    item_(std::forward<Args>(args)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
 {
 
 }
@@ -75,8 +103,8 @@ Node<Key, Value>::~Node()
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename NodeType>
+const std::pair<const Key, Value>& NodeBase<Key, Value, NodeType>::getItem() const
 {
     return item_;
 }
@@ -84,8 +112,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename NodeType>
+std::pair<const Key, Value>& NodeBase<Key, Value, NodeType>::getItem()
 {
     return item_;
 }
@@ -93,8 +121,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename NodeType>
+const Key& NodeBase<Key, Value, NodeType>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +130,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename NodeType>
+const Value& NodeBase<Key, Value, NodeType>::getValue() const
 {
     return item_.second;
 }
@@ -111,35 +139,36 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename NodeType>
+Value& NodeBase<Key, Value, NodeType>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent. No cast is needed since the pointer
+* is already stored as the most derived node type.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename NodeType>
+NodeType* NodeBase<Key, Value, NodeType>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename NodeType>
+NodeType* NodeBase<Key, Value, NodeType>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename NodeType>
+NodeType* NodeBase<Key, Value, NodeType>::getRight() const
 {
     return right_;
 }
@@ -147,8 +176,8 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename NodeType>
+void NodeBase<Key, Value, NodeType>::setParent(NodeType* parent)
 {
     parent_ = parent;
 }
@@ -156,8 +185,8 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename NodeType>
+void NodeBase<Key, Value, NodeType>::setLeft(NodeType* left)
 {
     left_ = left;
 }
@@ -165,8 +194,8 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename NodeType>
+void NodeBase<Key, Value, NodeType>::setRight(NodeType* right)
 {
     right_ = right;
 }
@@ -174,284 +203,1200 @@ void Node<Key, Value>::setRight(Node<Key, Value>* right)
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename NodeType>
+void NodeBase<Key, Value, NodeType>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
-/*
-  ---------------------------------------
-  End implementations for the Node class.
-  ---------------------------------------
+/**
+* A setter for the value of a node that moves from its argument.
 */
+template<typename Key, typename Value, typename NodeType>
+void NodeBase<Key, Value, NodeType>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
 
 /**
-* A templated unbalanced binary search tree.
+* Explicit constructor for a plain node.
 */
-template <typename Key, typename Value>
-class BinarySearchTree
+template<typename Key, typename Value>
+Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+    NodeBase<Key, Value, Node<Key, Value> >(key, value, parent)
 {
-public:
-    BinarySearchTree(); //TODO
-    virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
-    bool isBalanced() const; //TODO
-    void print() const;
-    bool empty() const;
-
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
-public:
-    /**
-    * An internal iterator class for traversing the contents of the BST.
-    */
-    class iterator  // TODO
-    {
-    public:
-        iterator();
-
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
-
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
-        iterator& operator++();
-
-    protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
-    };
-
-public:
-    iterator begin() const;
-    iterator end() const;
-    iterator find(const Key& key) const;
-    Value& operator[](const Key& key);
-    Value const & operator[](const Key& key) const;
 
-protected:
-    // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
-    // Note:  static means these functions don't have a "this" pointer
-    //        and instead just use the input argument.
+}
 
-    // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+/**
+* Constructor for a plain node that builds the item in place.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... args) :
+    NodeBase<Key, Value, Node<Key, Value> >(parent, std::forward<Args>(args)...)
+{
 
-    // Add helper functions here
-		static void successor(Node <Key, Value>*& current);
-		int calculateHeightIfBalanced(Node<Key, Value>* root_node) const;
-		void clearHelper(Node<Key, Value>* curr);
-protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
-};
+}
 
 /*
---------------------------------------------------------------
-Begin implementations for the BinarySearchTree::iterator class.
----------------------------------------------------------------
+  -------------------------------------------
+  End implementations for the NodeBase class.
+  -------------------------------------------
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Steps that only follow and rewire the parent/left/right links of a
+* node, whatever else the node holds. BinarySearchTree uses them on
+* the nodes it allocates, and IntrusiveAVLTree on hooks embedded in
+* the caller's objects.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) :
-	current_(ptr)
+template<typename NodeType>
+struct NodeLinks
 {
-    // TODO
-}
+    static NodeType* first(NodeType* root);
+    static NodeType* last(NodeType* root);
+    static NodeType* next(NodeType* node);
+    static NodeType* prev(NodeType* node);
+    static void swap(NodeType*& root, NodeType* n1, NodeType* n2);
+};
 
 /**
-* A default constructor that initializes the iterator to NULL.
+* Returns the leftmost node below root, or NULL if root is NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() :
-	current_(NULL)
+template<typename NodeType>
+NodeType* NodeLinks<NodeType>::first(NodeType* root)
 {
-    // TODO
+		NodeType* smallest = root;
+
+		//If the bst is empty, return NULL.
+		if(smallest == NULL){
+			return NULL;
+		}
+
+		//Find the leftmost value in the bst and return it.
+		while(smallest->getLeft() != NULL){
+			smallest = smallest->getLeft();
+		}
+		return smallest;
 }
 
 /**
-* Provides access to the item.
+* Returns the rightmost node below root, or NULL if root is NULL.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<typename NodeType>
+NodeType* NodeLinks<NodeType>::last(NodeType* root)
 {
-    return current_->getItem();
+		NodeType* largest = root;
+
+		//If the bst is empty, return NULL.
+		if(largest == NULL){
+			return NULL;
+		}
+
+		//Find the rightmost value in the bst and return it.
+		while(largest->getRight() != NULL){
+			largest = largest->getRight();
+		}
+		return largest;
 }
 
 /**
-* Provides access to the address of the item.
+* Returns the node that follows node in key order, or NULL.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<typename NodeType>
+NodeType* NodeLinks<NodeType>::next(NodeType* node)
 {
-    return &(current_->getItem());
+		NodeType* temp = node;
+
+		//If there is a right subtree, find the leftmost node
+		//on that subtree and return it.
+		if(temp->getRight() != NULL){
+			temp = temp->getRight();
+			while(temp->getLeft() != NULL){
+				temp = temp->getLeft();
+			}
+			return temp;
+		}
+
+		NodeType* parent = temp->getParent();
+
+		/* If there is not a right subtree, go up until one of the following
+		* is true:
+		* 
+		* The parent of the node being observed is NULL (hence it
+		* cannot be the successor)
+		*
+		* OR
+		*
+		* The node is to the left of its parent, in which case that
+		* parent is the successor.
+		*/
+		while(!(parent == NULL || parent->getLeft() == temp)){
+			temp = temp->getParent();
+			parent = parent->getParent();
+		}
+		return parent;
 }
 
 /**
-* Checks if 'this' iterator's internals have the same value
-* as 'rhs'
+* Returns the node that comes before node in key order, or NULL.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename NodeType>
+NodeType* NodeLinks<NodeType>::prev(NodeType* node)
 {
-    // TODO
-		Node<Key, Value>* thisNode = this->current_;
-		Node<Key, Value>* rhsNode = rhs.current_;
-
-		//if both are NULL return true. If only one is NULL, return
-		//false before it reaches the next few lines and causes
-		//an error.
-		if(thisNode == NULL || rhsNode == NULL){
-			if(thisNode == NULL && rhsNode == NULL){
-				return true;
+		//If there is a left subtree, find the rightmost node
+		//on that subtree and return it.
+		if(node->getLeft() != NULL){
+			node = node->getLeft();
+			while(node->getRight() != NULL){
+				node = node->getRight();
 			}
-			return false;
+			return node;
 		}
-		
-		if(thisNode->getKey() == rhsNode->getKey() && thisNode->getValue() == rhsNode->getValue()){
-			return true;
+
+		NodeType* parent = node->getParent();
+
+		/* If there is not a left subtree, go up until one of the following
+		* is true:
+		* 
+		* The parent of the node being observed is NULL (hence it
+		* cannot be the predecessor)
+		*
+		* OR
+		*
+		* The node is to the right of its parent, in which case that
+		* parent is the predecessor.
+		*/
+		while(!(parent == NULL || parent->getRight() == node)){
+			node = node->getParent();
+			parent = parent->getParent();
 		}
-		return false;
+		return parent;
 }
 
 /**
-* Checks if 'this' iterator's internals have a different value
-* as 'rhs'
+* Swaps the positions of n1 and n2 in the tree rooted at root, which is
+* updated if either of them is the root. The nodes themselves stay
+* where they are in memory.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<typename NodeType>
+void NodeLinks<NodeType>::swap(NodeType*& root, NodeType* n1, NodeType* n2)
 {
-    // TODO
-		return !(*this == rhs);
-}
+    if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
+        return;
+    }
+    NodeType* n1p = n1->getParent();
+    NodeType* n1r = n1->getRight();
+    NodeType* n1lt = n1->getLeft();
+    bool n1isLeft = false;
+    if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
+    NodeType* n2p = n2->getParent();
+    NodeType* n2r = n2->getRight();
+    NodeType* n2lt = n2->getLeft();
+    bool n2isLeft = false;
+    if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-/**
-* Advances the iterator's location using an in-order sequencing
-*/
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
-{
-    // TODO
-		successor(current_);
-		return *this;
-}
+    NodeType* temp;
+    temp = n1->getParent();
+    n1->setParent(n2->getParent());
+    n2->setParent(temp);
 
+    temp = n1->getLeft();
+    n1->setLeft(n2->getLeft());
+    n2->setLeft(temp);
 
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
-*/
+    temp = n1->getRight();
+    n1->setRight(n2->getRight());
+    n2->setRight(temp);
+
+    if( (n1r != NULL && n1r == n2) ) {
+        n2->setRight(n1);
+        n1->setParent(n2);
+    }
+    else if( n2r != NULL && n2r == n1) {
+        n1->setRight(n2);
+        n2->setParent(n1);
+
+    }
+    else if( n1lt != NULL && n1lt == n2) {
+        n2->setLeft(n1);
+        n1->setParent(n2);
+
+    }
+    else if( n2lt != NULL && n2lt == n1) {
+        n1->setLeft(n2);
+        n2->setParent(n1);
+
+    }
+
+
+    if(n1p != NULL && n1p != n2) {
+        if(n1isLeft) n1p->setLeft(n2);
+        else n1p->setRight(n2);
+    }
+    if(n1r != NULL && n1r != n2) {
+        n1r->setParent(n2);
+    }
+    if(n1lt != NULL && n1lt != n2) {
+        n1lt->setParent(n2);
+    }
+
+    if(n2p != NULL && n2p != n1) {
+        if(n2isLeft) n2p->setLeft(n1);
+        else n2p->setRight(n1);
+    }
+    if(n2r != NULL && n2r != n1) {
+        n2r->setParent(n1);
+    }
+    if(n2lt != NULL && n2lt != n1) {
+        n2lt->setParent(n1);
+    }
 
-/*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
-*/
+
+    if(root == n1) {
+        root = n2;
+    }
+    else if(root == n2) {
+        root = n1;
+    }
+}
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* The shape of a tree, as returned by stats(). Depths count edges from
+* the root, so the root is at depth 0 and depthHistogram, which holds the
+* number of nodes at each depth, has height entries. A node is off
+* balance if its two subtrees differ in height at all; in an AVL tree
+* that is at most one level, in a BinarySearchTree it can be any number.
+* bytes is what the tree holds on to, the unused slots of its node pool
+* included.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() :
-	root_(NULL)
+struct TreeStats
 {
-    // TODO
-}
+    TreeStats();
+
+    size_t nodes;
+    size_t leaves;
+    size_t height;
+    size_t maxLeafDepth;
+    size_t leafDepthSum;
+    size_t offBalanceNodes;
+    size_t bytes;
+    std::vector<size_t> depthHistogram;
+
+    double averageLeafDepth() const;
+    double offBalanceFraction() const;
+    void merge(const TreeStats& other);
+};
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+inline TreeStats::TreeStats() :
+    nodes(0), leaves(0), height(0), maxLeafDepth(0), leafDepthSum(0), offBalanceNodes(0), bytes(0)
 {
-    // TODO
-		clear();
+
 }
 
-/**
- * Returns true if tree is empty
-*/
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+inline double TreeStats::averageLeafDepth() const
 {
-    return root_ == NULL;
+    return leaves == 0 ? 0.0 : static_cast<double>(leafDepthSum) / leaves;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+inline double TreeStats::offBalanceFraction() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+    return nodes == 0 ? 0.0 : static_cast<double>(offBalanceNodes) / nodes;
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Adds the counts of other, as if its tree hung at the same depth as
+* this one. Used to sum up the parts of a partitioned container.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+inline void TreeStats::merge(const TreeStats& other)
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    nodes += other.nodes;
+    leaves += other.leaves;
+    height = height > other.height ? height : other.height;
+    maxLeafDepth = maxLeafDepth > other.maxLeafDepth ? maxLeafDepth : other.maxLeafDepth;
+    leafDepthSum += other.leafDepthSum;
+    offBalanceNodes += other.offBalanceNodes;
+    bytes += other.bytes;
+    if(depthHistogram.size() < other.depthHistogram.size()) {
+        depthHistogram.resize(other.depthHistogram.size(), 0);
+    }
+    for(size_t i = 0; i < other.depthHistogram.size(); ++i) {
+        depthHistogram[i] += other.depthHistogram[i];
+    }
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* A comparator that compares with operator< like std::less<Key>, but
+* takes any two types. It declares is_transparent, which lets the
+* lookups of a tree that uses it accept anything that compares with
+* Key, such as a const char* for std::string keys, without building a
+* Key first. This is what std::less<> does from C++14 on.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+struct TransparentLess
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return a < b;
+    }
+};
+
+/**
+* The operations whose latency TreeCounters can sample.
+*/
+enum TreeOperation { TREE_FIND, TREE_INSERT, TREE_REMOVE, TREE_OPERATION_COUNT };
+
+/**
+* The Counters policy trees get by default. Every hook is empty and
+* inline, so an uninstrumented tree compiles to the same code it did
+* before trees took a Counters parameter.
+*
+* A policy has to provide the hooks below and a nested Timer class that
+* is constructed with (policy&, TreeOperation) at the start of a find,
+* insert or remove and destroyed at its end.
+*/
+struct NoTreeCounters
+{
+    class Timer
+    {
+    public:
+        Timer(NoTreeCounters&, TreeOperation) { }
+    };
+
+    void comparisons(size_t) { }
+    void rotation(bool) { }
+    void nodeSwap() { }
+    void removeFixLevel() { }
+    void removeFixDone() { }
+    void allocation() { }
+    void deallocation() { }
+    void deallocations(size_t) { }
+};
+
+/**
+* A templated unbalanced binary search tree.
+* NodeType is the kind of node stored in the tree; derived trees
+* such as AVLTree pass their own node class so that every pointer
+* the tree follows already has the right type.
+* Compare orders the keys. If it has an is_transparent member type
+* (see TransparentLess), find(), lower_bound(), upper_bound(),
+* equal_range(), remove() and operator[] also take any key type that
+* Compare can compare with Key.
+* Counters is told about comparisons, node swaps and allocations, and
+* times finds, inserts and removes (see TreeCounters in
+* tree_counters.h). The default, NoTreeCounters, does nothing and
+* costs nothing.
+*/
+template <typename Key, typename Value, typename NodeType = Node<Key, Value>,
+          typename Compare = std::less<Key>, typename Counters = NoTreeCounters>
+class BinarySearchTree
+{
+public:
+    template<bool IsConst> class basic_iterator;
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    explicit BinarySearchTree(const Compare& comp = Compare()); //TODO
+    virtual ~BinarySearchTree(); //TODO
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    std::pair<iterator, bool> insert(P&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    virtual void remove(const Key& key); //TODO
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const K& key);
+    virtual size_t erase(const Key& lo, const Key& hi);
+    void clear(); //TODO
+    bool isBalanced() const; //TODO
+    TreeStats stats() const;
+    void print() const;
+    bool empty() const;
+    size_t size() const;
+    Compare key_comp() const;
+    Counters& counters();
+    const Counters& counters() const;
+
+    template<typename PPKey, typename PPValue, typename PPNode, typename PPCompare, typename PPCounters>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPNode, PPCompare, PPCounters> & tree);
+public:
+    /**
+    * An internal iterator class for traversing the contents of the BST.
+    * It is a bidirectional iterator: iterator hands out mutable items
+    * and const_iterator read-only ones. Two iterators are equal if they
+    * refer to the same node. The tree pointer lets end() step back to
+    * the largest item.
+    */
+    template<bool IsConst>
+    class basic_iterator  // TODO
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst,
+            const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst,
+            const value_type&, value_type&>::type reference;
+
+        basic_iterator();
+        template<bool WasConst, typename = typename std::enable_if<IsConst && !WasConst>::type>
+        basic_iterator(const basic_iterator<WasConst>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool RhsConst>
+        bool operator==(const basic_iterator<RhsConst>& rhs) const;
+        template<bool RhsConst>
+        bool operator!=(const basic_iterator<RhsConst>& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, NodeType, Compare, Counters>;
+        template<bool> friend class basic_iterator;
+        basic_iterator(NodeType* ptr, const BinarySearchTree<Key, Value, NodeType, Compare, Counters>* tree);
+        NodeType *current_;
+        const BinarySearchTree<Key, Value, NodeType, Compare, Counters>* tree_;
+    };
+
+public:
+    iterator begin();
+    const_iterator begin() const;
+    const_iterator cbegin() const;
+    iterator end();
+    const_iterator end() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    const_reverse_iterator rbegin() const;
+    reverse_iterator rend();
+    const_reverse_iterator rend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+    void findBatch(const Key* keys, size_t n, iterator* out);
+    void findBatch(const Key* keys, size_t n, const_iterator* out) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key);
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const;
+    iterator floor(const Key& key);
+    const_iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key);
+    const_iterator ceiling(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value& operator[](const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value const & operator[](const K& key) const;
+
+protected:
+    // Number of lookups findBatch() keeps in flight at once.
+    static const size_t BATCH_LANES = 16;
+
+    // Mandatory helper functions
+    template<typename K>
+    NodeType* internalFind(const K& k) const; // TODO
+    NodeType *getSmallestNode() const;  // TODO
+    NodeType *getLargestNode() const;
+    iterator makeIterator(NodeType* node);
+    const_iterator makeIterator(NodeType* node) const;
+    static NodeType* predecessor(NodeType* current); // TODO
+    template<typename K>
+    NodeType* findSlot(const K& key, NodeType*& parent, bool& isLeft) const;
+    void attachNode(NodeType* node, NodeType* parent, bool isLeft);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignUnique(K&& key, M&& obj);
+    static const Key& asKey(const Key& key);
+    static Key&& asKey(Key&& key);
+    template<typename K, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<K>::type, Key>::value>::type>
+    static Key asKey(K&& key);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplaceUnique(K&& key, Args&&... args);
+    virtual void rebalanceAfterInsert(NodeType* node);
+    virtual void removeNode(NodeType* node);
+    // Note:  static means these functions don't have a "this" pointer
+    //        and instead just use the input argument.
+
+    // Provided helper functions
+    virtual void printRoot (NodeType *r) const;
+    virtual void nodeSwap( NodeType* n1, NodeType* n2) ;
+
+    // Add helper functions here
+		static void successor(NodeType*& current);
+		int calculateHeightIfBalanced(NodeType* root_node) const;
+		size_t clearHelper(NodeType* curr);
+		void findNodes(const Key* keys, size_t n, NodeType** out) const;
+		template<typename K>
+		NodeType* boundNode(const K& key, bool strict) const;
+		NodeType* floorNode(const Key& key) const;
+		template<typename K>
+		NodeType* equalRangeEnd(NodeType* lower, const K& key) const;
+		NodeType* splitNodes(NodeType* tree, const Key& key, NodeType*& left, NodeType*& right) const;
+		static NodeType* concatNodes(NodeType* left, NodeType* right);
+		template<typename... Args>
+		NodeType* createNode(NodeType* parent, Args&&... args);
+		void destroyNode(NodeType* node);
+protected:
+    NodeType* root_;
+    // size_ is only meaningful while sizeKnown_ is set. Operations that
+    // move whole subtrees between trees may not know how many nodes
+    // they moved, and leave the count to the next call of size().
+    mutable size_t size_;
+    mutable bool sizeKnown_;
+    NodePool pool_;
+    Compare comp_;
+    // Lookups are const but still count, so the counters are mutable.
+    mutable Counters counters_;
+};
+
+/*
+--------------------------------------------------------------
+Begin implementations for the BinarySearchTree::iterator class.
+---------------------------------------------------------------
+*/
+
+/**
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the tree it belongs to.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::basic_iterator(NodeType *ptr,
+    const BinarySearchTree<Key, Value, NodeType, Compare, Counters>* tree) :
+	current_(ptr),
+	tree_(tree)
+{
+    // TODO
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::basic_iterator() :
+	current_(NULL),
+	tree_(NULL)
+{
+    // TODO
+}
+
+/**
+* Converts an iterator into a const_iterator.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+template<bool WasConst, typename>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::basic_iterator(
+    const basic_iterator<WasConst>& other) :
+	current_(other.current_),
+	tree_(other.tree_)
+{
+
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>::reference
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator*() const
+{
+    return current_->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>::pointer
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator->() const
+{
+    return &(current_->getItem());
+}
+
+/**
+* Checks if 'this' iterator refers to the same node as 'rhs'.
+* Only the node pointers are compared, so this is O(1) and does
+* not need Key or Value to be comparable.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+template<bool RhsConst>
+bool
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator==(
+    const basic_iterator<RhsConst>& rhs) const
+{
+    // TODO
+		return current_ == rhs.current_;
+}
+
+/**
+* Checks if 'this' iterator refers to a different node than 'rhs'.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+template<bool RhsConst>
+bool
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator!=(
+    const basic_iterator<RhsConst>& rhs) const
+{
+    // TODO
+		return current_ != rhs.current_;
+}
+
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>&
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator++()
+{
+    // TODO
+		successor(current_);
+		return *this;
+}
+
+/**
+* Post-increment: advances the iterator and returns its old position.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator++(int)
+{
+		basic_iterator old(*this);
+		successor(current_);
+		return old;
+}
+
+/**
+* Moves the iterator back to the previous item. Stepping back from
+* end() lands on the largest item in the tree.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>&
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator--()
+{
+		if(current_ == NULL){
+			current_ = tree_->getLargestNode();
+		} else {
+			current_ = predecessor(current_);
+		}
+		return *this;
+}
+
+/**
+* Post-decrement: moves the iterator back and returns its old position.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<bool IsConst>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::template basic_iterator<IsConst>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::basic_iterator<IsConst>::operator--(int)
+{
+		basic_iterator old(*this);
+		--(*this);
+		return old;
+}
+
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator class.
+-------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* comp orders the keys.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::BinarySearchTree(const Compare& comp) :
+	root_(NULL),
+	size_(0),
+	sizeKnown_(true),
+	pool_(sizeof(NodeType), alignof(NodeType)),
+	comp_(comp)
+{
+    // TODO
+}
+
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::~BinarySearchTree()
+{
+    // TODO
+		clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+bool BinarySearchTree<Key, Value, NodeType, Compare, Counters>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+ * Returns the number of items in the tree in constant time. The
+ * only exception is the first call after an operation that could
+ * not keep count (see sizeKnown_), which counts the items once.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+size_t BinarySearchTree<Key, Value, NodeType, Compare, Counters>::size() const
+{
+    if(!sizeKnown_) {
+        size_t count = 0;
+        for(NodeType* curr = getSmallestNode(); curr != NULL; successor(curr)) {
+            ++count;
+        }
+        size_ = count;
+        sizeKnown_ = true;
+    }
+    return size_;
+}
+
+/**
+ * Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+Compare BinarySearchTree<Key, Value, NodeType, Compare, Counters>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+ * Returns the tree's Counters policy, e.g. to take a snapshot() of
+ * what a TreeCounters has counted or to reset() it.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+Counters& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::counters()
+{
+    return counters_;
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+const Counters& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::counters() const
+{
+    return counters_;
+}
+
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::begin()
+{
+    BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator begin(getSmallestNode(), this);
+    return begin;
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::begin() const
+{
+    return const_iterator(getSmallestNode(), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::end()
+{
+    BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator end(NULL, this);
     return end;
 }
 
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::end() const
+{
+    return const_iterator(NULL, this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::reverse_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_reverse_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+/**
+* Returns a reverse iterator just before the "smallest" item
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::reverse_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_reverse_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::find(const Key & k)
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    typename Counters::Timer timer(counters_, TREE_FIND);
+    NodeType *curr = internalFind(k);
+    BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator it(curr, this);
     return it;
 }
 
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::find(const Key & k) const
+{
+    typename Counters::Timer timer(counters_, TREE_FIND);
+    return const_iterator(internalFind(k), this);
+}
+
+/**
+* Same as find(), for any key type a transparent Compare can compare
+* with Key. No Key is constructed.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::find(const K& k)
+{
+    typename Counters::Timer timer(counters_, TREE_FIND);
+    return iterator(internalFind(k), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::find(const K& k) const
+{
+    typename Counters::Timer timer(counters_, TREE_FIND);
+    return const_iterator(internalFind(k), this);
+}
+
+/**
+* Looks up n keys at once and stores an iterator for each in out, in
+* the same order as keys (end() for keys that are not in the tree).
+* Cheaper than calling find() n times when the tree does not fit in
+* cache, since the lookups wait for memory together (see findNodes()).
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::findBatch(const Key* keys, size_t n, iterator* out)
+{
+    NodeType* nodes[BATCH_LANES];
+    for(size_t base = 0; base < n; base += BATCH_LANES) {
+        size_t lanes = (n - base < BATCH_LANES) ? n - base : BATCH_LANES;
+        findNodes(keys + base, lanes, nodes);
+        for(size_t i = 0; i < lanes; ++i) {
+            out[base + i] = iterator(nodes[i], this);
+        }
+    }
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::findBatch(const Key* keys, size_t n, const_iterator* out) const
+{
+    NodeType* nodes[BATCH_LANES];
+    for(size_t base = 0; base < n; base += BATCH_LANES) {
+        size_t lanes = (n - base < BATCH_LANES) ? n - base : BATCH_LANES;
+        findNodes(keys + base, lanes, nodes);
+        for(size_t i = 0; i < lanes; ++i) {
+            out[base + i] = const_iterator(nodes[i], this);
+        }
+    }
+}
+
+/**
+* Returns an iterator to the first item whose key is not less
+* than key, or end() if there is none.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::lower_bound(const Key& key)
+{
+    return iterator(boundNode(key, false), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::lower_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, false), this);
+}
+
+/**
+* Same as lower_bound(), for any key type a transparent Compare can compare
+* with Key.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::lower_bound(const K& key)
+{
+    return iterator(boundNode(key, false), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::lower_bound(const K& key) const
+{
+    return const_iterator(boundNode(key, false), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater
+* than key, or end() if there is none.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::upper_bound(const Key& key)
+{
+    return iterator(boundNode(key, true), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::upper_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, true), this);
+}
+
+/**
+* Same as upper_bound(), for any key type a transparent Compare can compare
+* with Key.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::upper_bound(const K& key)
+{
+    return iterator(boundNode(key, true), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::upper_bound(const K& key) const
+{
+    return const_iterator(boundNode(key, true), this);
+}
+
+/**
+* Returns the range of items whose key is key, which holds at
+* most one item. Only one descent is made.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator,
+          typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::equal_range(const Key& key)
+{
+    NodeType* lower = boundNode(key, false);
+    return std::make_pair(iterator(lower, this), iterator(equalRangeEnd(lower, key), this));
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator,
+          typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::equal_range(const Key& key) const
+{
+    NodeType* lower = boundNode(key, false);
+    return std::make_pair(const_iterator(lower, this), const_iterator(equalRangeEnd(lower, key), this));
+}
+
+/**
+* Same as equal_range(), for any key type a transparent Compare can compare
+* with Key.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator,
+          typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::equal_range(const K& key)
+{
+    NodeType* lower = boundNode(key, false);
+    return std::make_pair(iterator(lower, this), iterator(equalRangeEnd(lower, key), this));
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator,
+          typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::equal_range(const K& key) const
+{
+    NodeType* lower = boundNode(key, false);
+    return std::make_pair(const_iterator(lower, this), const_iterator(equalRangeEnd(lower, key), this));
+}
+
+/**
+* Returns an iterator to the item with the largest key that is
+* not greater than key, or end() if there is none.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::floor(const Key& key)
+{
+    return iterator(floorNode(key), this);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::floor(const Key& key) const
+{
+    return const_iterator(floorNode(key), this);
+}
+
+/**
+* Returns an iterator to the item with the smallest key that is
+* not less than key, or end() if there is none. Same as lower_bound().
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::ceiling(const Key& key)
+{
+    return lower_bound(key);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
+
+/**
+ * Returns the value associated with the key. If the key is
+ * not in the map, a default constructed value is inserted
+ * for it first, using a single descent from the root.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+Value& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::operator[](const Key& key)
+{
+    return try_emplace(key).first->second;
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+Value const & BinarySearchTree<Key, Value, NodeType, Compare, Counters>::operator[](const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+ * Same as operator[], for any key type a transparent Compare can
+ * compare with Key. A Key is only built from key if it is not in
+ * the map yet, and it still takes a single descent.
+ */
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+Value& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::operator[](const K& key)
+{
+    return emplaceUnique(key).first->second;
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename C, typename>
+Value const & BinarySearchTree<Key, Value, NodeType, Compare, Counters>::operator[](const K& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
@@ -461,77 +1406,309 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
+* Returns an iterator to the item and true if a new node
+* was added, or false if an existing value was overwritten.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
     // TODO
-		Key key = keyValuePair.first;
-		Value value = keyValuePair.second;
+		return assignUnique(keyValuePair.first, keyValuePair.second);
+}
 
-		//If the bst is empty, create a root node
-		if(root_ == NULL){
-			Node<Key, Value>* newValue = new Node<Key, Value>(key, value, NULL);
-			root_ = newValue;
-			return;
+/**
+* Same as above, but the value is moved into the tree. The key
+* is const inside the pair, so it still has to be copied.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+		return assignUnique(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts any pair the item type can be built from, such as the
+* result of std::make_pair(). The key is looked up first, so a node
+* is only built when the key is new; otherwise the existing value
+* is assigned from the pair's second.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename P, typename>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::insert(P&& keyValuePair)
+{
+		return assignUnique(asKey(std::forward<P>(keyValuePair).first),
+				std::forward<P>(keyValuePair).second);
+}
+
+/**
+* Builds the item in place inside a new node from args, then links
+* the node in with a single descent. If the key is already in the
+* tree, the existing value is move-assigned from the new item and
+* the new node is thrown away, matching insert().
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::emplace(Args&&... args)
+{
+		typename Counters::Timer timer(counters_, TREE_INSERT);
+		NodeType* node = createNode(NULL, std::forward<Args>(args)...);
+		NodeType* parent = NULL;
+		bool isLeft = false;
+
+		NodeType* curr = findSlot(node->getKey(), parent, isLeft);
+		if(curr != NULL){
+			try {
+				curr->setValue(std::move(node->getValue()));
+			} catch(...) {
+				destroyNode(node);
+				throw;
+			}
+			destroyNode(node);
+			return std::make_pair(iterator(curr, this), false);
 		}
 
+		node->setParent(parent);
+		attachNode(node, parent, isLeft);
+		return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Inserts the key with the given value, or overwrites the value
+* if the key is already in the tree. Only one descent is made.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::insert_or_assign(const Key& key, M&& obj)
+{
+		return assignUnique(key, std::forward<M>(obj));
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::insert_or_assign(Key&& key, M&& obj)
+{
+		return assignUnique(std::move(key), std::forward<M>(obj));
+}
+
+/**
+* Inserts the key with a value built from args only if the key
+* is not in the tree yet. An existing value is left untouched and
+* args are not used at all in that case.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::try_emplace(const Key& key, Args&&... args)
+{
+		return emplaceUnique(key, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::try_emplace(Key&& key, Args&&... args)
+{
+		return emplaceUnique(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Helper behind insert() and insert_or_assign(). Overwrites the
+* value of an existing key, otherwise adds a node built directly
+* from key and obj.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::assignUnique(K&& key, M&& obj)
+{
+		typename Counters::Timer timer(counters_, TREE_INSERT);
+		NodeType* parent = NULL;
+		bool isLeft = false;
+
 		//If the key is already in the BST, change it
-		Node<Key, Value>* curr = internalFind(key);
+		NodeType* curr = findSlot(key, parent, isLeft);
 		if(curr != NULL){
-			curr->setValue(value);
-			return;
+			curr->getValue() = std::forward<M>(obj);
+			return std::make_pair(iterator(curr, this), false);
 		}
 
-		//Otherwise, start at the root and traverse until you get 
-		//to the right spot (a leaf node). Then, insert.
-		curr = root_;
-		Node<Key, Value>* next = NULL;
+		//Otherwise the descent stopped at the right spot, so hang
+		//the new node there.
+		curr = createNode(parent, std::piecewise_construct,
+				std::forward_as_tuple(std::forward<K>(key)),
+				std::forward_as_tuple(std::forward<M>(obj)));
+		attachNode(curr, parent, isLeft);
+		return std::make_pair(iterator(curr, this), true);
+}
+
+/**
+* Helpers for insert(P&&). A key that already is a Key is passed
+* through, so it is only copied if a node is built; any other type
+* is turned into a Key once, up front, rather than on every
+* comparison of the descent.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+const Key& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::asKey(const Key& key)
+{
+		return key;
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+Key&& BinarySearchTree<Key, Value, NodeType, Compare, Counters>::asKey(Key&& key)
+{
+		return std::move(key);
+}
+
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename>
+Key BinarySearchTree<Key, Value, NodeType, Compare, Counters>::asKey(K&& key)
+{
+		return Key(std::forward<K>(key));
+}
+
+/**
+* Helper behind try_emplace() and operator[]. Adds a node whose
+* value is built from args only if key is missing. key may be of
+* any type findSlot() takes; the node's Key is built from it.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator, bool>
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::emplaceUnique(K&& key, Args&&... args)
+{
+		typename Counters::Timer timer(counters_, TREE_INSERT);
+		NodeType* parent = NULL;
+		bool isLeft = false;
+
+		NodeType* curr = findSlot(key, parent, isLeft);
+		if(curr != NULL){
+			return std::make_pair(iterator(curr, this), false);
+		}
+
+		curr = createNode(parent, std::piecewise_construct,
+				std::forward_as_tuple(std::forward<K>(key)),
+				std::forward_as_tuple(std::forward<Args>(args)...));
+		attachNode(curr, parent, isLeft);
+		return std::make_pair(iterator(curr, this), true);
+}
+
+/**
+* Helper for the insert family. Walks down from the root once and
+* returns the node holding key if there is one. Otherwise returns
+* NULL and sets parent and isLeft to where a node for key belongs
+* (parent is NULL if the tree is empty). key is a Key, or anything a
+* transparent Compare can compare with one.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::findSlot(const K& key, NodeType*& parent, bool& isLeft) const
+{
+		NodeType* curr = root_;
+		parent = NULL;
+		isLeft = false;
 		while(curr != NULL){
-			if(key < curr->getKey()){
-				next = curr->getLeft();
-				if(next == NULL){
-					Node<Key, Value>* newValue = new Node<Key, Value>(key, value, curr);
-					curr->setLeft(newValue);
-				}
+			if(comp_(key, curr->getKey())){
+				parent = curr;
+				isLeft = true;
+				curr = curr->getLeft();
+			} else if(comp_(curr->getKey(), key)){
+				parent = curr;
+				isLeft = false;
+				curr = curr->getRight();
 			} else {
-				next = curr->getRight();
-				if(next == NULL){
-					Node<Key, Value>* newValue = new Node<Key, Value>(key, value, curr);
-					curr->setRight(newValue);
-				}
+				return curr;
 			}
-			curr = next;
-		}	
+		}
+		return NULL;
+}
+
+/**
+* Links a freshly created node into the spot found by findSlot()
+* and then gives derived trees the chance to rebalance.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::attachNode(NodeType* node, NodeType* parent, bool isLeft)
+{
+		if(parent == NULL){
+			root_ = node;
+		} else if(isLeft){
+			parent->setLeft(node);
+		} else {
+			parent->setRight(node);
+		}
+		++size_;
+		rebalanceAfterInsert(node);
+}
+
+/**
+* Called after every new node is linked in. A plain BST does not
+* rebalance, so there is nothing to do.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::rebalanceAfterInsert(NodeType* node)
+{
+
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::remove(const Key& key)
+{
+    // TODO
+		typename Counters::Timer timer(counters_, TREE_REMOVE);
+
+		//If an item with the key is not in the bst, do nothing.
+		NodeType* removal_item = internalFind(key);
+		if(removal_item != NULL){
+			removeNode(removal_item);
+		}
+}
+
+/**
+* Same as remove(), for any key type a transparent Compare can compare
+* with Key.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+template<typename K, typename C, typename>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::remove(const K& key)
+{
+		typename Counters::Timer timer(counters_, TREE_REMOVE);
+		NodeType* removal_item = internalFind(key);
+		if(removal_item != NULL){
+			removeNode(removal_item);
+		}
 }
 
-
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
+* Unlinks removal_item, a node of this tree, and frees it. Derived
+* trees override this to rebalance.
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::removeNode(NodeType* removal_item)
 {
-    // TODO
-
-		//If an item with the key is not in the bst, do nothing.
-		Node<Key, Value>* removal_item = internalFind(key);
-		if(removal_item == NULL){
-			return;
-		}
+		--size_;
 
 		//store the pointers to other nodes.
-		Node<Key, Value>* left_child = removal_item->getLeft();
-		Node<Key, Value>* right_child = removal_item->getRight();
-		Node<Key, Value>* parent = removal_item->getParent();
+		NodeType* left_child = removal_item->getLeft();
+		NodeType* right_child = removal_item->getRight();
+		NodeType* parent = removal_item->getParent();
 
 		//Handle the case when there are two children. Swap with
 		//the predecessor and then update the temporary pointers 
 		//made.
 		if(left_child != NULL && right_child != NULL){
-			Node<Key, Value>* pred = predecessor(removal_item);
+			NodeType* pred = predecessor(removal_item);
 			if(pred == NULL){
 				return;
 			}
@@ -558,7 +1735,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			if(left_child->getRight() != NULL){
 				left_child->getRight()->setParent(left_child);
 			}
-			delete removal_item;
+			destroyNode(removal_item);
 		} else if (right_child != NULL){
 			nodeSwap(removal_item, right_child);
 			right_child->setLeft(removal_item->getLeft());
@@ -569,13 +1746,13 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			if(right_child->getRight() != NULL){
 				right_child->getRight()->setParent(right_child);
 			}
-			delete removal_item;
+			destroyNode(removal_item);
 		} else {
 
 			//If a leaf node has NULL as a parent, it is the root. 
 			//Update the tree such that it becomes empty.
 			if(parent == NULL){
-				delete removal_item;
+				destroyNode(removal_item);
 				root_ = NULL;
 				return;
 			}
@@ -588,46 +1765,57 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			} else {
 				parent->setRight(NULL);
 			}
-			delete removal_item;
+			destroyNode(removal_item);
 		}
 }
 
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+/**
+* Removes every item whose key k satisfies lo <= k <= hi and returns
+* how many were removed. The tree is split at lo and at hi, the part
+* in between is freed, and the two outer parts are joined back
+* together. That takes O(k + h) for k removed items in a tree of
+* height h, instead of one remove() per item.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+size_t BinarySearchTree<Key, Value, NodeType, Compare, Counters>::erase(const Key& lo, const Key& hi)
 {
-    // TODO
-
-		//If there is a left subtree, find the rightmost node
-		//on that subtree and return it.
-		if(current->getLeft() != NULL){
-			current = current->getLeft();
-			while(current->getRight() != NULL){
-				current = current->getRight();
-			}
-			return current;
+		if(comp_(hi, lo)){
+			return 0;
 		}
 
-		Node<Key, Value>* parent = current->getParent();
-
-		/* If there is not a left subtree, go up until one of the following
-		* is true:
-		* 
-		* The parent of the node being observed is NULL (hence it
-		* cannot be the predecessor)
-		*
-		* OR
-		*
-		* The node is to the right of its parent, in which case that
-		* parent is the predecessor.
-		*/
-		while(!(parent == NULL || parent->getRight() == current)){
-			current = current->getParent();
-			parent = parent->getParent();
+		NodeType* left = NULL;
+		NodeType* rest = NULL;
+		NodeType* middle = NULL;
+		NodeType* right = NULL;
+		NodeType* loNode = splitNodes(root_, lo, left, rest);
+		NodeType* hiNode = splitNodes(rest, hi, middle, right);
+
+		//Free the middle part and the nodes at both ends.
+		size_t removed = 0;
+		if(middle != NULL){
+			removed += clearHelper(middle);
 		}
-		return parent;
+		if(loNode != NULL){
+			destroyNode(loNode);
+			++removed;
+		}
+		if(hiNode != NULL && hiNode != loNode){
+			destroyNode(hiNode);
+			++removed;
+		}
+
+		root_ = concatNodes(left, right);
+		size_ -= removed;
+		return removed;
+}
 
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+NodeType*
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::predecessor(NodeType* current)
+{
+    // TODO
+		return NodeLinks<NodeType>::prev(current);
 }
 
 /*
@@ -635,44 +1823,11 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 * differently (updating the current node by reference) since the
 * iterator class uses it.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::successor(Node<Key, Value>*& current)
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::successor(NodeType*& current)
 {
     // TODO
-
-		Node<Key, Value>* temp = current;
-
-		//If there is a right subtree, find the leftmost node
-		//on that subtree and return it.
-		if(temp->getRight() != NULL){
-			temp = temp->getRight();
-			while(temp->getLeft() != NULL){
-				temp = temp->getLeft();
-			}
-			current = temp;
-			return;
-		}
-
-		Node<Key, Value>* parent = temp->getParent();
-
-		/* If there is not a right subtree, go up until one of the following
-		* is true:
-		* 
-		* The parent of the node being observed is NULL (hence it
-		* cannot be the successor)
-		*
-		* OR
-		*
-		* The node is to the left of its parent, in which case that
-		* parent is the successor.
-		*/
-		while(!(parent == NULL || parent->getLeft() == temp)){
-			temp = temp->getParent();
-			parent = parent->getParent();
-		}
-		current = parent;
-		return;
-
+		current = NodeLinks<NodeType>::next(current);
 }
 
 
@@ -680,8 +1835,8 @@ void BinarySearchTree<Key, Value>::successor(Node<Key, Value>*& current)
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::clear()
 {
     // TODO
 
@@ -690,58 +1845,347 @@ void BinarySearchTree<Key, Value>::clear()
 			return;
 		}
 		
-		//Otherwise, call the helper function on the root node
-		//and then set the root equal to NULL once complete.
-		clearHelper(root_);
+		//Otherwise, call the helper function on the root node so
+		//every item gets destroyed. If no item has a destructor and
+		//the pool frees everything at once, the walk can be skipped.
+		//A pool sharing its arenas with other trees (after split()
+		//and friends) has to get every slot back for them, though.
+		//Then drop the pool's chunks and set the root equal to NULL.
+		if(!(NodePool::releasesInBulk && pool_.holdsArenasAlone() &&
+				std::is_trivially_destructible<Key>::value &&
+				std::is_trivially_destructible<Value>::value)){
+			clearHelper(root_);
+		}
+		else if(!std::is_same<Counters, NoTreeCounters>::value){
+			//The nodes go without destroyNode(), so tell the counters
+			//about them here. Only counters need size(), which may
+			//have to count the nodes after a split().
+			counters_.deallocations(size());
+		}
+		pool_.release();
 		root_ = NULL;
+		size_ = 0;
+		sizeKnown_ = true;
 
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* curr){
+/*
+* Frees the subtree rooted at curr without recursion, so that even a
+* degenerate tree with millions of nodes cannot overflow the stack.
+* It walks down to a leaf, frees it, unhooks it from its parent and
+* continues from the parent. Every edge is crossed once going down and
+* once going up, so the whole walk is linear in the size of the subtree.
+* The links of the node above the subtree are left alone. Returns the
+* number of nodes freed.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+size_t BinarySearchTree<Key, Value, NodeType, Compare, Counters>::clearHelper(NodeType* curr){
+
+	size_t freed = 0;
+	NodeType* stop = curr->getParent();
+	while(curr != stop){
+
+		//Go down while there is a child left to free.
+		if(curr->getLeft() != NULL){
+			curr = curr->getLeft();
+		} else if(curr->getRight() != NULL){
+			curr = curr->getRight();
+		} else {
 
-	//If it is a leaf node, remove that Node pointer.
-	if(curr->getLeft() == NULL && curr->getRight() == NULL){
-		delete curr;
-		return;
+			//It is a leaf node now, so unhook it from its parent,
+			//delete that Node pointer and go back up.
+			NodeType* parent = curr->getParent();
+			if(parent != stop){
+				if(parent->getLeft() == curr){
+					parent->setLeft(NULL);
+				} else {
+					parent->setRight(NULL);
+				}
+			}
+			destroyNode(curr);
+			++freed;
+			curr = parent;
+		}
 	}
+	return freed;
+}
 
-	//If it has a left value, call clearHelper() on it.
-	if(curr->getLeft() != NULL){
-		clearHelper(curr->getLeft());
+/**
+* Builds a node in a slot taken from the pool, forwarding args to
+* the constructor of the item. The slot is handed back if the
+* constructor throws.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+template<typename... Args>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::createNode(NodeType* parent, Args&&... args)
+{
+	void* slot = pool_.allocate();
+	NodeType* node;
+	try {
+		node = new (slot) NodeType(parent, std::forward<Args>(args)...);
+	} catch(...) {
+		pool_.deallocate(slot);
+		throw;
 	}
+	counters_.allocation();
+	return node;
+}
 
-	//If it has a right value, call clearHelper() on it.
-	if(curr->getRight() != NULL){
-		clearHelper(curr->getRight());
-	}
+/**
+* Runs the node's destructor and returns its slot to the pool.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::destroyNode(NodeType* node)
+{
+	node->~NodeType();
+	pool_.deallocate(node);
+	counters_.deallocation();
+}
+
+/**
+* Helper for findBatch(). Walks down the tree for up to BATCH_LANES
+* keys in lockstep: each round moves every unfinished lookup one level
+* down and prefetches the child it moves to, so by the time the round
+* comes back to a lookup its next node is usually in cache. The cache
+* misses of the different lookups overlap instead of queuing up one
+* after another as they do in a loop of find().
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::findNodes(const Key* keys, size_t n, NodeType** out) const
+{
+		NodeType* curr[BATCH_LANES];
+		size_t active[BATCH_LANES];
+		size_t count = 0;
+		for(size_t i = 0; i < n; ++i){
+			out[i] = NULL;
+			if(root_ != NULL){
+				curr[i] = root_;
+				active[count++] = i;
+			}
+		}
 
-	//At each level, once its left and right subtrees are empty,
-	//you can delete that Node pointer.
-	delete curr;
+		//Lookups that found their key or fell off the tree drop out of
+		//active; the rest are compacted to the front for the next round.
+		while(count > 0){
+			size_t kept = 0;
+			for(size_t j = 0; j < count; ++j){
+				size_t i = active[j];
+				NodeType* node = curr[i];
+				NodeType* next;
+				if(comp_(keys[i], node->getKey())){
+					next = node->getLeft();
+				} else if(comp_(node->getKey(), keys[i])){
+					next = node->getRight();
+				} else {
+					out[i] = node;
+					continue;
+				}
+				if(next != NULL){
+					__builtin_prefetch(next);
+					curr[i] = next;
+					active[kept++] = i;
+				}
+			}
+			count = kept;
+		}
 }
 
 /**
-* A helper function to find the smallest node in the tree.
+* Helper for lower_bound() and upper_bound(). Returns the node with
+* the smallest key that is not less than key, or greater than key if
+* strict is set, or NULL if there is none.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::boundNode(const K& key, bool strict) const
 {
-    // TODO
+		NodeType* curr = root_;
+		NodeType* best = NULL;
+		while(curr != NULL){
+			bool goLeft = strict ? comp_(key, curr->getKey()) : !comp_(curr->getKey(), key);
+			if(goLeft){
+				best = curr;
+				curr = curr->getLeft();
+			} else {
+				curr = curr->getRight();
+			}
+		}
+		return best;
+}
 
-		Node<Key, Value>* smallest = root_;
+/**
+* Helper for floor(). Returns the node with the largest key that is
+* not greater than key, or NULL if there is none.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::floorNode(const Key& key) const
+{
+		NodeType* curr = root_;
+		NodeType* best = NULL;
+		while(curr != NULL){
+			if(comp_(key, curr->getKey())){
+				curr = curr->getLeft();
+			} else {
+				best = curr;
+				curr = curr->getRight();
+			}
+		}
+		return best;
+}
 
-		//If the bst is empty, return NULL.
-		if(smallest == NULL){
-			return NULL;
+/**
+* Helper for equal_range(). Given the lower bound of key, returns the
+* upper bound: the next node if the lower bound holds key, otherwise
+* the lower bound itself.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::equalRangeEnd(NodeType* lower, const K& key) const
+{
+		if(lower == NULL || comp_(key, lower->getKey())){
+			return lower;
 		}
+		NodeType* upper = lower;
+		successor(upper);
+		return upper;
+}
 
-		//Find the leftmost value in the bst and return it.
-		while(smallest->getLeft() != NULL){
-			smallest = smallest->getLeft();
+/**
+* Splits the tree rooted at tree into the nodes with keys less than
+* key (rooted at left) and greater than key (rooted at right), walking
+* down the search path once. Nodes along the path are handed to the
+* side they belong to, and each side keeps one open slot (a right
+* child on the left side, a left child on the right side) where the
+* next node for that side goes. Returns the node holding key, fully
+* detached, or NULL. No rebalancing is done.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::splitNodes(NodeType* tree, const Key& key,
+		NodeType*& left, NodeType*& right) const
+{
+		NodeType* found = NULL;
+		NodeType* leftTail = NULL;
+		NodeType* rightTail = NULL;
+		NodeType* leftRest = NULL;
+		NodeType* rightRest = NULL;
+		left = NULL;
+		right = NULL;
+
+		NodeType* curr = tree;
+		while(curr != NULL){
+			if(comp_(curr->getKey(), key)){
+				//curr and its left subtree go left; keep looking
+				//in its right subtree.
+				if(leftTail == NULL){
+					left = curr;
+				} else {
+					leftTail->setRight(curr);
+				}
+				curr->setParent(leftTail);
+				leftTail = curr;
+				curr = curr->getRight();
+			} else if(comp_(key, curr->getKey())){
+				if(rightTail == NULL){
+					right = curr;
+				} else {
+					rightTail->setLeft(curr);
+				}
+				curr->setParent(rightTail);
+				rightTail = curr;
+				curr = curr->getLeft();
+			} else {
+				//The children of the node holding key fill the
+				//open slots of both sides.
+				found = curr;
+				leftRest = found->getLeft();
+				rightRest = found->getRight();
+				found->setParent(NULL);
+				found->setLeft(NULL);
+				found->setRight(NULL);
+				curr = NULL;
+			}
 		}
-		return smallest;
+
+		if(leftTail == NULL){
+			left = leftRest;
+		} else {
+			leftTail->setRight(leftRest);
+		}
+		if(leftRest != NULL){
+			leftRest->setParent(leftTail);
+		}
+		if(rightTail == NULL){
+			right = rightRest;
+		} else {
+			rightTail->setLeft(rightRest);
+		}
+		if(rightRest != NULL){
+			rightRest->setParent(rightTail);
+		}
+		return found;
+}
+
+/**
+* Joins two trees where every key in left is less than every key in
+* right by hanging right below the largest node of left. Returns the
+* new root. No rebalancing is done.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::concatNodes(NodeType* left, NodeType* right)
+{
+		if(left == NULL){
+			if(right != NULL){
+				right->setParent(NULL);
+			}
+			return right;
+		}
+		NodeType* largest = left;
+		while(largest->getRight() != NULL){
+			largest = largest->getRight();
+		}
+		largest->setRight(right);
+		if(right != NULL){
+			right->setParent(largest);
+		}
+		return left;
+}
+
+/**
+* A helper function to find the smallest node in the tree.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+NodeType*
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::getSmallestNode() const
+{
+    // TODO
+		return NodeLinks<NodeType>::first(root_);
+}
+
+/**
+* Helpers that let derived trees hand out iterators to their nodes.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::makeIterator(NodeType* node)
+{
+		return iterator(node, this);
+}
+
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+typename BinarySearchTree<Key, Value, NodeType, Compare, Counters>::const_iterator
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::makeIterator(NodeType* node) const
+{
+		return const_iterator(node, this);
+}
+
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+NodeType*
+BinarySearchTree<Key, Value, NodeType, Compare, Counters>::getLargestNode() const
+{
+		return NodeLinks<NodeType>::last(root_);
 }
 
 /**
@@ -749,11 +2193,12 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+template<typename K>
+NodeType* BinarySearchTree<Key, Value, NodeType, Compare, Counters>::internalFind(const K& key) const
 {
     // TODO
-		Node<Key, Value>* current = root_;
+		NodeType* current = root_;
 
 		//If the bst is empty, return NULL.
 		if(current == NULL){
@@ -763,24 +2208,30 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 		//Traverse the list using bst properties until you get the
 		//item with the key and return it. If you never get to it
 		//you're at a leaf node, return NULL.
-		while(current->getKey() != key){
-			if(key < current->getKey()){
-				current = current->getLeft();
-			} else {
-				current = current->getRight();
+		//Both comparisons are made on every step, so that neither
+		//one has to be a branch.
+		size_t levels = 0;
+		while(true){
+			++levels;
+			bool less = comp_(key, current->getKey());
+			bool greater = comp_(current->getKey(), key);
+			if(!less && !greater){
+				counters_.comparisons(2 * levels);
+				return current;
 			}
+			current = less ? current->getLeft() : current->getRight();
 			if(current == NULL){
+				counters_.comparisons(2 * levels);
 				return NULL;
 			}
 		}
-		return current;
 }
 
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+bool BinarySearchTree<Key, Value, NodeType, Compare, Counters>::isBalanced() const
 {
     // TODO
 
@@ -792,11 +2243,84 @@ bool BinarySearchTree<Key, Value>::isBalanced() const
 		return true;
 }
 
+/**
+* Walks the whole tree once and returns its shape (see TreeStats). The
+* walk follows parent pointers instead of recursing, so a tree that has
+* degenerated into a list of any length is fine; the only extra memory is
+* two heights per level.
+*/
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+TreeStats BinarySearchTree<Key, Value, NodeType, Compare, Counters>::stats() const
+{
+		TreeStats result;
+
+		//The heights of the left and right subtree of the node at
+		//each depth on the current path, filled in on the way up.
+		std::vector<size_t> leftHeights;
+		std::vector<size_t> rightHeights;
+		NodeType* node = root_;
+		NodeType* prev = NULL;
+		size_t depth = 0;
+		size_t childHeight = 0;
+		while(node != NULL){
+			NodeType* next = NULL;
+			if(prev == node->getParent()){
+				//First visit, coming down.
+				if(result.depthHistogram.size() <= depth){
+					result.depthHistogram.push_back(0);
+					leftHeights.push_back(0);
+					rightHeights.push_back(0);
+				}
+				++result.depthHistogram[depth];
+				++result.nodes;
+				leftHeights[depth] = 0;
+				rightHeights[depth] = 0;
+				next = node->getLeft() != NULL ? node->getLeft() : node->getRight();
+			} else if(prev == node->getLeft()){
+				leftHeights[depth] = childHeight;
+				next = node->getRight();
+			} else {
+				rightHeights[depth] = childHeight;
+			}
+
+			if(next != NULL){
+				prev = node;
+				node = next;
+				++depth;
+				continue;
+			}
+
+			//Both subtrees are done.
+			size_t left = leftHeights[depth];
+			size_t right = rightHeights[depth];
+			if(left == 0 && right == 0){
+				++result.leaves;
+				result.leafDepthSum += depth;
+				if(depth > result.maxLeafDepth){
+					result.maxLeafDepth = depth;
+				}
+			}
+			if(left != right){
+				++result.offBalanceNodes;
+			}
+			childHeight = 1 + (left > right ? left : right);
+			prev = node;
+			node = node->getParent();
+			--depth;
+		}
+		result.height = result.depthHistogram.size();
+		//Counted here rather than read from size_, which split() and
+		//join() leave stale.
+		result.bytes = sizeof(*this) +
+				(NodePool::releasesInBulk ? pool_.bytesReserved() : result.nodes * pool_.slotSize());
+		return result;
+}
+
 /*
 * Helper function for isBalanced()
 */
-template<typename Key, typename Value>
-int BinarySearchTree<Key,Value>::calculateHeightIfBalanced(Node<Key, Value>* root_node) const{
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+int BinarySearchTree<Key, Value, NodeType, Compare, Counters>::calculateHeightIfBalanced(NodeType* root_node) const{
 
 		// Base case, if its empty
 		if(root_node == NULL){
@@ -820,88 +2344,11 @@ int BinarySearchTree<Key,Value>::calculateHeightIfBalanced(Node<Key, Value>* roo
 		return -1;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename NodeType, typename Compare, typename Counters>
+void BinarySearchTree<Key, Value, NodeType, Compare, Counters>::nodeSwap(NodeType* n1, NodeType* n2)
 {
-    if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
-        return;
-    }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
-    bool n1isLeft = false;
-    if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
-    bool n2isLeft = false;
-    if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
-
-
-    Node<Key, Value>* temp;
-    temp = n1->getParent();
-    n1->setParent(n2->getParent());
-    n2->setParent(temp);
-
-    temp = n1->getLeft();
-    n1->setLeft(n2->getLeft());
-    n2->setLeft(temp);
-
-    temp = n1->getRight();
-    n1->setRight(n2->getRight());
-    n2->setRight(temp);
-
-    if( (n1r != NULL && n1r == n2) ) {
-        n2->setRight(n1);
-        n1->setParent(n2);
-    }
-    else if( n2r != NULL && n2r == n1) {
-        n1->setRight(n2);
-        n2->setParent(n1);
-
-    }
-    else if( n1lt != NULL && n1lt == n2) {
-        n2->setLeft(n1);
-        n1->setParent(n2);
-
-    }
-    else if( n2lt != NULL && n2lt == n1) {
-        n1->setLeft(n2);
-        n2->setParent(n1);
-
-    }
-
-
-    if(n1p != NULL && n1p != n2) {
-        if(n1isLeft) n1p->setLeft(n2);
-        else n1p->setRight(n2);
-    }
-    if(n1r != NULL && n1r != n2) {
-        n1r->setParent(n2);
-    }
-    if(n1lt != NULL && n1lt != n2) {
-        n1lt->setParent(n2);
-    }
-
-    if(n2p != NULL && n2p != n1) {
-        if(n2isLeft) n2p->setLeft(n1);
-        else n2p->setRight(n1);
-    }
-    if(n2r != NULL && n2r != n1) {
-        n2r->setParent(n1);
-    }
-    if(n2lt != NULL && n2lt != n1) {
-        n2lt->setParent(n1);
-    }
-
-
-    if(this->root_ == n1) {
-        this->root_ = n2;
-    }
-    else if(this->root_ == n2) {
-        this->root_ = n1;
-    }
-
+    NodeLinks<NodeType>::swap(root_, n1, n2);
+    counters_.nodeSwap();
 }
 
 /**
@@ -0,0 +1,1065 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "node_pool.h"
+
+/**
+* An ordered map stored as a B+ tree whose nodes hold many keys each, with
+* the same public interface as BinarySearchTree so either one can be used
+* behind the same code.
+*
+* The number of keys per node is fixed at compile time from sizeof(Key): the
+* keys of one node fill KEY_BYTES, which is two cache lines, so one node visit
+* costs about as many cache misses as one binary node but skips several
+* levels of a binary tree. Inner nodes only hold keys and child pointers; the
+* values sit in the leaves, next to their keys, and the leaves are linked in
+* key order for iteration.
+*
+* Insert and remove make a single pass down the tree. A full node is split
+* before the search enters it, and a node at the minimum size is refilled
+* from a sibling (or merged with one) before the search enters it, so no
+* change ever has to travel back up. operator[] looks the key up first, so
+* that finding it changes nothing, and only inserts a missing key into the
+* leaf it found, splitting the full nodes above that leaf as needed.
+*
+* Keys and values live in fixed arrays inside the nodes and are moved around
+* as nodes change, so both must be default constructible and move
+* assignable. Any insert or remove invalidates iterators.
+*/
+template <typename Key, typename Value>
+class BTree
+{
+public:
+    static const size_t KEY_BYTES = 128;
+    static const size_t MAX_KEYS = (KEY_BYTES / sizeof(Key) < 4) ? 4 : KEY_BYTES / sizeof(Key);
+    static const size_t MIN_KEYS = (MAX_KEYS - 1) / 2;
+
+    template<bool IsConst> class basic_iterator;
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+
+    BTree();
+    ~BTree();
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    bool empty() const;
+    size_t size() const;
+    size_t height() const;
+
+    /**
+    * A bidirectional iterator over the items in key order. Keys and values
+    * are stored in separate arrays, so the item is handed out as a pair of
+    * references rather than a reference to a stored pair; it->first and
+    * it->second work as usual.
+    */
+    template<bool IsConst>
+    class basic_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::conditional<IsConst, const Value&, Value&>::type value_reference;
+        typedef std::pair<const Key&, value_reference> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type reference;
+
+        // Lets it->second work although there is no pair to point to.
+        class pointer
+        {
+        public:
+            explicit pointer(const value_type& item) : item_(item) { }
+            const value_type* operator->() const { return &item_; }
+        private:
+            value_type item_;
+        };
+
+        basic_iterator();
+        template<bool WasConst, typename = typename std::enable_if<IsConst && !WasConst>::type>
+        basic_iterator(const basic_iterator<WasConst>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        template<bool RhsConst>
+        bool operator==(const basic_iterator<RhsConst>& rhs) const;
+        template<bool RhsConst>
+        bool operator!=(const basic_iterator<RhsConst>& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
+
+    protected:
+        friend class BTree<Key, Value>;
+        template<bool> friend class basic_iterator;
+        typedef typename BTree<Key, Value>::LeafNode LeafNode;
+        basic_iterator(LeafNode* leaf, size_t index, const BTree<Key, Value>* tree);
+        LeafNode* leaf_;    // NULL for end()
+        size_t index_;
+        const BTree<Key, Value>* tree_;
+    };
+
+    iterator begin();
+    const_iterator begin() const;
+    iterator end();
+    const_iterator end() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    struct NodeHeader
+    {
+        size_t count;
+        bool leaf;
+    };
+
+    struct InnerNode : public NodeHeader
+    {
+        Key keys[MAX_KEYS];
+        NodeHeader* children[MAX_KEYS + 1];
+    };
+
+    struct LeafNode : public NodeHeader
+    {
+        Key keys[MAX_KEYS];
+        Value values[MAX_KEYS];
+        LeafNode* prev;
+        LeafNode* next;
+    };
+
+    // More levels than any tree that fits in memory can have, since every
+    // inner node but the root has at least three children.
+    static const size_t MAX_HEIGHT = 64;
+
+    template<typename K, typename V>
+    std::pair<iterator, bool> insertUnique(K&& key, V&& value);
+    template<typename K, typename V>
+    iterator insertOnPath(InnerNode** path, LeafNode* leaf, K&& key, V&& value);
+    template<typename K, typename V>
+    iterator insertIntoLeaf(LeafNode* leaf, size_t i, K&& key, V&& value);
+    LeafNode* findLeaf(const Key& key, size_t& index) const;
+    LeafNode* findLeafPath(const Key& key, InnerNode** path, size_t& index) const;
+    LeafNode* firstLeaf() const;
+    LeafNode* lastLeaf() const;
+    void splitChild(InnerNode* parent, size_t i);
+    size_t fixChild(InnerNode* parent, size_t i);
+    void borrowFromLeft(InnerNode* parent, size_t i);
+    void borrowFromRight(InnerNode* parent, size_t i);
+    void mergeChildren(InnerNode* parent, size_t i);
+    int checkSubtree(const NodeHeader* node, const Key* lo, const Key* hi) const;
+    void freeSubtree(NodeHeader* node);
+
+    static size_t lowerIndex(const Key* keys, size_t count, const Key& key);
+    static size_t upperIndex(const Key* keys, size_t count, const Key& key);
+
+    LeafNode* createLeaf();
+    InnerNode* createInner();
+    void destroyNode(NodeHeader* node);
+
+    NodeHeader* root_;
+    size_t size_;
+    size_t height_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+};
+
+/*
+  ---------------------------------------
+  Begin implementations for BTree
+  ---------------------------------------
+*/
+
+/**
+* Constructs an empty tree.
+*/
+template<class Key, class Value>
+BTree<Key, Value>::BTree() :
+    root_(NULL),
+    size_(0),
+    height_(0),
+    leafPool_(sizeof(LeafNode), alignof(LeafNode)),
+    innerPool_(sizeof(InnerNode), alignof(InnerNode))
+{
+
+}
+
+template<class Key, class Value>
+BTree<Key, Value>::~BTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already there,
+* like BinarySearchTree::insert(). Returns an iterator to the item and
+* whether a new item was added.
+*/
+template<class Key, class Value>
+std::pair<typename BTree<Key, Value>::iterator, bool>
+BTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertUnique(keyValuePair.first, keyValuePair.second);
+}
+
+template<class Key, class Value>
+std::pair<typename BTree<Key, Value>::iterator, bool>
+BTree<Key, Value>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertUnique(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Removes the item with the given key, if there is one.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::remove(const Key& key)
+{
+    if(root_ == NULL) {
+        return;
+    }
+
+    NodeHeader* node = root_;
+    while(!node->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        size_t i = upperIndex(inner->keys, inner->count, key);
+        if(inner->children[i]->count <= MIN_KEYS) {
+            i = fixChild(inner, i);
+            // A merge can take the last key out of the root, which leaves
+            // the merged child as the new root to carry on from.
+            if(inner == root_ && inner->count == 0) {
+                root_ = inner->children[0];
+                destroyNode(inner);
+                --height_;
+                node = root_;
+                continue;
+            }
+        }
+        node = inner->children[i];
+    }
+
+    LeafNode* leaf = static_cast<LeafNode*>(node);
+    size_t i = lowerIndex(leaf->keys, leaf->count, key);
+    if(i == leaf->count || key < leaf->keys[i]) {
+        return;
+    }
+    for(size_t j = i + 1; j < leaf->count; ++j) {
+        leaf->keys[j - 1] = std::move(leaf->keys[j]);
+        leaf->values[j - 1] = std::move(leaf->values[j]);
+    }
+    --leaf->count;
+    leaf->keys[leaf->count] = Key();
+    leaf->values[leaf->count] = Value();
+    --size_;
+
+    if(leaf == root_ && leaf->count == 0) {
+        destroyNode(leaf);
+        root_ = NULL;
+        height_ = 0;
+    }
+}
+
+/**
+* Removes every item. If nothing needs a destructor, the pools drop their
+* chunks without visiting the nodes.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::clear()
+{
+    if(root_ == NULL) {
+        return;
+    }
+    if(!(NodePool::releasesInBulk &&
+            std::is_trivially_destructible<Key>::value &&
+            std::is_trivially_destructible<Value>::value)) {
+        freeSubtree(root_);
+    }
+    leafPool_.release();
+    innerPool_.release();
+    root_ = NULL;
+    size_ = 0;
+    height_ = 0;
+}
+
+/**
+* Checks the B+ tree invariants: every leaf is at the same depth, every
+* node but the root holds between MIN_KEYS and MAX_KEYS keys, and the keys
+* are in order. Linear in the number of nodes.
+*/
+template<class Key, class Value>
+bool BTree<Key, Value>::isBalanced() const
+{
+    if(root_ == NULL) {
+        return true;
+    }
+    return checkSubtree(root_, NULL, NULL) == (int)height_;
+}
+
+template<class Key, class Value>
+bool BTree<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Returns the number of items in constant time.
+*/
+template<class Key, class Value>
+size_t BTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+/**
+* Returns the number of levels, counting the leaves.
+*/
+template<class Key, class Value>
+size_t BTree<Key, Value>::height() const
+{
+    return height_;
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::iterator BTree<Key, Value>::begin()
+{
+    return iterator(firstLeaf(), 0, this);
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::const_iterator BTree<Key, Value>::begin() const
+{
+    return const_iterator(firstLeaf(), 0, this);
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::iterator BTree<Key, Value>::end()
+{
+    return iterator(NULL, 0, this);
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::const_iterator BTree<Key, Value>::end() const
+{
+    return const_iterator(NULL, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value>
+typename BTree<Key, Value>::iterator BTree<Key, Value>::find(const Key& key)
+{
+    size_t index = 0;
+    LeafNode* leaf = findLeaf(key, index);
+    return iterator(leaf, index, this);
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::const_iterator BTree<Key, Value>::find(const Key& key) const
+{
+    size_t index = 0;
+    LeafNode* leaf = findLeaf(key, index);
+    return const_iterator(leaf, index, this);
+}
+
+/**
+* Returns the value for key, inserting a default value first if the key is
+* not in the tree. Takes a single pass down the tree either way.
+*/
+template<class Key, class Value>
+Value& BTree<Key, Value>::operator[](const Key& key)
+{
+    if(root_ == NULL) {
+        return insertUnique(key, Value()).first.leaf_->values[0];
+    }
+    InnerNode* path[MAX_HEIGHT];
+    size_t index = 0;
+    LeafNode* leaf = findLeafPath(key, path, index);
+    if(index == leaf->count || key < leaf->keys[index]) {
+        iterator it = insertOnPath(path, leaf, key, Value());
+        leaf = it.leaf_;
+        index = it.index_;
+    }
+    return leaf->values[index];
+}
+
+/**
+* Returns the value for key, which must be in the tree; throws
+* std::out_of_range otherwise.
+*/
+template<class Key, class Value>
+Value const & BTree<Key, Value>::operator[](const Key& key) const
+{
+    size_t index = 0;
+    LeafNode* leaf = findLeaf(key, index);
+    if(leaf == NULL) throw std::out_of_range("Invalid key");
+    return leaf->values[index];
+}
+
+/**
+* Inserts or overwrites in one pass down the tree, splitting every full
+* node on the way before entering it, so the leaf always has room.
+*/
+template<class Key, class Value>
+template<typename K, typename V>
+std::pair<typename BTree<Key, Value>::iterator, bool>
+BTree<Key, Value>::insertUnique(K&& key, V&& value)
+{
+    if(root_ == NULL) {
+        root_ = createLeaf();
+        height_ = 1;
+    }
+    if(root_->count == MAX_KEYS) {
+        InnerNode* top = createInner();
+        top->children[0] = root_;
+        root_ = top;
+        ++height_;
+        splitChild(top, 0);
+    }
+
+    NodeHeader* node = root_;
+    while(!node->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        size_t i = upperIndex(inner->keys, inner->count, key);
+        if(inner->children[i]->count == MAX_KEYS) {
+            splitChild(inner, i);
+            if(!(key < inner->keys[i])) {
+                ++i;
+            }
+        }
+        node = inner->children[i];
+    }
+
+    LeafNode* leaf = static_cast<LeafNode*>(node);
+    size_t i = lowerIndex(leaf->keys, leaf->count, key);
+    if(i < leaf->count && !(key < leaf->keys[i])) {
+        leaf->values[i] = std::forward<V>(value);
+        return std::make_pair(iterator(leaf, i, this), false);
+    }
+    return std::make_pair(insertIntoLeaf(leaf, i, std::forward<K>(key), std::forward<V>(value)), true);
+}
+
+/**
+* Inserts key, which is not in the tree, into leaf, which findLeafPath()
+* reached through the inner nodes in path. If the leaf is full, the full
+* nodes right above it are split as well, starting from the lowest
+* ancestor with room (or a new root), so every split has room in its
+* parent.
+*/
+template<class Key, class Value>
+template<typename K, typename V>
+typename BTree<Key, Value>::iterator
+BTree<Key, Value>::insertOnPath(InnerNode** path, LeafNode* leaf, K&& key, V&& value)
+{
+    if(leaf->count == MAX_KEYS) {
+        size_t depth = height_ - 1;
+        size_t top = depth;
+        while(top > 0 && path[top - 1]->count == MAX_KEYS) {
+            --top;
+        }
+        if(top == 0) {
+            InnerNode* root = createInner();
+            root->children[0] = root_;
+            root_ = root;
+            ++height_;
+            for(size_t l = depth; l > 0; --l) {
+                path[l] = path[l - 1];
+            }
+            path[0] = root;
+            ++depth;
+            top = 1;
+        }
+        for(size_t l = top - 1; l < depth; ++l) {
+            InnerNode* parent = path[l];
+            size_t i = upperIndex(parent->keys, parent->count, key);
+            splitChild(parent, i);
+            if(!(key < parent->keys[i])) {
+                ++i;
+            }
+            if(l + 1 < depth) {
+                path[l + 1] = static_cast<InnerNode*>(parent->children[i]);
+            } else {
+                leaf = static_cast<LeafNode*>(parent->children[i]);
+            }
+        }
+    }
+    size_t i = lowerIndex(leaf->keys, leaf->count, key);
+    return insertIntoLeaf(leaf, i, std::forward<K>(key), std::forward<V>(value));
+}
+
+/**
+* Puts a new item at position i of leaf, which has room for it.
+*/
+template<class Key, class Value>
+template<typename K, typename V>
+typename BTree<Key, Value>::iterator
+BTree<Key, Value>::insertIntoLeaf(LeafNode* leaf, size_t i, K&& key, V&& value)
+{
+    for(size_t j = leaf->count; j > i; --j) {
+        leaf->keys[j] = std::move(leaf->keys[j - 1]);
+        leaf->values[j] = std::move(leaf->values[j - 1]);
+    }
+    leaf->keys[i] = std::forward<K>(key);
+    leaf->values[i] = std::forward<V>(value);
+    ++leaf->count;
+    ++size_;
+    return iterator(leaf, i, this);
+}
+
+/**
+* Returns the leaf holding key and its position there, or NULL. Inner
+* nodes send keys equal to a separator to the right, where the separator
+* was copied from.
+*/
+template<class Key, class Value>
+typename BTree<Key, Value>::LeafNode* BTree<Key, Value>::findLeaf(const Key& key, size_t& index) const
+{
+    NodeHeader* node = root_;
+    if(node == NULL) {
+        return NULL;
+    }
+    while(!node->leaf) {
+        const InnerNode* inner = static_cast<const InnerNode*>(node);
+        node = inner->children[upperIndex(inner->keys, inner->count, key)];
+    }
+    LeafNode* leaf = static_cast<LeafNode*>(node);
+    index = lowerIndex(leaf->keys, leaf->count, key);
+    if(index == leaf->count || key < leaf->keys[index]) {
+        return NULL;
+    }
+    return leaf;
+}
+
+/**
+* Walks down to the leaf where key belongs in a tree that is not empty,
+* storing the inner nodes passed on the way in path, and returns the leaf
+* with the position of the first key not less than key in index.
+*/
+template<class Key, class Value>
+typename BTree<Key, Value>::LeafNode*
+BTree<Key, Value>::findLeafPath(const Key& key, InnerNode** path, size_t& index) const
+{
+    NodeHeader* node = root_;
+    size_t depth = 0;
+    while(!node->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        path[depth++] = inner;
+        node = inner->children[upperIndex(inner->keys, inner->count, key)];
+    }
+    LeafNode* leaf = static_cast<LeafNode*>(node);
+    index = lowerIndex(leaf->keys, leaf->count, key);
+    return leaf;
+}
+
+/**
+* Leftmost leaf, or NULL if the tree is empty.
+*/
+template<class Key, class Value>
+typename BTree<Key, Value>::LeafNode* BTree<Key, Value>::firstLeaf() const
+{
+    NodeHeader* node = root_;
+    if(node == NULL) {
+        return NULL;
+    }
+    while(!node->leaf) {
+        node = static_cast<InnerNode*>(node)->children[0];
+    }
+    return static_cast<LeafNode*>(node);
+}
+
+/**
+* Rightmost leaf, or NULL if the tree is empty.
+*/
+template<class Key, class Value>
+typename BTree<Key, Value>::LeafNode* BTree<Key, Value>::lastLeaf() const
+{
+    NodeHeader* node = root_;
+    if(node == NULL) {
+        return NULL;
+    }
+    while(!node->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        node = inner->children[inner->count];
+    }
+    return static_cast<LeafNode*>(node);
+}
+
+/**
+* Splits the full child i of parent in two and puts the separator between
+* them into parent, which must not be full. A leaf keeps its lower half and
+* copies the first key of the upper half up; an inner node moves its middle
+* key up instead.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::splitChild(InnerNode* parent, size_t i)
+{
+    NodeHeader* child = parent->children[i];
+    NodeHeader* right = NULL;
+    Key separator;
+
+    if(child->leaf) {
+        LeafNode* left = static_cast<LeafNode*>(child);
+        LeafNode* newLeaf = createLeaf();
+        size_t keep = MAX_KEYS / 2;
+        for(size_t j = keep; j < MAX_KEYS; ++j) {
+            newLeaf->keys[j - keep] = std::move(left->keys[j]);
+            newLeaf->values[j - keep] = std::move(left->values[j]);
+        }
+        newLeaf->count = MAX_KEYS - keep;
+        left->count = keep;
+        newLeaf->next = left->next;
+        newLeaf->prev = left;
+        if(left->next != NULL) {
+            left->next->prev = newLeaf;
+        }
+        left->next = newLeaf;
+        separator = newLeaf->keys[0];
+        right = newLeaf;
+    } else {
+        InnerNode* left = static_cast<InnerNode*>(child);
+        InnerNode* newInner = createInner();
+        size_t mid = MAX_KEYS / 2;
+        separator = std::move(left->keys[mid]);
+        for(size_t j = mid + 1; j < MAX_KEYS; ++j) {
+            newInner->keys[j - mid - 1] = std::move(left->keys[j]);
+        }
+        for(size_t j = mid + 1; j <= MAX_KEYS; ++j) {
+            newInner->children[j - mid - 1] = left->children[j];
+        }
+        newInner->count = MAX_KEYS - mid - 1;
+        left->count = mid;
+        right = newInner;
+    }
+
+    for(size_t j = parent->count; j > i; --j) {
+        parent->keys[j] = std::move(parent->keys[j - 1]);
+        parent->children[j + 1] = parent->children[j];
+    }
+    parent->keys[i] = std::move(separator);
+    parent->children[i + 1] = right;
+    ++parent->count;
+}
+
+/**
+* Makes sure child i of parent has more than MIN_KEYS keys, by borrowing
+* one from a sibling that can spare it or else merging with a sibling.
+* Returns the index of the child that now covers the old child's keys.
+*/
+template<class Key, class Value>
+size_t BTree<Key, Value>::fixChild(InnerNode* parent, size_t i)
+{
+    if(i > 0 && parent->children[i - 1]->count > MIN_KEYS) {
+        borrowFromLeft(parent, i);
+        return i;
+    }
+    if(i < parent->count && parent->children[i + 1]->count > MIN_KEYS) {
+        borrowFromRight(parent, i);
+        return i;
+    }
+    if(i < parent->count) {
+        mergeChildren(parent, i);
+        return i;
+    }
+    mergeChildren(parent, i - 1);
+    return i - 1;
+}
+
+/**
+* Moves the last key of child i - 1 over to child i, through the
+* separator between them.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::borrowFromLeft(InnerNode* parent, size_t i)
+{
+    NodeHeader* child = parent->children[i];
+    NodeHeader* sibling = parent->children[i - 1];
+
+    if(child->leaf) {
+        LeafNode* to = static_cast<LeafNode*>(child);
+        LeafNode* from = static_cast<LeafNode*>(sibling);
+        for(size_t j = to->count; j > 0; --j) {
+            to->keys[j] = std::move(to->keys[j - 1]);
+            to->values[j] = std::move(to->values[j - 1]);
+        }
+        --from->count;
+        to->keys[0] = std::move(from->keys[from->count]);
+        to->values[0] = std::move(from->values[from->count]);
+        from->keys[from->count] = Key();
+        from->values[from->count] = Value();
+        ++to->count;
+        parent->keys[i - 1] = to->keys[0];
+    } else {
+        InnerNode* to = static_cast<InnerNode*>(child);
+        InnerNode* from = static_cast<InnerNode*>(sibling);
+        for(size_t j = to->count; j > 0; --j) {
+            to->keys[j] = std::move(to->keys[j - 1]);
+        }
+        for(size_t j = to->count + 1; j > 0; --j) {
+            to->children[j] = to->children[j - 1];
+        }
+        to->keys[0] = std::move(parent->keys[i - 1]);
+        to->children[0] = from->children[from->count];
+        parent->keys[i - 1] = std::move(from->keys[from->count - 1]);
+        --from->count;
+        ++to->count;
+    }
+}
+
+/**
+* Moves the first key of child i + 1 over to child i, through the
+* separator between them.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::borrowFromRight(InnerNode* parent, size_t i)
+{
+    NodeHeader* child = parent->children[i];
+    NodeHeader* sibling = parent->children[i + 1];
+
+    if(child->leaf) {
+        LeafNode* to = static_cast<LeafNode*>(child);
+        LeafNode* from = static_cast<LeafNode*>(sibling);
+        to->keys[to->count] = std::move(from->keys[0]);
+        to->values[to->count] = std::move(from->values[0]);
+        ++to->count;
+        for(size_t j = 1; j < from->count; ++j) {
+            from->keys[j - 1] = std::move(from->keys[j]);
+            from->values[j - 1] = std::move(from->values[j]);
+        }
+        --from->count;
+        from->keys[from->count] = Key();
+        from->values[from->count] = Value();
+        parent->keys[i] = from->keys[0];
+    } else {
+        InnerNode* to = static_cast<InnerNode*>(child);
+        InnerNode* from = static_cast<InnerNode*>(sibling);
+        to->keys[to->count] = std::move(parent->keys[i]);
+        to->children[to->count + 1] = from->children[0];
+        ++to->count;
+        parent->keys[i] = std::move(from->keys[0]);
+        for(size_t j = 1; j < from->count; ++j) {
+            from->keys[j - 1] = std::move(from->keys[j]);
+        }
+        for(size_t j = 1; j <= from->count; ++j) {
+            from->children[j - 1] = from->children[j];
+        }
+        --from->count;
+    }
+}
+
+/**
+* Merges child i + 1 of parent into child i and drops the separator between
+* them from parent. Both children are at the minimum size, so the result
+* fits in one node.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::mergeChildren(InnerNode* parent, size_t i)
+{
+    NodeHeader* child = parent->children[i];
+    NodeHeader* sibling = parent->children[i + 1];
+
+    if(child->leaf) {
+        LeafNode* to = static_cast<LeafNode*>(child);
+        LeafNode* from = static_cast<LeafNode*>(sibling);
+        for(size_t j = 0; j < from->count; ++j) {
+            to->keys[to->count + j] = std::move(from->keys[j]);
+            to->values[to->count + j] = std::move(from->values[j]);
+        }
+        to->count += from->count;
+        to->next = from->next;
+        if(from->next != NULL) {
+            from->next->prev = to;
+        }
+    } else {
+        InnerNode* to = static_cast<InnerNode*>(child);
+        InnerNode* from = static_cast<InnerNode*>(sibling);
+        to->keys[to->count] = std::move(parent->keys[i]);
+        for(size_t j = 0; j < from->count; ++j) {
+            to->keys[to->count + 1 + j] = std::move(from->keys[j]);
+        }
+        for(size_t j = 0; j <= from->count; ++j) {
+            to->children[to->count + 1 + j] = from->children[j];
+        }
+        to->count += from->count + 1;
+    }
+    destroyNode(sibling);
+
+    for(size_t j = i + 1; j < parent->count; ++j) {
+        parent->keys[j - 1] = std::move(parent->keys[j]);
+        parent->children[j] = parent->children[j + 1];
+    }
+    --parent->count;
+    parent->keys[parent->count] = Key();
+}
+
+/**
+* Helper for isBalanced(). Returns the number of levels below and
+* including node, or -1 if an invariant does not hold. All keys in the
+* subtree must lie in [lo, hi) where given.
+*/
+template<class Key, class Value>
+int BTree<Key, Value>::checkSubtree(const NodeHeader* node, const Key* lo, const Key* hi) const
+{
+    if(node != root_ && (node->count < MIN_KEYS || node->count > MAX_KEYS)) {
+        return -1;
+    }
+
+    const Key* keys = node->leaf ? static_cast<const LeafNode*>(node)->keys
+                                 : static_cast<const InnerNode*>(node)->keys;
+    for(size_t j = 0; j < node->count; ++j) {
+        if((j > 0 && !(keys[j - 1] < keys[j])) ||
+                (lo != NULL && keys[j] < *lo) || (hi != NULL && !(keys[j] < *hi))) {
+            return -1;
+        }
+    }
+    if(node->leaf) {
+        return 1;
+    }
+
+    const InnerNode* inner = static_cast<const InnerNode*>(node);
+    int depth = -1;
+    for(size_t j = 0; j <= inner->count; ++j) {
+        const Key* childLo = (j == 0) ? lo : &inner->keys[j - 1];
+        const Key* childHi = (j == inner->count) ? hi : &inner->keys[j];
+        int childDepth = checkSubtree(inner->children[j], childLo, childHi);
+        if(childDepth < 0 || (depth >= 0 && childDepth != depth)) {
+            return -1;
+        }
+        depth = childDepth;
+    }
+    return depth + 1;
+}
+
+/**
+* Frees every node below and including node. The recursion is only as deep
+* as the tree is tall.
+*/
+template<class Key, class Value>
+void BTree<Key, Value>::freeSubtree(NodeHeader* node)
+{
+    if(!node->leaf) {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        for(size_t j = 0; j <= inner->count; ++j) {
+            freeSubtree(inner->children[j]);
+        }
+    }
+    destroyNode(node);
+}
+
+/**
+* Number of keys less than key. The loop has no early exit, so for small
+* key types it compiles to a branch free count.
+*/
+template<class Key, class Value>
+size_t BTree<Key, Value>::lowerIndex(const Key* keys, size_t count, const Key& key)
+{
+    size_t index = 0;
+    for(size_t j = 0; j < count; ++j) {
+        index += (keys[j] < key);
+    }
+    return index;
+}
+
+/**
+* Number of keys not greater than key.
+*/
+template<class Key, class Value>
+size_t BTree<Key, Value>::upperIndex(const Key* keys, size_t count, const Key& key)
+{
+    size_t index = 0;
+    for(size_t j = 0; j < count; ++j) {
+        index += !(key < keys[j]);
+    }
+    return index;
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::LeafNode* BTree<Key, Value>::createLeaf()
+{
+    void* slot = leafPool_.allocate();
+    LeafNode* leaf = NULL;
+    try {
+        leaf = new (slot) LeafNode();
+    } catch(...) {
+        leafPool_.deallocate(slot);
+        throw;
+    }
+    leaf->count = 0;
+    leaf->leaf = true;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    return leaf;
+}
+
+template<class Key, class Value>
+typename BTree<Key, Value>::InnerNode* BTree<Key, Value>::createInner()
+{
+    void* slot = innerPool_.allocate();
+    InnerNode* inner = NULL;
+    try {
+        inner = new (slot) InnerNode();
+    } catch(...) {
+        innerPool_.deallocate(slot);
+        throw;
+    }
+    inner->count = 0;
+    inner->leaf = false;
+    return inner;
+}
+
+template<class Key, class Value>
+void BTree<Key, Value>::destroyNode(NodeHeader* node)
+{
+    if(node->leaf) {
+        LeafNode* leaf = static_cast<LeafNode*>(node);
+        leaf->~LeafNode();
+        leafPool_.deallocate(leaf);
+    } else {
+        InnerNode* inner = static_cast<InnerNode*>(node);
+        inner->~InnerNode();
+        innerPool_.deallocate(inner);
+    }
+}
+
+/*
+  ---------------------------------------------
+  Begin implementations for the basic_iterator
+  ---------------------------------------------
+*/
+
+template<class Key, class Value>
+template<bool IsConst>
+BTree<Key, Value>::basic_iterator<IsConst>::basic_iterator() :
+    leaf_(NULL),
+    index_(0),
+    tree_(NULL)
+{
+
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+BTree<Key, Value>::basic_iterator<IsConst>::basic_iterator(LeafNode* leaf, size_t index,
+    const BTree<Key, Value>* tree) :
+    leaf_(leaf),
+    index_(leaf == NULL ? 0 : index),
+    tree_(tree)
+{
+
+}
+
+/**
+* Converts an iterator into a const_iterator.
+*/
+template<class Key, class Value>
+template<bool IsConst>
+template<bool WasConst, typename>
+BTree<Key, Value>::basic_iterator<IsConst>::basic_iterator(const basic_iterator<WasConst>& other) :
+    leaf_(other.leaf_),
+    index_(other.index_),
+    tree_(other.tree_)
+{
+
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>::reference
+BTree<Key, Value>::basic_iterator<IsConst>::operator*() const
+{
+    return reference(leaf_->keys[index_], leaf_->values[index_]);
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>::pointer
+BTree<Key, Value>::basic_iterator<IsConst>::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Iterators are equal if they refer to the same slot of the same leaf.
+*/
+template<class Key, class Value>
+template<bool IsConst>
+template<bool RhsConst>
+bool BTree<Key, Value>::basic_iterator<IsConst>::operator==(const basic_iterator<RhsConst>& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+template<bool RhsConst>
+bool BTree<Key, Value>::basic_iterator<IsConst>::operator!=(const basic_iterator<RhsConst>& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next item, moving on to the next leaf at the end of one.
+*/
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>&
+BTree<Key, Value>::basic_iterator<IsConst>::operator++()
+{
+    ++index_;
+    if(index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>
+BTree<Key, Value>::basic_iterator<IsConst>::operator++(int)
+{
+    basic_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous item; from end() that is the largest item.
+*/
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>&
+BTree<Key, Value>::basic_iterator<IsConst>::operator--()
+{
+    if(leaf_ == NULL) {
+        leaf_ = tree_->lastLeaf();
+        index_ = leaf_->count - 1;
+    } else if(index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    } else {
+        --index_;
+    }
+    return *this;
+}
+
+template<class Key, class Value>
+template<bool IsConst>
+typename BTree<Key, Value>::template basic_iterator<IsConst>
+BTree<Key, Value>::basic_iterator<IsConst>::operator--(int)
+{
+    basic_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+#endif
@@ -0,0 +1,1065 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "epoch.h"
+
+/**
+* A one byte lock for tree nodes. A std::mutex is as big as the rest of a
+* node together, and node locks are only ever held for a few stores.
+* Waiters spin on a plain load, and yield once they have spun for a while.
+* Works with std::lock_guard.
+*/
+class SpinLock
+{
+public:
+    SpinLock() : locked_(false) { }
+
+    void lock()
+    {
+        int spins = 0;
+        while(locked_.exchange(true, std::memory_order_acquire)) {
+            while(locked_.load(std::memory_order_relaxed)) {
+                if(++spins >= SPIN_LIMIT) {
+                    std::this_thread::yield();
+                    spins = 0;
+                }
+            }
+        }
+    }
+
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    static const int SPIN_LIMIT = 64;
+    std::atomic<bool> locked_;
+};
+
+/**
+* An AVL tree map that many threads may read and change at once, after
+* Bronson, Casper, Chafi and Olukotun, "A Practical Concurrent Binary Search
+* Tree" (PPoPP 2010).
+*
+* Lookups take no locks at all. Every node carries a version number that a
+* writer bumps whenever it moves part of the node's subtree out from under
+* it, which is what a rotation does to the node that goes down. A reader
+* walks hand over hand: it reads a child, then checks that the version of
+* the parent has not changed, and starts that step over if it has. Readers
+* therefore only ever wait on a node that is in the middle of a rotation.
+*
+* Writers lock only the nodes they change: insert() locks the parent of the
+* new leaf, a rotation locks the node, its parent and the child that comes
+* up, always top down. Balance is relaxed: a writer first makes its change
+* and then walks back up fixing heights and rotating, one node at a time,
+* so concurrent writers may see the tree briefly out of balance. Once no
+* writer is running the tree is a proper AVL tree again.
+*
+* remove() unlinks a node with at most one child. A node with two children
+* just loses its value and stays behind as a routing node, to be unlinked
+* later once it has lost a child. Unlinked nodes and replaced values are
+* handed to the EpochReclaimer and freed once no reader can still see them.
+*
+* Since a value may be replaced or freed as soon as a lookup returns, find()
+* copies the value out instead of returning an iterator or a reference.
+* Keys are never changed after insertion. Key must be default constructible
+* (the sentinel above the root holds a default key) and copyable, and Value
+* copyable.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+protected:
+    // The result of one attempt at an operation.
+    enum Outcome { RETRY, ABSENT, PRESENT };
+
+    // Directions to a child, as returned by compare().
+    static const int LEFT = -1;
+    static const int RIGHT = 1;
+
+    // Version bits. A node being rotated down has SHRINKING set until the
+    // rotation is done, then its version moves on by VERSION_STEP. An
+    // unlinked node keeps the version UNLINKED for good.
+    static const uint64_t UNLINKED = 1;
+    static const uint64_t SHRINKING = 2;
+    static const uint64_t VERSION_STEP = 4;
+
+    // What nodeCondition() asks for, unless it returns a new height.
+    static const int UNLINK_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int NOTHING_REQUIRED = -3;
+
+    // Reads a node keeps retrying before it blocks on a rotating node.
+    static const int SPIN_COUNT = 100;
+
+    struct Node
+    {
+        Node(const Key& nodeKey, Node* parentNode, Value* nodeValue);
+        ~Node();
+        std::atomic<Node*>& child(int dir);
+
+        // Ordered so that what a lookup reads comes first.
+        const Key key;
+        std::atomic<uint64_t> version;
+        std::atomic<Node*> left;
+        std::atomic<Node*> right;
+        std::atomic<Value*> value;  // NULL for a routing node
+        std::atomic<Node*> parent;
+        std::atomic<int> height;
+        SpinLock lock;
+    };
+
+    Outcome attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value* value) const;
+    Outcome attemptPut(const Key& key, const Value& value, Node* node, int dir, uint64_t nodeVersion);
+    Outcome attemptInsert(const Key& key, const Value& value, Node* node, int dir, uint64_t nodeVersion);
+    Outcome attemptUpdate(Node* node, const Value& value);
+    Outcome attemptRemove(const Key& key, Node* node, int dir, uint64_t nodeVersion);
+    Outcome attemptRemoveNode(Node* parent, Node* node);
+
+    void fixHeightAndRebalance(Node* node);
+    int nodeCondition(Node* node) const;
+    Node* fixHeight_nl(Node* node);
+    Node* rebalance_nl(Node* parent, Node* node);
+    bool attemptUnlink_nl(Node* parent, Node* node);
+    Node* rebalanceToRight_nl(Node* parent, Node* node, Node* left, int hR0);
+    Node* rebalanceToLeft_nl(Node* parent, Node* node, Node* right, int hL0);
+    Node* rotateRight_nl(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLR);
+    Node* rotateLeft_nl(Node* parent, Node* node, int hL, Node* right, Node* rightLeft, int hRL, int hRR);
+    Node* rotateRightOverLeft_nl(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLRL);
+    Node* rotateLeftOverRight_nl(Node* parent, Node* node, int hL, Node* right, Node* rightLeft, int hRR, int hRLR);
+
+    static int compare(const Key& key, const Key& nodeKey);
+    static int heightOf(Node* node);
+    static bool canUnlink(Node* node);
+    static void waitUntilNotChanging(Node* node);
+    static int checkedHeight(Node* node);
+    static void freeSubtree(Node* node);
+
+    // Sentinel whose right child is the root, so the root can be replaced
+    // like any other child. Its version never changes.
+    mutable Node rootHolder_;
+    std::atomic<size_t> size_;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for ConcurrentAVLTree
+  ---------------------------------------------
+*/
+
+/**
+* Constructs an empty tree.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    rootHolder_(Key(), NULL, NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Frees every node still in the tree. No other thread may use the tree
+* any more; nodes it already unlinked are freed by the EpochReclaimer.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    freeSubtree(rootHolder_.right.load());
+    rootHolder_.right.store(NULL);
+}
+
+/**
+* Inserts the item, or replaces the value if the key is already there.
+* Returns true if a new item was added.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochReclaimer::Guard guard;
+    Outcome outcome;
+    do {
+        outcome = attemptPut(keyValuePair.first, keyValuePair.second, &rootHolder_, RIGHT, 0);
+    } while(outcome == RETRY);
+    if(outcome == ABSENT) {
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/**
+* Removes the item with the given key. Returns true if there was one.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    EpochReclaimer::Guard guard;
+    Outcome outcome;
+    do {
+        outcome = attemptRemove(key, &rootHolder_, RIGHT, 0);
+    } while(outcome == RETRY);
+    if(outcome == PRESENT) {
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is not in the tree. Takes no locks.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochReclaimer::Guard guard;
+    Outcome outcome;
+    do {
+        outcome = attemptGet(key, &rootHolder_, RIGHT, 0, &value);
+    } while(outcome == RETRY);
+    return outcome == PRESENT;
+}
+
+/**
+* Returns true if the key is in the tree. Takes no locks.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    EpochReclaimer::Guard guard;
+    Outcome outcome;
+    do {
+        outcome = attemptGet(key, &rootHolder_, RIGHT, 0, NULL);
+    } while(outcome == RETRY);
+    return outcome == PRESENT;
+}
+
+/**
+* Returns the number of items. While writers are running this is only a
+* recent count, not one that matches any single moment.
+*/
+template<class Key, class Value>
+size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Checks the stored heights and the AVL balance of every node. Only
+* meaningful while no writer is running.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::isBalanced() const
+{
+    return checkedHeight(rootHolder_.right.load()) >= 0;
+}
+
+/**
+* One optimistic step of a lookup: node was reached with version
+* nodeVersion, and key lies in its subtree in direction dir. Returns RETRY
+* if node has since shrunk, so the caller redoes its own step.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value* value) const
+{
+    while(true) {
+        Node* child = node->child(dir).load(std::memory_order_acquire);
+        if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+            return RETRY;
+        }
+        if(child == NULL) {
+            return ABSENT;
+        }
+        int nextDir = compare(key, child->key);
+        if(nextDir == 0) {
+            Value* found = child->value.load(std::memory_order_acquire);
+            if(found == NULL) {
+                return ABSENT;
+            }
+            if(value != NULL) {
+                *value = *found;
+            }
+            return PRESENT;
+        }
+        uint64_t childVersion = child->version.load(std::memory_order_acquire);
+        if((childVersion & SHRINKING) != 0) {
+            waitUntilNotChanging(child);
+        } else if(childVersion != UNLINKED && child == node->child(dir).load(std::memory_order_acquire)) {
+            if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+                return RETRY;
+            }
+            Outcome outcome = attemptGet(key, child, nextDir, childVersion, value);
+            if(outcome != RETRY) {
+                return outcome;
+            }
+        }
+    }
+}
+
+/**
+* One step of insert(), validated like attemptGet(). Returns ABSENT if a
+* new item was added and PRESENT if an existing value was replaced.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptPut(const Key& key, const Value& value, Node* node, int dir, uint64_t nodeVersion)
+{
+    Outcome outcome;
+    do {
+        Node* child = node->child(dir).load(std::memory_order_acquire);
+        if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+            return RETRY;
+        }
+        if(child == NULL) {
+            outcome = attemptInsert(key, value, node, dir, nodeVersion);
+        } else {
+            int nextDir = compare(key, child->key);
+            if(nextDir == 0) {
+                outcome = attemptUpdate(child, value);
+            } else {
+                uint64_t childVersion = child->version.load(std::memory_order_acquire);
+                if((childVersion & SHRINKING) != 0) {
+                    waitUntilNotChanging(child);
+                    outcome = RETRY;
+                } else if(childVersion != UNLINKED && child == node->child(dir).load(std::memory_order_acquire)) {
+                    if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+                        return RETRY;
+                    }
+                    outcome = attemptPut(key, value, child, nextDir, childVersion);
+                } else {
+                    outcome = RETRY;
+                }
+            }
+        }
+    } while(outcome == RETRY);
+    return outcome;
+}
+
+/**
+* Hangs a new leaf under node, if node is still where the search left it
+* and the slot is still empty, then repairs the path above.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptInsert(const Key& key, const Value& value, Node* node, int dir, uint64_t nodeVersion)
+{
+    {
+        std::lock_guard<SpinLock> lock(node->lock);
+        if(node->version.load(std::memory_order_relaxed) != nodeVersion ||
+                node->child(dir).load(std::memory_order_relaxed) != NULL) {
+            return RETRY;
+        }
+        Value* box = new Value(value);
+        Node* leaf = NULL;
+        try {
+            leaf = new Node(key, node, box);
+        } catch(...) {
+            delete box;
+            throw;
+        }
+        node->child(dir).store(leaf, std::memory_order_release);
+    }
+    fixHeightAndRebalance(node);
+    return ABSENT;
+}
+
+/**
+* Replaces the value of node. A routing node gets its value back, which
+* counts as adding the key again.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptUpdate(Node* node, const Value& value)
+{
+    Value* box = new Value(value);
+    Value* old = NULL;
+    {
+        std::lock_guard<SpinLock> lock(node->lock);
+        if(node->version.load(std::memory_order_relaxed) == UNLINKED) {
+            delete box;
+            return RETRY;
+        }
+        old = node->value.exchange(box, std::memory_order_acq_rel);
+    }
+    if(old == NULL) {
+        return ABSENT;
+    }
+    EpochReclaimer::retire(old);
+    return PRESENT;
+}
+
+/**
+* One step of remove(), validated like attemptGet(). Returns PRESENT if an
+* item was removed.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptRemove(const Key& key, Node* node, int dir, uint64_t nodeVersion)
+{
+    Outcome outcome;
+    do {
+        Node* child = node->child(dir).load(std::memory_order_acquire);
+        if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+            return RETRY;
+        }
+        if(child == NULL) {
+            return ABSENT;
+        }
+        int nextDir = compare(key, child->key);
+        if(nextDir == 0) {
+            outcome = attemptRemoveNode(node, child);
+        } else {
+            uint64_t childVersion = child->version.load(std::memory_order_acquire);
+            if((childVersion & SHRINKING) != 0) {
+                waitUntilNotChanging(child);
+                outcome = RETRY;
+            } else if(childVersion != UNLINKED && child == node->child(dir).load(std::memory_order_acquire)) {
+                if(node->version.load(std::memory_order_acquire) != nodeVersion) {
+                    return RETRY;
+                }
+                outcome = attemptRemove(key, child, nextDir, childVersion);
+            } else {
+                outcome = RETRY;
+            }
+        }
+    } while(outcome == RETRY);
+    return outcome;
+}
+
+/**
+* Removes the value of node, a child of parent. A node with two children
+* only turns into a routing node; otherwise it is unlinked right away,
+* which needs the parent locked as well.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptRemoveNode(Node* parent, Node* node)
+{
+    if(node->value.load(std::memory_order_acquire) == NULL) {
+        return ABSENT;
+    }
+    Value* old = NULL;
+    if(!canUnlink(node)) {
+        std::lock_guard<SpinLock> lock(node->lock);
+        if(node->version.load(std::memory_order_relaxed) == UNLINKED || canUnlink(node)) {
+            return RETRY;
+        }
+        old = node->value.exchange(NULL, std::memory_order_acq_rel);
+    } else {
+        {
+            std::lock_guard<SpinLock> parentLock(parent->lock);
+            if(parent->version.load(std::memory_order_relaxed) == UNLINKED ||
+                    node->parent.load(std::memory_order_relaxed) != parent) {
+                return RETRY;
+            }
+            std::lock_guard<SpinLock> lock(node->lock);
+            if(node->version.load(std::memory_order_relaxed) == UNLINKED) {
+                return RETRY;
+            }
+            old = node->value.load(std::memory_order_relaxed);
+            if(old == NULL) {
+                return ABSENT;
+            }
+            if(!canUnlink(node)) {
+                return RETRY;
+            }
+            Node* left = node->left.load(std::memory_order_relaxed);
+            Node* splice = (left != NULL) ? left : node->right.load(std::memory_order_relaxed);
+            if(parent->left.load(std::memory_order_relaxed) == node) {
+                parent->left.store(splice, std::memory_order_release);
+            } else {
+                parent->right.store(splice, std::memory_order_release);
+            }
+            if(splice != NULL) {
+                splice->parent.store(parent, std::memory_order_release);
+            }
+            node->version.store(UNLINKED, std::memory_order_release);
+            node->value.store(NULL, std::memory_order_release);
+        }
+        EpochReclaimer::retire(node);
+        fixHeightAndRebalance(parent);
+    }
+    if(old == NULL) {
+        return ABSENT;
+    }
+    EpochReclaimer::retire(old);
+    return PRESENT;
+}
+
+/**
+* Walks up from node, fixing heights, unlinking routing nodes and rotating
+* until nothing is left to do. Each step locks the node, plus its parent
+* if the step rotates or unlinks.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(Node* node)
+{
+    while(node != NULL && node->parent.load(std::memory_order_acquire) != NULL) {
+        int condition = nodeCondition(node);
+        if(condition == NOTHING_REQUIRED || node->version.load(std::memory_order_acquire) == UNLINKED) {
+            return;
+        }
+        if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            std::lock_guard<SpinLock> lock(node->lock);
+            node = fixHeight_nl(node);
+        } else {
+            Node* parent = node->parent.load(std::memory_order_acquire);
+            std::lock_guard<SpinLock> parentLock(parent->lock);
+            if(parent->version.load(std::memory_order_relaxed) != UNLINKED &&
+                    node->parent.load(std::memory_order_relaxed) == parent) {
+                std::lock_guard<SpinLock> lock(node->lock);
+                node = rebalance_nl(parent, node);
+            }
+        }
+    }
+}
+
+/**
+* Says what node needs: UNLINK_REQUIRED for a routing node that has lost a
+* child, REBALANCE_REQUIRED if its subtrees differ in height by more than
+* one, its correct height if the stored one is wrong, and NOTHING_REQUIRED
+* otherwise. Reads without locks, so the answer is only a hint.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(Node* node) const
+{
+    Node* left = node->left.load(std::memory_order_acquire);
+    Node* right = node->right.load(std::memory_order_acquire);
+    if((left == NULL || right == NULL) && node->value.load(std::memory_order_acquire) == NULL) {
+        return UNLINK_REQUIRED;
+    }
+    int hN = node->height.load(std::memory_order_relaxed);
+    int hL0 = heightOf(left);
+    int hR0 = heightOf(right);
+    int hNRepl = 1 + (hL0 > hR0 ? hL0 : hR0);
+    int balance = hL0 - hR0;
+    if(balance < -1 || balance > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return hN != hNRepl ? hNRepl : NOTHING_REQUIRED;
+}
+
+/**
+* Stores the right height in node, which must be locked. Returns the node
+* to look at next: the parent if the height changed, node itself if it
+* needs more than a new height, or NULL if it is fine.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node* ConcurrentAVLTree<Key, Value>::fixHeight_nl(Node* node)
+{
+    int condition = nodeCondition(node);
+    if(condition == REBALANCE_REQUIRED || condition == UNLINK_REQUIRED) {
+        return node;
+    }
+    if(condition == NOTHING_REQUIRED) {
+        return NULL;
+    }
+    node->height.store(condition, std::memory_order_relaxed);
+    return node->parent.load(std::memory_order_relaxed);
+}
+
+/**
+* Does whatever node needs, with node and its parent locked. Returns the
+* next node to look at, like fixHeight_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node* ConcurrentAVLTree<Key, Value>::rebalance_nl(Node* parent, Node* node)
+{
+    Node* left = node->left.load(std::memory_order_relaxed);
+    Node* right = node->right.load(std::memory_order_relaxed);
+    if((left == NULL || right == NULL) && node->value.load(std::memory_order_relaxed) == NULL) {
+        if(attemptUnlink_nl(parent, node)) {
+            return fixHeight_nl(parent);
+        }
+        return node;
+    }
+    int hN = node->height.load(std::memory_order_relaxed);
+    int hL0 = heightOf(left);
+    int hR0 = heightOf(right);
+    int hNRepl = 1 + (hL0 > hR0 ? hL0 : hR0);
+    int balance = hL0 - hR0;
+    if(balance > 1) {
+        return rebalanceToRight_nl(parent, node, left, hR0);
+    }
+    if(balance < -1) {
+        return rebalanceToLeft_nl(parent, node, right, hL0);
+    }
+    if(hNRepl != hN) {
+        node->height.store(hNRepl, std::memory_order_relaxed);
+        return fixHeight_nl(parent);
+    }
+    return NULL;
+}
+
+/**
+* Unlinks the routing node node, which has at most one child, with node
+* and parent locked. Returns false if the tree has changed in the meantime.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink_nl(Node* parent, Node* node)
+{
+    Node* parentLeft = parent->left.load(std::memory_order_relaxed);
+    Node* parentRight = parent->right.load(std::memory_order_relaxed);
+    if(parentLeft != node && parentRight != node) {
+        return false;
+    }
+    Node* left = node->left.load(std::memory_order_relaxed);
+    Node* right = node->right.load(std::memory_order_relaxed);
+    if(left != NULL && right != NULL) {
+        return false;
+    }
+    Node* splice = (left != NULL) ? left : right;
+    if(parentLeft == node) {
+        parent->left.store(splice, std::memory_order_release);
+    } else {
+        parent->right.store(splice, std::memory_order_release);
+    }
+    if(splice != NULL) {
+        splice->parent.store(parent, std::memory_order_release);
+    }
+    node->version.store(UNLINKED, std::memory_order_release);
+    node->value.store(NULL, std::memory_order_release);
+    EpochReclaimer::retire(node);
+    return true;
+}
+
+/**
+* node is too heavy on the left. Rotates right once, or twice if the left
+* child leans right, with parent and node locked. Returns the next node to
+* look at.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(Node* parent, Node* node, Node* left, int hR0)
+{
+    std::lock_guard<SpinLock> leftLock(left->lock);
+    int hL = left->height.load(std::memory_order_relaxed);
+    if(hL - hR0 <= 1) {
+        return node;
+    }
+    Node* leftRight = left->right.load(std::memory_order_relaxed);
+    int hLL0 = heightOf(left->left.load(std::memory_order_relaxed));
+    int hLR0 = heightOf(leftRight);
+    if(hLL0 >= hLR0) {
+        return rotateRight_nl(parent, node, left, hR0, hLL0, leftRight, hLR0);
+    }
+    {
+        std::lock_guard<SpinLock> leftRightLock(leftRight->lock);
+        int hLR = leftRight->height.load(std::memory_order_relaxed);
+        if(hLL0 >= hLR) {
+            return rotateRight_nl(parent, node, left, hR0, hLL0, leftRight, hLR);
+        }
+        int hLRL = heightOf(leftRight->left.load(std::memory_order_relaxed));
+        int balance = hLL0 - hLRL;
+        if(balance >= -1 && balance <= 1) {
+            return rotateRightOverLeft_nl(parent, node, left, hR0, hLL0, leftRight, hLRL);
+        }
+    }
+    // The double rotation would leave left unbalanced; fix left first.
+    return rebalanceToLeft_nl(node, left, leftRight, hLL0);
+}
+
+/**
+* Mirror image of rebalanceToRight_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(Node* parent, Node* node, Node* right, int hL0)
+{
+    std::lock_guard<SpinLock> rightLock(right->lock);
+    int hR = right->height.load(std::memory_order_relaxed);
+    if(hL0 - hR >= -1) {
+        return node;
+    }
+    Node* rightLeft = right->left.load(std::memory_order_relaxed);
+    int hRL0 = heightOf(rightLeft);
+    int hRR0 = heightOf(right->right.load(std::memory_order_relaxed));
+    if(hRR0 >= hRL0) {
+        return rotateLeft_nl(parent, node, hL0, right, rightLeft, hRL0, hRR0);
+    }
+    {
+        std::lock_guard<SpinLock> rightLeftLock(rightLeft->lock);
+        int hRL = rightLeft->height.load(std::memory_order_relaxed);
+        if(hRR0 >= hRL) {
+            return rotateLeft_nl(parent, node, hL0, right, rightLeft, hRL, hRR0);
+        }
+        int hRLR = heightOf(rightLeft->right.load(std::memory_order_relaxed));
+        int balance = hRR0 - hRLR;
+        if(balance >= -1 && balance <= 1) {
+            return rotateLeftOverRight_nl(parent, node, hL0, right, rightLeft, hRR0, hRLR);
+        }
+    }
+    return rebalanceToRight_nl(node, right, rightLeft, hRR0);
+}
+
+/**
+* Rotates left up over node, with parent, node and left locked. node
+* shrinks, so readers inside it are sent back while SHRINKING is set.
+* Returns the next node to look at.
+*
+* If node still needs work after the rotation, it is returned and left
+* keeps the old height of node for now. The repair walk comes back up
+* through left, sees that height is wrong and carries the change on to
+* parent. Had left got its real height here, that walk would stop at left
+* and parent would never learn that its subtree changed height.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateRight_nl(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLR)
+{
+    uint64_t nodeVersion = node->version.load(std::memory_order_relaxed);
+    int hN = node->height.load(std::memory_order_relaxed);
+    Node* parentLeft = parent->left.load(std::memory_order_relaxed);
+
+    node->version.store(nodeVersion | SHRINKING, std::memory_order_release);
+
+    node->left.store(leftRight, std::memory_order_release);
+    if(leftRight != NULL) {
+        leftRight->parent.store(node, std::memory_order_release);
+    }
+    left->right.store(node, std::memory_order_release);
+    node->parent.store(left, std::memory_order_release);
+    if(parentLeft == node) {
+        parent->left.store(left, std::memory_order_release);
+    } else {
+        parent->right.store(left, std::memory_order_release);
+    }
+    left->parent.store(parent, std::memory_order_release);
+
+    int hNRepl = 1 + (hLR > hR ? hLR : hR);
+    int balanceN = hLR - hR;
+    bool nodeNeedsWork = balanceN < -1 || balanceN > 1 ||
+        ((leftRight == NULL || hR == 0) && node->value.load(std::memory_order_relaxed) == NULL);
+    node->height.store(hNRepl, std::memory_order_relaxed);
+    left->height.store(nodeNeedsWork ? hN : 1 + (hLL > hNRepl ? hLL : hNRepl), std::memory_order_relaxed);
+
+    node->version.store(nodeVersion + VERSION_STEP, std::memory_order_release);
+
+    if(nodeNeedsWork) {
+        return node;
+    }
+    int balanceL = hLL - hNRepl;
+    if(balanceL < -1 || balanceL > 1) {
+        return left;
+    }
+    if(hLL == 0 && left->value.load(std::memory_order_relaxed) == NULL) {
+        return left;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Mirror image of rotateRight_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateLeft_nl(Node* parent, Node* node, int hL, Node* right, Node* rightLeft, int hRL, int hRR)
+{
+    uint64_t nodeVersion = node->version.load(std::memory_order_relaxed);
+    int hN = node->height.load(std::memory_order_relaxed);
+    Node* parentLeft = parent->left.load(std::memory_order_relaxed);
+
+    node->version.store(nodeVersion | SHRINKING, std::memory_order_release);
+
+    node->right.store(rightLeft, std::memory_order_release);
+    if(rightLeft != NULL) {
+        rightLeft->parent.store(node, std::memory_order_release);
+    }
+    right->left.store(node, std::memory_order_release);
+    node->parent.store(right, std::memory_order_release);
+    if(parentLeft == node) {
+        parent->left.store(right, std::memory_order_release);
+    } else {
+        parent->right.store(right, std::memory_order_release);
+    }
+    right->parent.store(parent, std::memory_order_release);
+
+    int hNRepl = 1 + (hL > hRL ? hL : hRL);
+    int balanceN = hRL - hL;
+    bool nodeNeedsWork = balanceN < -1 || balanceN > 1 ||
+        ((rightLeft == NULL || hL == 0) && node->value.load(std::memory_order_relaxed) == NULL);
+    node->height.store(hNRepl, std::memory_order_relaxed);
+    right->height.store(nodeNeedsWork ? hN : 1 + (hNRepl > hRR ? hNRepl : hRR), std::memory_order_relaxed);
+
+    node->version.store(nodeVersion + VERSION_STEP, std::memory_order_release);
+
+    if(nodeNeedsWork) {
+        return node;
+    }
+    int balanceR = hRR - hNRepl;
+    if(balanceR < -1 || balanceR > 1) {
+        return right;
+    }
+    if(hRR == 0 && right->value.load(std::memory_order_relaxed) == NULL) {
+        return right;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Double rotation bringing leftRight up over left and node, with parent,
+* node, left and leftRight locked. Both node and left shrink.
+*
+* The paper skips this rotation when it would leave left as a routing node
+* with a missing child, and leaves node out of balance. Here it rotates
+* anyway and unlinks left next, so the tree always ends up balanced.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(Node* parent, Node* node, Node* left, int hR, int hLL, Node* leftRight, int hLRL)
+{
+    uint64_t nodeVersion = node->version.load(std::memory_order_relaxed);
+    int hN = node->height.load(std::memory_order_relaxed);
+    uint64_t leftVersion = left->version.load(std::memory_order_relaxed);
+    Node* parentLeft = parent->left.load(std::memory_order_relaxed);
+    Node* leftRightLeft = leftRight->left.load(std::memory_order_relaxed);
+    Node* leftRightRight = leftRight->right.load(std::memory_order_relaxed);
+    int hLRR = heightOf(leftRightRight);
+
+    node->version.store(nodeVersion | SHRINKING, std::memory_order_release);
+    left->version.store(leftVersion | SHRINKING, std::memory_order_release);
+
+    node->left.store(leftRightRight, std::memory_order_release);
+    if(leftRightRight != NULL) {
+        leftRightRight->parent.store(node, std::memory_order_release);
+    }
+    left->right.store(leftRightLeft, std::memory_order_release);
+    if(leftRightLeft != NULL) {
+        leftRightLeft->parent.store(left, std::memory_order_release);
+    }
+    leftRight->left.store(left, std::memory_order_release);
+    left->parent.store(leftRight, std::memory_order_release);
+    leftRight->right.store(node, std::memory_order_release);
+    node->parent.store(leftRight, std::memory_order_release);
+    if(parentLeft == node) {
+        parent->left.store(leftRight, std::memory_order_release);
+    } else {
+        parent->right.store(leftRight, std::memory_order_release);
+    }
+    leftRight->parent.store(parent, std::memory_order_release);
+
+    int hNRepl = 1 + (hLRR > hR ? hLRR : hR);
+    int hLRepl = 1 + (hLL > hLRL ? hLL : hLRL);
+    int balanceN = hLRR - hR;
+    bool nodeNeedsWork = balanceN < -1 || balanceN > 1 ||
+        ((leftRightRight == NULL || hR == 0) && node->value.load(std::memory_order_relaxed) == NULL);
+    bool leftNeedsWork = (leftRightLeft == NULL || hLL == 0) && left->value.load(std::memory_order_relaxed) == NULL;
+    node->height.store(hNRepl, std::memory_order_relaxed);
+    left->height.store(hLRepl, std::memory_order_relaxed);
+    leftRight->height.store((nodeNeedsWork || leftNeedsWork) ? hN : 1 + (hLRepl > hNRepl ? hLRepl : hNRepl),
+                            std::memory_order_relaxed);
+
+    node->version.store(nodeVersion + VERSION_STEP, std::memory_order_release);
+    left->version.store(leftVersion + VERSION_STEP, std::memory_order_release);
+
+    if(nodeNeedsWork) {
+        return node;
+    }
+    if(leftNeedsWork) {
+        return left;
+    }
+    int balanceLR = hLRepl - hNRepl;
+    if(balanceLR < -1 || balanceLR > 1) {
+        return leftRight;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft_nl().
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(Node* parent, Node* node, int hL, Node* right, Node* rightLeft, int hRR, int hRLR)
+{
+    uint64_t nodeVersion = node->version.load(std::memory_order_relaxed);
+    int hN = node->height.load(std::memory_order_relaxed);
+    uint64_t rightVersion = right->version.load(std::memory_order_relaxed);
+    Node* parentLeft = parent->left.load(std::memory_order_relaxed);
+    Node* rightLeftLeft = rightLeft->left.load(std::memory_order_relaxed);
+    Node* rightLeftRight = rightLeft->right.load(std::memory_order_relaxed);
+    int hRLL = heightOf(rightLeftLeft);
+
+    node->version.store(nodeVersion | SHRINKING, std::memory_order_release);
+    right->version.store(rightVersion | SHRINKING, std::memory_order_release);
+
+    node->right.store(rightLeftLeft, std::memory_order_release);
+    if(rightLeftLeft != NULL) {
+        rightLeftLeft->parent.store(node, std::memory_order_release);
+    }
+    right->left.store(rightLeftRight, std::memory_order_release);
+    if(rightLeftRight != NULL) {
+        rightLeftRight->parent.store(right, std::memory_order_release);
+    }
+    rightLeft->right.store(right, std::memory_order_release);
+    right->parent.store(rightLeft, std::memory_order_release);
+    rightLeft->left.store(node, std::memory_order_release);
+    node->parent.store(rightLeft, std::memory_order_release);
+    if(parentLeft == node) {
+        parent->left.store(rightLeft, std::memory_order_release);
+    } else {
+        parent->right.store(rightLeft, std::memory_order_release);
+    }
+    rightLeft->parent.store(parent, std::memory_order_release);
+
+    int hNRepl = 1 + (hL > hRLL ? hL : hRLL);
+    int hRRepl = 1 + (hRLR > hRR ? hRLR : hRR);
+    int balanceN = hRLL - hL;
+    bool nodeNeedsWork = balanceN < -1 || balanceN > 1 ||
+        ((rightLeftLeft == NULL || hL == 0) && node->value.load(std::memory_order_relaxed) == NULL);
+    bool rightNeedsWork = (rightLeftRight == NULL || hRR == 0) && right->value.load(std::memory_order_relaxed) == NULL;
+    node->height.store(hNRepl, std::memory_order_relaxed);
+    right->height.store(hRRepl, std::memory_order_relaxed);
+    rightLeft->height.store((nodeNeedsWork || rightNeedsWork) ? hN : 1 + (hNRepl > hRRepl ? hNRepl : hRRepl),
+                            std::memory_order_relaxed);
+
+    node->version.store(nodeVersion + VERSION_STEP, std::memory_order_release);
+    right->version.store(rightVersion + VERSION_STEP, std::memory_order_release);
+
+    if(nodeNeedsWork) {
+        return node;
+    }
+    if(rightNeedsWork) {
+        return right;
+    }
+    int balanceRL = hRRepl - hNRepl;
+    if(balanceRL < -1 || balanceRL > 1) {
+        return rightLeft;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* LEFT if key goes left of nodeKey, RIGHT if it goes right, 0 if equal.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& key, const Key& nodeKey)
+{
+    if(key < nodeKey) {
+        return LEFT;
+    }
+    return (nodeKey < key) ? RIGHT : 0;
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::heightOf(Node* node)
+{
+    return node == NULL ? 0 : node->height.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::canUnlink(Node* node)
+{
+    return node->left.load(std::memory_order_acquire) == NULL ||
+           node->right.load(std::memory_order_acquire) == NULL;
+}
+
+/**
+* Waits for the rotation that set SHRINKING on node to finish: spins a
+* little, then waits for the lock the rotating thread holds.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilNotChanging(Node* node)
+{
+    uint64_t version = node->version.load(std::memory_order_acquire);
+    if((version & SHRINKING) == 0) {
+        return;
+    }
+    for(int i = 0; i < SPIN_COUNT; ++i) {
+        if(node->version.load(std::memory_order_acquire) != version) {
+            return;
+        }
+    }
+    std::lock_guard<SpinLock> lock(node->lock);
+}
+
+/**
+* Helper for isBalanced(). Returns the height of node, or -1 if a stored
+* height is wrong or the subtrees of some node differ by more than one.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::checkedHeight(Node* node)
+{
+    if(node == NULL) {
+        return 0;
+    }
+    int left = checkedHeight(node->left.load());
+    int right = checkedHeight(node->right.load());
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1) {
+        return -1;
+    }
+    int height = 1 + (left > right ? left : right);
+    return height == node->height.load() ? height : -1;
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::freeSubtree(Node* node)
+{
+    if(node == NULL) {
+        return;
+    }
+    freeSubtree(node->left.load());
+    freeSubtree(node->right.load());
+    delete node;
+}
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::Node::Node(const Key& nodeKey, Node* parentNode, Value* nodeValue) :
+    key(nodeKey),
+    version(0),
+    left(NULL),
+    right(NULL),
+    value(nodeValue),
+    parent(parentNode),
+    height(1)
+{
+
+}
+
+/**
+* Frees the value, if the node still has one.
+*/
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::Node::~Node()
+{
+    delete value.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value>
+std::atomic<typename ConcurrentAVLTree<Key, Value>::Node*>& ConcurrentAVLTree<Key, Value>::Node::child(int dir)
+{
+    return dir == LEFT ? left : right;
+}
+
+#endif
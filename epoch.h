@@ -0,0 +1,293 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+* Epoch based reclamation for lock-free readers.
+*
+* A reader that follows pointers without taking locks holds an
+* EpochReclaimer::Guard for as long as it uses what it found. A writer that
+* unlinks an object hands it to retire() instead of deleting it. The object
+* is deleted once every thread that could still see it has let go of its
+* guard, which is checked cheaply through a global epoch counter: each guard
+* announces the epoch it started in, the epoch only moves on once every
+* active guard has caught up with it, and whatever was retired two epochs
+* ago can no longer be reached by anyone.
+*
+* There is one reclaimer per process, shared by every container that uses
+* it. Each thread gets a record the first time it takes a guard or retires
+* something. Records are reused by later threads, and whatever a thread
+* still had waiting when it exited is handed over to the survivors.
+*/
+class EpochReclaimer
+{
+    struct Record;
+
+public:
+    /**
+    * Keeps everything the current thread can still see alive while it
+    * exists. Guards nest; only the outermost one counts.
+    */
+    class Guard
+    {
+    public:
+        Guard();
+        ~Guard();
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+        Record* record_;
+    };
+
+    template<typename T>
+    static void retire(T* object);
+    static void collect();
+
+private:
+    struct Retired
+    {
+        void* object;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
+
+    // Per thread state. state is 0 while the thread holds no guard, and
+    // otherwise the epoch the guard started in, shifted left, plus one.
+    struct Record
+    {
+        Record() : state(0), inUse(true), next(NULL), depth(0), sinceCollect(0) { }
+        std::atomic<uint64_t> state;
+        std::atomic<bool> inUse;
+        Record* next;
+        unsigned depth;
+        size_t sinceCollect;
+        std::vector<Retired> limbo;
+    };
+
+    struct Domain
+    {
+        Domain() : epoch(2), records(NULL) { }
+        ~Domain();
+        std::atomic<uint64_t> epoch;
+        std::atomic<Record*> records;
+        std::mutex orphanMutex;
+        std::vector<Retired> orphans;
+    };
+
+    // Gives the record back when its thread exits.
+    struct ThreadSlot
+    {
+        ThreadSlot() : record(NULL) { }
+        ~ThreadSlot();
+        Record* record;
+    };
+
+    static Domain& domain();
+    static Record* threadRecord();
+    static void retireObject(void* object, void (*destroy)(void*));
+    static void collect(Record* record);
+    static bool tryAdvance(Domain& domain);
+    static void freeExpired(std::vector<Retired>& list, uint64_t epoch);
+
+    template<typename T>
+    static void destroyObject(void* object);
+
+    // A thread tries to move the epoch on after this many retire() calls.
+    static const size_t COLLECT_INTERVAL = 64;
+};
+
+/*
+  ---------------------------------------
+  Begin implementations for EpochReclaimer
+  ---------------------------------------
+*/
+
+/**
+* Announces the current epoch for this thread. The epoch is read again
+* after the announcement, so a thread that was slow to announce never
+* claims an epoch that other threads already consider finished.
+*/
+inline EpochReclaimer::Guard::Guard() :
+    record_(threadRecord())
+{
+    if(record_->depth++ > 0) {
+        return;
+    }
+    Domain& shared = domain();
+    while(true) {
+        uint64_t epoch = shared.epoch.load();
+        record_->state.store((epoch << 1) | 1);
+        if(shared.epoch.load() == epoch) {
+            break;
+        }
+    }
+}
+
+inline EpochReclaimer::Guard::~Guard()
+{
+    if(--record_->depth == 0) {
+        record_->state.store(0, std::memory_order_release);
+    }
+}
+
+/**
+* Deletes object once no guard that might have seen it is left. The
+* object must already be unreachable for new readers.
+*/
+template<typename T>
+void EpochReclaimer::retire(T* object)
+{
+    retireObject(object, &destroyObject<T>);
+}
+
+/**
+* Tries to move the epoch on and frees what this thread retired that has
+* become unreachable.
+*/
+inline void EpochReclaimer::collect()
+{
+    collect(threadRecord());
+}
+
+/**
+* The process wide state, created on first use. By the time it is
+* destroyed every thread has exited, so everything left can go.
+*/
+inline EpochReclaimer::Domain& EpochReclaimer::domain()
+{
+    static Domain shared;
+    return shared;
+}
+
+inline EpochReclaimer::Domain::~Domain()
+{
+    Record* record = records.load();
+    while(record != NULL) {
+        Record* next = record->next;
+        freeExpired(record->limbo, UINT64_MAX);
+        delete record;
+        record = next;
+    }
+    freeExpired(orphans, UINT64_MAX);
+}
+
+/**
+* Returns the calling thread's record, claiming a free one or adding a new
+* one to the list the first time.
+*/
+inline EpochReclaimer::Record* EpochReclaimer::threadRecord()
+{
+    static thread_local ThreadSlot slot;
+    if(slot.record != NULL) {
+        return slot.record;
+    }
+    Domain& shared = domain();
+    for(Record* record = shared.records.load(); record != NULL; record = record->next) {
+        bool expected = false;
+        if(!record->inUse.load() && record->inUse.compare_exchange_strong(expected, true)) {
+            slot.record = record;
+            return record;
+        }
+    }
+    Record* record = new Record;
+    record->next = shared.records.load();
+    while(!shared.records.compare_exchange_weak(record->next, record)) {
+    }
+    slot.record = record;
+    return record;
+}
+
+/**
+* Hands what the exiting thread still had waiting to the other threads and
+* frees its record for reuse.
+*/
+inline EpochReclaimer::ThreadSlot::~ThreadSlot()
+{
+    if(record == NULL) {
+        return;
+    }
+    Domain& shared = domain();
+    if(!record->limbo.empty()) {
+        std::lock_guard<std::mutex> lock(shared.orphanMutex);
+        shared.orphans.insert(shared.orphans.end(), record->limbo.begin(), record->limbo.end());
+        record->limbo.clear();
+    }
+    record->state.store(0);
+    record->depth = 0;
+    record->sinceCollect = 0;
+    record->inUse.store(false);
+}
+
+inline void EpochReclaimer::retireObject(void* object, void (*destroy)(void*))
+{
+    Record* record = threadRecord();
+    Retired retired = { object, destroy, domain().epoch.load() };
+    record->limbo.push_back(retired);
+    if(++record->sinceCollect >= COLLECT_INTERVAL) {
+        collect(record);
+    }
+}
+
+/**
+* Frees whatever was retired at least two epochs ago, first by this
+* thread and then, if no other thread is at it, by threads that exited.
+*/
+inline void EpochReclaimer::collect(Record* record)
+{
+    Domain& shared = domain();
+    record->sinceCollect = 0;
+    tryAdvance(shared);
+    uint64_t epoch = shared.epoch.load();
+    freeExpired(record->limbo, epoch);
+
+    std::unique_lock<std::mutex> lock(shared.orphanMutex, std::try_to_lock);
+    if(lock.owns_lock()) {
+        freeExpired(shared.orphans, epoch);
+    }
+}
+
+/**
+* Moves the epoch on by one if every thread inside a guard has announced
+* the current epoch. Returns false if some thread is still behind.
+*/
+inline bool EpochReclaimer::tryAdvance(Domain& shared)
+{
+    uint64_t epoch = shared.epoch.load();
+    for(Record* record = shared.records.load(); record != NULL; record = record->next) {
+        uint64_t state = record->state.load();
+        if((state & 1) != 0 && (state >> 1) != epoch) {
+            return false;
+        }
+    }
+    return shared.epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/**
+* Frees the objects in list retired two or more epochs before epoch and
+* keeps the rest.
+*/
+inline void EpochReclaimer::freeExpired(std::vector<Retired>& list, uint64_t epoch)
+{
+    size_t kept = 0;
+    for(size_t i = 0; i < list.size(); ++i) {
+        if(epoch == UINT64_MAX || list[i].epoch + 2 <= epoch) {
+            list[i].destroy(list[i].object);
+        } else {
+            list[kept++] = list[i];
+        }
+    }
+    list.resize(kept);
+}
+
+template<typename T>
+void EpochReclaimer::destroyObject(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* An immutable snapshot of a search tree, made by freeze().
+*
+* The keys are stored in one contiguous array in Eytzinger (breadth first)
+* order: the root is at index 1 and the children of index k are at 2k and
+* 2k + 1. The values live in a parallel array, so a lookup only touches keys
+* until it has found its position. The top levels of the implicit tree share
+* a few cache lines, and all the descendants a search can reach a few levels
+* further down are adjacent, so they are prefetched while the current level
+* is compared. The descent itself has no data dependent branches: every step
+* is k = 2k + (key < x).
+*
+* Compare orders the keys, and must match the order of the items the
+* snapshot is built from.
+*
+* Indices below are 1-based as in the layout; slot k is stored at k - 1.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    FrozenTree();
+    template<typename ForwardIt>
+    FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    class const_iterator;
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+
+    size_t size() const;
+    bool empty() const;
+    size_t bytes() const;
+
+    /**
+    * A bidirectional iterator over the snapshot in key order. Keys and
+    * values are kept apart, so the items it yields are pairs of references
+    * built on the fly rather than references to stored pairs.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key&, const Value&> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type reference;
+
+        // Lets it->first work although there is no pair to point to.
+        class pointer
+        {
+        public:
+            explicit pointer(const value_type& item) : item_(item) { }
+            const value_type* operator->() const { return &item_; }
+        private:
+            value_type item_;
+        };
+
+        const_iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    private:
+        friend class FrozenTree<Key, Value, Compare>;
+        const_iterator(size_t index, const FrozenTree<Key, Value, Compare>* tree);
+
+        size_t index_;  // 0 is end()
+        const FrozenTree<Key, Value, Compare>* tree_;
+    };
+
+private:
+    size_t lowerBoundIndex(const Key& key, bool strict) const;
+    size_t firstIndex() const;
+    size_t lastIndex() const;
+    size_t nextIndex(size_t k) const;
+    size_t prevIndex(size_t k) const;
+    static size_t firstIndexOf(size_t n);
+    static size_t nextIndexOf(size_t k, size_t n);
+    void prefetch(size_t k) const;
+
+    // Number of keys that fit in one cache line. The descendants of k that
+    // are this many levels down sit next to each other, starting at
+    // k * KEYS_PER_LINE, so that is where prefetch() looks.
+    static const size_t CACHE_LINE = 64;
+    static const size_t KEYS_PER_LINE =
+        sizeof(Key) >= CACHE_LINE ? 1 : CACHE_LINE / sizeof(Key);
+
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
+    Compare comp_;
+};
+
+template <class Key, class Value, class NodeType, class Compare, class Counters>
+class BinarySearchTree;
+
+template <class Key, class Value, class NodeType, class Compare, class Counters>
+FrozenTree<Key, Value, Compare> freeze(const BinarySearchTree<Key, Value, NodeType, Compare, Counters>& tree);
+
+/*
+  ---------------------------------------
+  Begin implementations for FrozenTree
+  ---------------------------------------
+*/
+
+/**
+* Constructs an empty snapshot.
+*/
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree()
+{
+
+}
+
+/**
+* Builds a snapshot out of the pairs in [first, last), which must be sorted
+* by strictly increasing key, or std::invalid_argument is thrown. The
+* range is walked once to find the items and once more, in layout order,
+* to copy them.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    comp_(comp)
+{
+    std::vector<ForwardIt> items;
+    for(ForwardIt it = first; it != last; ++it) {
+        if(!items.empty() && !comp_(items.back()->first, it->first)) {
+            throw std::invalid_argument("FrozenTree: keys are not strictly increasing");
+        }
+        items.push_back(it);
+    }
+
+    // An in-order walk over the layout visits slots in key order, which
+    // tells which item every slot gets.
+    size_t n = items.size();
+    std::vector<size_t> itemOf(n + 1);
+    size_t rank = 0;
+    for(size_t k = (n == 0) ? 0 : firstIndexOf(n); k != 0; k = nextIndexOf(k, n)) {
+        itemOf[k] = rank++;
+    }
+
+    keys_.reserve(n);
+    values_.reserve(n);
+    for(size_t k = 1; k <= n; ++k) {
+        keys_.push_back(items[itemOf[k]]->first);
+        values_.push_back(items[itemOf[k]]->second);
+    }
+}
+
+/**
+* Returns an iterator to the smallest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(firstIndex(), this);
+}
+
+/**
+* Returns an iterator past the largest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    size_t k = lowerBoundIndex(key, false);
+    if(k != 0 && comp_(key, keys_[k - 1])) {
+        k = 0;
+    }
+    return const_iterator(k, this);
+}
+
+/**
+* Returns an iterator to the first key not less than key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundIndex(key, false), this);
+}
+
+/**
+* Returns an iterator to the first key greater than key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundIndex(key, true), this);
+}
+
+/**
+* Returns the number of items.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return keys_.size();
+}
+
+/**
+* Returns true if the snapshot holds no items.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return keys_.empty();
+}
+
+/**
+* Returns the memory taken by the two arrays, not counting anything the
+* keys or values own themselves.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::bytes() const
+{
+    return keys_.capacity() * sizeof(Key) + values_.capacity() * sizeof(Value);
+}
+
+/**
+* Descends the implicit tree without branching on the comparisons: going
+* right appends a 1 bit to k, going left a 0 bit. Once k has fallen off the
+* bottom, the answer is the last node where the search went left, which is
+* found by dropping the trailing 1 bits and the 0 bit before them.
+* Returns 0 if every key is smaller (or not greater, if strict).
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::lowerBoundIndex(const Key& key, bool strict) const
+{
+    size_t n = keys_.size();
+    const Key* keys = keys_.data();
+    size_t k = 1;
+    if(strict) {
+        while(k <= n) {
+            prefetch(k);
+            k = 2 * k + !comp_(key, keys[k - 1]);
+        }
+    } else {
+        while(k <= n) {
+            prefetch(k);
+            k = 2 * k + comp_(keys[k - 1], key);
+        }
+    }
+#if defined(__GNUC__)
+    k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+#else
+    while(k & 1) {
+        k >>= 1;
+    }
+    k >>= 1;
+#endif
+    return k;
+}
+
+/**
+* Asks for the cache line holding the descendants of k a few levels down.
+* The address may lie past the end of the array; prefetches never fault,
+* and the arithmetic is done on integers so no pointer leaves the array.
+*/
+template<class Key, class Value, class Compare>
+void FrozenTree<Key, Value, Compare>::prefetch(size_t k) const
+{
+#if defined(__GNUC__)
+    uintptr_t base = reinterpret_cast<uintptr_t>(keys_.data());
+    __builtin_prefetch(reinterpret_cast<const void*>(base + (k * KEYS_PER_LINE - 1) * sizeof(Key)));
+#else
+    (void)k;
+#endif
+}
+
+/**
+* Layout index of the smallest key, or 0 if there is none.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::firstIndex() const
+{
+    return keys_.empty() ? 0 : firstIndexOf(keys_.size());
+}
+
+/**
+* Layout index of the largest key, or 0 if there is none.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::lastIndex() const
+{
+    size_t n = keys_.size();
+    if(n == 0) {
+        return 0;
+    }
+    size_t k = 1;
+    while(2 * k + 1 <= n) {
+        k = 2 * k + 1;
+    }
+    return k;
+}
+
+/**
+* In-order successor of slot k, or 0 after the last one.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::nextIndex(size_t k) const
+{
+    return nextIndexOf(k, keys_.size());
+}
+
+/**
+* Layout index of the smallest of n keys: the leftmost slot, reached by
+* going left from the root as long as there is a left child.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::firstIndexOf(size_t n)
+{
+    size_t k = 1;
+    while(2 * k <= n) {
+        k = 2 * k;
+    }
+    return k;
+}
+
+/**
+* In-order successor of slot k among n slots, or 0 after the last one: the
+* smallest key of the right subtree, or else the first ancestor that k is
+* left of. Going up out of a right child shifts a 1 bit off k.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::nextIndexOf(size_t k, size_t n)
+{
+    if(2 * k + 1 <= n) {
+        k = 2 * k + 1;
+        while(2 * k <= n) {
+            k = 2 * k;
+        }
+        return k;
+    }
+    while(k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+}
+
+/**
+* In-order predecessor of slot k, or 0 before the first one. Mirrors
+* nextIndexOf(): the largest key of the left subtree, or else the first
+* ancestor that k is right of.
+*/
+template<class Key, class Value, class Compare>
+size_t FrozenTree<Key, Value, Compare>::prevIndex(size_t k) const
+{
+    size_t n = keys_.size();
+    if(2 * k <= n) {
+        k = 2 * k;
+        while(2 * k + 1 <= n) {
+            k = 2 * k + 1;
+        }
+        return k;
+    }
+    while(k != 0 && (k & 1) == 0) {
+        k >>= 1;
+    }
+    return k >> 1;
+}
+
+/*
+  ---------------------------------------------
+  Begin implementations for the const_iterator
+  ---------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    index_(0),
+    tree_(NULL)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator(size_t index, const FrozenTree<Key, Value, Compare>* tree) :
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+/**
+* Returns the key and value of the current item.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator::reference
+FrozenTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return reference(tree_->keys_[index_ - 1], tree_->values_[index_ - 1]);
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator::pointer
+FrozenTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Iterators are equal if they refer to the same slot.
+*/
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+/**
+* Advances to the next key, in amortized constant time.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator& FrozenTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = tree_->nextIndex(index_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous key; from end() that is the largest key.
+*/
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator& FrozenTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = (index_ == 0) ? tree_->lastIndex() : tree_->prevIndex(index_);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator FrozenTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/**
+* Returns a read-only copy of tree (a BinarySearchTree, AVLTree or one of
+* their variants) laid out for fast lookups. Later changes to the tree do
+* not show up in it.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+FrozenTree<Key, Value, Compare> freeze(const BinarySearchTree<Key, Value, NodeType, Compare, Counters>& tree)
+{
+    return FrozenTree<Key, Value, Compare>(tree.begin(), tree.end(), tree.key_comp());
+}
+
+#endif
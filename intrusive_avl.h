@@ -0,0 +1,592 @@
+#ifndef INTRUSIVE_AVL_H
+#define INTRUSIVE_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include "avlbst.h"
+
+/**
+* The links an object needs to sit in an IntrusiveAVLTree. A type that
+* should be kept in such a tree derives from AVLHook<T>, with T the type
+* itself. An object can be in as many trees at once as it has hooks; give
+* each hook its own Tag type to tell them apart:
+*
+*     struct ById { };
+*     struct ByDeadline { };
+*     struct Job : AVLHook<Job, ById>, AVLHook<Job, ByDeadline> { ... };
+*
+* Copying an object does not copy its links. The copy starts out in no
+* tree, and assigning to an object that is in a tree leaves it there.
+*/
+template <typename T, typename Tag = void>
+class AVLHook
+{
+public:
+    AVLHook() : parent_(NULL), left_(NULL), right_(NULL), balance_(0) { }
+    AVLHook(const AVLHook&) : parent_(NULL), left_(NULL), right_(NULL), balance_(0) { }
+    AVLHook& operator=(const AVLHook&) { return *this; }
+
+    // The links and balance, used by AVLAlgorithms and NodeLinks.
+    AVLHook* getParent() const { return parent_; }
+    AVLHook* getLeft() const { return left_; }
+    AVLHook* getRight() const { return right_; }
+    void setParent(AVLHook* parent) { parent_ = parent; }
+    void setLeft(AVLHook* left) { left_ = left; }
+    void setRight(AVLHook* right) { right_ = right; }
+
+    int8_t getBalance() const { return balance_; }
+    void setBalance(int8_t balance) { balance_ = balance; }
+    void updateBalance(int8_t diff) { balance_ += diff; }
+
+    // No subtree sizes are kept.
+    static const bool hasSubtreeSize = false;
+    void updateSubtreeSize() { }
+    void swapSubtreeSize(AVLHook*) { }
+
+private:
+    AVLHook* parent_;
+    AVLHook* left_;
+    AVLHook* right_;
+    int8_t balance_;
+};
+
+/**
+* An AVL tree over objects the caller owns. Instead of copying each key
+* and value into a node it allocates, the tree links the objects
+* themselves together through the AVLHook they carry, so inserting and
+* removing never allocate, and an object can be removed in O(log n) given
+* only a reference to it, without looking up its key first.
+*
+* The key of an object is the member KeyField points to, compared with
+* Compare. It must not change while the object is in the tree. The tree
+* never creates, copies or destroys an object; the caller has to keep each
+* one alive, and at the same address, until it has been removed again or
+* the tree has been cleared or destroyed.
+*
+* The balancing is the same code AVLTree uses, see AVLAlgorithms in
+* avlbst.h.
+*/
+template <typename T, typename Key, Key T::*KeyField, typename Compare = std::less<Key>, typename Tag = void>
+class IntrusiveAVLTree
+{
+public:
+    typedef AVLHook<T, Tag> Hook;
+
+    template<bool IsConst>
+    class basic_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, const T*, T*>::type pointer;
+        typedef typename std::conditional<IsConst, const T&, T&>::type reference;
+
+        basic_iterator();
+        // An iterator converts to a const_iterator.
+        basic_iterator(const basic_iterator<false>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const basic_iterator& rhs) const;
+        bool operator!=(const basic_iterator& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
+
+    private:
+        friend class IntrusiveAVLTree;
+        friend class basic_iterator<true>;
+        basic_iterator(Hook* current, const IntrusiveAVLTree* tree);
+
+        Hook* current_;
+        const IntrusiveAVLTree* tree_;
+    };
+
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+
+    explicit IntrusiveAVLTree(const Compare& comp = Compare());
+    ~IntrusiveAVLTree();
+
+    std::pair<iterator, bool> insert(T& item);
+    void remove(T& item);
+    T* remove(const Key& key);
+    void clear();
+
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    iterator iterator_to(T& item);
+    const_iterator iterator_to(const T& item) const;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    Compare key_comp() const;
+
+private:
+    // Objects are owned by the caller, so the tree cannot be copied.
+    IntrusiveAVLTree(const IntrusiveAVLTree&);
+    IntrusiveAVLTree& operator=(const IntrusiveAVLTree&);
+
+    static Hook* hookOf(T& item);
+    static T* itemOf(Hook* hook);
+    static const Key& keyOf(const Hook* hook);
+
+    Hook* internalFind(const Key& key) const;
+    Hook* boundNode(const Key& key, bool strict) const;
+    int checkedHeight(const Hook* node) const;
+
+    Hook* root_;
+    size_t size_;
+    Compare comp_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for IntrusiveAVLTree::basic_iterator
+  ---------------------------------------------
+*/
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::basic_iterator() :
+    current_(NULL), tree_(NULL)
+{
+
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::basic_iterator(const basic_iterator<false>& other) :
+    current_(other.current_), tree_(other.tree_)
+{
+
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::basic_iterator(Hook* current, const IntrusiveAVLTree* tree) :
+    current_(current), tree_(tree)
+{
+
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>::reference
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator*() const
+{
+    return *itemOf(current_);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>::pointer
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator->() const
+{
+    return itemOf(current_);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+bool IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator==(const basic_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+bool IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator!=(const basic_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>&
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator++()
+{
+    current_ = NodeLinks<Hook>::next(current_);
+    return *this;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator++(int)
+{
+    basic_iterator old(*this);
+    ++*this;
+    return old;
+}
+
+/**
+* Stepping back from end() goes to the largest object.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>&
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator--()
+{
+    if(current_ == NULL) {
+        current_ = NodeLinks<Hook>::last(tree_->root_);
+    } else {
+        current_ = NodeLinks<Hook>::prev(current_);
+    }
+    return *this;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+template<bool IsConst>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::template basic_iterator<IsConst>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::basic_iterator<IsConst>::operator--(int)
+{
+    basic_iterator old(*this);
+    --*this;
+    return old;
+}
+
+/*
+  ---------------------------------------------
+  End implementations for IntrusiveAVLTree::basic_iterator
+  ---------------------------------------------
+*/
+
+/*
+  ---------------------------------------
+  Begin implementations for IntrusiveAVLTree
+  ---------------------------------------
+*/
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::IntrusiveAVLTree(const Compare& comp) :
+    root_(NULL), size_(0), comp_(comp)
+{
+
+}
+
+/**
+* The objects are left where they are; their hooks are just no longer
+* part of any tree.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::~IntrusiveAVLTree()
+{
+
+}
+
+/**
+* Links item into the tree. If an object with the same key is already in
+* the tree, item is left alone and the returned iterator points to the
+* other object. item must not be in this tree, or in any other tree through
+* the same hook.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+std::pair<typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator, bool>
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::insert(T& item)
+{
+    const Key& key = item.*KeyField;
+    Hook* parent = NULL;
+    Hook* curr = root_;
+    bool left = false;
+    while(curr != NULL) {
+        parent = curr;
+        if(comp_(key, keyOf(curr))) {
+            left = true;
+            curr = curr->getLeft();
+        } else if(comp_(keyOf(curr), key)) {
+            left = false;
+            curr = curr->getRight();
+        } else {
+            return std::make_pair(iterator(curr, this), false);
+        }
+    }
+
+    Hook* node = hookOf(item);
+    node->setParent(parent);
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    node->setBalance(0);
+    if(parent == NULL) {
+        root_ = node;
+    } else if(left) {
+        parent->setLeft(node);
+    } else {
+        parent->setRight(node);
+    }
+    ++size_;
+    NoTreeCounters counters;
+    AVLAlgorithms<Hook>::rebalanceAfterInsert(root_, counters, node);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Unlinks item, which must be in this tree. Only the path from item up to
+* the root is touched, so no key is compared.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+void IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::remove(T& item)
+{
+    Hook* node = hookOf(item);
+    NoTreeCounters counters;
+    AVLAlgorithms<Hook>::unlink(root_, counters, node);
+    --size_;
+    node->setParent(NULL);
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    node->setBalance(0);
+}
+
+/**
+* Unlinks the object with the given key and returns it, or returns NULL
+* if there is none.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+T* IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::remove(const Key& key)
+{
+    Hook* node = internalFind(key);
+    if(node == NULL) {
+        return NULL;
+    }
+    T* item = itemOf(node);
+    remove(*item);
+    return item;
+}
+
+/**
+* Forgets every object at once, in O(1). The hooks are not reset; insert()
+* sets them up again when an object is linked into a tree the next time.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+void IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::clear()
+{
+    root_ = NULL;
+    size_ = 0;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::find(const Key& key)
+{
+    return iterator(internalFind(key), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::find(const Key& key) const
+{
+    return const_iterator(internalFind(key), this);
+}
+
+/**
+* Returns the first object whose key is not less than key.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::lower_bound(const Key& key)
+{
+    return iterator(boundNode(key, false), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::lower_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, false), this);
+}
+
+/**
+* Returns the first object whose key is greater than key.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::upper_bound(const Key& key)
+{
+    return iterator(boundNode(key, true), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::upper_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, true), this);
+}
+
+/**
+* Returns an iterator to item, which must be in this tree, without a
+* lookup.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator_to(T& item)
+{
+    return iterator(hookOf(item), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator_to(const T& item) const
+{
+    return const_iterator(hookOf(const_cast<T&>(item)), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::begin()
+{
+    return iterator(NodeLinks<Hook>::first(root_), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::end()
+{
+    return iterator(NULL, this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::begin() const
+{
+    return const_iterator(NodeLinks<Hook>::first(root_), this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::const_iterator
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::end() const
+{
+    return const_iterator(NULL, this);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+bool IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+size_t IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::size() const
+{
+    return size_;
+}
+
+/**
+* Checks that every subtree is balanced and that the balance each hook
+* stores matches the heights of its subtrees.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+bool IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::isBalanced() const
+{
+    return checkedHeight(root_) >= 0;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+Compare IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::Hook*
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::hookOf(T& item)
+{
+    return static_cast<Hook*>(&item);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+T* IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::itemOf(Hook* hook)
+{
+    return static_cast<T*>(hook);
+}
+
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+const Key& IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::keyOf(const Hook* hook)
+{
+    return static_cast<const T*>(hook)->*KeyField;
+}
+
+/**
+* Returns the hook of the object with the given key, or NULL. Like
+* BinarySearchTree::internalFind, both comparisons are made on every step
+* so the next child is picked without a branch.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::Hook*
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::internalFind(const Key& key) const
+{
+    Hook* curr = root_;
+    while(curr != NULL) {
+        bool less = comp_(key, keyOf(curr));
+        bool greater = comp_(keyOf(curr), key);
+        if(!less && !greater) {
+            return curr;
+        }
+        curr = less ? curr->getLeft() : curr->getRight();
+    }
+    return NULL;
+}
+
+/**
+* Returns the first hook whose key is greater than key (strict) or not
+* less than key, or NULL if there is none.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+typename IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::Hook*
+IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::boundNode(const Key& key, bool strict) const
+{
+    Hook* result = NULL;
+    Hook* curr = root_;
+    while(curr != NULL) {
+        bool goLeft = strict ? comp_(key, keyOf(curr)) : !comp_(keyOf(curr), key);
+        if(goLeft) {
+            result = curr;
+            curr = curr->getLeft();
+        } else {
+            curr = curr->getRight();
+        }
+    }
+    return result;
+}
+
+/**
+* Returns the height of the subtree at node, or -1 if it is out of balance
+* or a stored balance is wrong.
+*/
+template<typename T, typename Key, Key T::*KeyField, typename Compare, typename Tag>
+int IntrusiveAVLTree<T, Key, KeyField, Compare, Tag>::checkedHeight(const Hook* node) const
+{
+    if(node == NULL) {
+        return 0;
+    }
+    int left = checkedHeight(node->getLeft());
+    int right = checkedHeight(node->getRight());
+    if(left < 0 || right < 0 || right - left != node->getBalance() || right - left > 1 || left - right > 1) {
+        return -1;
+    }
+    return 1 + (left > right ? left : right);
+}
+
+/*
+  ---------------------------------------
+  End implementations for IntrusiveAVLTree
+  ---------------------------------------
+*/
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Compile with -DBST_HEAP_NODES to fall back to one ::operator new per node.
+// This is only meant for benchmarking the pool against plain heap allocation.
+
+/**
+* A slab allocator for the nodes of a single search tree.
+*
+* Slots of a fixed size are carved out of large contiguous chunks, so nodes
+* that are inserted together end up next to each other in memory. Slots that
+* are handed back with deallocate() are recycled through an intrusive free
+* list before any new chunk is requested. release() drops every chunk at once,
+* which lets a tree whose items need no destructor throw itself away without
+* visiting a single node.
+*
+* The chunks a pool carves up form its arena. Trees that hand nodes to each
+* other (AVLTree::split() and friends) do so without copying them: the
+* receiving pool adopts the arenas of the giving pool, and an arena is freed
+* once no pool refers to it any more. The free list of the giving pool moves
+* along with its arenas. A pool that lets go of an arena which other pools
+* still hold hands its free slots in that arena, and the part of its last
+* chunk it never used, back to the arena, and the next of the other pools
+* to run out of slots takes them. So a tree that is split off and cleared
+* over and over reuses the same memory instead of piling up chunks. Its
+* nodes must be destroyed one by one for that, though: holdsArenasAlone()
+* tells whether release() may skip them.
+*
+* A pool only ever adds chunks to its own arena, so pools that share arenas
+* can still be used from different threads. The slots handed back to an
+* arena are swapped in and out atomically as a whole list, the chunk list
+* of an arena is locked while it grows, and the byte count is atomic
+* because bytesReserved() of another pool reads it.
+*/
+class NodePool
+{
+public:
+    NodePool(size_t slotSize, size_t slotAlign);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* slot);
+    void release();
+    void adopt(NodePool& other);
+    bool holdsArenasAlone() const;
+
+    size_t slotSize() const;
+    size_t chunkCount() const;
+    size_t arenaCount() const;
+    size_t bytesReserved() const;
+
+    // True if release() really frees every slot, i.e. callers may skip the
+    // per-node walk when no destructors need to run.
+#ifdef BST_HEAP_NODES
+    static const bool releasesInBulk = false;
+#else
+    static const bool releasesInBulk = true;
+#endif
+
+private:
+    // Pools belong to exactly one tree, so they cannot be copied.
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    void grow();
+    bool reclaim();
+    void handBack();
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    // The chunks of one pool, shared with every pool that adopted them.
+    // Only the owner adds chunks, under mutex, which pools handing slots
+    // back take to find out which slots belong to the arena. handedBack
+    // holds the slots of pools that let go of the arena before the others.
+    struct Arena
+    {
+        Arena() : bytes(0), handedBack(NULL) { }
+        ~Arena();
+        std::mutex mutex;
+        std::vector<std::pair<char*, size_t> > chunks;
+        std::atomic<size_t> bytes;
+        std::atomic<FreeSlot*> handedBack;
+    };
+
+    // One chunk of an arena, for finding the arena a slot lies in.
+    struct Span
+    {
+        char* begin;
+        char* end;
+        size_t arena;
+        bool operator<(const Span& rhs) const { return begin < rhs.begin; }
+    };
+
+    void adoptArena(const std::shared_ptr<Arena>& arena);
+
+    // First chunk holds this many slots; each new chunk doubles the previous
+    // one until a chunk reaches MAX_CHUNK_BYTES.
+    static const size_t FIRST_CHUNK_SLOTS = 16;
+    static const size_t MAX_CHUNK_BYTES = 1 << 20;
+
+    size_t slotSize_;
+    size_t nextChunkSlots_;
+    char* cursor_;
+    char* chunkEnd_;
+    FreeSlot* freeList_;
+    // Free lists taken over from adopted pools, used once freeList_ runs
+    // out, so that adopt() does not have to walk them.
+    std::vector<FreeSlot*> spareLists_;
+    std::shared_ptr<Arena> arena_;
+    std::vector<std::shared_ptr<Arena> > adopted_;
+};
+
+/**
+* Constructs an empty pool. No memory is requested until the first allocate().
+* The slot size is rounded up so that every slot is suitably aligned and large
+* enough to hold a free list link.
+*/
+inline NodePool::NodePool(size_t slotSize, size_t slotAlign) :
+    slotSize_(slotSize < sizeof(FreeSlot) ? sizeof(FreeSlot) : slotSize),
+    nextChunkSlots_(FIRST_CHUNK_SLOTS),
+    cursor_(NULL),
+    chunkEnd_(NULL),
+    freeList_(NULL)
+{
+    if(slotAlign < alignof(FreeSlot)) {
+        slotAlign = alignof(FreeSlot);
+    }
+    slotSize_ = (slotSize_ + slotAlign - 1) / slotAlign * slotAlign;
+}
+
+/**
+* Destructor, which lets go of every arena (see release()). Whoever owns the
+* pool must already have destroyed the objects living in it.
+*/
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Returns uninitialized memory for one slot, preferring recycled slots:
+* its own, then those of adopted pools, then the unused part of the current
+* chunk, then slots other pools handed back to a shared arena.
+*/
+inline void* NodePool::allocate()
+{
+#ifdef BST_HEAP_NODES
+    return ::operator new(slotSize_);
+#else
+    if(freeList_ == NULL && !spareLists_.empty()) {
+        freeList_ = spareLists_.back();
+        spareLists_.pop_back();
+    }
+    if(freeList_ == NULL && cursor_ == chunkEnd_ && !reclaim()) {
+        grow();
+    }
+    if(freeList_ != NULL) {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+    void* slot = cursor_;
+    cursor_ += slotSize_;
+    return slot;
+#endif
+}
+
+/**
+* Hands a slot back to the pool. The object in it must already be destroyed.
+*/
+inline void NodePool::deallocate(void* slot)
+{
+#ifdef BST_HEAP_NODES
+    ::operator delete(slot);
+#else
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    freed->next = freeList_;
+    freeList_ = freed;
+#endif
+}
+
+/**
+* Drops every chunk, invalidating all outstanding slots, and resets the pool
+* so it can be used again. Chunks that other pools adopted live on until the
+* last of those pools lets go of them as well, and the free slots in them
+* are handed back for those pools to use. Slots still holding objects are
+* lost to everyone until then, so a pool that does not hold its arenas
+* alone should get every slot back through deallocate() first.
+*/
+inline void NodePool::release()
+{
+#ifndef BST_HEAP_NODES
+    handBack();
+#endif
+    arena_.reset();
+    adopted_.clear();
+    spareLists_.clear();
+    nextChunkSlots_ = FIRST_CHUNK_SLOTS;
+    cursor_ = NULL;
+    chunkEnd_ = NULL;
+    freeList_ = NULL;
+}
+
+/**
+* Makes the slots of other valid in this pool: they may be handed to
+* deallocate() here, and the memory behind them stays alive for as long as
+* this pool holds it, even if other is released. The free slots of other
+* move over to this pool. Both pools must have the same slot size.
+*/
+inline void NodePool::adopt(NodePool& other)
+{
+#ifndef BST_HEAP_NODES
+    if(&other == this) {
+        return;
+    }
+    if(other.arena_) {
+        adoptArena(other.arena_);
+    }
+    for(size_t i = 0; i < other.adopted_.size(); ++i) {
+        adoptArena(other.adopted_[i]);
+    }
+    if(other.freeList_ != NULL) {
+        spareLists_.push_back(other.freeList_);
+        other.freeList_ = NULL;
+    }
+    spareLists_.insert(spareLists_.end(), other.spareLists_.begin(), other.spareLists_.end());
+    other.spareLists_.clear();
+#endif
+}
+
+/**
+* True if no other pool holds any of the arenas of this one, so release()
+* frees every slot for good.
+*/
+inline bool NodePool::holdsArenasAlone() const
+{
+    if(arena_ && arena_.use_count() > 1) {
+        return false;
+    }
+    for(size_t i = 0; i < adopted_.size(); ++i) {
+        if(adopted_[i].use_count() > 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Adds one arena to the adopted ones unless the pool already holds it.
+*/
+inline void NodePool::adoptArena(const std::shared_ptr<Arena>& arena)
+{
+    if(arena == arena_) {
+        return;
+    }
+    for(size_t i = 0; i < adopted_.size(); ++i) {
+        if(adopted_[i] == arena) {
+            return;
+        }
+    }
+    adopted_.push_back(arena);
+}
+
+/**
+* Returns the size in bytes of a single slot, including padding.
+*/
+inline size_t NodePool::slotSize() const
+{
+    return slotSize_;
+}
+
+/**
+* Returns the number of chunks currently held by the pool.
+*/
+inline size_t NodePool::chunkCount() const
+{
+    return arena_ ? arena_->chunks.size() : 0;
+}
+
+/**
+* Returns the number of arenas the pool holds, its own included.
+*/
+inline size_t NodePool::arenaCount() const
+{
+    return adopted_.size() + (arena_ ? 1 : 0);
+}
+
+/**
+* Returns the bytes of every chunk the pool holds, including those of
+* adopted arenas, which other pools count as well. Free slots and the
+* part of the last chunk not handed out yet are included. Without the
+* slab pool (BST_HEAP_NODES) this is 0.
+*/
+inline size_t NodePool::bytesReserved() const
+{
+    size_t bytes = arena_ ? arena_->bytes.load(std::memory_order_relaxed) : 0;
+    for(size_t i = 0; i < adopted_.size(); ++i) {
+        bytes += adopted_[i]->bytes.load(std::memory_order_relaxed);
+    }
+    return bytes;
+}
+
+/**
+* Requests the next chunk from the heap and makes it the bump region.
+*/
+inline void NodePool::grow()
+{
+    if(!arena_) {
+        arena_ = std::make_shared<Arena>();
+    }
+    size_t bytes = nextChunkSlots_ * slotSize_;
+    std::lock_guard<std::mutex> lock(arena_->mutex);
+    arena_->chunks.reserve(arena_->chunks.size() + 1);
+    char* chunk = static_cast<char*>(::operator new(bytes));
+    arena_->chunks.push_back(std::make_pair(chunk, bytes));
+    arena_->bytes.store(arena_->bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    cursor_ = chunk;
+    chunkEnd_ = chunk + bytes;
+    if(bytes * 2 <= MAX_CHUNK_BYTES) {
+        nextChunkSlots_ *= 2;
+    }
+}
+
+/**
+* Takes the slots other pools handed back to one of the arenas this pool
+* holds, if there are any, as the new free list.
+*/
+inline bool NodePool::reclaim()
+{
+    if(arena_) {
+        freeList_ = arena_->handedBack.exchange(NULL);
+    }
+    for(size_t i = 0; freeList_ == NULL && i < adopted_.size(); ++i) {
+        freeList_ = adopted_[i]->handedBack.exchange(NULL);
+    }
+    return freeList_ != NULL;
+}
+
+/**
+* Called by release(). Sorts the free slots by the arena they lie in and
+* hands those in arenas other pools still hold back to the arena. The rest
+* go away with their arenas.
+*/
+inline void NodePool::handBack()
+{
+    std::vector<Arena*> shared;
+    if(arena_ && arena_.use_count() > 1) {
+        shared.push_back(arena_.get());
+    }
+    for(size_t i = 0; i < adopted_.size(); ++i) {
+        if(adopted_[i].use_count() > 1) {
+            shared.push_back(adopted_[i].get());
+        }
+    }
+    if(shared.empty()) {
+        return;
+    }
+
+    // The part of the current chunk never handed out is free too.
+    if(arena_ && arena_.use_count() > 1) {
+        for(; cursor_ != chunkEnd_; cursor_ += slotSize_) {
+            deallocate(cursor_);
+        }
+    }
+
+    // Every chunk of the shared arenas, by address, with its arena.
+    std::vector<Span> spans;
+    for(size_t a = 0; a < shared.size(); ++a) {
+        std::lock_guard<std::mutex> lock(shared[a]->mutex);
+        for(size_t c = 0; c < shared[a]->chunks.size(); ++c) {
+            Span span = { shared[a]->chunks[c].first, shared[a]->chunks[c].first + shared[a]->chunks[c].second, a };
+            spans.push_back(span);
+        }
+    }
+    std::sort(spans.begin(), spans.end());
+
+    std::vector<FreeSlot*> heads(shared.size(), NULL);
+    std::vector<FreeSlot*> tails(shared.size(), NULL);
+    spareLists_.push_back(freeList_);
+    freeList_ = NULL;
+    for(size_t l = 0; l < spareLists_.size(); ++l) {
+        FreeSlot* slot = spareLists_[l];
+        while(slot != NULL) {
+            FreeSlot* next = slot->next;
+            char* at = reinterpret_cast<char*>(slot);
+            Span key = { at, at, 0 };
+            std::vector<Span>::iterator span = std::upper_bound(spans.begin(), spans.end(), key);
+            if(span != spans.begin() && at < (--span)->end) {
+                size_t a = span->arena;
+                slot->next = heads[a];
+                heads[a] = slot;
+                if(tails[a] == NULL) {
+                    tails[a] = slot;
+                }
+            }
+            slot = next;
+        }
+    }
+    spareLists_.clear();
+
+    for(size_t a = 0; a < shared.size(); ++a) {
+        if(heads[a] == NULL) {
+            continue;
+        }
+        FreeSlot* old = shared[a]->handedBack.load();
+        do {
+            tails[a]->next = old;
+        } while(!shared[a]->handedBack.compare_exchange_weak(old, heads[a]));
+    }
+}
+
+/**
+* Frees the chunks once the last pool holding the arena lets go of it.
+*/
+inline NodePool::Arena::~Arena()
+{
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        ::operator delete(chunks[i].first);
+    }
+}
+
+#endif
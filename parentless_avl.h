@@ -0,0 +1,728 @@
+#ifndef PARENTLESS_AVL_H
+#define PARENTLESS_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "node_pool.h"
+
+/**
+* An AVL tree map whose nodes have no parent pointer. A node holds its
+* item and two child pointers and nothing else: the balance lives in the
+* low two bits of the left child pointer. For int keys and values that is
+* 24 bytes per node, against 40 for an AVLNode and 32 for a
+* CompactAVLNode.
+*
+* Without parents, whatever has to walk back up the tree remembers the
+* way down instead. insert() and remove() record the path they took in a
+* stack and fix the balances along it; an iterator keeps a stack of the
+* nodes whose left subtree it is in. AVL trees are never more than about
+* 1.44 log2(n) high, so a stack of MAX_HEIGHT entries is enough for any
+* tree that fits in memory.
+*
+* The price is in the iterators: they are a few hundred bytes, only go
+* forward, and are invalidated by every insert() and remove(), not just
+* by removing the item they point to.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ParentlessAVLTree
+{
+    struct Node;
+
+public:
+    // An AVL tree this high already has more than 2^44 nodes.
+    static const int MAX_HEIGHT = 64;
+
+    template<bool IsConst>
+    class basic_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst,
+            const value_type*, value_type*>::type pointer;
+        typedef typename std::conditional<IsConst,
+            const value_type&, value_type&>::type reference;
+
+        basic_iterator();
+        // An iterator converts to a const_iterator.
+        basic_iterator(const basic_iterator<false>& other);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const basic_iterator& rhs) const;
+        bool operator!=(const basic_iterator& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+
+    private:
+        friend class ParentlessAVLTree;
+        friend class basic_iterator<true>;
+        void pushLeftmost(Node* node);
+
+        // path_[depth_ - 1] is the current node, the entries below it the
+        // ancestors that come after it.
+        Node* path_[MAX_HEIGHT];
+        int depth_;
+    };
+
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+
+    explicit ParentlessAVLTree(const Compare& comp = Compare());
+    ~ParentlessAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    bool contains(const Key& key) const;
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+    Compare key_comp() const;
+
+    static size_t nodeSize();
+
+private:
+    // The tree owns its nodes through the pool, so it cannot be copied.
+    ParentlessAVLTree(const ParentlessAVLTree&);
+    ParentlessAVLTree& operator=(const ParentlessAVLTree&);
+
+    struct Node
+    {
+        template<typename... Args>
+        Node(Args&&... args) : item(std::forward<Args>(args)...)
+        {
+            links[0] = 0;
+            links[1] = 0;
+        }
+
+        // The children are kept in an array so that a lookup can pick
+        // the next one by index instead of with a branch. Only the left
+        // link carries balance bits, but masking both is harmless.
+        Node* child(bool right) const
+        {
+            return reinterpret_cast<Node*>(links[right] & ~BALANCE_BITS);
+        }
+        Node* left() const { return child(false); }
+        Node* right() const { return child(true); }
+        void setLeft(Node* node)
+        {
+            links[0] = reinterpret_cast<uintptr_t>(node) | (links[0] & BALANCE_BITS);
+        }
+        void setRight(Node* node)
+        {
+            links[1] = reinterpret_cast<uintptr_t>(node);
+        }
+        // Right subtree height minus left subtree height, -1, 0 or 1,
+        // stored as two bit two's complement.
+        int balance() const
+        {
+            return static_cast<int>((links[0] & BALANCE_BITS) ^ 2) - 2;
+        }
+        void setBalance(int balance)
+        {
+            links[0] = (links[0] & ~BALANCE_BITS) | (static_cast<uintptr_t>(balance) & BALANCE_BITS);
+        }
+
+        std::pair<const Key, Value> item;
+        uintptr_t links[2];
+    };
+
+    static const uintptr_t BALANCE_BITS = 3;
+
+    Node* descend(const Key& key, bool exact, Node** path, int& depth) const;
+    void replaceChild(Node* parent, bool wentRight, Node* child);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static Node* rebalance(Node* node, int balance, bool& heightChanged);
+    static int checkedHeight(const Node* node);
+    void destroyNode(Node* node);
+
+    Node* root_;
+    size_t size_;
+    Compare comp_;
+    NodePool pool_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for ParentlessAVLTree::basic_iterator
+  ---------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator() :
+    depth_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::basic_iterator(const basic_iterator<false>& other) :
+    depth_(other.depth_)
+{
+    for(int i = 0; i < depth_; ++i) {
+        path_[i] = other.path_[i];
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename ParentlessAVLTree<Key, Value, Compare>::template basic_iterator<IsConst>::reference
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator*() const
+{
+    return path_[depth_ - 1]->item;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename ParentlessAVLTree<Key, Value, Compare>::template basic_iterator<IsConst>::pointer
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator->() const
+{
+    return &path_[depth_ - 1]->item;
+}
+
+/**
+* Two iterators are equal if they are at the same node, or both at the
+* end.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+bool ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator==(const basic_iterator& rhs) const
+{
+    if(depth_ == 0 || rhs.depth_ == 0) {
+        return depth_ == rhs.depth_;
+    }
+    return path_[depth_ - 1] == rhs.path_[rhs.depth_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+bool ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator!=(const basic_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* The next node is the leftmost one in the right subtree if there is
+* one, and otherwise the nearest ancestor on the stack.
+*/
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename ParentlessAVLTree<Key, Value, Compare>::template basic_iterator<IsConst>&
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++()
+{
+    Node* current = path_[--depth_];
+    pushLeftmost(current->right());
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+typename ParentlessAVLTree<Key, Value, Compare>::template basic_iterator<IsConst>
+ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::operator++(int)
+{
+    basic_iterator old(*this);
+    ++*this;
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<bool IsConst>
+void ParentlessAVLTree<Key, Value, Compare>::basic_iterator<IsConst>::pushLeftmost(Node* node)
+{
+    while(node != NULL) {
+        path_[depth_++] = node;
+        node = node->left();
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for ParentlessAVLTree::basic_iterator
+  ---------------------------------------------
+*/
+
+/*
+  ---------------------------------------
+  Begin implementations for ParentlessAVLTree
+  ---------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+ParentlessAVLTree<Key, Value, Compare>::ParentlessAVLTree(const Compare& comp) :
+    root_(NULL), size_(0), comp_(comp), pool_(sizeof(Node), alignof(Node))
+{
+    static_assert(alignof(Node) > BALANCE_BITS, "no spare pointer bits for the balance");
+}
+
+template<typename Key, typename Value, typename Compare>
+ParentlessAVLTree<Key, Value, Compare>::~ParentlessAVLTree()
+{
+    clear();
+}
+
+/**
+* Inserts the item unless its key is already there, and returns whether
+* it did. An iterator would take a second descent to build, so none is
+* returned. The way down is kept on a stack; going back up it, each
+* node's balance moves towards the side that grew, until a node ends up
+* balanced or one rotation restores the height the subtree had before.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ParentlessAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Node* path[MAX_HEIGHT];
+    bool wentRight[MAX_HEIGHT];
+    int depth = 0;
+    Node* curr = root_;
+    while(curr != NULL) {
+        if(comp_(keyValuePair.first, curr->item.first)) {
+            path[depth] = curr;
+            wentRight[depth++] = false;
+            curr = curr->left();
+        } else if(comp_(curr->item.first, keyValuePair.first)) {
+            path[depth] = curr;
+            wentRight[depth++] = true;
+            curr = curr->right();
+        } else {
+            return false;
+        }
+    }
+
+    Node* node = new (pool_.allocate()) Node(keyValuePair);
+    ++size_;
+    if(depth == 0) {
+        root_ = node;
+    } else {
+        replaceChild(path[depth - 1], wentRight[depth - 1], node);
+    }
+
+    for(int i = depth - 1; i >= 0; --i) {
+        Node* parent = path[i];
+        int balance = parent->balance() + (wentRight[i] ? 1 : -1);
+        if(balance == 0) {
+            parent->setBalance(0);
+            break;
+        }
+        if(balance == 1 || balance == -1) {
+            parent->setBalance(balance);
+            continue;
+        }
+        bool heightChanged;
+        Node* top = rebalance(parent, balance, heightChanged);
+        if(i == 0) {
+            root_ = top;
+        } else {
+            replaceChild(path[i - 1], wentRight[i - 1], top);
+        }
+        break;
+    }
+    return true;
+}
+
+/**
+* Removes the item with the given key, if there is one. A node with two
+* children is replaced by its successor, which is found by carrying on
+* down the same stack. Going back up, every node whose subtree lost
+* height is rebalanced, until one keeps its height.
+*/
+template<typename Key, typename Value, typename Compare>
+void ParentlessAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Node* path[MAX_HEIGHT];
+    bool wentRight[MAX_HEIGHT];
+    int depth = 0;
+    Node* curr = root_;
+    while(curr != NULL) {
+        bool less = comp_(key, curr->item.first);
+        if(!less && !comp_(curr->item.first, key)) {
+            break;
+        }
+        path[depth] = curr;
+        wentRight[depth++] = !less;
+        curr = less ? curr->left() : curr->right();
+    }
+    if(curr == NULL) {
+        return;
+    }
+
+    Node* removed = curr;
+    if(removed->left() != NULL && removed->right() != NULL) {
+        //The successor takes the removed node's place, and its own old
+        //place becomes the one that loses a node.
+        int removedAt = depth;
+        path[depth] = removed;
+        wentRight[depth++] = true;
+        Node* successor = removed->right();
+        while(successor->left() != NULL) {
+            path[depth] = successor;
+            wentRight[depth++] = false;
+            successor = successor->left();
+        }
+        replaceChild(path[depth - 1], wentRight[depth - 1], successor->right());
+        successor->setLeft(removed->left());
+        successor->setRight(removed->right());
+        successor->setBalance(removed->balance());
+        if(removedAt == 0) {
+            root_ = successor;
+        } else {
+            replaceChild(path[removedAt - 1], wentRight[removedAt - 1], successor);
+        }
+        path[removedAt] = successor;
+    } else {
+        Node* child = removed->left() != NULL ? removed->left() : removed->right();
+        if(depth == 0) {
+            root_ = child;
+        } else {
+            replaceChild(path[depth - 1], wentRight[depth - 1], child);
+        }
+    }
+    destroyNode(removed);
+    --size_;
+
+    for(int i = depth - 1; i >= 0; --i) {
+        Node* parent = path[i];
+        int balance = parent->balance() + (wentRight[i] ? -1 : 1);
+        if(balance == 1 || balance == -1) {
+            parent->setBalance(balance);
+            break;
+        }
+        if(balance == 0) {
+            parent->setBalance(0);
+            continue;
+        }
+        bool heightChanged;
+        Node* top = rebalance(parent, balance, heightChanged);
+        if(i == 0) {
+            root_ = top;
+        } else {
+            replaceChild(path[i - 1], wentRight[i - 1], top);
+        }
+        if(!heightChanged) {
+            break;
+        }
+    }
+}
+
+/**
+* Deletes every node. Rotating each left child up until there is none
+* lines the tree up along its right spine, so no stack is needed. If the
+* items need no destructor the pool is simply dropped.
+*/
+template<typename Key, typename Value, typename Compare>
+void ParentlessAVLTree<Key, Value, Compare>::clear()
+{
+    if(NodePool::releasesInBulk && std::is_trivially_destructible<std::pair<const Key, Value> >::value) {
+        pool_.release();
+    } else {
+        Node* curr = root_;
+        while(curr != NULL) {
+            Node* left = curr->left();
+            if(left != NULL) {
+                curr->setLeft(left->right());
+                left->setRight(curr);
+                curr = left;
+            } else {
+                Node* next = curr->right();
+                destroyNode(curr);
+                curr = next;
+            }
+        }
+    }
+    root_ = NULL;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::iterator
+ParentlessAVLTree<Key, Value, Compare>::find(const Key& key)
+{
+    iterator it;
+    if(descend(key, true, it.path_, it.depth_) == NULL) {
+        it.depth_ = 0;
+    }
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::const_iterator
+ParentlessAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it;
+    if(descend(key, true, it.path_, it.depth_) == NULL) {
+        it.depth_ = 0;
+    }
+    return it;
+}
+
+/**
+* Returns the first item whose key is not less than key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::iterator
+ParentlessAVLTree<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    iterator it;
+    descend(key, false, it.path_, it.depth_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::const_iterator
+ParentlessAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    const_iterator it;
+    descend(key, false, it.path_, it.depth_);
+    return it;
+}
+
+/**
+* A lookup that builds no iterator.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ParentlessAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    Node* curr = root_;
+    while(curr != NULL) {
+        bool less = comp_(key, curr->item.first);
+        bool greater = comp_(curr->item.first, key);
+        if(!less && !greater) {
+            return true;
+        }
+        curr = curr->child(greater);
+    }
+    return false;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::iterator
+ParentlessAVLTree<Key, Value, Compare>::begin()
+{
+    iterator it;
+    it.pushLeftmost(root_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::iterator
+ParentlessAVLTree<Key, Value, Compare>::end()
+{
+    return iterator();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::const_iterator
+ParentlessAVLTree<Key, Value, Compare>::begin() const
+{
+    const_iterator it;
+    it.pushLeftmost(root_);
+    return it;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::const_iterator
+ParentlessAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool ParentlessAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+size_t ParentlessAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+/**
+* Checks that every subtree is balanced and that each stored balance
+* matches the heights of the node's subtrees.
+*/
+template<typename Key, typename Value, typename Compare>
+bool ParentlessAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    return checkedHeight(root_) >= 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare ParentlessAVLTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* The bytes one item takes up in the tree, padding included.
+*/
+template<typename Key, typename Value, typename Compare>
+size_t ParentlessAVLTree<Key, Value, Compare>::nodeSize()
+{
+    return sizeof(Node);
+}
+
+/**
+* Walks down towards key, pushing onto path every node whose left
+* subtree the walk enters: those are what an iterator visits after the
+* node it stops at. With exact set, returns the node holding key, pushed
+* last, or NULL. Otherwise the top of the stack is the lower bound and
+* the return value is unused.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::Node*
+ParentlessAVLTree<Key, Value, Compare>::descend(const Key& key, bool exact, Node** path, int& depth) const
+{
+    depth = 0;
+    Node* curr = root_;
+    while(curr != NULL) {
+        bool right = comp_(curr->item.first, key);
+        if(exact && !right && !comp_(key, curr->item.first)) {
+            path[depth++] = curr;
+            return curr;
+        }
+        //Always written, but only kept when the walk goes left.
+        path[depth] = curr;
+        depth += !right;
+        curr = curr->child(right);
+    }
+    return NULL;
+}
+
+/**
+* Makes child the left or right child of parent.
+*/
+template<typename Key, typename Value, typename Compare>
+void ParentlessAVLTree<Key, Value, Compare>::replaceChild(Node* parent, bool wentRight, Node* child)
+{
+    if(wentRight) {
+        parent->setRight(child);
+    } else {
+        parent->setLeft(child);
+    }
+}
+
+/**
+* Rotates node's right child up and returns it. Balances are left to
+* the caller.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::Node*
+ParentlessAVLTree<Key, Value, Compare>::rotateLeft(Node* node)
+{
+    Node* child = node->right();
+    node->setRight(child->left());
+    child->setLeft(node);
+    return child;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::Node*
+ParentlessAVLTree<Key, Value, Compare>::rotateRight(Node* node)
+{
+    Node* child = node->left();
+    node->setLeft(child->right());
+    child->setRight(node);
+    return child;
+}
+
+/**
+* Restores the balance of node, whose balance has become balance (2 or
+* -2), with one or two rotations, and returns the new top of its
+* subtree. heightChanged tells whether the subtree is now one lower than
+* it was before the rotations, which after a remove means the fix-up has
+* to carry on upwards.
+*/
+template<typename Key, typename Value, typename Compare>
+typename ParentlessAVLTree<Key, Value, Compare>::Node*
+ParentlessAVLTree<Key, Value, Compare>::rebalance(Node* node, int balance, bool& heightChanged)
+{
+    int side = balance > 0 ? 1 : -1;
+    Node* child = side > 0 ? node->right() : node->left();
+    int childBalance = child->balance();
+    if(childBalance != -side) {
+        //Single rotation.
+        Node* top = side > 0 ? rotateLeft(node) : rotateRight(node);
+        if(childBalance == 0) {
+            node->setBalance(side);
+            child->setBalance(-side);
+            heightChanged = false;
+        } else {
+            node->setBalance(0);
+            child->setBalance(0);
+            heightChanged = true;
+        }
+        return top;
+    }
+
+    //Double rotation: the grandchild on the inside comes up.
+    Node* grandchild = side > 0 ? child->left() : child->right();
+    int grandBalance = grandchild->balance();
+    if(side > 0) {
+        node->setRight(rotateRight(child));
+    } else {
+        node->setLeft(rotateLeft(child));
+    }
+    Node* top = side > 0 ? rotateLeft(node) : rotateRight(node);
+    node->setBalance(grandBalance == side ? -side : 0);
+    child->setBalance(grandBalance == -side ? side : 0);
+    grandchild->setBalance(0);
+    heightChanged = true;
+    return top;
+}
+
+/**
+* Returns the height of the subtree at node, or -1 if it is out of
+* balance or a stored balance is wrong.
+*/
+template<typename Key, typename Value, typename Compare>
+int ParentlessAVLTree<Key, Value, Compare>::checkedHeight(const Node* node)
+{
+    if(node == NULL) {
+        return 0;
+    }
+    int left = checkedHeight(node->left());
+    int right = checkedHeight(node->right());
+    if(left < 0 || right < 0 || right - left != node->balance() || right - left > 1 || left - right > 1) {
+        return -1;
+    }
+    return 1 + (left > right ? left : right);
+}
+
+template<typename Key, typename Value, typename Compare>
+void ParentlessAVLTree<Key, Value, Compare>::destroyNode(Node* node)
+{
+    node->~Node();
+    pool_.deallocate(node);
+}
+
+/*
+  ---------------------------------------
+  End implementations for ParentlessAVLTree
+  ---------------------------------------
+*/
+
+#endif
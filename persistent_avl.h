@@ -0,0 +1,826 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* A read-only version of a PersistentAVLTree.
+*
+* Versions of a persistent tree share every node they have in common, so a
+* snapshot is just a counted reference to a root: taking one, copying it and
+* dropping it are all O(1), apart from freeing the nodes no other version
+* uses when the last reference to them goes away.
+*
+* The nodes a snapshot can reach are never changed again, so a snapshot may
+* be read, copied and destroyed on any thread while the writer goes on
+* changing the tree. Passing a snapshot to another thread needs the usual
+* synchronization (a mutex, a queue, ...), like any other object.
+*
+* Nodes have no parent pointers, since a shared node has one parent per
+* version, so iterators keep the path from the root instead. An iterator is
+* valid as long as the snapshot it came from.
+*/
+template <typename Key, typename Value>
+class AVLSnapshot
+{
+protected:
+    struct Node;
+
+public:
+    AVLSnapshot();
+    AVLSnapshot(const AVLSnapshot& other);
+    AVLSnapshot& operator=(const AVLSnapshot& other);
+    ~AVLSnapshot();
+
+    /**
+    * A forward iterator over the items in key order.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type& reference;
+        typedef const value_type* pointer;
+
+        const_iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    private:
+        friend class AVLSnapshot<Key, Value>;
+        void pushLeftSpine(const Node* node);
+        // Nodes still to be visited on the way back up, ending with the
+        // current one. Empty for end().
+        std::vector<const Node*> path_;
+    };
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    bool isBalanced() const;
+    bool empty() const;
+    size_t size() const;
+
+protected:
+    struct Node
+    {
+        Node(const std::pair<const Key, Value>& keyValuePair, Node* leftChild, Node* rightChild, int subtreeHeight);
+
+        std::pair<const Key, Value> item;
+        Node* left;
+        Node* right;
+        int height;
+        // Number of parents and snapshots that point at this node.
+        std::atomic<size_t> refs;
+    };
+
+    static Node* retain(Node* node);
+    static void release(Node* node);
+    static int heightOf(const Node* node);
+    static int checkedHeight(const Node* node);
+    const Node* findNode(const Key& key) const;
+
+    Node* root_;
+    size_t size_;
+};
+
+/**
+* An AVLTree that keeps old versions around for as long as someone holds a
+* snapshot() of them.
+*
+* insert() and remove() never change a node that is shared with a snapshot;
+* they copy the nodes on the path from the root to the change instead, which
+* is O(log n) nodes, and point the copies at the untouched subtrees. If no
+* node the change can reach is shared, it is made in place instead, so a
+* tree with no snapshots outstanding does no copying at all. Copying the
+* tree itself is O(1) too: the copies share their nodes until one of them
+* changes.
+*
+* Both kinds of change leave the tree as it was if copying an item or
+* allocating a node throws. A change in place allocates its node before it
+* touches the tree. A copying change holds on to the old root until the new
+* path is complete, and drops the copies made so far if it fails.
+*
+* The writer side (insert(), remove(), clear(), snapshot()) is meant for one
+* thread at a time. Nodes come from the heap rather than a NodePool, since
+* the last snapshot to let go of a node may do so on any thread.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree : public AVLSnapshot<Key, Value>
+{
+public:
+    typedef AVLSnapshot<Key, Value> Snapshot;
+
+    PersistentAVLTree();
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+protected:
+    typedef typename Snapshot::Node Node;
+
+    Node* walk(const Key& key, bool forRemove, bool& alone) const;
+    static bool ownsSubtree(const Node* node, int levels);
+    Node* insertHelper(Node* node, const std::pair<const Key, Value>& keyValuePair, Node*& leaf);
+    Node* removeHelper(Node* node, const Key& key);
+    Node* removeMin(Node* node, Node*& min);
+    static Node* makeUnique(Node* node);
+    static Node* rebalance(Node* node);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static void updateHeight(Node* node);
+};
+
+/*
+  ---------------------------------------
+  Begin implementations for AVLSnapshot
+  ---------------------------------------
+*/
+
+/**
+* Constructs an empty snapshot.
+*/
+template<class Key, class Value>
+AVLSnapshot<Key, Value>::AVLSnapshot() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Copies the handle, not the nodes.
+*/
+template<class Key, class Value>
+AVLSnapshot<Key, Value>::AVLSnapshot(const AVLSnapshot& other) :
+    root_(retain(other.root_)),
+    size_(other.size_)
+{
+
+}
+
+template<class Key, class Value>
+AVLSnapshot<Key, Value>& AVLSnapshot<Key, Value>::operator=(const AVLSnapshot& other)
+{
+    Node* old = root_;
+    root_ = retain(other.root_);
+    size_ = other.size_;
+    release(old);
+    return *this;
+}
+
+/**
+* Drops the reference to the root, which frees every node that no other
+* version shares.
+*/
+template<class Key, class Value>
+AVLSnapshot<Key, Value>::~AVLSnapshot()
+{
+    release(root_);
+}
+
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator AVLSnapshot<Key, Value>::begin() const
+{
+    const_iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator AVLSnapshot<Key, Value>::end() const
+{
+    return const_iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator AVLSnapshot<Key, Value>::find(const Key& key) const
+{
+    const_iterator it = lower_bound(key);
+    if(it != end() && key < it->first) {
+        return end();
+    }
+    return it;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key, or
+* end(). The path keeps only the nodes where the search went left, which
+* are exactly the ones iteration still has to come back to.
+*/
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator AVLSnapshot<Key, Value>::lower_bound(const Key& key) const
+{
+    const_iterator it;
+    const Node* node = root_;
+    while(node != NULL) {
+        if(node->item.first < key) {
+            node = node->right;
+        } else {
+            it.path_.push_back(node);
+            node = node->left;
+        }
+    }
+    return it;
+}
+
+/**
+* Returns the value for key, which must be in the snapshot; throws
+* std::out_of_range otherwise.
+*/
+template<class Key, class Value>
+Value const & AVLSnapshot<Key, Value>::operator[](const Key& key) const
+{
+    const Node* node = findNode(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->item.second;
+}
+
+/**
+* Checks that the stored heights are right and that the subtrees of every
+* node differ in height by at most one.
+*/
+template<class Key, class Value>
+bool AVLSnapshot<Key, Value>::isBalanced() const
+{
+    return checkedHeight(root_) >= 0;
+}
+
+template<class Key, class Value>
+bool AVLSnapshot<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Returns the number of items in constant time.
+*/
+template<class Key, class Value>
+size_t AVLSnapshot<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+AVLSnapshot<Key, Value>::Node::Node(const std::pair<const Key, Value>& keyValuePair,
+    Node* leftChild, Node* rightChild, int subtreeHeight) :
+    item(keyValuePair),
+    left(leftChild),
+    right(rightChild),
+    height(subtreeHeight),
+    refs(1)
+{
+
+}
+
+/**
+* Adds a reference to node, if any, and returns it.
+*/
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::Node* AVLSnapshot<Key, Value>::retain(Node* node)
+{
+    if(node != NULL) {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops a reference to node, and frees it along with its own references
+* to its children once it was the last one. The recursion goes no deeper
+* than the tree is tall.
+*/
+template<class Key, class Value>
+void AVLSnapshot<Key, Value>::release(Node* node)
+{
+    if(node == NULL || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    release(node->left);
+    release(node->right);
+    delete node;
+}
+
+/**
+* Returns the node with the given key, or NULL.
+*/
+template<class Key, class Value>
+const typename AVLSnapshot<Key, Value>::Node* AVLSnapshot<Key, Value>::findNode(const Key& key) const
+{
+    const Node* node = root_;
+    while(node != NULL) {
+        if(key < node->item.first) {
+            node = node->left;
+        } else if(node->item.first < key) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+template<class Key, class Value>
+int AVLSnapshot<Key, Value>::heightOf(const Node* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+/**
+* Helper for isBalanced(). Returns the height of node, or -1 if the subtree
+* breaks the AVL rules or a stored height is wrong.
+*/
+template<class Key, class Value>
+int AVLSnapshot<Key, Value>::checkedHeight(const Node* node)
+{
+    if(node == NULL) {
+        return 0;
+    }
+    int left = checkedHeight(node->left);
+    int right = checkedHeight(node->right);
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1) {
+        return -1;
+    }
+    int height = 1 + (left > right ? left : right);
+    return height == node->height ? height : -1;
+}
+
+/*
+  ---------------------------------------------
+  Begin implementations for the const_iterator
+  ---------------------------------------------
+*/
+
+template<class Key, class Value>
+AVLSnapshot<Key, Value>::const_iterator::const_iterator()
+{
+
+}
+
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator::reference
+AVLSnapshot<Key, Value>::const_iterator::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator::pointer
+AVLSnapshot<Key, Value>::const_iterator::operator->() const
+{
+    return &(path_.back()->item);
+}
+
+/**
+* Iterators are equal if they are at the same node; all end() iterators
+* are equal.
+*/
+template<class Key, class Value>
+bool AVLSnapshot<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()) {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value>
+bool AVLSnapshot<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves on to the smallest key in the right subtree if there is one, or
+* else back up to the nearest node still waiting on the path.
+*/
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator&
+AVLSnapshot<Key, Value>::const_iterator::operator++()
+{
+    const Node* node = path_.back();
+    path_.pop_back();
+    pushLeftSpine(node->right);
+    return *this;
+}
+
+template<class Key, class Value>
+typename AVLSnapshot<Key, Value>::const_iterator
+AVLSnapshot<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Pushes node and its chain of left children, ending at the smallest key
+* below node.
+*/
+template<class Key, class Value>
+void AVLSnapshot<Key, Value>::const_iterator::pushLeftSpine(const Node* node)
+{
+    while(node != NULL) {
+        path_.push_back(node);
+        node = node->left;
+    }
+}
+
+/*
+  ---------------------------------------------
+  Begin implementations for PersistentAVLTree
+  ---------------------------------------------
+*/
+
+/**
+* Constructs an empty tree.
+*/
+template<class Key, class Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree()
+{
+
+}
+
+/**
+* Inserts the item, or replaces the value if the key is already there.
+* Returns true if a new item was added. Snapshots taken earlier do not see
+* the change.
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool alone = false;
+    Node* found = walk(keyValuePair.first, false, alone);
+    if(found != NULL && alone) {
+        found->item.second = keyValuePair.second;
+        return false;
+    }
+    Node* leaf = found == NULL ? new Node(keyValuePair, NULL, NULL, 1) : NULL;
+    if(alone) {
+        this->root_ = insertHelper(this->root_, keyValuePair, leaf);
+    } else {
+        Node* old = Snapshot::retain(this->root_);
+        Node* root = NULL;
+        try {
+            root = insertHelper(this->root_, keyValuePair, leaf);
+        } catch(...) {
+            Snapshot::release(leaf);
+            this->root_ = old;
+            throw;
+        }
+        Snapshot::release(old);
+        this->root_ = root;
+    }
+    if(found == NULL) {
+        ++this->size_;
+    }
+    return found == NULL;
+}
+
+/**
+* Removes the item with the given key, if there is one. A missing key
+* copies nothing.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    bool alone = false;
+    if(walk(key, true, alone) == NULL) {
+        return;
+    }
+    if(alone) {
+        this->root_ = removeHelper(this->root_, key);
+    } else {
+        Node* old = Snapshot::retain(this->root_);
+        Node* root = NULL;
+        try {
+            root = removeHelper(this->root_, key);
+        } catch(...) {
+            this->root_ = old;
+            throw;
+        }
+        Snapshot::release(old);
+        this->root_ = root;
+    }
+    --this->size_;
+}
+
+/**
+* Empties the tree. Nodes that snapshots still use stay alive for them.
+*/
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    Snapshot::release(this->root_);
+    this->root_ = NULL;
+    this->size_ = 0;
+}
+
+/**
+* Returns a read-only handle on the current contents in O(1).
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Snapshot PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return Snapshot(*this);
+}
+
+/**
+* Returns the node holding key, or NULL, and sets alone if no node that
+* changing it can reach is shared with another version. Those are the
+* nodes on the way down, and for a remove also the way on to the next
+* larger key and everything two levels below either way, which the
+* rotations while rebalancing may touch.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node*
+PersistentAVLTree<Key, Value>::walk(const Key& key, bool forRemove, bool& alone) const
+{
+    int levels = forRemove ? 2 : 0;
+    alone = true;
+    Node* node = this->root_;
+    while(node != NULL) {
+        alone = alone && ownsSubtree(node, levels);
+        if(key < node->item.first) {
+            node = node->left;
+        } else if(node->item.first < key) {
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+    if(node != NULL && forRemove && node->left != NULL) {
+        for(Node* next = node->right; next != NULL; next = next->left) {
+            alone = alone && ownsSubtree(next, levels);
+        }
+    }
+    return node;
+}
+
+/**
+* True if node and the nodes up to levels below it have no other owner.
+*/
+template<class Key, class Value>
+bool PersistentAVLTree<Key, Value>::ownsSubtree(const Node* node, int levels)
+{
+    if(node == NULL) {
+        return true;
+    }
+    if(node->refs.load(std::memory_order_acquire) != 1) {
+        return false;
+    }
+    return levels == 0 || (ownsSubtree(node->left, levels - 1) && ownsSubtree(node->right, levels - 1));
+}
+
+/**
+* Recursive helper for insert(). Takes over the caller's reference to node
+* and returns a reference to the root of the changed subtree, into which
+* leaf is linked if the key is new (leaf is then set to NULL).
+*
+* This and the other helpers let go of the reference they were given if
+* they throw, so every caller unhooks a child before handing it down. That
+* only frees copies: insert() and remove() call them on shared nodes with
+* an extra reference to the old root, and on unshared ones only where
+* nothing can throw.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node*
+PersistentAVLTree<Key, Value>::insertHelper(Node* node, const std::pair<const Key, Value>& keyValuePair, Node*& leaf)
+{
+    if(node == NULL) {
+        Node* added = leaf;
+        leaf = NULL;
+        return added;
+    }
+    node = makeUnique(node);
+    try {
+        if(keyValuePair.first < node->item.first) {
+            Node* child = node->left;
+            node->left = NULL;
+            node->left = insertHelper(child, keyValuePair, leaf);
+        } else if(node->item.first < keyValuePair.first) {
+            Node* child = node->right;
+            node->right = NULL;
+            node->right = insertHelper(child, keyValuePair, leaf);
+        } else {
+            node->item.second = keyValuePair.second;
+            return node;
+        }
+    } catch(...) {
+        Snapshot::release(node);
+        throw;
+    }
+    return rebalance(node);
+}
+
+/**
+* Recursive helper for remove(); the key must be in the subtree. Takes
+* over the caller's reference to node like insertHelper(). A node with two
+* children is replaced by the smallest node of its right subtree, since
+* the key in a node cannot be changed.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node*
+PersistentAVLTree<Key, Value>::removeHelper(Node* node, const Key& key)
+{
+    node = makeUnique(node);
+    if(key < node->item.first || node->item.first < key) {
+        Node*& link = key < node->item.first ? node->left : node->right;
+        Node* child = link;
+        link = NULL;
+        try {
+            link = removeHelper(child, key);
+        } catch(...) {
+            Snapshot::release(node);
+            throw;
+        }
+        return rebalance(node);
+    }
+
+    Node* replacement = NULL;
+    bool twoChildren = node->left != NULL && node->right != NULL;
+    if(node->left == NULL) {
+        replacement = node->right;
+    } else if(node->right == NULL) {
+        replacement = node->left;
+    } else {
+        Node* right = node->right;
+        node->right = NULL;
+        Node* rest = NULL;
+        try {
+            rest = removeMin(right, replacement);
+        } catch(...) {
+            // The smallest node may already be unlinked and only held here.
+            Snapshot::release(replacement);
+            Snapshot::release(node);
+            throw;
+        }
+        replacement->left = node->left;
+        replacement->right = rest;
+    }
+    // The references to the children moved on with them.
+    node->left = NULL;
+    node->right = NULL;
+    Snapshot::release(node);
+    return twoChildren ? rebalance(replacement) : replacement;
+}
+
+/**
+* Unlinks the smallest node below node and hands it back in min, unshared
+* and without children. Returns the rest of the subtree.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node*
+PersistentAVLTree<Key, Value>::removeMin(Node* node, Node*& min)
+{
+    node = makeUnique(node);
+    if(node->left == NULL) {
+        Node* rest = node->right;
+        node->right = NULL;
+        min = node;
+        return rest;
+    }
+    Node* child = node->left;
+    node->left = NULL;
+    try {
+        node->left = removeMin(child, min);
+    } catch(...) {
+        Snapshot::release(node);
+        throw;
+    }
+    return rebalance(node);
+}
+
+/**
+* Returns a node the caller may change in place: node itself if the
+* caller holds the only reference to it, or else a fresh copy that shares
+* the children. Takes over the caller's reference either way.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node* PersistentAVLTree<Key, Value>::makeUnique(Node* node)
+{
+    if(node->refs.load(std::memory_order_acquire) == 1) {
+        return node;
+    }
+    Node* copy = NULL;
+    try {
+        copy = new Node(node->item, NULL, NULL, node->height);
+    } catch(...) {
+        Snapshot::release(node);
+        throw;
+    }
+    copy->left = Snapshot::retain(node->left);
+    copy->right = Snapshot::retain(node->right);
+    Snapshot::release(node);
+    return copy;
+}
+
+/**
+* Restores the AVL property at node, whose subtrees are balanced and
+* differ in height by at most two, and returns the new subtree root.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node* PersistentAVLTree<Key, Value>::rebalance(Node* node)
+{
+    int balance = Snapshot::heightOf(node->right) - Snapshot::heightOf(node->left);
+    if(balance > 1) {
+        if(Snapshot::heightOf(node->right->left) > Snapshot::heightOf(node->right->right)) {
+            Node* child = node->right;
+            node->right = NULL;
+            try {
+                node->right = rotateRight(child);
+            } catch(...) {
+                Snapshot::release(node);
+                throw;
+            }
+        }
+        return rotateLeft(node);
+    }
+    if(balance < -1) {
+        if(Snapshot::heightOf(node->left->right) > Snapshot::heightOf(node->left->left)) {
+            Node* child = node->left;
+            node->left = NULL;
+            try {
+                node->left = rotateLeft(child);
+            } catch(...) {
+                Snapshot::release(node);
+                throw;
+            }
+        }
+        return rotateRight(node);
+    }
+    updateHeight(node);
+    return node;
+}
+
+/**
+* Rotates the right child of node up. node must be unshared; the child is
+* made unshared here before it is changed.
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node* PersistentAVLTree<Key, Value>::rotateLeft(Node* node)
+{
+    node = makeUnique(node);
+    Node* child = node->right;
+    node->right = NULL;
+    try {
+        child = makeUnique(child);
+    } catch(...) {
+        Snapshot::release(node);
+        throw;
+    }
+    node->right = child->left;
+    child->left = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+/**
+* Mirror image of rotateLeft().
+*/
+template<class Key, class Value>
+typename PersistentAVLTree<Key, Value>::Node* PersistentAVLTree<Key, Value>::rotateRight(Node* node)
+{
+    node = makeUnique(node);
+    Node* child = node->left;
+    node->left = NULL;
+    try {
+        child = makeUnique(child);
+    } catch(...) {
+        Snapshot::release(node);
+        throw;
+    }
+    node->left = child->right;
+    child->right = node;
+    updateHeight(node);
+    updateHeight(child);
+    return child;
+}
+
+template<class Key, class Value>
+void PersistentAVLTree<Key, Value>::updateHeight(Node* node)
+{
+    int left = Snapshot::heightOf(node->left);
+    int right = Snapshot::heightOf(node->right);
+    node->height = 1 + (left > right ? left : right);
+}
+
+#endif
@@ -0,0 +1,631 @@
+#ifndef SHARDED_TREE_H
+#define SHARDED_TREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+#include "epoch.h"
+
+/**
+* A map split by key range into a fixed number of AVLTree shards, each
+* behind its own lock, so that writers working on different key ranges
+* never wait for each other.
+*
+* Shard i holds the keys from boundary i-1 up to, but not including,
+* boundary i. The boundaries start out empty, which sends every key to the
+* first shard, and are chosen in one of two ways:
+*
+* - partition() takes a sample of the keys that are expected, for instance
+*   the first batch of a load, and puts boundaries at its quantiles.
+* - rebalance() does the same with the keys actually stored. insert() calls
+*   it by itself once one shard holds more than REBALANCE_FACTOR times the
+*   average of the other shards, so the shards follow whatever skew the
+*   writers have.
+*
+* Moving the boundaries locks every shard, walks the items once to find the
+* new boundaries and copies them, in order, into a fresh tree per shard
+* (AVLTree::buildFromSorted()). The old trees are then freed together with
+* their pools, so the memory of every shard only ever covers its current
+* items, however often the boundaries move. This costs one pass and one copy
+* of every item, and room for both copies while it runs. A shard only
+* triggers it after growing to twice the size of the others, so the items
+* grow geometrically between two moves, which keeps the cost per insert
+* constant.
+*
+* Every shard counts its own items, and size() adds the counts up, so
+* writers on different shards share no counter.
+*
+* Boundaries are replaced as a whole, never changed in place. An operation
+* reads the current boundaries under an EpochReclaimer::Guard, locks the
+* shard they name and then checks that the boundaries are still the same,
+* retrying otherwise. Since replacing them needs every shard lock, holding
+* one shard lock keeps them fixed.
+*
+* find() copies the value out because a reference would outlive the lock.
+* Iterating visits the shards in key order, which gives the items in key
+* order; it takes no locks, so it must not run alongside writers.
+*/
+template <typename Key, typename Value>
+class ShardedTree
+{
+public:
+    typedef AVLTree<Key, Value> Tree;
+    class const_iterator;
+
+    explicit ShardedTree(size_t shards = 0);
+    ~ShardedTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+    bool isBalanced() const;
+
+    size_t shardCount() const;
+    size_t shardSize(size_t shard) const;
+    TreeStats stats() const;
+    template<typename InputIt>
+    void partition(InputIt first, InputIt last);
+    void rebalance();
+
+    /**
+    * A forward iterator over the items of every shard in key order.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type& reference;
+        typedef const value_type* pointer;
+
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    protected:
+        friend class ShardedTree<Key, Value>;
+        const_iterator(const ShardedTree<Key, Value>* tree, size_t shard, typename Tree::const_iterator item);
+        void skipEmptyShards();
+        const ShardedTree<Key, Value>* tree_;
+        size_t shard_;   // shardCount() for end()
+        typename Tree::const_iterator item_;
+    };
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+protected:
+    // A shard moves the boundaries once it holds this many times the
+    // average of the other shards, and at least MIN_REBALANCE_SIZE items.
+    // insert() only looks every SKEW_CHECK_INTERVAL items, since the check
+    // reads the count of every shard.
+    static const size_t REBALANCE_FACTOR = 2;
+    static const size_t MIN_REBALANCE_SIZE = 1024;
+    static const size_t SKEW_CHECK_INTERVAL = 64;
+    static const size_t CACHE_LINE = 64;
+
+    // Every shard starts on its own cache line, so that threads locking
+    // neighbouring shards do not fight over one line. count is only
+    // written under the shard lock, but read by size() without it.
+    struct alignas(CACHE_LINE) Shard
+    {
+        Shard() : count(0) { }
+        std::mutex mutex;
+        Tree tree;
+        std::atomic<size_t> count;
+    };
+
+    // The lower key of every shard but the first, in order.
+    struct Layout
+    {
+        std::vector<Key> bounds;
+    };
+
+    Shard& lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const;
+    size_t shardFor(const Layout& layout, const Key& key) const;
+    bool isSkewed(size_t shard) const;
+    void rebalanceIfSkewed();
+    void lockAll() const;
+    void unlockAll() const;
+    void repartition(std::vector<Key>& bounds, bool fromContents);
+
+private:
+    // Shards and the boundaries are shared by every thread, so a copy
+    // could not be made consistently.
+    ShardedTree(const ShardedTree&);
+    ShardedTree& operator=(const ShardedTree&);
+
+    size_t shardCount_;
+    // new only aligns to alignof(std::max_align_t) before C++17, so the
+    // shards are placed by hand inside a larger buffer.
+    std::unique_ptr<char[]> shardBuffer_;
+    Shard* shards_;
+    std::atomic<Layout*> layout_;
+    // Held by whoever is moving the boundaries.
+    std::mutex rebalanceMutex_;
+};
+
+/*
+  ---------------------------------------
+  Begin implementations for ShardedTree
+  ---------------------------------------
+*/
+
+/**
+* Creates an empty map with the given number of shards, or four per core
+* if shards is 0.
+*/
+template<class Key, class Value>
+ShardedTree<Key, Value>::ShardedTree(size_t shards) :
+    shardCount_(shards),
+    shards_(NULL),
+    layout_(new Layout)
+{
+    if(shardCount_ == 0) {
+        shardCount_ = 4 * std::max(1u, std::thread::hardware_concurrency());
+    }
+    shardBuffer_.reset(new char[(shardCount_ + 1) * sizeof(Shard)]);
+    void* first = shardBuffer_.get();
+    size_t space = (shardCount_ + 1) * sizeof(Shard);
+    std::align(alignof(Shard), shardCount_ * sizeof(Shard), first, space);
+    shards_ = static_cast<Shard*>(first);
+    for(size_t i = 0; i < shardCount_; ++i) {
+        new (&shards_[i]) Shard;
+    }
+}
+
+/**
+* Destructor. No other thread may still use the map.
+*/
+template<class Key, class Value>
+ShardedTree<Key, Value>::~ShardedTree()
+{
+    for(size_t i = shardCount_; i > 0; --i) {
+        shards_[i - 1].~Shard();
+    }
+    delete layout_.load();
+}
+
+/**
+* Inserts the item, or replaces the value if the key is already there.
+* Returns true if a new item was added. Afterwards moves the shard
+* boundaries if the shard has grown far beyond its share.
+*/
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added;
+    bool skewed = false;
+    {
+        std::unique_lock<std::mutex> lock;
+        Shard& shard = lockShard(keyValuePair.first, lock);
+        added = shard.tree.insert(keyValuePair).second;
+        if(added) {
+            size_t count = shard.count.load(std::memory_order_relaxed) + 1;
+            shard.count.store(count, std::memory_order_relaxed);
+            skewed = count % SKEW_CHECK_INTERVAL == 0 && isSkewed(&shard - shards_);
+        }
+    }
+    if(skewed) {
+        rebalanceIfSkewed();
+    }
+    return added;
+}
+
+/**
+* Removes the item with the given key. Returns false if there was none.
+*/
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> lock;
+    Shard& shard = lockShard(key, lock);
+    size_t before = shard.tree.size();
+    shard.tree.remove(key);
+    if(shard.tree.size() == before) {
+        return false;
+    }
+    shard.count.store(shard.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is not in the map.
+*/
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::unique_lock<std::mutex> lock;
+    const Shard& shard = lockShard(key, lock);
+    typename Tree::const_iterator it = shard.tree.find(key);
+    if(it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::contains(const Key& key) const
+{
+    std::unique_lock<std::mutex> lock;
+    const Shard& shard = lockShard(key, lock);
+    return shard.tree.find(key) != shard.tree.end();
+}
+
+/**
+* Returns the number of items. While writers are running this is only a
+* recent count, not one that matches any single moment.
+*/
+template<class Key, class Value>
+size_t ShardedTree<Key, Value>::size() const
+{
+    size_t total = 0;
+    for(size_t i = 0; i < shardCount_; ++i) {
+        total += shards_[i].count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Checks that every shard is balanced and holds only keys inside its
+* boundaries. Only meaningful while no writer is running.
+*/
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::isBalanced() const
+{
+    const Layout& layout = *layout_.load();
+    for(size_t i = 0; i < shardCount_; ++i) {
+        const Tree& tree = shards_[i].tree;
+        if(!tree.isBalanced()) {
+            return false;
+        }
+        for(typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it) {
+            if(shardFor(layout, it->first) != i) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<class Key, class Value>
+size_t ShardedTree<Key, Value>::shardCount() const
+{
+    return shardCount_;
+}
+
+/**
+* Returns the number of items in one shard. Throws std::out_of_range for
+* a shard that does not exist.
+*/
+template<class Key, class Value>
+size_t ShardedTree<Key, Value>::shardSize(size_t shard) const
+{
+    if(shard >= shardCount_) {
+        throw std::out_of_range("Invalid shard");
+    }
+    std::lock_guard<std::mutex> lock(shards_[shard].mutex);
+    return shards_[shard].tree.size();
+}
+
+/**
+* Returns the shape of all shards together (see TreeStats), with each
+* shard counted as if it hung at the top. Only one shard is locked at a
+* time, so writers to the other shards carry on, and the result is not a
+* snapshot of a single moment.
+*/
+template<class Key, class Value>
+TreeStats ShardedTree<Key, Value>::stats() const
+{
+    TreeStats result;
+    result.bytes = sizeof(*this) + shardCount_ * sizeof(Shard);
+    for(size_t i = 0; i < shardCount_; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        TreeStats shard = shards_[i].tree.stats();
+        shard.bytes -= sizeof(Tree);
+        result.merge(shard);
+    }
+    return result;
+}
+
+/**
+* Places the shard boundaries at the quantiles of the sample [first,
+* last), which need not be sorted, and moves the stored items to match.
+* An empty sample leaves the boundaries alone.
+*/
+template<class Key, class Value>
+template<typename InputIt>
+void ShardedTree<Key, Value>::partition(InputIt first, InputIt last)
+{
+    std::vector<Key> sample(first, last);
+    if(sample.empty()) {
+        return;
+    }
+    std::sort(sample.begin(), sample.end());
+    std::vector<Key> bounds;
+    for(size_t i = 1; i < shardCount_; ++i) {
+        bounds.push_back(sample[sample.size() * i / shardCount_]);
+    }
+    std::lock_guard<std::mutex> exclusive(rebalanceMutex_);
+    repartition(bounds, false);
+}
+
+/**
+* Places the shard boundaries so that every shard holds the same number of
+* items, give or take one. Blocks every other operation while it runs.
+*/
+template<class Key, class Value>
+void ShardedTree<Key, Value>::rebalance()
+{
+    std::vector<Key> bounds;
+    std::lock_guard<std::mutex> exclusive(rebalanceMutex_);
+    repartition(bounds, true);
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator ShardedTree<Key, Value>::begin() const
+{
+    const_iterator it(this, 0, shards_[0].tree.begin());
+    it.skipEmptyShards();
+    return it;
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator ShardedTree<Key, Value>::end() const
+{
+    return const_iterator(this, shardCount_, shards_[shardCount_ - 1].tree.end());
+}
+
+/**
+* Locks the shard that holds key under the current boundaries and returns
+* it. Retries if the boundaries moved before the lock was taken.
+*/
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::Shard&
+ShardedTree<Key, Value>::lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const
+{
+    EpochReclaimer::Guard guard;
+    while(true) {
+        const Layout* layout = layout_.load(std::memory_order_acquire);
+        Shard& shard = shards_[shardFor(*layout, key)];
+        std::unique_lock<std::mutex> held(shard.mutex);
+        if(layout_.load(std::memory_order_acquire) == layout) {
+            lock.swap(held);
+            return shard;
+        }
+    }
+}
+
+/**
+* Returns the index of the shard whose range holds key.
+*/
+template<class Key, class Value>
+size_t ShardedTree<Key, Value>::shardFor(const Layout& layout, const Key& key) const
+{
+    return std::upper_bound(layout.bounds.begin(), layout.bounds.end(), key) - layout.bounds.begin();
+}
+
+/**
+* Returns true if the shard holds more than REBALANCE_FACTOR times the
+* average of the other shards. Comparing with the others rather than with
+* the total works for any number of shards, two included.
+*/
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::isSkewed(size_t shard) const
+{
+    size_t items = shards_[shard].count.load(std::memory_order_relaxed);
+    if(shardCount_ < 2 || items < MIN_REBALANCE_SIZE) {
+        return false;
+    }
+    size_t others = size() - items;
+    return items * (shardCount_ - 1) > REBALANCE_FACTOR * others;
+}
+
+/**
+* Called by insert() when its shard looked skewed. Gives up if another
+* thread is already moving the boundaries, and checks again once every
+* shard is locked, since the boundaries may have moved in the meantime.
+*/
+template<class Key, class Value>
+void ShardedTree<Key, Value>::rebalanceIfSkewed()
+{
+    std::unique_lock<std::mutex> exclusive(rebalanceMutex_, std::try_to_lock);
+    if(!exclusive.owns_lock()) {
+        return;
+    }
+    lockAll();
+    bool skewed = false;
+    for(size_t i = 0; i < shardCount_ && !skewed; ++i) {
+        skewed = isSkewed(i);
+    }
+    unlockAll();
+    if(skewed) {
+        std::vector<Key> bounds;
+        repartition(bounds, true);
+    }
+}
+
+/**
+* Locks every shard, in order. Operations only ever hold one shard lock,
+* so this cannot deadlock with them.
+*/
+template<class Key, class Value>
+void ShardedTree<Key, Value>::lockAll() const
+{
+    for(size_t i = 0; i < shardCount_; ++i) {
+        shards_[i].mutex.lock();
+    }
+}
+
+template<class Key, class Value>
+void ShardedTree<Key, Value>::unlockAll() const
+{
+    for(size_t i = shardCount_; i > 0; --i) {
+        shards_[i - 1].mutex.unlock();
+    }
+}
+
+/**
+* Moves the items to new shard boundaries. With fromContents set, bounds
+* is filled with the keys that split the stored items evenly; otherwise
+* bounds holds the new boundaries in order. The caller holds
+* rebalanceMutex_.
+*
+* The items are copied into new trees rather than split and joined, so the
+* pool of every shard only holds the memory of its own items. Moving the
+* nodes would make every pool adopt the arenas of every other one, and no
+* chunk could be freed for as long as the map lives.
+*/
+template<class Key, class Value>
+void ShardedTree<Key, Value>::repartition(std::vector<Key>& bounds, bool fromContents)
+{
+    lockAll();
+    try {
+        size_t total = size();
+        if(fromContents) {
+            if(total == 0) {
+                unlockAll();
+                return;
+            }
+            bounds.clear();
+            const_iterator it = begin();
+            size_t position = 0;
+            for(size_t i = 1; i < shardCount_; ++i) {
+                for(; position < total * i / shardCount_; ++position) {
+                    ++it;
+                }
+                bounds.push_back(it->first);
+            }
+        }
+
+        // Shard i takes the keys from bounds[i - 1] up to bounds[i], which
+        // follow each other in the shards as they are now.
+        std::unique_ptr<Tree[]> rebuilt(new Tree[shardCount_]);
+        std::vector<size_t> counts(shardCount_, 0);
+        const_iterator first = begin();
+        for(size_t i = 0; i < shardCount_; ++i) {
+            const_iterator last = first;
+            while(last != end() && (i == bounds.size() || last->first < bounds[i])) {
+                ++last;
+                ++counts[i];
+            }
+            rebuilt[i].buildFromSorted(first, last);
+            first = last;
+        }
+
+        for(size_t i = 0; i < shardCount_; ++i) {
+            Tree& tree = shards_[i].tree;
+            tree.clear();
+            tree.concat(tree, rebuilt[i]);
+            shards_[i].count.store(counts[i], std::memory_order_relaxed);
+        }
+    } catch(...) {
+        unlockAll();
+        throw;
+    }
+
+    Layout* layout = new Layout;
+    layout->bounds.swap(bounds);
+    Layout* old = layout_.exchange(layout, std::memory_order_acq_rel);
+    unlockAll();
+    EpochReclaimer::retire(old);
+}
+
+/*
+  ---------------------------------------
+  Begin implementations for ShardedTree::const_iterator
+  ---------------------------------------
+*/
+
+template<class Key, class Value>
+ShardedTree<Key, Value>::const_iterator::const_iterator(const ShardedTree<Key, Value>* tree, size_t shard,
+        typename Tree::const_iterator item) :
+    tree_(tree),
+    shard_(shard),
+    item_(item)
+{
+}
+
+/**
+* Moves on to the first item of the next non-empty shard while the
+* current shard has run out, stopping at end().
+*/
+template<class Key, class Value>
+void ShardedTree<Key, Value>::const_iterator::skipEmptyShards()
+{
+    while(shard_ < tree_->shardCount_ && item_ == tree_->shards_[shard_].tree.end()) {
+        if(++shard_ < tree_->shardCount_) {
+            item_ = tree_->shards_[shard_].tree.begin();
+        }
+    }
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator::reference
+ShardedTree<Key, Value>::const_iterator::operator*() const
+{
+    return *item_;
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator::pointer
+ShardedTree<Key, Value>::const_iterator::operator->() const
+{
+    return &*item_;
+}
+
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return tree_ == rhs.tree_ && shard_ == rhs.shard_ && (shard_ == tree_->shardCount_ || item_ == rhs.item_);
+}
+
+template<class Key, class Value>
+bool ShardedTree<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator&
+ShardedTree<Key, Value>::const_iterator::operator++()
+{
+    ++item_;
+    skipEmptyShards();
+    return *this;
+}
+
+template<class Key, class Value>
+typename ShardedTree<Key, Value>::const_iterator
+ShardedTree<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++*this;
+    return old;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include "bst.h"
+#include "avlbst.h"
+#include "tree_counters.h"
+#include "tree_trace.h"
+
+using namespace std;
+
+// Replays a trace written by TracedTree against one of the trees and
+// reports throughput and latency percentiles per operation, so that two
+// builds, or two trees, can be compared on the same recorded traffic.
+//
+//   tree-replay TRACE [--tree avl|compact|bst|map] [--paced]
+//   tree-replay --sample TRACE [OPS]
+//
+// By default the records are replayed back to back. --paced waits for the
+// time each operation was recorded at, which keeps bursts and idle gaps
+// (and with them what is in cache) as they were. Latencies are measured
+// around each operation alone and include the ~20 ns of reading the clock.
+// --sample writes a small synthetic trace to try the tool with.
+//
+// Traces with 4 or 8 byte keys and values are replayed as int32_t and
+// int64_t. For other types, call replay() with them from your own build.
+
+typedef chrono::steady_clock Clock;
+
+// Keeps the optimizer from discarding lookups whose results are unused.
+static volatile long sink;
+
+static const char* const OP_NAMES[] =
+    { "", "insert", "remove", "find", "seek", "seek-first", "steps", "clear" };
+static const int OP_SLOTS = sizeof(OP_NAMES) / sizeof(OP_NAMES[0]);
+
+// The few calls that differ between the trees and std::map.
+template<typename Tree, typename Key, typename Value>
+void insertItem(Tree& tree, const Key& key, const Value& value)
+{
+    tree.insert(make_pair(key, value));
+}
+
+// map::insert() keeps the old value of a key that is already there, but
+// the trees overwrite it, so the map has to assign.
+template<typename Key, typename Value>
+void insertItem(map<Key, Value>& tree, const Key& key, const Value& value)
+{
+    tree[key] = value;
+}
+
+template<typename Tree, typename Key>
+void removeKey(Tree& tree, const Key& key)
+{
+    tree.remove(key);
+}
+
+template<typename Key, typename Value>
+void removeKey(map<Key, Value>& tree, const Key& key)
+{
+    tree.erase(key);
+}
+
+/**
+* Runs records against an empty Tree and prints what it measured.
+*/
+template<typename Tree, typename Key, typename Value>
+void replay(const vector<TraceRecord<Key, Value> >& records, bool paced)
+{
+    Tree tree;
+    typename Tree::iterator current = tree.end();
+    LatencyHistogram latency[OP_SLOTS];
+    uint64_t counts[OP_SLOTS] = { 0 };
+    uint64_t nanos[OP_SLOTS] = { 0 };
+    uint64_t maxLagNanos = 0;
+    long total = 0;
+
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < records.size(); ++i) {
+        const TraceRecord<Key, Value>& r = records[i];
+        if(paced) {
+            Clock::time_point due = start + chrono::nanoseconds(r.atNanos);
+            Clock::time_point now = Clock::now();
+            if(now < due) {
+                // Sleeping is too coarse for short gaps, so those spin.
+                if(due - now > chrono::microseconds(200)) {
+                    this_thread::sleep_until(due - chrono::microseconds(100));
+                }
+                while(Clock::now() < due) {
+                }
+            } else {
+                uint64_t lag = chrono::duration_cast<chrono::nanoseconds>(now - due).count();
+                maxLagNanos = max(maxLagNanos, lag);
+            }
+        }
+
+        Clock::time_point before = Clock::now();
+        switch(r.op) {
+        case TRACE_INSERT:
+            insertItem(tree, r.key, r.value);
+            current = tree.end();
+            break;
+        case TRACE_REMOVE:
+            removeKey(tree, r.key);
+            current = tree.end();
+            break;
+        case TRACE_FIND:
+            current = tree.find(r.key);
+            total += current != tree.end();
+            break;
+        case TRACE_SEEK:
+            current = tree.lower_bound(r.key);
+            break;
+        case TRACE_SEEK_FIRST:
+            current = tree.begin();
+            break;
+        case TRACE_STEPS:
+            for(uint64_t s = 0; s < r.steps && current != tree.end(); ++s) {
+                total += current->second != 0;
+                ++current;
+            }
+            break;
+        case TRACE_CLEAR:
+            tree.clear();
+            current = tree.end();
+            break;
+        }
+        Clock::time_point after = Clock::now();
+        uint64_t took = chrono::duration_cast<chrono::nanoseconds>(after - before).count();
+        latency[r.op].record(took);
+        nanos[r.op] += took;
+        ++counts[r.op];
+    }
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+    sink = total;
+
+    cout << "replayed " << records.size() << " operations in " << fixed << setprecision(3)
+         << secs << " s, " << setprecision(2) << records.size() / secs / 1e6 << " Mops/s";
+    if(paced) {
+        cout << ", at most " << setprecision(1) << maxLagNanos / 1e3 << " us behind";
+    }
+    cout << endl;
+    // The percentiles are power of two buckets (see LatencyHistogram); the
+    // mean is exact and is the column to compare two close runs by.
+    cout << left << setw(12) << "op" << right << setw(12) << "count" << setw(10) << "mean"
+         << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99"
+         << setw(10) << "p99.9" << "   (ns, upper bounds)" << endl;
+    for(int op = 1; op < OP_SLOTS; ++op) {
+        if(counts[op] == 0) {
+            continue;
+        }
+        cout << left << setw(12) << OP_NAMES[op] << right << setw(12) << counts[op]
+             << setw(10) << setprecision(1) << (double)nanos[op] / counts[op]
+             << setw(10) << latency[op].percentile(50) << setw(10) << latency[op].percentile(90)
+             << setw(10) << latency[op].percentile(99) << setw(10) << latency[op].percentile(99.9)
+             << endl;
+    }
+}
+
+template<typename Key, typename Value>
+int replayFile(const string& path, const string& treeName, bool paced)
+{
+    vector<TraceRecord<Key, Value> > records;
+    TraceReader<Key, Value> reader(path);
+    TraceRecord<Key, Value> record;
+    while(reader.next(record)) {
+        records.push_back(record);
+    }
+    double recorded = records.empty() ? 0.0 : records.back().atNanos / 1e9;
+    cout << path << ": " << records.size() << " operations recorded over "
+         << fixed << setprecision(3) << recorded << " s, replaying against " << treeName
+         << (paced ? " at the recorded pace" : " as fast as possible") << endl;
+
+    if(treeName == "avl") {
+        replay<AVLTree<Key, Value> >(records, paced);
+    } else if(treeName == "compact") {
+        replay<CompactAVLTree<Key, Value> >(records, paced);
+    } else if(treeName == "bst") {
+        replay<BinarySearchTree<Key, Value> >(records, paced);
+    } else if(treeName == "map") {
+        replay<map<Key, Value> >(records, paced);
+    } else {
+        cerr << "unknown tree " << treeName << " (avl, compact, bst or map)" << endl;
+        return 2;
+    }
+    return 0;
+}
+
+template<typename Key>
+int replayFile(const string& path, const TraceHeader& header, const string& treeName, bool paced)
+{
+    if(header.valueSize == 4) {
+        return replayFile<Key, int32_t>(path, treeName, paced);
+    } else if(header.valueSize == 8) {
+        return replayFile<Key, int64_t>(path, treeName, paced);
+    }
+    cerr << "values of " << header.valueSize << " bytes are not supported here" << endl;
+    return 2;
+}
+
+/**
+* Writes a trace of ops operations on int keys: lookups skewed towards
+* small keys, inserts, removes and short range scans.
+*/
+void writeSample(const string& path, size_t ops)
+{
+    TracedTree<int32_t, int32_t> tree(path);
+    mt19937 rng(42);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    const int range = 1000000;
+    for(size_t i = 0; i < ops; ++i) {
+        double u = uniform(rng);
+        int key = (int)(u * u * u * range);
+        unsigned kind = rng() % 100;
+        if(kind < 60) {
+            sink = tree.find(key) != tree.end();
+        } else if(kind < 85) {
+            tree.insert(make_pair(key, (int32_t)i));
+        } else if(kind < 95) {
+            tree.remove(key);
+        } else {
+            TracedTree<int32_t, int32_t>::iterator it = tree.lower_bound(key);
+            for(int s = 0; s < 10 && it != tree.end(); ++s, ++it) {
+                sink = it->second;
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc >= 3 && strcmp(argv[1], "--sample") == 0) {
+        size_t ops = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000000;
+        writeSample(argv[2], ops);
+        cout << "wrote " << ops << " operations to " << argv[2] << endl;
+        return 0;
+    }
+
+    string path;
+    string treeName = "avl";
+    bool paced = false;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--tree") == 0 && i + 1 < argc) {
+            treeName = argv[++i];
+        } else if(strcmp(argv[i], "--paced") == 0) {
+            paced = true;
+        } else if(path.empty() && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if(path.empty()) {
+        cerr << "usage: " << argv[0] << " TRACE [--tree avl|compact|bst|map] [--paced]\n"
+             << "       " << argv[0] << " --sample TRACE [OPS]" << endl;
+        return 2;
+    }
+
+    try {
+        TraceHeader header = readTraceHeader(path);
+        if(header.keySize == 4) {
+            return replayFile<int32_t>(path, header, treeName, paced);
+        } else if(header.keySize == 8) {
+            return replayFile<int64_t>(path, header, treeName, paced);
+        }
+        cerr << "keys of " << header.keySize << " bytes are not supported here" << endl;
+        return 2;
+    } catch(const std::runtime_error& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,299 @@
+#ifndef TREE_COUNTERS_H
+#define TREE_COUNTERS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "bst.h"
+
+// TreeOperation and the NoTreeCounters default live in bst.h, so that
+// trees that are not instrumented do not need this header.
+
+/**
+* How long the sampled operations of one kind took. Bucket i counts the
+* operations that took between 2^i and 2^(i+1) - 1 nanoseconds (bucket 0
+* also holds those under a nanosecond), so percentiles come out as the
+* upper end of a bucket, at most twice the true value.
+*/
+struct LatencyHistogram
+{
+    static const int BUCKETS = 40;
+
+    LatencyHistogram();
+    void record(uint64_t nanos);
+    uint64_t samples() const;
+    uint64_t percentile(double p) const;
+
+    uint64_t counts[BUCKETS];
+};
+
+/**
+* What a TreeCounters policy has counted so far, see
+* TreeCounters::snapshot().
+*/
+struct TreeCounterSnapshot
+{
+    TreeCounterSnapshot();
+
+    // Key comparisons made by lookups (find(), contains(), remove(), ...),
+    // two per level visited.
+    uint64_t comparisons;
+    // Rotations done while rebalancing; a double rotation counts once.
+    uint64_t singleRotations;
+    uint64_t doubleRotations;
+    // Nodes swapped with their predecessor or child on the way out.
+    uint64_t nodeSwaps;
+    // Removes that ran the AVL remove fix-up, the levels it walked up in
+    // total and the most it walked up in a single remove.
+    uint64_t removeFixes;
+    uint64_t removeFixLevels;
+    uint64_t maxRemoveFixDepth;
+    uint64_t allocations;
+    uint64_t deallocations;
+    // Indexed by TreeOperation. Empty unless the policy samples latency.
+    LatencyHistogram latency[TREE_OPERATION_COUNT];
+};
+
+/**
+* A Counters policy that counts what the tree does, for use as the last
+* template parameter of BinarySearchTree or AVLTree:
+*
+*   AVLTree<int, int, AVLNode<int, int>, std::less<int>, TreeCounters<> >
+*
+* With SampleEvery set to N > 0, every Nth find, insert and remove is also
+* timed into a LatencyHistogram. Reading the clock twice costs tens of
+* nanoseconds, about as much as a lookup in a small tree, so N of 64 or
+* more keeps the overhead low enough for production use. The counters
+* are plain integers: they are as thread-safe as the tree they are in,
+* so a tree with counters may no longer be read from several threads at
+* once.
+*/
+template <unsigned SampleEvery = 0>
+class TreeCounters
+{
+public:
+    class Timer
+    {
+    public:
+        Timer(TreeCounters& counters, TreeOperation op);
+        ~Timer();
+
+    private:
+        Timer(const Timer&);
+        Timer& operator=(const Timer&);
+
+        // NULL unless this operation was picked for sampling.
+        TreeCounters* counters_;
+        TreeOperation op_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    TreeCounters();
+
+    void comparisons(size_t count) { counts_.comparisons += count; }
+    void rotation(bool isDouble);
+    void nodeSwap() { ++counts_.nodeSwaps; }
+    void removeFixLevel() { ++removeFixDepth_; }
+    void removeFixDone();
+    void allocation() { ++counts_.allocations; }
+    void deallocation() { ++counts_.deallocations; }
+    void deallocations(size_t count) { counts_.deallocations += count; }
+
+    TreeCounterSnapshot snapshot() const;
+    void reset();
+
+private:
+    TreeCounterSnapshot counts_;
+    uint64_t removeFixDepth_;
+    unsigned untilSample_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for LatencyHistogram and
+  TreeCounterSnapshot.
+  -----------------------------------------------
+*/
+
+/**
+* An empty histogram.
+*/
+inline LatencyHistogram::LatencyHistogram()
+{
+    for(int i = 0; i < BUCKETS; ++i) {
+        counts[i] = 0;
+    }
+}
+
+/**
+* Adds one operation that took nanos nanoseconds.
+*/
+inline void LatencyHistogram::record(uint64_t nanos)
+{
+    int bucket = 0;
+    while(nanos > 1 && bucket < BUCKETS - 1) {
+        nanos >>= 1;
+        ++bucket;
+    }
+    ++counts[bucket];
+}
+
+/**
+* Number of operations recorded.
+*/
+inline uint64_t LatencyHistogram::samples() const
+{
+    uint64_t total = 0;
+    for(int i = 0; i < BUCKETS; ++i) {
+        total += counts[i];
+    }
+    return total;
+}
+
+/**
+* Returns, in nanoseconds, the upper end of the bucket that holds the
+* p-th percentile (0 < p <= 100), or 0 if nothing was recorded.
+*/
+inline uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t total = samples();
+    if(total == 0) {
+        return 0;
+    }
+    double exact = p / 100.0 * total;
+    uint64_t rank = (uint64_t)exact;
+    if(rank < exact || rank == 0) {
+        ++rank;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if(seen >= rank) {
+            return ((uint64_t)2 << i) - 1;
+        }
+    }
+    return 0;
+}
+
+/**
+* All counts zero.
+*/
+inline TreeCounterSnapshot::TreeCounterSnapshot() :
+    comparisons(0),
+    singleRotations(0),
+    doubleRotations(0),
+    nodeSwaps(0),
+    removeFixes(0),
+    removeFixLevels(0),
+    maxRemoveFixDepth(0),
+    allocations(0),
+    deallocations(0)
+{
+}
+
+/*
+  -----------------------------------------------
+  End implementations for LatencyHistogram and
+  TreeCounterSnapshot.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the TreeCounters class.
+  -----------------------------------------------
+*/
+
+/**
+* Starts timing the operation if it is the one in SampleEvery that gets
+* sampled. With SampleEvery == 0 the check is false at compile time.
+*/
+template<unsigned SampleEvery>
+TreeCounters<SampleEvery>::Timer::Timer(TreeCounters& counters, TreeOperation op) :
+    counters_(NULL),
+    op_(op)
+{
+    if(SampleEvery != 0 && --counters.untilSample_ == 0) {
+        counters.untilSample_ = SampleEvery;
+        counters_ = &counters;
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+/**
+* Records the time since construction if this operation was sampled.
+*/
+template<unsigned SampleEvery>
+TreeCounters<SampleEvery>::Timer::~Timer()
+{
+    if(SampleEvery != 0 && counters_ != NULL) {
+        std::chrono::nanoseconds took = std::chrono::steady_clock::now() - start_;
+        counters_->counts_.latency[op_].record((uint64_t)took.count());
+    }
+}
+
+/**
+* Default constructor; all counts start at zero.
+*/
+template<unsigned SampleEvery>
+TreeCounters<SampleEvery>::TreeCounters() :
+    removeFixDepth_(0),
+    untilSample_(SampleEvery)
+{
+}
+
+/**
+* Counts one single or double rotation.
+*/
+template<unsigned SampleEvery>
+void TreeCounters<SampleEvery>::rotation(bool isDouble)
+{
+    if(isDouble) {
+        ++counts_.doubleRotations;
+    } else {
+        ++counts_.singleRotations;
+    }
+}
+
+/**
+* Called once the remove fix-up has finished; adds the levels it walked
+* (one removeFixLevel() per level) to the totals.
+*/
+template<unsigned SampleEvery>
+void TreeCounters<SampleEvery>::removeFixDone()
+{
+    ++counts_.removeFixes;
+    counts_.removeFixLevels += removeFixDepth_;
+    if(removeFixDepth_ > counts_.maxRemoveFixDepth) {
+        counts_.maxRemoveFixDepth = removeFixDepth_;
+    }
+    removeFixDepth_ = 0;
+}
+
+/**
+* Returns a copy of the counts so far.
+*/
+template<unsigned SampleEvery>
+TreeCounterSnapshot TreeCounters<SampleEvery>::snapshot() const
+{
+    return counts_;
+}
+
+/**
+* Sets every count back to zero.
+*/
+template<unsigned SampleEvery>
+void TreeCounters<SampleEvery>::reset()
+{
+    counts_ = TreeCounterSnapshot();
+    removeFixDepth_ = 0;
+    untilSample_ = SampleEvery;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the TreeCounters class.
+  -----------------------------------------------
+*/
+
+#endif
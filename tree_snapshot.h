@@ -0,0 +1,861 @@
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A snapshot file holds the items of a tree in key order, written by
+ * writeSnapshot() and served straight from memory by
+ * MappedTree. It has no pointers in it, only offsets from the start of
+ * the file, so it can be mapped at any address. Its layout:
+ *
+ *   SnapshotHeader
+ *   keys           integer keys: the first key of every block of
+ *                  blockSize keys; other keys: every key, as raw bytes
+ *   block offsets  integer keys only: blockCount + 1 uint64_t, where the
+ *                  deltas of each block start, from the start of the
+ *                  deltas (the last one is the size of the deltas)
+ *   deltas         integer keys only: for every key that does not start a
+ *                  block, key - previous key as a LEB128 varint
+ *   values         every value, as raw bytes
+ *
+ * Each section starts at a multiple of SNAPSHOT_SECTION_ALIGN bytes, so
+ * keys, offsets and values can be read in place. The checksum covers
+ * every byte after the header. Keys and values are stored byte for byte,
+ * so they have to be trivially copyable, and a snapshot is only read on a
+ * machine with the same byte order. The POSIX mmap() is used to map it.
+ */
+
+static const uint64_t SNAPSHOT_SECTION_ALIGN = 64;
+
+/**
+* The start of every snapshot file. Offsets count from the start of the
+* file.
+*/
+struct SnapshotHeader
+{
+    static const uint32_t VERSION = 1;
+    static const uint32_t DELTA_KEYS = 1;
+
+    char magic[8];              // "TREESNP" and a NUL
+    uint32_t version;
+    uint32_t flags;             // DELTA_KEYS for integer keys
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+    uint64_t blockSize;         // 0 without DELTA_KEYS
+    uint64_t blockCount;
+    uint64_t keysOffset;
+    uint64_t blockOffsetsOffset;
+    uint64_t deltasOffset;
+    uint64_t deltasSize;
+    uint64_t valuesOffset;
+    uint64_t fileSize;
+    uint64_t checksum;
+};
+
+/**
+* Whether MappedTree::load() reads the whole file to check its checksum.
+* Checking touches every page, so a file that is known to be intact (say,
+* checked once after it was copied into place) loads in constant time with
+* SKIP_CHECKSUM.
+*/
+enum SnapshotCheck { VERIFY_CHECKSUM, SKIP_CHECKSUM };
+
+/**
+* A 64 bit checksum of a byte stream, fed in pieces of any size. Works on
+* 8 byte words, so it keeps up with reading the file.
+*/
+class SnapshotChecksum
+{
+public:
+    SnapshotChecksum();
+    void update(const void* bytes, size_t size);
+    uint64_t value() const;
+
+private:
+    void mix(uint64_t word);
+
+    uint64_t hash_;
+    uint64_t total_;
+    unsigned char pending_[8];
+    size_t pendingSize_;
+};
+
+/**
+* How keys are stored. Integer keys (other than bool) are delta encoded,
+* with the difference taken modulo 2^bits, so keys in any order decode
+* back exactly; keys sorted by std::less take one to three bytes each
+* unless they are far apart.
+*/
+template <typename Key,
+          bool Integral = std::is_integral<Key>::value && !std::is_same<Key, bool>::value>
+struct SnapshotKeyDelta
+{
+    static const bool enabled = false;
+    static uint64_t diff(const Key&, const Key&) { return 0; }
+    static Key add(const Key& key, uint64_t) { return key; }
+};
+
+template <typename Key>
+struct SnapshotKeyDelta<Key, true>
+{
+    typedef typename std::make_unsigned<Key>::type Unsigned;
+
+    static const bool enabled = true;
+    static uint64_t diff(const Key& from, const Key& to)
+    {
+        return (Unsigned)((Unsigned)to - (Unsigned)from);
+    }
+    static Key add(const Key& key, uint64_t delta)
+    {
+        return (Key)(Unsigned)((Unsigned)key + (Unsigned)delta);
+    }
+};
+
+/**
+* Helper for writeSnapshot(). Appends sections to a file through a buffer
+* and checksums them on the way out.
+*/
+class SnapshotOutput
+{
+public:
+    explicit SnapshotOutput(std::FILE* file, uint64_t written);
+    bool put(uint64_t offset, const void* bytes, size_t size);
+    bool flush();
+    uint64_t written() const;
+    uint64_t checksum() const;
+
+private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    std::FILE* file_;
+    std::vector<unsigned char> buffer_;
+    SnapshotChecksum checksum_;
+    uint64_t written_;
+};
+
+template <class Key, class Value, class NodeType, class Compare, class Counters>
+class BinarySearchTree;
+
+template <typename Key, typename Value, typename ForwardIt>
+void writeSnapshot(const std::string& path, ForwardIt first, ForwardIt last);
+template <class Key, class Value, class NodeType, class Compare, class Counters>
+void writeSnapshot(const BinarySearchTree<Key, Value, NodeType, Compare, Counters>& tree,
+                   const std::string& path);
+
+/**
+* A read-only tree served from a snapshot file (see writeSnapshot())
+* that is mapped into memory. Nothing is copied or built when it loads:
+* find() and lower_bound() binary search the keys (or the first keys of
+* the delta blocks, then decode within one block) and values are read
+* where they lie in the mapping. materialize() turns it back into a
+* mutable tree.
+*
+* Compare must order keys the way the tree that was saved did.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedTree
+{
+public:
+    // Keys per delta block: a lookup decodes at most this many varints.
+    static const uint64_t BLOCK_SIZE = 32;
+
+    explicit MappedTree(const Compare& comp = Compare());
+    explicit MappedTree(const std::string& path, SnapshotCheck check = VERIFY_CHECKSUM,
+                        const Compare& comp = Compare());
+    ~MappedTree();
+
+    void load(const std::string& path, SnapshotCheck check = VERIFY_CHECKSUM);
+    void unload();
+
+    class const_iterator;
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    size_t size() const;
+    bool empty() const;
+
+    template<typename Tree>
+    void materialize(Tree& tree) const;
+
+    /**
+    * A forward iterator over the snapshot in key order. Integer keys are
+    * decoded as it goes, so the items it yields hold the key by value and
+    * a reference to the value in the mapping.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, const Value&> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type reference;
+
+        // Lets it->first work although there is no pair to point to.
+        class pointer
+        {
+        public:
+            explicit pointer(const value_type& item) : item_(item) { }
+            const value_type* operator->() const { return &item_; }
+        private:
+            value_type item_;
+        };
+
+        const_iterator();
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    private:
+        friend class MappedTree<Key, Value, Compare>;
+        const_iterator(const MappedTree<Key, Value, Compare>* tree, size_t index);
+        void decode();
+
+        const MappedTree<Key, Value, Compare>* tree_;
+        size_t index_;          // size() is end()
+        Key key_;
+        const unsigned char* nextDelta_;
+    };
+
+private:
+    // A tree owns its mapping, so it cannot be copied.
+    MappedTree(const MappedTree&);
+    MappedTree& operator=(const MappedTree&);
+
+    void fail(const std::string& path, const char* what);
+    static uint64_t readVarint(const unsigned char*& p);
+
+    typedef SnapshotKeyDelta<Key> Delta;
+
+    const unsigned char* base_;
+    size_t mappedSize_;
+    size_t count_;
+    size_t blockCount_;
+    const Key* keys_;
+    const uint64_t* blockOffsets_;
+    const unsigned char* deltas_;
+    const Value* values_;
+    Compare comp_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for SnapshotChecksum and
+  writeSnapshot().
+  -----------------------------------------------
+*/
+
+inline SnapshotChecksum::SnapshotChecksum() :
+    hash_(0x736e617073686f74ULL),
+    total_(0),
+    pendingSize_(0)
+{
+}
+
+/**
+* Adds size bytes to the checksum. Bytes that do not fill a word yet wait
+* for the next call.
+*/
+inline void SnapshotChecksum::update(const void* bytes, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    total_ += size;
+    while(pendingSize_ != 0 && size != 0) {
+        pending_[pendingSize_++] = *p++;
+        --size;
+        if(pendingSize_ == 8) {
+            uint64_t word;
+            std::memcpy(&word, pending_, 8);
+            mix(word);
+            pendingSize_ = 0;
+        }
+    }
+    if(size == 0) {
+        return;
+    }
+    for(; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        mix(word);
+    }
+    std::memcpy(pending_, p, size);
+    pendingSize_ = size;
+}
+
+/**
+* The checksum of everything added so far, including its length.
+*/
+inline uint64_t SnapshotChecksum::value() const
+{
+    SnapshotChecksum last(*this);
+    if(last.pendingSize_ != 0) {
+        uint64_t word = 0;
+        std::memcpy(&word, last.pending_, last.pendingSize_);
+        last.mix(word);
+    }
+    last.mix(total_);
+    return last.hash_;
+}
+
+inline void SnapshotChecksum::mix(uint64_t word)
+{
+    hash_ = (hash_ ^ word) * 0x9e3779b97f4a7c15ULL;
+    hash_ ^= hash_ >> 29;
+}
+
+inline SnapshotOutput::SnapshotOutput(std::FILE* file, uint64_t written) :
+    file_(file),
+    written_(written)
+{
+}
+
+/**
+* Pads the file with zeros up to offset, which must not be behind what
+* was written already, then appends size bytes.
+*/
+inline bool SnapshotOutput::put(uint64_t offset, const void* bytes, size_t size)
+{
+    buffer_.insert(buffer_.end(), offset - written_, 0);
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    buffer_.insert(buffer_.end(), p, p + size);
+    written_ = offset + size;
+    return buffer_.size() < BUFFER_BYTES || flush();
+}
+
+/**
+* Hands the buffered bytes to the file.
+*/
+inline bool SnapshotOutput::flush()
+{
+    checksum_.update(buffer_.data(), buffer_.size());
+    bool ok = buffer_.empty() || std::fwrite(buffer_.data(), buffer_.size(), 1, file_) == 1;
+    buffer_.clear();
+    return ok;
+}
+
+inline uint64_t SnapshotOutput::written() const
+{
+    return written_;
+}
+
+/**
+* The checksum of everything flushed so far.
+*/
+inline uint64_t SnapshotOutput::checksum() const
+{
+    return checksum_.value();
+}
+
+/**
+* Writes the items in [first, last), sorted by key, to a snapshot file at
+* path (see the comment at the top of tree_snapshot.h). The file is
+* written under a temporary name and renamed over path at the end, so a
+* reader never sees half of it. Throws std::runtime_error if it cannot be
+* written. The range is walked twice: once for the keys, once for the
+* values.
+*/
+template<typename Key, typename Value, typename ForwardIt>
+void writeSnapshot(const std::string& path, ForwardIt first, ForwardIt last)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "writeSnapshot: keys and values are stored as raw bytes");
+    typedef SnapshotKeyDelta<Key> Delta;
+    const uint64_t blockSize = MappedTree<Key, Value>::BLOCK_SIZE;
+
+    // Keys, and for integer keys the block index and the deltas, are
+    // collected first, since the values go after them.
+    std::vector<Key> keys;
+    std::vector<uint64_t> blockOffsets;
+    std::vector<unsigned char> deltas;
+    uint64_t count = 0;
+    Key prev = Key();
+    for(ForwardIt it = first; it != last; ++it, ++count) {
+        Key key = it->first;
+        if(!Delta::enabled) {
+            keys.push_back(key);
+        } else if(count % blockSize == 0) {
+            keys.push_back(key);
+            blockOffsets.push_back(deltas.size());
+        } else {
+            uint64_t delta = Delta::diff(prev, key);
+            while(delta >= 0x80) {
+                deltas.push_back((unsigned char)(delta | 0x80));
+                delta >>= 7;
+            }
+            deltas.push_back((unsigned char)delta);
+        }
+        prev = key;
+    }
+    if(Delta::enabled) {
+        blockOffsets.push_back(deltas.size());
+    }
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TREESNP", 8);
+    header.version = SnapshotHeader::VERSION;
+    header.flags = Delta::enabled ? SnapshotHeader::DELTA_KEYS : 0;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = count;
+    header.blockSize = Delta::enabled ? blockSize : 0;
+    header.blockCount = Delta::enabled ? keys.size() : 0;
+
+    const uint64_t align = SNAPSHOT_SECTION_ALIGN;
+    header.keysOffset = (sizeof(header) + align - 1) / align * align;
+    uint64_t end = header.keysOffset + keys.size() * sizeof(Key);
+    header.blockOffsetsOffset = (end + align - 1) / align * align;
+    end = header.blockOffsetsOffset + blockOffsets.size() * sizeof(uint64_t);
+    header.deltasOffset = (end + align - 1) / align * align;
+    header.deltasSize = deltas.size();
+    end = header.deltasOffset + deltas.size();
+    header.valuesOffset = (end + align - 1) / align * align;
+    header.fileSize = header.valuesOffset + count * sizeof(Value);
+
+    std::string temp = path + ".tmp";
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+    if(file == NULL) {
+        throw std::runtime_error("writeSnapshot: cannot create " + temp);
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    SnapshotOutput out(file, sizeof(header));
+    ok = ok && out.put(header.keysOffset, keys.data(), keys.size() * sizeof(Key));
+    ok = ok && out.put(header.blockOffsetsOffset, blockOffsets.data(),
+                       blockOffsets.size() * sizeof(uint64_t));
+    ok = ok && out.put(header.deltasOffset, deltas.data(), deltas.size());
+    uint64_t next = header.valuesOffset;
+    for(ForwardIt it = first; ok && it != last; ++it) {
+        Value value = it->second;
+        ok = out.put(next, &value, sizeof(Value));
+        next = out.written();
+    }
+    // An empty tree still pads up to where its values would start.
+    ok = ok && out.put(next, NULL, 0) && out.flush();
+
+    header.checksum = out.checksum();
+    ok = ok && std::fseek(file, 0, SEEK_SET) == 0;
+    ok = ok && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (std::fclose(file) == 0) && ok;
+    if(!ok || out.written() != header.fileSize || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("writeSnapshot: cannot write " + path);
+    }
+}
+
+/**
+* Writes the items of tree (a BinarySearchTree, AVLTree or one of their
+* variants) to a snapshot file at path that MappedTree can map back in
+* without copying. Throws std::runtime_error if the file cannot be
+* written.
+*/
+template<class Key, class Value, class NodeType, class Compare, class Counters>
+void writeSnapshot(const BinarySearchTree<Key, Value, NodeType, Compare, Counters>& tree,
+                   const std::string& path)
+{
+    writeSnapshot<Key, Value>(path, tree.begin(), tree.end());
+}
+
+/*
+  -----------------------------------------------
+  End implementations for SnapshotChecksum and
+  writeSnapshot().
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for MappedTree::const_iterator
+  -----------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    tree_(NULL),
+    index_(0),
+    key_(),
+    nextDelta_(NULL)
+{
+}
+
+/**
+* An iterator at the index-th item, or at end() if index is size(). For
+* integer keys the block holding the item is decoded up to it.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::const_iterator::const_iterator(
+        const MappedTree<Key, Value, Compare>* tree, size_t index) :
+    tree_(tree),
+    index_(index),
+    key_(),
+    nextDelta_(NULL)
+{
+    if(index_ >= tree_->count_) {
+        return;
+    }
+    if(!Delta::enabled) {
+        key_ = tree_->keys_[index_];
+        return;
+    }
+    size_t block = index_ / BLOCK_SIZE;
+    key_ = tree_->keys_[block];
+    nextDelta_ = tree_->deltas_ + tree_->blockOffsets_[block];
+    for(size_t i = block * BLOCK_SIZE + 1; i <= index_; ++i) {
+        key_ = Delta::add(key_, readVarint(nextDelta_));
+    }
+}
+
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator::reference
+MappedTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return value_type(key_, tree_->values_[index_]);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator::pointer
+MappedTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_ && tree_ == rhs.tree_;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next item: the next key is either the first key of a new
+* block or the current key plus the next delta.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator&
+MappedTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    ++index_;
+    if(index_ < tree_->count_) {
+        decode();
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++*this;
+    return old;
+}
+
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::const_iterator::decode()
+{
+    if(!Delta::enabled) {
+        key_ = tree_->keys_[index_];
+    } else if(index_ % BLOCK_SIZE == 0) {
+        size_t block = index_ / BLOCK_SIZE;
+        key_ = tree_->keys_[block];
+        nextDelta_ = tree_->deltas_ + tree_->blockOffsets_[block];
+    } else {
+        key_ = Delta::add(key_, readVarint(nextDelta_));
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for MappedTree::const_iterator
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for MappedTree
+  -----------------------------------------------
+*/
+
+/**
+* An empty tree with nothing mapped.
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(const Compare& comp) :
+    base_(NULL),
+    mappedSize_(0),
+    count_(0),
+    blockCount_(0),
+    keys_(NULL),
+    blockOffsets_(NULL),
+    deltas_(NULL),
+    values_(NULL),
+    comp_(comp)
+{
+}
+
+/**
+* Maps the snapshot at path, see load().
+*/
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::MappedTree(const std::string& path, SnapshotCheck check,
+                                            const Compare& comp) :
+    base_(NULL),
+    mappedSize_(0),
+    count_(0),
+    blockCount_(0),
+    keys_(NULL),
+    blockOffsets_(NULL),
+    deltas_(NULL),
+    values_(NULL),
+    comp_(comp)
+{
+    load(path, check);
+}
+
+template<class Key, class Value, class Compare>
+MappedTree<Key, Value, Compare>::~MappedTree()
+{
+    unload();
+}
+
+/**
+* Maps the snapshot at path read-only, replacing whatever was mapped
+* before. The header is checked against Key and Value, every section
+* against the size of the file, and with VERIFY_CHECKSUM the checksum
+* against the contents. Throws std::runtime_error (leaving the tree empty)
+* if any of that fails.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::load(const std::string& path, SnapshotCheck check)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "MappedTree: keys and values are read as raw bytes");
+    unload();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("MappedTree: cannot open " + path);
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("MappedTree: " + path + " is not a tree snapshot");
+    }
+    void* mapped = ::mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        throw std::runtime_error("MappedTree: cannot map " + path);
+    }
+    base_ = static_cast<const unsigned char*>(mapped);
+    mappedSize_ = info.st_size;
+
+    const SnapshotHeader& h = *reinterpret_cast<const SnapshotHeader*>(base_);
+    if(std::memcmp(h.magic, "TREESNP", 8) != 0) {
+        fail(path, "is not a tree snapshot");
+    }
+    if(h.version != SnapshotHeader::VERSION) {
+        fail(path, "has an unsupported version");
+    }
+    if(h.keySize != sizeof(Key) || h.valueSize != sizeof(Value) ||
+       (h.flags == SnapshotHeader::DELTA_KEYS) != Delta::enabled) {
+        fail(path, "holds other key or value types");
+    }
+    uint64_t blocks = Delta::enabled ? (h.count + BLOCK_SIZE - 1) / BLOCK_SIZE : 0;
+    uint64_t keyCount = Delta::enabled ? blocks : h.count;
+    bool fits = h.fileSize == mappedSize_ && h.blockCount == blocks &&
+                h.keysOffset <= h.fileSize && h.blockOffsetsOffset <= h.fileSize &&
+                h.deltasOffset <= h.fileSize && h.deltasSize <= h.fileSize &&
+                h.valuesOffset <= h.fileSize &&
+                h.blockSize == (Delta::enabled ? BLOCK_SIZE : 0) &&
+                h.count <= mappedSize_ / sizeof(Value) &&
+                h.keysOffset % SNAPSHOT_SECTION_ALIGN == 0 &&
+                h.keysOffset + keyCount * sizeof(Key) <= h.blockOffsetsOffset &&
+                h.blockOffsetsOffset % SNAPSHOT_SECTION_ALIGN == 0 &&
+                h.blockOffsetsOffset + (Delta::enabled ? blocks + 1 : 0) * sizeof(uint64_t) <= h.deltasOffset &&
+                h.deltasOffset + h.deltasSize <= h.valuesOffset &&
+                h.valuesOffset % SNAPSHOT_SECTION_ALIGN == 0 &&
+                h.valuesOffset + h.count * sizeof(Value) == h.fileSize;
+    if(!fits) {
+        fail(path, "is truncated or damaged");
+    }
+    if(check == VERIFY_CHECKSUM) {
+        SnapshotChecksum checksum;
+        checksum.update(base_ + sizeof(SnapshotHeader), mappedSize_ - sizeof(SnapshotHeader));
+        if(checksum.value() != h.checksum) {
+            fail(path, "does not match its checksum");
+        }
+    }
+
+    keys_ = reinterpret_cast<const Key*>(base_ + h.keysOffset);
+    blockOffsets_ = reinterpret_cast<const uint64_t*>(base_ + h.blockOffsetsOffset);
+    deltas_ = base_ + h.deltasOffset;
+    values_ = reinterpret_cast<const Value*>(base_ + h.valuesOffset);
+    if(Delta::enabled) {
+        // A bad offset would send decoding outside the mapping, so they
+        // are checked even when the checksum is not.
+        for(uint64_t b = 0; b < blocks; ++b) {
+            uint64_t maxBytes = (BLOCK_SIZE - 1) * 10;
+            if(blockOffsets_[b] > blockOffsets_[b + 1] ||
+               blockOffsets_[b + 1] - blockOffsets_[b] > maxBytes) {
+                fail(path, "is truncated or damaged");
+            }
+        }
+        if(blockOffsets_[blocks] != h.deltasSize) {
+            fail(path, "is truncated or damaged");
+        }
+    }
+    count_ = h.count;
+    blockCount_ = blocks;
+}
+
+/**
+* Unmaps the snapshot, leaving an empty tree. Iterators into it become
+* invalid.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::unload()
+{
+    if(base_ != NULL) {
+        ::munmap(const_cast<unsigned char*>(base_), mappedSize_);
+    }
+    base_ = NULL;
+    mappedSize_ = 0;
+    count_ = 0;
+    blockCount_ = 0;
+    keys_ = NULL;
+    blockOffsets_ = NULL;
+    deltas_ = NULL;
+    values_ = NULL;
+}
+
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, count_);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it = lower_bound(key);
+    if(it.index_ < count_ && !comp_(key, it.key_)) {
+        return it;
+    }
+    return end();
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+* Raw keys are binary searched directly. Delta encoded keys are found by
+* binary searching the first keys of the blocks and then decoding the one
+* block that can hold key.
+*/
+template<class Key, class Value, class Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    if(!Delta::enabled) {
+        return const_iterator(this, std::lower_bound(keys_, keys_ + count_, key, comp_) - keys_);
+    }
+    size_t after = std::upper_bound(keys_, keys_ + blockCount_, key, comp_) - keys_;
+    if(after == 0) {
+        return begin();
+    }
+    size_t block = after - 1;
+    const_iterator it(this, block * BLOCK_SIZE);
+    size_t blockEnd = std::min((size_t)(block + 1) * BLOCK_SIZE, count_);
+    while(it.index_ < blockEnd && comp_(it.key_, key)) {
+        ++it;
+    }
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+size_t MappedTree<Key, Value, Compare>::size() const
+{
+    return count_;
+}
+
+template<class Key, class Value, class Compare>
+bool MappedTree<Key, Value, Compare>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+* Replaces the contents of tree, which must have buildFromSorted() (an
+* AVLTree or one of its variants), with the items of the snapshot, in
+* linear time.
+*/
+template<class Key, class Value, class Compare>
+template<typename Tree>
+void MappedTree<Key, Value, Compare>::materialize(Tree& tree) const
+{
+    tree.buildFromSorted(begin(), end());
+}
+
+/**
+* Unmaps what was mapped and throws std::runtime_error about path.
+*/
+template<class Key, class Value, class Compare>
+void MappedTree<Key, Value, Compare>::fail(const std::string& path, const char* what)
+{
+    unload();
+    throw std::runtime_error("MappedTree: " + path + " " + what);
+}
+
+template<class Key, class Value, class Compare>
+uint64_t MappedTree<Key, Value, Compare>::readVarint(const unsigned char*& p)
+{
+    // A damaged file is not checked for runs of continuation bytes, so at
+    // most ten bytes, a full 64 bit delta, are read.
+    uint64_t n = *p & 0x7f;
+    for(int shift = 7; (*p++ & 0x80) && shift < 64; shift += 7) {
+        n |= (uint64_t)(*p & 0x7f) << shift;
+    }
+    return n;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for MappedTree
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,628 @@
+#ifndef TREE_TRACE_H
+#define TREE_TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/*
+ * A trace is a file of the operations made on one tree, written by
+ * TracedTree and read back by TraceReader (tree-replay replays them).
+ *
+ * It starts with a TraceHeader, followed by one record per operation:
+ *
+ *   uint8   TraceOp
+ *   varint  nanoseconds since the previous record (the first: since the
+ *           trace was opened)
+ *   ...     the key for INSERT, REMOVE, FIND and SEEK, then the value for
+ *           INSERT, as raw bytes; a varint count for STEPS
+ *
+ * Varints are LEB128: 7 bits per byte, low bits first, the high bit set on
+ * every byte but the last. Keys and values are copied byte for byte, so
+ * they have to be trivially copyable, and a trace is only read back on a
+ * machine with the same byte order.
+ */
+
+/**
+* What a trace record stands for. Iteration is recorded as the call that
+* positions an iterator (FIND, SEEK for lower_bound(), SEEK_FIRST for
+* begin()) followed by a STEPS record with how many times iterators were
+* advanced before the next operation.
+*/
+enum TraceOp { TRACE_INSERT = 1, TRACE_REMOVE, TRACE_FIND, TRACE_SEEK,
+               TRACE_SEEK_FIRST, TRACE_STEPS, TRACE_CLEAR };
+
+/**
+* The start of every trace file.
+*/
+struct TraceHeader
+{
+    static const uint32_t VERSION = 1;
+
+    char magic[8];          // "TREETRC" and a NUL
+    uint32_t version;
+    uint16_t keySize;
+    uint16_t valueSize;
+    uint64_t startNanos;    // system_clock at open, since the epoch
+};
+
+/**
+* One operation read back from a trace. atNanos counts from the start of
+* the trace. key is unused for SEEK_FIRST, STEPS and CLEAR, value is only
+* used for INSERT, and steps only for STEPS.
+*/
+template <typename Key, typename Value>
+struct TraceRecord
+{
+    TraceOp op;
+    uint64_t atNanos;
+    Key key;
+    Value value;
+    uint64_t steps;
+};
+
+/**
+* Appends records to a trace file. Records are collected in a buffer and
+* written in blocks, so recording an operation costs about one clock read.
+* A block that cannot be written (say, the disk is full) makes flush(), and
+* so the record() that fills the buffer, throw std::runtime_error; the
+* records in it are lost. The destructor cannot throw, so call flush()
+* first to hear about the last block.
+*/
+template <typename Key, typename Value>
+class TraceWriter
+{
+public:
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+
+    void record(TraceOp op, const Key* key, const Value* value, uint64_t steps);
+    void flush();
+
+private:
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    void put(const void* bytes, size_t size);
+    void putVarint(uint64_t n);
+
+    static const size_t BUFFER_BYTES = 1 << 16;
+
+    std::FILE* file_;
+    std::vector<unsigned char> buffer_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+/**
+* Reads a trace back one record at a time.
+*/
+template <typename Key, typename Value>
+class TraceReader
+{
+public:
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    const TraceHeader& header() const;
+    bool next(TraceRecord<Key, Value>& record);
+
+private:
+    TraceReader(const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+
+    void get(void* bytes, size_t size);
+    uint64_t getVarint();
+
+    std::FILE* file_;
+    TraceHeader header_;
+    uint64_t atNanos_;
+};
+
+inline TraceHeader readTraceHeader(const std::string& path);
+
+/**
+* A tree that records every insert(), remove(), find(), lower_bound(),
+* begin() and clear() made through it, and how far its iterators are
+* advanced, to a trace file (see TraceWriter). Tracing is opt-in: use a
+* TracedTree in place of the tree where a trace is wanted, and reach the
+* tree itself through tree() for anything that should not be recorded.
+*
+* All iterators handed out by one TracedTree share one step counter, so a
+* loop that interleaves two iterators is replayed as one that advances a
+* single iterator as often as both together.
+*/
+template <typename Key, typename Value, typename Tree = AVLTree<Key, Value> >
+class TracedTree
+{
+public:
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator(const typename Tree::iterator& it, uint64_t* steps);
+        reference operator*() const;
+        pointer operator->() const;
+        iterator& operator++();
+        iterator operator++(int);
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+    private:
+        typename Tree::iterator it_;
+        uint64_t* steps_;
+    };
+
+    explicit TracedTree(const std::string& path);
+    ~TracedTree();
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    iterator find(const Key& key);
+    iterator lower_bound(const Key& key);
+    iterator begin();
+    iterator end();
+    void clear();
+    size_t size() const;
+    bool empty() const;
+    void flush();
+
+    Tree& tree();
+    const Tree& tree() const;
+
+private:
+    void record(TraceOp op, const Key* key, const Value* value);
+
+    Tree tree_;
+    TraceWriter<Key, Value> writer_;
+    uint64_t steps_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for TraceWriter and
+  TraceReader.
+  -----------------------------------------------
+*/
+
+/**
+* Creates (or truncates) the trace file at path and writes its header.
+* Throws std::runtime_error if the file cannot be opened.
+*/
+template<typename Key, typename Value>
+TraceWriter<Key, Value>::TraceWriter(const std::string& path) :
+    file_(std::fopen(path.c_str(), "wb")),
+    last_(std::chrono::steady_clock::now())
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "TraceWriter: keys and values are written as raw bytes");
+    if(file_ == NULL) {
+        throw std::runtime_error("TraceWriter: cannot open " + path);
+    }
+    buffer_.reserve(BUFFER_BYTES);
+
+    TraceHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TREETRC", 8);
+    header.version = TraceHeader::VERSION;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.startNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    put(&header, sizeof(header));
+}
+
+/**
+* Writes what is still buffered and closes the file. A failure here is
+* dropped, since a destructor must not throw.
+*/
+template<typename Key, typename Value>
+TraceWriter<Key, Value>::~TraceWriter()
+{
+    try {
+        flush();
+    } catch(const std::runtime_error&) {
+    }
+    std::fclose(file_);
+}
+
+/**
+* Appends one record. key and value may be NULL for operations that have
+* none; steps is only written for TRACE_STEPS.
+*/
+template<typename Key, typename Value>
+void TraceWriter<Key, Value>::record(TraceOp op, const Key* key, const Value* value, uint64_t steps)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    uint64_t delta = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+    last_ = now;
+
+    unsigned char code = (unsigned char)op;
+    put(&code, 1);
+    putVarint(delta);
+    if(key != NULL) {
+        put(key, sizeof(Key));
+    }
+    if(value != NULL) {
+        put(value, sizeof(Value));
+    }
+    if(op == TRACE_STEPS) {
+        putVarint(steps);
+    }
+    if(buffer_.size() >= BUFFER_BYTES) {
+        flush();
+    }
+}
+
+/**
+* Hands the buffered records to the file. Throws std::runtime_error if
+* they could not all be written.
+*/
+template<typename Key, typename Value>
+void TraceWriter<Key, Value>::flush()
+{
+    bool ok = true;
+    if(!buffer_.empty()) {
+        ok = std::fwrite(&buffer_[0], 1, buffer_.size(), file_) == buffer_.size();
+        buffer_.clear();
+    }
+    if(std::fflush(file_) != 0 || !ok) {
+        throw std::runtime_error("TraceWriter: cannot write the trace");
+    }
+}
+
+template<typename Key, typename Value>
+void TraceWriter<Key, Value>::put(const void* bytes, size_t size)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    buffer_.insert(buffer_.end(), p, p + size);
+}
+
+template<typename Key, typename Value>
+void TraceWriter<Key, Value>::putVarint(uint64_t n)
+{
+    while(n >= 0x80) {
+        unsigned char byte = (unsigned char)(n | 0x80);
+        put(&byte, 1);
+        n >>= 7;
+    }
+    unsigned char byte = (unsigned char)n;
+    put(&byte, 1);
+}
+
+/**
+* Reads the header of the trace at path, e.g. to pick the Key and Value
+* types to open it with. Throws std::runtime_error if it is not a trace
+* or has another version.
+*/
+inline TraceHeader readTraceHeader(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if(file == NULL) {
+        throw std::runtime_error("readTraceHeader: cannot open " + path);
+    }
+    TraceHeader header;
+    size_t got = std::fread(&header, 1, sizeof(header), file);
+    std::fclose(file);
+    if(got != sizeof(header) || std::memcmp(header.magic, "TREETRC", 8) != 0) {
+        throw std::runtime_error("readTraceHeader: " + path + " is not a tree trace");
+    }
+    if(header.version != TraceHeader::VERSION) {
+        throw std::runtime_error("readTraceHeader: " + path + " has an unsupported version");
+    }
+    return header;
+}
+
+/**
+* Opens the trace at path and checks that it was written for this Key and
+* Value. Throws std::runtime_error if it cannot be read or does not match.
+*/
+template<typename Key, typename Value>
+TraceReader<Key, Value>::TraceReader(const std::string& path) :
+    file_(NULL),
+    atNanos_(0)
+{
+    header_ = readTraceHeader(path);
+    if(header_.keySize != sizeof(Key) || header_.valueSize != sizeof(Value)) {
+        throw std::runtime_error("TraceReader: " + path + " has other key or value sizes");
+    }
+    file_ = std::fopen(path.c_str(), "rb");
+    if(file_ == NULL) {
+        throw std::runtime_error("TraceReader: cannot open " + path);
+    }
+    std::fseek(file_, sizeof(TraceHeader), SEEK_SET);
+}
+
+template<typename Key, typename Value>
+TraceReader<Key, Value>::~TraceReader()
+{
+    if(file_ != NULL) {
+        std::fclose(file_);
+    }
+}
+
+template<typename Key, typename Value>
+const TraceHeader& TraceReader<Key, Value>::header() const
+{
+    return header_;
+}
+
+/**
+* Reads the next record into record. Returns false at the end of the
+* trace; throws std::runtime_error if it ends in the middle of a record.
+*/
+template<typename Key, typename Value>
+bool TraceReader<Key, Value>::next(TraceRecord<Key, Value>& record)
+{
+    int code = std::fgetc(file_);
+    if(code == EOF) {
+        return false;
+    }
+    if(code < TRACE_INSERT || code > TRACE_CLEAR) {
+        throw std::runtime_error("TraceReader: unknown operation in trace");
+    }
+    record.op = (TraceOp)code;
+    atNanos_ += getVarint();
+    record.atNanos = atNanos_;
+    record.steps = 0;
+    if(record.op == TRACE_INSERT || record.op == TRACE_REMOVE ||
+       record.op == TRACE_FIND || record.op == TRACE_SEEK) {
+        get(&record.key, sizeof(Key));
+    }
+    if(record.op == TRACE_INSERT) {
+        get(&record.value, sizeof(Value));
+    }
+    if(record.op == TRACE_STEPS) {
+        record.steps = getVarint();
+    }
+    return true;
+}
+
+template<typename Key, typename Value>
+void TraceReader<Key, Value>::get(void* bytes, size_t size)
+{
+    if(std::fread(bytes, 1, size, file_) != size) {
+        throw std::runtime_error("TraceReader: trace ends in the middle of a record");
+    }
+}
+
+template<typename Key, typename Value>
+uint64_t TraceReader<Key, Value>::getVarint()
+{
+    uint64_t n = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte;
+        get(&byte, 1);
+        n |= (uint64_t)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0) {
+            return n;
+        }
+    }
+    throw std::runtime_error("TraceReader: varint too long");
+}
+
+/*
+  -----------------------------------------------
+  End implementations for TraceWriter and
+  TraceReader.
+  -----------------------------------------------
+*/
+
+/*
+  -----------------------------------------------
+  Begin implementations for the TracedTree class.
+  -----------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Tree>
+TracedTree<Key, Value, Tree>::iterator::iterator(const typename Tree::iterator& it, uint64_t* steps) :
+    it_(it),
+    steps_(steps)
+{
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator::reference
+TracedTree<Key, Value, Tree>::iterator::operator*() const
+{
+    return *it_;
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator::pointer
+TracedTree<Key, Value, Tree>::iterator::operator->() const
+{
+    return &*it_;
+}
+
+/**
+* Advances the iterator and counts the step for the next STEPS record.
+*/
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator&
+TracedTree<Key, Value, Tree>::iterator::operator++()
+{
+    ++it_;
+    ++*steps_;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator
+TracedTree<Key, Value, Tree>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++*this;
+    return old;
+}
+
+template<typename Key, typename Value, typename Tree>
+bool TracedTree<Key, Value, Tree>::iterator::operator==(const iterator& rhs) const
+{
+    return it_ == rhs.it_;
+}
+
+template<typename Key, typename Value, typename Tree>
+bool TracedTree<Key, Value, Tree>::iterator::operator!=(const iterator& rhs) const
+{
+    return it_ != rhs.it_;
+}
+
+/**
+* An empty tree that records to a new trace file at path. Throws
+* std::runtime_error if the file cannot be created.
+*/
+template<typename Key, typename Value, typename Tree>
+TracedTree<Key, Value, Tree>::TracedTree(const std::string& path) :
+    writer_(path),
+    steps_(0)
+{
+}
+
+/**
+* Records the last iterator steps, if any, and closes the trace. Errors
+* writing it are dropped (see TraceWriter); call flush() first to see them.
+*/
+template<typename Key, typename Value, typename Tree>
+TracedTree<Key, Value, Tree>::~TracedTree()
+{
+    try {
+        record(TRACE_STEPS, NULL, NULL);
+    } catch(const std::runtime_error&) {
+    }
+}
+
+/**
+* Inserts through the tree and passes its result on: the item's position
+* and whether it was added rather than overwritten.
+*/
+template<typename Key, typename Value, typename Tree>
+std::pair<typename TracedTree<Key, Value, Tree>::iterator, bool>
+TracedTree<Key, Value, Tree>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    record(TRACE_INSERT, &keyValuePair.first, &keyValuePair.second);
+    std::pair<typename Tree::iterator, bool> result = tree_.insert(keyValuePair);
+    return std::make_pair(iterator(result.first, &steps_), result.second);
+}
+
+template<typename Key, typename Value, typename Tree>
+void TracedTree<Key, Value, Tree>::remove(const Key& key)
+{
+    record(TRACE_REMOVE, &key, NULL);
+    tree_.remove(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator
+TracedTree<Key, Value, Tree>::find(const Key& key)
+{
+    record(TRACE_FIND, &key, NULL);
+    return iterator(tree_.find(key), &steps_);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator
+TracedTree<Key, Value, Tree>::lower_bound(const Key& key)
+{
+    record(TRACE_SEEK, &key, NULL);
+    return iterator(tree_.lower_bound(key), &steps_);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator
+TracedTree<Key, Value, Tree>::begin()
+{
+    record(TRACE_SEEK_FIRST, NULL, NULL);
+    return iterator(tree_.begin(), &steps_);
+}
+
+/**
+* The end iterator. Not an operation of its own, so nothing is recorded.
+*/
+template<typename Key, typename Value, typename Tree>
+typename TracedTree<Key, Value, Tree>::iterator
+TracedTree<Key, Value, Tree>::end()
+{
+    return iterator(tree_.end(), &steps_);
+}
+
+template<typename Key, typename Value, typename Tree>
+void TracedTree<Key, Value, Tree>::clear()
+{
+    record(TRACE_CLEAR, NULL, NULL);
+    tree_.clear();
+}
+
+template<typename Key, typename Value, typename Tree>
+size_t TracedTree<Key, Value, Tree>::size() const
+{
+    return tree_.size();
+}
+
+template<typename Key, typename Value, typename Tree>
+bool TracedTree<Key, Value, Tree>::empty() const
+{
+    return tree_.empty();
+}
+
+/**
+* Writes everything recorded so far to the file, e.g. before the process
+* is expected to be killed. Throws std::runtime_error if that fails.
+*/
+template<typename Key, typename Value, typename Tree>
+void TracedTree<Key, Value, Tree>::flush()
+{
+    record(TRACE_STEPS, NULL, NULL);
+    writer_.flush();
+}
+
+/**
+* The tree itself. Nothing done through it is recorded.
+*/
+template<typename Key, typename Value, typename Tree>
+Tree& TracedTree<Key, Value, Tree>::tree()
+{
+    return tree_;
+}
+
+template<typename Key, typename Value, typename Tree>
+const Tree& TracedTree<Key, Value, Tree>::tree() const
+{
+    return tree_;
+}
+
+/**
+* Writes a record for op, preceded by a STEPS record if iterators were
+* advanced since the last one. A STEPS op only writes the pending steps.
+*/
+template<typename Key, typename Value, typename Tree>
+void TracedTree<Key, Value, Tree>::record(TraceOp op, const Key* key, const Value* value)
+{
+    if(steps_ != 0) {
+        writer_.record(TRACE_STEPS, NULL, NULL, steps_);
+        steps_ = 0;
+    }
+    if(op != TRACE_STEPS) {
+        writer_.record(op, key, value, 0);
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the TracedTree class.
+  -----------------------------------------------
+*/
+
+#endif